@@ -1,3 +1,11 @@
+#define _GNU_SOURCE // pthread_setaffinity_np
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
 #include <jansson.h>
 
 #include <config.h>
@@ -14,6 +22,18 @@
 #define TMS_JANUS_PLUGIN_PLAY_AUTHOR "Jasony62"
 #define TMS_JANUS_PLUGIN_PLAY_PACKAGE "janus.plugin.tms.play"
 
+#define TMS_PLAY_MAX_PLAYLIST 64 // 播放列表中最多包含的文件数
+#define TMS_PLAY_MAX_BENCH_RUNS 1000 // bench.play最多播放的次数
+#define TMS_PLAY_MAX_BENCH_FRAMES 100000 // bench.resample每种输入最多重采样的帧数
+#define TMS_PLAY_MAX_SOAK_CYCLES 1000000 // bench.soak最多执行的次数
+#define TMS_PLAY_SOAK_MAX_RSS_KB 8192    // bench.soak默认允许的常驻内存增长，千字节
+#define TMS_PLAY_MAX_BENCH_SESSIONS 200 // bench.sessions最多同时播放的会话数，每个会话1个播放线程
+#define TMS_PLAY_BENCH_SETTLE_MS 3000    // bench.sessions默认在测量前播放的时长，毫秒
+#define TMS_PLAY_JOIN_TIMEOUT_US 5000000 // 销毁插件时等待播放线程结束的最长时间，微秒
+#define TMS_PLAY_REJECT_BUSY 409         // 压测不能开始：节点上有正在进行的播放或者正在执行其它压测
+#define TMS_PLAY_MAX_MESSAGE_WORKERS 64 // 最多的消息处理线程数
+#define TMS_PLAY_QUEUE_WAIT_WARN_US 100000 // 请求排队超过这个时间时输出警告，微秒
+
 janus_plugin *create(void);
 int janus_plugin_init_tms_play(janus_callbacks *callback, const char *config_path);
 void janus_plugin_destroy_tms_play(void);
@@ -29,7 +49,9 @@ json_t *janus_plugin_query_session_tms_play(janus_plugin_session *handle);
 void janus_plugin_destroy_session_tms_play(janus_plugin_session *handle, int *error);
 void janus_plugin_setup_media_tms_play(janus_plugin_session *handle);
 void janus_plugin_hangup_media_tms_play(janus_plugin_session *handle);
+void janus_plugin_incoming_rtcp_tms_play(janus_plugin_session *handle, janus_plugin_rtcp *packet);
 struct janus_plugin_result *janus_plugin_handle_message_tms_play(janus_plugin_session *handle, char *transaction, json_t *message, json_t *jsep);
+json_t *janus_plugin_handle_admin_message_tms_play(json_t *message);
 
 /* 指定实现插件接口的方法 */
 static janus_plugin janus_plugin_tms_play =
@@ -51,20 +73,63 @@ static janus_plugin janus_plugin_tms_play =
 
             .setup_media = janus_plugin_setup_media_tms_play,
             .hangup_media = janus_plugin_hangup_media_tms_play,
+            .incoming_rtcp = janus_plugin_incoming_rtcp_tms_play,
 
-            .handle_message = janus_plugin_handle_message_tms_play, );
+            .handle_message = janus_plugin_handle_message_tms_play,
+            .handle_admin_message = janus_plugin_handle_admin_message_tms_play, );
 
 /* Static configuration instance */
 static janus_config *config = NULL;
 static char *media_root = NULL; // 媒体文件存储位置
+static tms_play_options play_options = {.pacing_peak_kbps = 0, .pacing_spread = 50, .clip_cache_mb = 0, .clip_cache_max_kb = 4096, .fast_start_ms = 0, .fast_start_kbps = 0, .remote_cache_dir = NULL, .remote_cache_mb = 0, .remote_block_kb = 1024, .remote_readahead_s = 10, .io_threads = 0, .io_block_kb = 128, .io_readahead_ms = 2000, .live_probesize = 32768, .live_analyze_ms = 500, .audio_codec = TMS_AUDIO_CODEC_PCMA, .opus_kbps = 24, .opus_complexity = 5, .opus_frame_ms = 20, .drop_policy = TMS_DROP_NONE, .drop_loss = 50, .drop_lateness_ms = 150};
+static gchar **remote_prefixes = NULL; // 允许播放的远程文件和直播地址前缀，没有配置时不允许播放远程文件和直播
+static char *capture_dir = NULL;       // 抓包文件的目录，没有配置时不允许抓包
+
+/* 是否为远程文件或直播的地址 */
+static gboolean tms_play_is_url(const char *filename)
+{
+  return tms_remote_is_url(filename) || tms_live_is_url(filename);
+}
+/* 获得文件的完整路径，远程文件和直播为地址，不允许播放的地址返回NULL */
+static char *tms_play_fullpath(const char *filename)
+{
+  if (!tms_play_is_url(filename))
+    return g_strdup_printf("%s/%s", media_root, filename);
+
+  int i = 0;
+  for (; remote_prefixes && remote_prefixes[i]; i++)
+  {
+    if (g_str_has_prefix(filename, remote_prefixes[i]))
+      return g_strdup(filename);
+  }
+  JANUS_LOG(LOG_WARN, "[TmsPlay] 不允许播放的远程文件 %s\n", filename);
+
+  return NULL;
+}
+/* 获得完整路径对应的文件名，和请求中指定的一致 */
+static const char *tms_play_relpath(const char *fullpath)
+{
+  if (tms_play_is_url(fullpath))
+    return fullpath;
+
+  return fullpath + strlen(media_root) + 1;
+}
 
-/* 生成jsep offer sdp */
-static void tms_play_create_offer_sdp(char **sdp, gboolean doaudio, gboolean dovideo)
+/* 生成jsep offer sdp，audio_codec为音频输出的编码 */
+static void tms_play_create_offer_sdp(char **sdp, gboolean doaudio, gboolean dovideo, int audio_codec)
 {
   gint64 sdp_version = 1;
   gint64 sdp_sessid = janus_get_real_time();
   uint8_t aport = 1, acodec = 8;
   char *artpmap = "PCMA/8000";
+  int akbps = 64;
+  if (audio_codec == TMS_AUDIO_CODEC_OPUS)
+  {
+    /* opus使用动态负载类型，rtpmap中必须是2声道，实际发送单声道 */
+    acodec = 111;
+    artpmap = "opus/48000/2";
+    akbps = play_options.opus_kbps;
+  }
   uint8_t vport = 1, vcodec = 96;
   char *vrtpmap = "H264/90000";
 
@@ -86,7 +151,15 @@ static void tms_play_create_offer_sdp(char **sdp, gboolean doaudio, gboolean dov
     g_strlcat(sdptemp, buffer, 2048);
     //g_snprintf(buffer, 512, "a=rtpmap:%d %s\r\n", acodec, artpmap);
     //g_strlcat(sdptemp, buffer, 2048);
-    g_strlcat(sdptemp, "b=AS:64\r\n", 2048);
+    if (audio_codec == TMS_AUDIO_CODEC_OPUS)
+    {
+      g_snprintf(buffer, 512, "a=rtpmap:%d %s\r\n"
+                              "a=fmtp:%d minptime=10;maxaveragebitrate=%d\r\n",
+                 acodec, artpmap, acodec, akbps * 1000);
+      g_strlcat(sdptemp, buffer, 2048);
+    }
+    g_snprintf(buffer, 512, "b=AS:%d\r\n", akbps);
+    g_strlcat(sdptemp, buffer, 2048);
     g_strlcat(sdptemp, "a=sendonly\r\n", 2048);
   }
   /* Add video line */
@@ -102,8 +175,9 @@ static void tms_play_create_offer_sdp(char **sdp, gboolean doaudio, gboolean dov
     // g_strlcat(sdptemp, buffer, 2048);
     // g_snprintf(buffer, 512, "a=rtcp-fb:%d nack pli\r\n", vcodec);
     // g_strlcat(sdptemp, buffer, 2048);
-    // g_snprintf(buffer, 512, "a=rtcp-fb:%d goog-remb\r\n", vcodec);
-    // g_strlcat(sdptemp, buffer, 2048);
+    /* 接收端通过REMB反馈估计带宽，用于切换码率 */
+    g_snprintf(buffer, 512, "a=rtcp-fb:%d goog-remb\r\n", vcodec);
+    g_strlcat(sdptemp, buffer, 2048);
     g_strlcat(sdptemp, "a=sendonly\r\n", 2048);
   }
 
@@ -114,6 +188,213 @@ static volatile gint initialized = 0;
 /* 调用janus基础功能 */
 static janus_callbacks *gateway = NULL;
 
+/*************************************************
+ * 准入控制
+ * 
+ * 节点过载时所有播放的发送时间都会变差，开始新的播放前检查并发播放数、发送延迟和CPU空闲，
+ * 超过限制时拒绝，或者降级为只播放音频，保证已经开始的播放的质量。
+ * 下线模式下拒绝所有新的播放，已经开始的播放不受影响，用于滚动重启。
+ *************************************************/
+#define TMS_PLAY_CPU_SAMPLE_US 1000000 // CPU空闲的采样间隔，微秒
+
+/* 拒绝播放时返回的代码 */
+#define TMS_PLAY_REJECT_MAX_PLAYBACKS 429 // 并发播放数超过限制
+#define TMS_PLAY_REJECT_OVERLOAD 503      // 发送延迟或者CPU超过限制
+#define TMS_PLAY_REJECT_DRAINING 410      // 节点正在下线
+
+static int max_playbacks = 0;       // 最大并发播放数，0表示不限制
+static int max_lateness_ms = 0;     // 允许的平均发送延迟，毫秒，0表示不检查
+static int min_cpu_idle = 0;        // 要求的CPU空闲百分比，0表示不检查
+static gboolean overload_audio = FALSE; // 发送延迟或者CPU超过限制时降级为只播放音频，否则拒绝
+
+static volatile gint draining = 0;            // 是否处于下线模式
+static volatile gint benching = 0;            // 是否正在执行压测，压测期间拒绝新的播放
+static volatile gint nb_active_playbacks = 0; // 占用的播放名额：正在启动和正在执行的播放数，压测的播放不计入
+/* 计数器 */
+static volatile gint nb_rejected_max_playbacks = 0;
+static volatile gint nb_rejected_lateness = 0;
+static volatile gint nb_rejected_cpu = 0;
+static volatile gint nb_rejected_draining = 0;
+static volatile gint nb_rejected_bench = 0;
+static volatile gint nb_downgraded = 0;
+
+/* CPU空闲，根据/proc/stat中两次采样的差值计算 */
+static janus_mutex cpu_mutex = JANUS_MUTEX_INITIALIZER;
+static int64_t cpu_sample_us = 0;
+static guint64 cpu_last_total = 0, cpu_last_idle = 0;
+static int cpu_idle = 100;
+
+/* 获得最近的CPU空闲百分比，间隔1秒以上才重新采样 */
+static int tms_play_cpu_idle(void)
+{
+  janus_mutex_lock(&cpu_mutex);
+  int64_t now_us = janus_get_monotonic_time();
+  if (now_us - cpu_sample_us >= TMS_PLAY_CPU_SAMPLE_US)
+  {
+    FILE *file = fopen("/proc/stat", "r");
+    if (file)
+    {
+      guint64 user = 0, nice = 0, system = 0, idle = 0, iowait = 0, irq = 0, softirq = 0, steal = 0;
+      if (fscanf(file, "cpu %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64, &user, &nice, &system, &idle, &iowait, &irq, &softirq, &steal) >= 4)
+      {
+        guint64 total = user + nice + system + idle + iowait + irq + softirq + steal;
+        idle += iowait;
+        if (cpu_sample_us > 0 && total > cpu_last_total)
+          cpu_idle = (int)((idle - cpu_last_idle) * 100 / (total - cpu_last_total));
+        cpu_last_total = total;
+        cpu_last_idle = idle;
+      }
+      fclose(file);
+    }
+    cpu_sample_us = now_us;
+  }
+  int result = cpu_idle;
+  janus_mutex_unlock(&cpu_mutex);
+
+  return result;
+}
+/* 释放tms_play_admit占用的播放名额 */
+static void tms_play_release(void)
+{
+  g_atomic_int_add(&nb_active_playbacks, -1);
+}
+/**
+ * 检查是否可以开始新的播放
+ * 
+ * 返回0：可以播放，占用1个播放名额，audio_only表示是否降级为只播放音频，播放结束或者没有启动时调用tms_play_release释放；
+ * 否则返回拒绝的代码，reason为原因，不占用名额
+ */
+static int tms_play_admit(gboolean *audio_only, const char **reason)
+{
+  *audio_only = FALSE;
+
+  if (g_atomic_int_get(&draining))
+  {
+    g_atomic_int_inc(&nb_rejected_draining);
+    *reason = "节点正在下线，不接受新的播放";
+    return TMS_PLAY_REJECT_DRAINING;
+  }
+  /* 先占用名额再检查，同时到达的请求不会都通过并发数的检查；开始压测时先拒绝播放再检查播放数，两者不会同时通过 */
+  int nb_active = g_atomic_int_add(&nb_active_playbacks, 1) + 1;
+  if (g_atomic_int_get(&benching))
+  {
+    tms_play_release();
+    g_atomic_int_inc(&nb_rejected_bench);
+    *reason = "节点正在执行压测，不接受新的播放";
+    return TMS_PLAY_REJECT_OVERLOAD;
+  }
+  if (max_playbacks > 0 && nb_active > max_playbacks)
+  {
+    tms_play_release();
+    g_atomic_int_inc(&nb_rejected_max_playbacks);
+    *reason = "并发播放数超过限制";
+    return TMS_PLAY_REJECT_MAX_PLAYBACKS;
+  }
+
+  volatile gint *counter = NULL;
+  if (max_lateness_ms > 0 && tms_play_lateness() > max_lateness_ms * 1000)
+  {
+    counter = &nb_rejected_lateness;
+    *reason = "发送延迟超过限制";
+  }
+  else if (min_cpu_idle > 0 && tms_play_cpu_idle() < min_cpu_idle)
+  {
+    counter = &nb_rejected_cpu;
+    *reason = "CPU空闲低于限制";
+  }
+  if (counter == NULL)
+    return 0;
+
+  if (overload_audio)
+  {
+    g_atomic_int_inc(&nb_downgraded);
+    *audio_only = TRUE;
+    JANUS_LOG(LOG_WARN, "[TmsPlay] %s，降级为只播放音频\n", *reason);
+    return 0;
+  }
+  tms_play_release();
+  g_atomic_int_inc(counter);
+
+  return TMS_PLAY_REJECT_OVERLOAD;
+}
+/* 准入控制的状态和计数器 */
+static json_t *tms_play_admission_status(void)
+{
+  json_t *status = json_object();
+  json_object_set_new(status, "draining", json_boolean(g_atomic_int_get(&draining)));
+  json_object_set_new(status, "benching", json_boolean(g_atomic_int_get(&benching)));
+  json_object_set_new(status, "active_playbacks", json_integer(g_atomic_int_get(&nb_active_playbacks)));
+  json_object_set_new(status, "lateness_us", json_integer(tms_play_lateness()));
+  json_object_set_new(status, "cpu_idle", json_integer(tms_play_cpu_idle()));
+  json_t *rejected = json_object();
+  json_object_set_new(rejected, "max_playbacks", json_integer(g_atomic_int_get(&nb_rejected_max_playbacks)));
+  json_object_set_new(rejected, "lateness", json_integer(g_atomic_int_get(&nb_rejected_lateness)));
+  json_object_set_new(rejected, "cpu", json_integer(g_atomic_int_get(&nb_rejected_cpu)));
+  json_object_set_new(rejected, "draining", json_integer(g_atomic_int_get(&nb_rejected_draining)));
+  json_object_set_new(rejected, "bench", json_integer(g_atomic_int_get(&nb_rejected_bench)));
+  json_object_set_new(status, "rejected", rejected);
+  json_object_set_new(status, "downgraded", json_integer(g_atomic_int_get(&nb_downgraded)));
+
+  return status;
+}
+
+/*************************************************
+ * 播放线程调度
+ * 
+ * 播放线程按媒体时间发送rtp包，和janus的ICE/DTLS线程竞争CPU时会产生发送抖动。
+ * 可以把播放线程绑定到指定的CPU上，使用实时调度策略或者调整nice值。
+ *************************************************/
+static gboolean playback_affinity = FALSE; // 是否绑定CPU
+static cpu_set_t playback_cpus;            // 播放线程可以使用的CPU
+static int playback_policy = SCHED_OTHER;  // 调度策略
+static int playback_priority = 0;          // SCHED_FIFO和SCHED_RR的优先级
+static int playback_nice = 0;              // SCHED_OTHER的nice值
+
+/* 解析CPU列表，例如：2-3,6 */
+static gboolean tms_play_parse_cpus(const char *text, cpu_set_t *cpus)
+{
+  CPU_ZERO(cpus);
+  gchar **parts = g_strsplit(text, ",", -1);
+  int i = 0;
+  for (; parts[i] != NULL; i++)
+  {
+    int first, last;
+    char *part = g_strstrip(parts[i]);
+    if (*part == '\0')
+      continue;
+    int n = sscanf(part, "%d-%d", &first, &last);
+    if (n == 1)
+      last = first;
+    for (; n >= 1 && first <= last && first < CPU_SETSIZE; first++)
+    {
+      if (first >= 0)
+        CPU_SET(first, cpus);
+    }
+  }
+  g_strfreev(parts);
+
+  return CPU_COUNT(cpus) > 0;
+}
+/* 播放线程开始时设置调度参数 */
+static void tms_play_setup_playback_thread(void)
+{
+  int ret;
+  if (playback_affinity && (ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &playback_cpus)) != 0)
+    JANUS_LOG(LOG_WARN, "[TmsPlay] 播放线程绑定CPU失败：%s\n", g_strerror(ret));
+
+  if (playback_policy == SCHED_FIFO || playback_policy == SCHED_RR)
+  {
+    struct sched_param param = {.sched_priority = playback_priority};
+    if ((ret = pthread_setschedparam(pthread_self(), playback_policy, &param)) != 0)
+      JANUS_LOG(LOG_WARN, "[TmsPlay] 设置播放线程调度策略失败，需要CAP_SYS_NICE权限：%s\n", g_strerror(ret));
+  }
+  else if (playback_nice != 0)
+  {
+    if (setpriority(PRIO_PROCESS, syscall(SYS_gettid), playback_nice) < 0)
+      JANUS_LOG(LOG_WARN, "[TmsPlay] 设置播放线程nice值失败：%s\n", g_strerror(errno));
+  }
+}
+
 /*************************************************
  * 插件ffmpeg媒体播放
  * ffmpeg运行在独立的线程中，获取数据状态时要加锁
@@ -122,12 +403,18 @@ static janus_callbacks *gateway = NULL;
 static void tms_play_ffmpeg_send_event(tms_play_ffmpeg *ffmpeg, char *msg)
 {
   janus_plugin_session *handle = ffmpeg->handle;
+  janus_callbacks *callbacks = ffmpeg->gateway ? ffmpeg->gateway : gateway;
   json_t *event = json_object();
   json_object_set_new(event, "tms_play_event", json_string(msg));
-  int ret = gateway->push_event(handle, &janus_plugin_tms_play, NULL, event, NULL);
+  /* 首帧时间，用于调整快速启动参数 */
+  if (ffmpeg->ttff_us > 0)
+    json_object_set_new(event, "ttff_ms", json_integer(ffmpeg->ttff_us / 1000));
+  int ret = callbacks->push_event(handle, &janus_plugin_tms_play, NULL, event, NULL);
   if (ret < 0)
     JANUS_LOG(LOG_VERB, "[TmsPlay] >> 推送事件: %d (%s)\n", ret, janus_get_api_error(ret));
+  json_decref(event);
 }
+static void tms_play_counts_add(const char *filename);
 /* 异步ffmpeg媒体播放 */
 static void *tms_play_async_ffmpeg_thread(void *data)
 {
@@ -135,7 +422,18 @@ static void *tms_play_async_ffmpeg_thread(void *data)
 
   tms_play_ffmpeg *ffmpeg = (tms_play_ffmpeg *)data;
   janus_plugin_session *handle = ffmpeg->handle;
-  tms_play_main(gateway, handle, ffmpeg);
+  tms_play_setup_playback_thread();
+  tms_play_main(ffmpeg->gateway ? ffmpeg->gateway : gateway, handle, ffmpeg);
+  /* 只统计成功打开的文件，不存在或者无法打开的文件名不会进入播放次数；压测（不发送数据的接口）不统计 */
+  int i = 0;
+  for (; ffmpeg->gateway == NULL && ffmpeg->names[i]; i++)
+  {
+    if (ffmpeg->opened[i])
+      tms_play_counts_add(ffmpeg->names[i]);
+  }
+  g_atomic_int_set(&ffmpeg->running, 0);
+  if (ffmpeg->admitted)
+    tms_play_release();
 
   /* 通知线程已经结束 */
   janus_mutex_lock(&ffmpeg->mutex);
@@ -149,6 +447,8 @@ static void *tms_play_async_ffmpeg_thread(void *data)
   janus_refcount_decrease(&ffmpeg->ref);
 
   JANUS_LOG(LOG_VERB, "[TmsPlay] 结束媒体发送线程\n");
+
+  return NULL;
 }
 /* 销毁ffmpeg实例。可能播放线程仍然在执行，修改状态，需要加锁。 */
 static void tms_play_ffmpeg_destroy(tms_play_ffmpeg *ffmpeg)
@@ -159,12 +459,25 @@ static void tms_play_ffmpeg_destroy(tms_play_ffmpeg *ffmpeg)
 
   g_atomic_int_set(&ffmpeg->destroyed, 1);
   g_atomic_pointer_set(&ffmpeg->handle, NULL);
-  g_free(ffmpeg->filename);
 
   janus_mutex_unlock(&ffmpeg->mutex);
 
   JANUS_LOG(LOG_VERB, "[TmsPlay] 完成销毁ffmpeg\n");
 }
+/**
+ * 等待播放线程结束，回收线程的资源
+ *
+ * 在消息处理线程中开始下一次播放前（之前的播放已经结束）和销毁插件时调用；
+ * 销毁会话时不等待，避免阻塞janus，释放ffmpeg时分离线程，线程结束后自动回收
+ */
+static void tms_play_ffmpeg_join(tms_play_ffmpeg *ffmpeg)
+{
+  if (ffmpeg->thread)
+  {
+    g_thread_join(ffmpeg->thread);
+    ffmpeg->thread = NULL;
+  }
+}
 /**
  * 释放ffmpeg实例，通过引用计数调用
  */
@@ -173,29 +486,90 @@ static void tms_play_ffmpeg_ref_free(const janus_refcount *ffmpeg_ref)
   tms_play_ffmpeg *ffmpeg = janus_refcount_containerof(ffmpeg_ref, tms_play_ffmpeg, ref);
   JANUS_LOG(LOG_VERB, "[TmsPlay] 开始释放ffmpeg %p\n", ffmpeg);
 
+  /* 播放线程可能仍在使用文件名，所以在最后释放 */
+  g_strfreev(ffmpeg->playlist);
+  g_strfreev(ffmpeg->names);
+  g_free(ffmpeg->opened);
+  g_strfreev(ffmpeg->renditions);
+  g_free(ffmpeg->capture_file);
+  if (ffmpeg->trace)
+    tms_trace_ring_unref(ffmpeg->trace);
+  /* 没有等待的播放线程，分离后由线程结束时回收 */
+  if (ffmpeg->thread)
+    g_thread_unref(ffmpeg->thread);
+  janus_mutex_destroy(&ffmpeg->mutex);
   g_free(ffmpeg);
 
   JANUS_LOG(LOG_VERB, "[TmsPlay] 完成释放ffmpeg\n");
 }
-/* 创建tms_play_ffmpeg实例 */
-static int tms_play_ffmpeg_create(tms_play_ffmpeg **out_ffmpeg, janus_plugin_session *handle, const char *filename, int64_t base_timestamp)
+/* 播放的统计：发送的包数，接收端反馈和码率切换 */
+static json_t *tms_play_ffmpeg_stats(tms_play_ffmpeg *ffmpeg)
+{
+  json_t *stats = json_object();
+  json_object_set_new(stats, "video_rtps", json_integer(ffmpeg->nb_video_rtps));
+  json_object_set_new(stats, "audio_rtps", json_integer(ffmpeg->nb_audio_rtps));
+  json_object_set_new(stats, "remb_kbps", json_integer(g_atomic_int_get(&ffmpeg->feedback.remb_kbps)));
+  json_object_set_new(stats, "video_loss", json_integer(g_atomic_int_get(&ffmpeg->feedback.video_loss)));
+  json_object_set_new(stats, "audio_loss", json_integer(g_atomic_int_get(&ffmpeg->feedback.audio_loss)));
+  if (ffmpeg->renditions)
+  {
+    json_object_set_new(stats, "rendition", json_integer(g_atomic_int_get(&ffmpeg->rendition)));
+    json_object_set_new(stats, "video_kbps", json_integer(g_atomic_int_get(&ffmpeg->video_kbps)));
+    json_object_set_new(stats, "rendition_switches", json_integer(g_atomic_int_get(&ffmpeg->nb_rendition_switches)));
+  }
+  json_object_set_new(stats, "drop_policy", json_string(tms_drop_policy_name(ffmpeg->options.drop_policy)));
+  json_object_set_new(stats, "congested", json_boolean(g_atomic_int_get(&ffmpeg->congested)));
+  json_object_set_new(stats, "dropped_frames", json_integer(g_atomic_int_get(&ffmpeg->nb_dropped_frames)));
+  json_object_set_new(stats, "av_skew_ms", json_real(g_atomic_int_get(&ffmpeg->av_skew_us) / 1000.0));
+  json_object_set_new(stats, "max_av_skew_ms", json_real(g_atomic_int_get(&ffmpeg->max_av_skew_us) / 1000.0));
+
+  return stats;
+}
+/**
+ * 创建tms_play_ffmpeg实例，filenames中的文件按顺序连续播放
+ *
+ * 返回0：成功，-1：没有可以播放的文件（文件名为空或者是不允许播放的远程文件），不创建实例
+ */
+static int tms_play_ffmpeg_create(tms_play_ffmpeg **out_ffmpeg, janus_plugin_session *handle, const char **filenames, int nb_files, int64_t base_timestamp)
 {
   /* 要求播放指定的文件 */
-  char fullpath[512]; // 要播放文件的完整路径
-  memset(fullpath, 9, 512);
-  g_snprintf(fullpath, 512, "%s/%s", media_root, filename);
-  /* 是否要检查文件是否存在？ */
+  char **playlist = g_malloc0(sizeof(char *) * (nb_files + 1));
+  char **names = g_malloc0(sizeof(char *) * (nb_files + 1));
+  int i = 0, nb_playlist = 0;
+  for (; i < nb_files; i++)
+  {
+    /* 是否要检查文件是否存在？ */
+    char *fullpath = filenames[i] ? tms_play_fullpath(filenames[i]) : NULL;
+    if (fullpath)
+    {
+      names[nb_playlist] = g_strdup(filenames[i]);
+      playlist[nb_playlist++] = fullpath;
+    }
+  }
+  if (nb_playlist == 0)
+  {
+    g_free(playlist);
+    g_free(names);
+    return -1;
+  }
 
   tms_play_ffmpeg *ffmpeg = NULL;
   ffmpeg = g_malloc0(sizeof(tms_play_ffmpeg));
   ffmpeg->handle = handle;
   ffmpeg->webrtcup = 1;
   ffmpeg->playing = 1;
+  ffmpeg->running = 0;
   ffmpeg->destroyed = 0;
+  ffmpeg->loop = FALSE;
+  ffmpeg->video_track = TMS_PLAY_TRACK_AUTO;
+  ffmpeg->audio_track = TMS_PLAY_TRACK_AUTO;
   ffmpeg->nb_audio_rtps = 0;
   ffmpeg->nb_video_rtps = 0;
   ffmpeg->base_timestamp = base_timestamp; // 在一次会话中，为了支持多次播放，采用会话的创建时间作为媒体RTP时间戳的基础时间
-  ffmpeg->filename = g_strdup(fullpath);
+  ffmpeg->playlist = playlist;
+  ffmpeg->names = names;
+  ffmpeg->opened = g_malloc0(sizeof(gboolean) * nb_playlist);
+  ffmpeg->options = play_options;
 
   janus_mutex_init(&ffmpeg->mutex);
   janus_refcount_init(&ffmpeg->ref, tms_play_ffmpeg_ref_free);
@@ -204,6 +578,28 @@ static int tms_play_ffmpeg_create(tms_play_ffmpeg **out_ffmpeg, janus_plugin_ses
 
   return 0;
 }
+/* 启动播放线程，线程持有1个引用，返回0：成功，-1：失败 */
+static int tms_play_ffmpeg_launch(tms_play_ffmpeg *ffmpeg, guint64 session_id)
+{
+  GError *error = NULL;
+  janus_refcount_increase(&ffmpeg->ref); // 线程使用，引用加1
+  g_atomic_int_set(&ffmpeg->running, 1);
+  /* 线程名称包含会话标识，便于在top等工具中找到会话的播放线程 */
+  char tname[16];
+  g_snprintf(tname, sizeof(tname), "tmsplay %" PRIu64, session_id);
+  ffmpeg->thread = g_thread_try_new(tname, tms_play_async_ffmpeg_thread, ffmpeg, &error);
+  if (error != NULL)
+  {
+    JANUS_LOG(LOG_ERR, "[TmsPlay] 启动媒体播放线程发生错误：%d (%s)\n", error->code, error->message ? error->message : "??");
+    g_error_free(error);
+    ffmpeg->thread = NULL;
+    g_atomic_int_set(&ffmpeg->running, 0);
+    janus_refcount_decrease(&ffmpeg->ref);
+    return -1;
+  }
+
+  return 0;
+}
 
 /***********************************
  * 插件会话 
@@ -212,15 +608,21 @@ typedef struct tms_play_session
 {
   janus_plugin_session *handle;
   janus_refcount ref;
+  janus_mutex mutex; // 修改和读取ffmpeg时加锁
   tms_play_ffmpeg *ffmpeg;
   volatile gint webrtcup;
-  int64_t create_time_us; // 会话创建时间，单位：微秒
+  volatile gint destroyed; // 会话已经销毁，不再处理请求
+  int64_t create_time_us;  // 会话创建时间，单位：微秒
+  guint64 id;              // 插件分配的会话标识，管理接口通过它指定会话
+  TmsTraceRing *trace;     // 会话的跟踪记录
+  int audio_codec;         // 音频输出的编码，创建offer时确定，之后的播放都使用这种编码
 } tms_play_session;
 /**
- * 释放会话
+ * 释放会话，通过引用计数调用
  */
-static void tms_play_session_free(tms_play_session *session)
+static void tms_play_session_ref_free(const janus_refcount *session_ref)
 {
+  tms_play_session *session = janus_refcount_containerof(session_ref, tms_play_session, ref);
   JANUS_LOG(LOG_VERB, "[TmsPlay] 开始释放会话\n");
 
   /* 去掉对其它资源的引用 */
@@ -230,24 +632,447 @@ static void tms_play_session_free(tms_play_session *session)
     janus_refcount_decrease(&session->ffmpeg->ref);
     session->ffmpeg = NULL;
   }
-  // 为什么不用释放？janus的session会进行释放？
-  // g_free(session);
+  if (session->trace)
+  {
+    tms_trace_ring_unref(session->trace);
+    session->trace = NULL;
+  }
+  janus_mutex_destroy(&session->mutex);
+  g_free(session);
 
   JANUS_LOG(LOG_VERB, "[TmsPlay] 完成释放会话\n");
 }
+/* 释放1个会话的引用 */
+static void tms_play_session_unref(tms_play_session *session)
+{
+  janus_refcount_decrease(&session->ref);
+}
+/**
+ * 会话开始新的播放，之前的播放已经结束
+ *
+ * 接着之前的rtp包数量生成seq，接收端的反馈和丢帧数在多次播放之间保留；
+ * 会话持有ffmpeg创建时的引用，替换时释放之前的ffmpeg
+ */
+static void tms_play_session_set_ffmpeg(tms_play_session *session, tms_play_ffmpeg *ffmpeg)
+{
+  tms_play_ffmpeg *prev = session->ffmpeg;
+  if (prev)
+  {
+    ffmpeg->nb_video_rtps = prev->nb_video_rtps;
+    ffmpeg->nb_audio_rtps = prev->nb_audio_rtps;
+    g_atomic_int_set(&ffmpeg->feedback.remb_kbps, g_atomic_int_get(&prev->feedback.remb_kbps));
+    g_atomic_int_set(&ffmpeg->feedback.video_loss, g_atomic_int_get(&prev->feedback.video_loss));
+    g_atomic_int_set(&ffmpeg->feedback.audio_loss, g_atomic_int_get(&prev->feedback.audio_loss));
+    g_atomic_int_set(&ffmpeg->nb_dropped_frames, g_atomic_int_get(&prev->nb_dropped_frames));
+    g_atomic_int_set(&ffmpeg->max_av_skew_us, g_atomic_int_get(&prev->max_av_skew_us));
+    tms_play_ffmpeg_join(prev);
+    tms_play_ffmpeg_destroy(prev);
+  }
+
+  janus_mutex_lock(&session->mutex);
+  session->ffmpeg = ffmpeg;
+  janus_mutex_unlock(&session->mutex);
+  if (prev)
+    janus_refcount_decrease(&prev->ref);
+}
+/* 会话的播放状态 */
+enum
+{
+  TMS_PLAY_SESSION_IDLE = 0, // 没有播放
+  TMS_PLAY_SESSION_PLAYING,  // 播放中
+  TMS_PLAY_SESSION_PAUSED,   // 暂停
+  TMS_PLAY_SESSION_NB_STATES
+};
+static const char *tms_play_session_state_names[TMS_PLAY_SESSION_NB_STATES] = {"idle", "playing", "paused"};
+/* 获得会话的播放状态 */
+static int tms_play_session_state(tms_play_session *session)
+{
+  int state = TMS_PLAY_SESSION_IDLE;
+  janus_mutex_lock(&session->mutex);
+  tms_play_ffmpeg *ffmpeg = session->ffmpeg;
+  if (ffmpeg && g_atomic_int_get(&ffmpeg->running))
+  {
+    int playing = g_atomic_int_get(&ffmpeg->playing);
+    state = playing == 1 ? TMS_PLAY_SESSION_PLAYING : (playing == 2 ? TMS_PLAY_SESSION_PAUSED : TMS_PLAY_SESSION_IDLE);
+  }
+  janus_mutex_unlock(&session->mutex);
+
+  return state;
+}
+
+/*************************************
+ * 会话注册表
+ * 
+ * 按handle分为多个分段，每个分段1个锁，查找、添加和删除只锁1个分段。
+ * 注册表持有会话的1个引用，查找返回的会话引用加1，用完后需要减1。
+ * 批量操作逐个分段复制会话的引用后马上释放锁，再对复制的会话执行操作，不会在执行过程中持有锁。
+ *************************************/
+#define TMS_PLAY_SESSION_STRIPES 16 // 注册表的分段数
+
+typedef struct tms_play_session_stripe
+{
+  janus_mutex mutex;
+  GHashTable *sessions; // handle到会话
+} tms_play_session_stripe;
+static tms_play_session_stripe session_stripes[TMS_PLAY_SESSION_STRIPES];
+static volatile gint next_session_id = 0;
+
+static tms_play_session_stripe *tms_play_session_stripe_of(janus_plugin_session *handle)
+{
+  return &session_stripes[(GPOINTER_TO_SIZE(handle) >> 4) % TMS_PLAY_SESSION_STRIPES];
+}
+static void tms_play_sessions_init(void)
+{
+  int i = 0;
+  for (; i < TMS_PLAY_SESSION_STRIPES; i++)
+  {
+    janus_mutex_init(&session_stripes[i].mutex);
+    session_stripes[i].sessions = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)tms_play_session_unref);
+  }
+}
+static void tms_play_sessions_destroy(void)
+{
+  int i = 0;
+  for (; i < TMS_PLAY_SESSION_STRIPES; i++)
+  {
+    janus_mutex_lock(&session_stripes[i].mutex);
+    g_hash_table_destroy(session_stripes[i].sessions);
+    session_stripes[i].sessions = NULL;
+    janus_mutex_unlock(&session_stripes[i].mutex);
+  }
+}
+/* 加入注册表，注册表持有创建时的引用 */
+static void tms_play_session_register(tms_play_session *session)
+{
+  session->id = (guint64)g_atomic_int_add(&next_session_id, 1) + 1;
+  tms_play_session_stripe *stripe = tms_play_session_stripe_of(session->handle);
+  janus_mutex_lock(&stripe->mutex);
+  g_hash_table_insert(stripe->sessions, session->handle, session);
+  janus_mutex_unlock(&stripe->mutex);
+}
+/* 从注册表中删除，释放注册表持有的引用 */
+static void tms_play_session_unregister(janus_plugin_session *handle)
+{
+  tms_play_session_stripe *stripe = tms_play_session_stripe_of(handle);
+  janus_mutex_lock(&stripe->mutex);
+  if (stripe->sessions)
+    g_hash_table_remove(stripe->sessions, handle);
+  janus_mutex_unlock(&stripe->mutex);
+}
+/* 通过handle查找会话，返回的会话引用加1 */
+static tms_play_session *tms_play_session_lookup(janus_plugin_session *handle)
+{
+  tms_play_session *session = NULL;
+  tms_play_session_stripe *stripe = tms_play_session_stripe_of(handle);
+  janus_mutex_lock(&stripe->mutex);
+  if (stripe->sessions)
+    session = g_hash_table_lookup(stripe->sessions, handle);
+  if (session && !g_atomic_int_get(&session->destroyed))
+    janus_refcount_increase(&session->ref);
+  else
+    session = NULL;
+  janus_mutex_unlock(&stripe->mutex);
+
+  return session;
+}
+/* 获得所有会话的引用，每次只锁1个分段，用完后通过tms_play_sessions_release释放 */
+static GList *tms_play_sessions_snapshot(void)
+{
+  GList *list = NULL;
+  int i = 0;
+  for (; i < TMS_PLAY_SESSION_STRIPES; i++)
+  {
+    tms_play_session_stripe *stripe = &session_stripes[i];
+    janus_mutex_lock(&stripe->mutex);
+    if (stripe->sessions)
+    {
+      GHashTableIter iter;
+      gpointer value;
+      g_hash_table_iter_init(&iter, stripe->sessions);
+      while (g_hash_table_iter_next(&iter, NULL, &value))
+      {
+        tms_play_session *session = (tms_play_session *)value;
+        if (g_atomic_int_get(&session->destroyed))
+          continue;
+        janus_refcount_increase(&session->ref);
+        list = g_list_prepend(list, session);
+      }
+    }
+    janus_mutex_unlock(&stripe->mutex);
+  }
+
+  return list;
+}
+static void tms_play_sessions_release(GList *list)
+{
+  g_list_free_full(list, (GDestroyNotify)tms_play_session_unref);
+}
+/* 通过标识查找会话，返回的会话引用加1 */
+static tms_play_session *tms_play_session_find(guint64 id)
+{
+  tms_play_session *found = NULL;
+  int i = 0;
+  for (; i < TMS_PLAY_SESSION_STRIPES && found == NULL; i++)
+  {
+    tms_play_session_stripe *stripe = &session_stripes[i];
+    janus_mutex_lock(&stripe->mutex);
+    if (stripe->sessions)
+    {
+      GHashTableIter iter;
+      gpointer value;
+      g_hash_table_iter_init(&iter, stripe->sessions);
+      while (g_hash_table_iter_next(&iter, NULL, &value))
+      {
+        tms_play_session *session = (tms_play_session *)value;
+        if (session->id == id && !g_atomic_int_get(&session->destroyed))
+        {
+          janus_refcount_increase(&session->ref);
+          found = session;
+          break;
+        }
+      }
+    }
+    janus_mutex_unlock(&stripe->mutex);
+  }
+
+  return found;
+}
+/* 按播放状态统计会话数量 */
+static void tms_play_sessions_count(int counts[TMS_PLAY_SESSION_NB_STATES])
+{
+  memset(counts, 0, sizeof(int) * TMS_PLAY_SESSION_NB_STATES);
+  GList *list = tms_play_sessions_snapshot(), *item;
+  for (item = list; item; item = item->next)
+    counts[tms_play_session_state((tms_play_session *)item->data)]++;
+  tms_play_sessions_release(list);
+}
+/* 播放列表中是否包含指定文件 */
+static gboolean tms_play_ffmpeg_has_file(tms_play_ffmpeg *ffmpeg, const char *fullpath)
+{
+  int i = 0;
+  for (; ffmpeg->playlist[i]; i++)
+  {
+    if (!strcmp(ffmpeg->playlist[i], fullpath))
+      return TRUE;
+  }
+  return FALSE;
+}
+/* 停止所有正在播放指定文件的会话，fullpath为NULL时停止所有会话，返回停止的会话数 */
+static int tms_play_sessions_stop(const char *fullpath)
+{
+  int nb_stopped = 0;
+  GList *list = tms_play_sessions_snapshot(), *item;
+  for (item = list; item; item = item->next)
+  {
+    tms_play_session *session = (tms_play_session *)item->data;
+    janus_mutex_lock(&session->mutex);
+    tms_play_ffmpeg *ffmpeg = session->ffmpeg;
+    if (ffmpeg && g_atomic_int_get(&ffmpeg->running) && g_atomic_int_get(&ffmpeg->playing) != 0 && (fullpath == NULL || tms_play_ffmpeg_has_file(ffmpeg, fullpath)))
+    {
+      g_atomic_int_set(&ffmpeg->playing, 0);
+      nb_stopped++;
+    }
+    janus_mutex_unlock(&session->mutex);
+  }
+  tms_play_sessions_release(list);
+
+  return nb_stopped;
+}
+/* 等待所有会话的播放线程结束，销毁插件时调用，已经销毁的会话的播放线程最多等待timeout_us微秒 */
+static void tms_play_sessions_join(int64_t timeout_us)
+{
+  GList *list = tms_play_sessions_snapshot(), *item;
+  for (item = list; item; item = item->next)
+  {
+    tms_play_session *session = (tms_play_session *)item->data;
+    janus_mutex_lock(&session->mutex);
+    tms_play_ffmpeg *ffmpeg = session->ffmpeg;
+    if (ffmpeg)
+      janus_refcount_increase(&ffmpeg->ref);
+    janus_mutex_unlock(&session->mutex);
+    if (ffmpeg)
+    {
+      tms_play_ffmpeg_join(ffmpeg);
+      janus_refcount_decrease(&ffmpeg->ref);
+    }
+  }
+  tms_play_sessions_release(list);
+
+  int64_t begin_us = av_gettime_relative();
+  while (g_atomic_int_get(&nb_active_playbacks) > 0 && av_gettime_relative() - begin_us < timeout_us)
+    g_usleep(10000);
+  if (g_atomic_int_get(&nb_active_playbacks) > 0)
+    JANUS_LOG(LOG_WARN, "[TmsPlay] 仍有 %d 个播放线程没有结束\n", g_atomic_int_get(&nb_active_playbacks));
+}
+/*************************************
+ * 文件预热
+ * 
+ * 插件启动后在低优先级的后台线程中预热配置指定的文件和播放次数最多的文件，
+ * 播放次数保存在文件中，重启后仍然有效
+ *************************************/
+static gchar **prewarm_files = NULL;     // 配置指定要预热的文件
+static int prewarm_auto = 0;             // 自动预热播放次数最多的前几个文件
+static char *popularity_file = NULL;     // 保存播放次数的文件
+static GHashTable *play_counts = NULL;   // 文件名到播放次数
+static janus_mutex play_counts_mutex;
+static int nb_unsaved_play_counts = 0;   // 没有保存的播放次数
+static GThread *prewarm_thread = NULL;
+static volatile gint prewarm_stopping = 0;
+
+#define TMS_PLAY_POPULARITY_SAVE_INTERVAL 1000 // 每播放多少次保存1次播放次数
+#define TMS_PLAY_POPULARITY_MAX_FILES 10000    // 最多记录播放次数的文件数，超过时替换播放次数最少的文件
+
+/* 读取保存的播放次数，每行为：次数\t文件名 */
+static void tms_play_counts_load(void)
+{
+  gchar *contents = NULL;
+  if (popularity_file == NULL || !g_file_get_contents(popularity_file, &contents, NULL, NULL))
+    return;
+
+  gchar **lines = g_strsplit(contents, "\n", -1);
+  int i = 0;
+  for (; lines[i] != NULL; i++)
+  {
+    gchar **fields = g_strsplit(lines[i], "\t", 2);
+    if (fields[0] && fields[1] && *fields[1] && g_hash_table_size(play_counts) < TMS_PLAY_POPULARITY_MAX_FILES)
+      g_hash_table_insert(play_counts, g_strdup(fields[1]), GINT_TO_POINTER(atoi(fields[0])));
+    g_strfreev(fields);
+  }
+  g_strfreev(lines);
+  g_free(contents);
+
+  JANUS_LOG(LOG_VERB, "[TmsPlay] 读取 %d 个文件的播放次数\n", g_hash_table_size(play_counts));
+}
+/* 保存播放次数，需要先加锁 */
+static void tms_play_counts_save(void)
+{
+  if (popularity_file == NULL)
+    return;
+
+  GString *contents = g_string_new(NULL);
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, play_counts);
+  while (g_hash_table_iter_next(&iter, &key, &value))
+    g_string_append_printf(contents, "%d\t%s\n", GPOINTER_TO_INT(value), (char *)key);
+
+  GError *error = NULL;
+  if (!g_file_set_contents(popularity_file, contents->str, contents->len, &error))
+  {
+    JANUS_LOG(LOG_WARN, "[TmsPlay] 保存播放次数失败：%s\n", error->message);
+    g_error_free(error);
+  }
+  g_string_free(contents, TRUE);
+  nb_unsaved_play_counts = 0;
+}
+/* 记录的文件数达到上限时，移除播放次数最少的文件，需要先加锁 */
+static void tms_play_counts_evict(void)
+{
+  gpointer victim = NULL;
+  int min_count = 0;
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, play_counts);
+  while (g_hash_table_iter_next(&iter, &key, &value))
+  {
+    if (victim == NULL || GPOINTER_TO_INT(value) < min_count)
+    {
+      victim = key;
+      min_count = GPOINTER_TO_INT(value);
+    }
+  }
+  if (victim)
+    g_hash_table_remove(play_counts, victim);
+}
+/* 记录1次播放，由播放线程在文件成功打开后调用 */
+static void tms_play_counts_add(const char *filename)
+{
+  if (filename == NULL)
+    return;
+
+  janus_mutex_lock(&play_counts_mutex);
+  if (play_counts == NULL)
+  {
+    janus_mutex_unlock(&play_counts_mutex);
+    return;
+  }
+  int count = GPOINTER_TO_INT(g_hash_table_lookup(play_counts, filename));
+  if (count == 0 && g_hash_table_size(play_counts) >= TMS_PLAY_POPULARITY_MAX_FILES)
+    tms_play_counts_evict();
+  g_hash_table_insert(play_counts, g_strdup(filename), GINT_TO_POINTER(count + 1));
+  if (++nb_unsaved_play_counts >= TMS_PLAY_POPULARITY_SAVE_INTERVAL)
+    tms_play_counts_save();
+  janus_mutex_unlock(&play_counts_mutex);
+}
+/* 按播放次数从多到少排序 */
+static gint tms_play_counts_compare(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  int count_a = GPOINTER_TO_INT(g_hash_table_lookup(play_counts, a));
+  int count_b = GPOINTER_TO_INT(g_hash_table_lookup(play_counts, b));
+  return count_b - count_a;
+}
+/* 预热1个文件 */
+static void tms_play_prewarm_file(const char *filename)
+{
+  char *fullpath = tms_play_fullpath(filename);
+  if (fullpath)
+    tms_play_prewarm(fullpath);
+  g_free(fullpath);
+}
+/* 后台预热线程 */
+static void *tms_play_prewarm_thread(void *data)
+{
+  JANUS_LOG(LOG_VERB, "[TmsPlay] 启动文件预热线程\n");
+
+  /* 降低线程优先级，不影响正在进行的播放 */
+  setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+
+  int i = 0;
+  for (; prewarm_files && prewarm_files[i] && !g_atomic_int_get(&prewarm_stopping); i++)
+    tms_play_prewarm_file(prewarm_files[i]);
+
+  if (prewarm_auto > 0)
+  {
+    janus_mutex_lock(&play_counts_mutex);
+    GList *popular = g_list_sort_with_data(g_hash_table_get_keys(play_counts), tms_play_counts_compare, NULL), *item;
+    GList *filenames = NULL;
+    for (item = popular, i = 0; item && i < prewarm_auto; item = item->next, i++)
+      filenames = g_list_append(filenames, g_strdup(item->data));
+    g_list_free(popular);
+    janus_mutex_unlock(&play_counts_mutex);
+
+    for (item = filenames; item && !g_atomic_int_get(&prewarm_stopping); item = item->next)
+      tms_play_prewarm_file(item->data);
+    g_list_free_full(filenames, g_free);
+  }
+
+  JANUS_LOG(LOG_VERB, "[TmsPlay] 结束文件预热线程\n");
+
+  return NULL;
+}
+
 /*************************************
  * 插件消息
  *************************************/
 typedef struct tms_play_message
 {
   janus_plugin_session *handle;
+  tms_play_session *session; // 持有会话的1个引用
   char *transaction;
   json_t *message;
   json_t *jsep;
+  int64_t received_us; // 收到请求的时间（单调时钟），微秒
+  int64_t queue_wait_us; // 在队列中等待处理的时间，微秒
 } tms_play_message;
-static GAsyncQueue *messages = NULL;
+/**
+ * 多个消息处理线程，每个线程1个队列
+ * 
+ * 按会话分配队列，同一个会话的请求按顺序处理，1个慢请求只影响同一队列中的会话
+ */
+static int nb_message_workers = 4;
+static GAsyncQueue *messages[TMS_PLAY_MAX_MESSAGE_WORKERS];
+static GThread *message_handle_threads[TMS_PLAY_MAX_MESSAGE_WORKERS];
 static tms_play_message exit_message;
-static GThread *message_handle_thread;
 /**
  * 释放异步消息 
  */
@@ -257,11 +1082,9 @@ static void tms_play_message_free(tms_play_message *msg)
   if (!msg || msg == &exit_message)
     return;
 
-  if (msg->handle && msg->handle->plugin_handle)
-  {
-    tms_play_session *session = (tms_play_session *)msg->handle->plugin_handle;
-    janus_refcount_decrease(&session->ref);
-  }
+  if (msg->session)
+    janus_refcount_decrease(&msg->session->ref);
+  msg->session = NULL;
   msg->handle = NULL;
 
   g_free(msg->transaction);
@@ -277,109 +1100,257 @@ static void tms_play_message_free(tms_play_message *msg)
 
   JANUS_LOG(LOG_VERB, "[TmsPlay] 完成释放异步消息\n");
 }
+/* 推送请求的处理结果，带上请求的排队时间 */
+static void tms_play_message_push_event(tms_play_message *msg, json_t *event, json_t *jsep)
+{
+  json_object_set_new(event, "queue_wait_us", json_integer(msg->queue_wait_us));
+  int ret = gateway->push_event(msg->handle, &janus_plugin_tms_play, msg->transaction, event, jsep);
+  if (ret < 0)
+    JANUS_LOG(LOG_VERB, "[TmsPlay] >> 推送事件: %d (%s)\n", ret, janus_get_api_error(ret));
+  json_decref(event);
+}
+/* 探测文件的基本信息，生成probe.file的结果，基本信息有缓存，不需要每次打开文件 */
+static json_t *tms_play_probe_result(const char *fullpath)
+{
+  json_t *result = json_object();
+  tms_play_probe_info info;
+  int ret = tms_play_probe(fullpath, &info);
+  if (ret == -1)
+  {
+    json_object_set_new(result, "code", json_integer(404));
+    json_object_set_new(result, "path", json_string(fullpath));
+  }
+  else if (ret < 0)
+  {
+    json_object_set_new(result, "code", json_integer(400));
+    json_object_set_new(result, "path", json_string(fullpath));
+    json_object_set_new(result, "reason", json_string("无法获取文件媒体流信息"));
+  }
+  else
+  {
+    JANUS_LOG(LOG_VERB, "[TmsPlay] 媒体文件 %s nb_streams = %d , duration = %ld\n", fullpath, info.nb_streams, info.duration);
+    json_object_set_new(result, "code", json_integer(0));
+    json_object_set_new(result, "streams", json_integer(info.nb_streams));
+    json_object_set_new(result, "duration", json_integer(info.duration));
+  }
+
+  return result;
+}
 /**
  * 异步消息处理 
  */
 static void *tms_play_async_message_thread(void *data)
 {
+  GAsyncQueue *queue = (GAsyncQueue *)data;
+
   JANUS_LOG(LOG_VERB, "[TmsPlay] 启动异步消息处理线程\n");
 
   tms_play_message *msg = NULL;
   json_t *root = NULL;
   while (g_atomic_int_get(&initialized))
   {
-    msg = g_async_queue_pop(messages);
+    msg = g_async_queue_pop(queue);
     if (msg == &exit_message)
       break;
-    if (msg->handle == NULL || msg->handle->plugin_handle == NULL)
+    tms_play_session *session = msg->session;
+    if (session == NULL || g_atomic_int_get(&session->destroyed))
     {
       tms_play_message_free(msg);
       continue;
     }
 
-    tms_play_session *session = (tms_play_session *)msg->handle->plugin_handle;
-
     root = msg->message;
     json_t *request = json_object_get(root, "request");
     const char *request_text = json_string_value(request);
 
+    /* 排队时间 */
+    msg->queue_wait_us = janus_get_monotonic_time() - msg->received_us;
+    if (msg->queue_wait_us > TMS_PLAY_QUEUE_WAIT_WARN_US)
+      JANUS_LOG(LOG_WARN, "[TmsPlay][%p] 请求[%s][%s]排队 %" PRId64 " 微秒\n", msg->handle, request_text, msg->transaction, msg->queue_wait_us);
+    else
+      JANUS_LOG(LOG_VERB, "[TmsPlay][%p] 请求[%s][%s]排队 %" PRId64 " 微秒\n", msg->handle, request_text, msg->transaction, msg->queue_wait_us);
+
     if (!strcasecmp(request_text, "request.offer"))
     {
       /* 要求服务端创建Offer，发起Webrtc连接 */
       json_t *event = json_object();
       json_object_set_new(event, "tms_play_event", json_string("create.offer"));
 
+      /* 音频编码可以由请求指定，没有指定时使用插件的配置 */
+      json_t *audio_codec = json_object_get(root, "audio_codec");
+      session->audio_codec = json_is_string(audio_codec) ? tms_audio_codec_from_name(json_string_value(audio_codec)) : play_options.audio_codec;
+      json_object_set_new(event, "audio_codec", json_string(tms_audio_codec_name(session->audio_codec)));
+
       char *sdp = NULL;
-      tms_play_create_offer_sdp(&sdp, TRUE, TRUE);
+      tms_play_create_offer_sdp(&sdp, TRUE, TRUE, session->audio_codec);
       JANUS_LOG(LOG_VERB, "[TmsPlay] 创建Offer SDP:\n%s\n", sdp);
       json_t *jsep = json_pack("{ssss}", "type", "offer", "sdp", sdp);
 
-      int ret = gateway->push_event(msg->handle, &janus_plugin_tms_play, msg->transaction, event, jsep);
-      if (ret < 0)
-        JANUS_LOG(LOG_VERB, "[TmsPlay] >> 推送事件: %d (%s)\n", ret, janus_get_api_error(ret));
+      tms_play_message_push_event(msg, event, jsep);
 
       g_free(sdp);
-      json_decref(event);
+      json_decref(jsep);
+    }
+    else if (!strcasecmp(request_text, "probe.file"))
+    {
+      /* 探测直播地址，直播源没有响应时最多等待5秒，不阻塞janus的传输线程，通过事件返回结果 */
+      char *fullpath = tms_play_fullpath(json_string_value(json_object_get(root, "file")));
+      json_t *event = tms_play_probe_result(fullpath ? fullpath : "");
+      json_object_set_new(event, "tms_play_event", json_string("probe.file"));
+      tms_play_message_push_event(msg, event, NULL);
+      g_free(fullpath);
     }
     else if (g_atomic_int_get(&session->webrtcup))
     {
       /* Webrtc连接已经建立，可以控制媒体播放 */
       tms_play_ffmpeg *ffmpeg = session->ffmpeg;
-      if (!strcasecmp(request_text, "ctrl.play"))
+      gboolean audio_only = FALSE;
+      const char *reject_reason = NULL;
+      int reject_code = 0;
+      if (ffmpeg && g_atomic_int_get(&ffmpeg->running) && !strcasecmp(request_text, "ctrl.play"))
       {
         /* 已经指定了文件，在播放过程中 */
-        if (ffmpeg)
+        if (ffmpeg->playing == 1)
+        {
+          /* 当前是播放状态，进入暂停状态 */
+          g_atomic_int_set(&ffmpeg->playing, 2);
+          /* 通知暂停了媒体播放线程 */
+          json_t *event = json_object();
+          json_object_set_new(event, "tms_play_event", json_string("pause.play"));
+          tms_play_message_push_event(msg, event, NULL);
+        }
+        else if (ffmpeg->playing == 2)
+        {
+          /* 当前是暂停状态，进入播放状态 */
+          g_atomic_int_set(&ffmpeg->playing, 1);
+          /* 通知恢复了媒体播放线程 */
+          json_t *event = json_object();
+          json_object_set_new(event, "tms_play_event", json_string("resume.play"));
+          tms_play_message_push_event(msg, event, NULL);
+        }
+        else if (ffmpeg->playing == 0)
+        {
+          /* 当前是停止状态？*/
+        }
+      }
+      else if (ffmpeg && g_atomic_int_get(&ffmpeg->running) && !strcasecmp(request_text, "ctrl.playlist"))
+      {
+        /* 正在播放，不能开始新的播放列表 */
+        json_t *event = json_object();
+        json_object_set_new(event, "tms_play_event", json_string("reject.play"));
+        json_object_set_new(event, "reason", json_string("正在播放，需要先停止播放"));
+        tms_play_message_push_event(msg, event, NULL);
+      }
+      else if ((!strcasecmp(request_text, "ctrl.play") || !strcasecmp(request_text, "ctrl.playlist")) && (reject_code = tms_play_admit(&audio_only, &reject_reason)) != 0)
+      {
+        /* 准入控制拒绝了新的播放 */
+        JANUS_LOG(LOG_WARN, "[TmsPlay][%p] 拒绝播放：%s\n", msg->handle, reject_reason);
+        json_t *event = json_object();
+        json_object_set_new(event, "tms_play_event", json_string("reject.play"));
+        json_object_set_new(event, "code", json_integer(reject_code));
+        json_object_set_new(event, "reason", json_string(reject_reason));
+        tms_play_message_push_event(msg, event, NULL);
+      }
+      else if (!strcasecmp(request_text, "ctrl.play") || !strcasecmp(request_text, "ctrl.playlist"))
+      {
+        /* 指定要播放的文件，播放列表中的文件按顺序连续播放 */
+        int nb_files = 0;
+        const char *filenames[TMS_PLAY_MAX_PLAYLIST];
+        if (!strcasecmp(request_text, "ctrl.play"))
+        {
+          json_t *file = json_object_get(root, "file");
+          filenames[nb_files++] = json_string_value(file);
+        }
+        else
         {
-          if (ffmpeg->playing == 1)
+          json_t *files = json_object_get(root, "files");
+          size_t index;
+          json_t *file;
+          json_array_foreach(files, index, file)
           {
-            /* 当前是播放状态，进入暂停状态 */
-            g_atomic_int_set(&ffmpeg->playing, 2);
-            /* 通知暂停了媒体播放线程 */
-            json_t *event = json_object();
-            json_object_set_new(event, "tms_play_event", json_string("pause.play"));
-            gateway->push_event(msg->handle, &janus_plugin_tms_play, msg->transaction, event, NULL);
+            if (nb_files < TMS_PLAY_MAX_PLAYLIST && json_is_string(file))
+              filenames[nb_files++] = json_string_value(file);
           }
-          else if (ffmpeg->playing == 2)
+        }
+
+        if (tms_play_ffmpeg_create(&ffmpeg, session->handle, filenames, nb_files, session->create_time_us) < 0)
+        {
+          /* 没有可以播放的文件，不启动播放线程 */
+          tms_play_release();
+          JANUS_LOG(LOG_WARN, "[TmsPlay][%p] 拒绝播放：没有可以播放的文件\n", msg->handle);
+          json_t *event = json_object();
+          json_object_set_new(event, "tms_play_event", json_string("reject.play"));
+          json_object_set_new(event, "code", json_integer(400));
+          json_object_set_new(event, "reason", json_string("没有可以播放的文件"));
+          tms_play_message_push_event(msg, event, NULL);
+          tms_play_message_free(msg);
+          continue;
+        }
+        ffmpeg->admitted = TRUE;
+        ffmpeg->loop = json_is_true(json_object_get(root, "loop"));
+        ffmpeg->audio_only = audio_only;
+        ffmpeg->audio_codec = session->audio_codec;
+        /* 拥塞时的丢帧策略，没有指定或不支持时使用配置 */
+        json_t *drop_policy = json_object_get(root, "drop_policy");
+        if (json_is_string(drop_policy) && tms_drop_policy_from_name(json_string_value(drop_policy)) >= 0)
+          ffmpeg->options.drop_policy = tms_drop_policy_from_name(json_string_value(drop_policy));
+        /* 指定要播放的媒体流，没有指定时自动选择 */
+        json_t *video_track = json_object_get(root, "video_track");
+        if (json_is_integer(video_track))
+          ffmpeg->video_track = json_integer_value(video_track);
+        json_t *audio_track = json_object_get(root, "audio_track");
+        if (json_is_integer(audio_track))
+          ffmpeg->audio_track = json_integer_value(audio_track);
+        /* 同一内容其它码率的文件，按接收端反馈在关键帧上切换 */
+        json_t *renditions = json_object_get(root, "renditions");
+        if (!strcasecmp(request_text, "ctrl.play") && json_is_array(renditions) && json_array_size(renditions) > 0)
+        {
+          ffmpeg->renditions = g_malloc0(sizeof(char *) * TMS_PLAY_MAX_RENDITIONS);
+          int nb_renditions = 0;
+          size_t index;
+          json_t *rendition;
+          json_array_foreach(renditions, index, rendition)
           {
-            /* 当前是暂停状态，进入播放状态 */
-            g_atomic_int_set(&ffmpeg->playing, 1);
-            /* 通知恢复了媒体播放线程 */
-            json_t *event = json_object();
-            json_object_set_new(event, "tms_play_event", json_string("resume.play"));
-            gateway->push_event(msg->handle, &janus_plugin_tms_play, msg->transaction, event, NULL);
+            char *fullpath = json_is_string(rendition) && nb_renditions < TMS_PLAY_MAX_RENDITIONS - 1 ? tms_play_fullpath(json_string_value(rendition)) : NULL;
+            if (fullpath)
+              ffmpeg->renditions[nb_renditions++] = fullpath;
           }
-          else if (ffmpeg->playing == 0)
+          if (nb_renditions == 0)
           {
-            /* 当前是停止状态？*/
+            g_free(ffmpeg->renditions);
+            ffmpeg->renditions = NULL;
           }
         }
-        else
-        {
-          /* 指定要播放的文件 */
-          json_t *file = json_object_get(root, "file");
-          const char *filename = json_string_value(file);
+        /* 将发送的rtp包写入pcap文件，用于排查发包问题 */
+        if (capture_dir && json_is_true(json_object_get(root, "capture")))
+          ffmpeg->capture_file = g_strdup_printf("%s/tms_play_%" PRIu64 "_%" PRId64 ".pcap", capture_dir, session->id, janus_get_real_time());
+        ffmpeg->request_time_us = msg->received_us;
+        ffmpeg->trace = session->trace;
+        tms_trace_ring_ref(ffmpeg->trace);
 
-          tms_play_ffmpeg_create(&ffmpeg, session->handle, filename, session->create_time_us);
+        tms_play_session_set_ffmpeg(session, ffmpeg);
 
-          session->ffmpeg = ffmpeg;
-          janus_refcount_increase(&ffmpeg->ref); // 会话使用，引用加1
-
-          /* 启用媒体播放线程 */
-          GError *error = NULL;
-          janus_refcount_increase(&ffmpeg->ref); // 线程使用，引用加1
-          g_thread_try_new("TmsPlay ffmpeg thread", tms_play_async_ffmpeg_thread, ffmpeg, &error);
-          if (error != NULL)
-          {
-            JANUS_LOG(LOG_ERR, "[TmsPlay] 启动媒体播放线程发生错误：%d (%s)\n", error->code, error->message ? error->message : "??");
-            janus_refcount_decrease(&ffmpeg->ref);
-          }
-          else
-          {
-            /* 通知启用了媒体播放线程 */
-            json_t *event = json_object();
-            json_object_set_new(event, "tms_play_event", json_string("launch.play"));
-            gateway->push_event(msg->handle, &janus_plugin_tms_play, msg->transaction, event, NULL);
-          }
+        /* 启用媒体播放线程 */
+        if (tms_play_ffmpeg_launch(ffmpeg, session->id) == 0)
+        {
+          /* 通知启用了媒体播放线程 */
+          json_t *event = json_object();
+          json_object_set_new(event, "tms_play_event", json_string("launch.play"));
+          if (audio_only)
+            json_object_set_new(event, "audio_only", json_true());
+          if (ffmpeg->capture_file)
+            json_object_set_new(event, "capture", json_string(ffmpeg->capture_file));
+          tms_play_message_push_event(msg, event, NULL);
+        }
+        else
+        {
+          /* 播放线程没有启动，释放名额 */
+          tms_play_release();
+          json_t *event = json_object();
+          json_object_set_new(event, "tms_play_event", json_string("reject.play"));
+          json_object_set_new(event, "code", json_integer(500));
+          json_object_set_new(event, "reason", json_string("启动播放线程失败"));
+          tms_play_message_push_event(msg, event, NULL);
         }
       }
       else
@@ -395,6 +1366,8 @@ static void *tms_play_async_message_thread(void *data)
   }
 
   JANUS_LOG(LOG_VERB, "[TmsPlay] 结束消息处理线程\n");
+
+  return NULL;
 }
 
 /**************************************
@@ -465,48 +1438,296 @@ int janus_plugin_init_tms_play(janus_callbacks *callback, const char *config_pat
     if (item_media_root != NULL && item_media_root->value != NULL)
       media_root = g_strdup(item_media_root->value);
     JANUS_LOG(LOG_VERB, "[TmsPlay] 媒体文件根目录：%s\n", media_root);
+    /* 视频帧内发包平滑 */
+    janus_config_item *item_pacing_peak_kbps = janus_config_get(config, config_general, janus_config_type_item, "pacing_peak_kbps");
+    if (item_pacing_peak_kbps != NULL && item_pacing_peak_kbps->value != NULL)
+      play_options.pacing_peak_kbps = atoi(item_pacing_peak_kbps->value);
+    janus_config_item *item_pacing_spread = janus_config_get(config, config_general, janus_config_type_item, "pacing_spread");
+    if (item_pacing_spread != NULL && item_pacing_spread->value != NULL)
+      play_options.pacing_spread = atoi(item_pacing_spread->value);
+    JANUS_LOG(LOG_VERB, "[TmsPlay] 视频帧内发包平滑：峰值速率 %d kbps，分散在帧间隔的 %d%%\n", play_options.pacing_peak_kbps, play_options.pacing_spread);
+    /* 片段缓存 */
+    janus_config_item *item_clip_cache_mb = janus_config_get(config, config_general, janus_config_type_item, "clip_cache_mb");
+    if (item_clip_cache_mb != NULL && item_clip_cache_mb->value != NULL)
+      play_options.clip_cache_mb = atoi(item_clip_cache_mb->value);
+    janus_config_item *item_clip_cache_max_kb = janus_config_get(config, config_general, janus_config_type_item, "clip_cache_max_kb");
+    if (item_clip_cache_max_kb != NULL && item_clip_cache_max_kb->value != NULL)
+      play_options.clip_cache_max_kb = atoi(item_clip_cache_max_kb->value);
+    JANUS_LOG(LOG_VERB, "[TmsPlay] 片段缓存：预算 %d MB，单个片段最大 %d KB\n", play_options.clip_cache_mb, play_options.clip_cache_max_kb);
+    /* 远程文件 */
+    janus_config_item *item_remote_cache_dir = janus_config_get(config, config_general, janus_config_type_item, "remote_cache_dir");
+    if (item_remote_cache_dir != NULL && item_remote_cache_dir->value != NULL)
+      play_options.remote_cache_dir = g_strdup(item_remote_cache_dir->value);
+    janus_config_item *item_remote_cache_mb = janus_config_get(config, config_general, janus_config_type_item, "remote_cache_mb");
+    if (item_remote_cache_mb != NULL && item_remote_cache_mb->value != NULL)
+      play_options.remote_cache_mb = atoi(item_remote_cache_mb->value);
+    janus_config_item *item_remote_block_kb = janus_config_get(config, config_general, janus_config_type_item, "remote_block_kb");
+    if (item_remote_block_kb != NULL && item_remote_block_kb->value != NULL)
+      play_options.remote_block_kb = atoi(item_remote_block_kb->value);
+    janus_config_item *item_remote_readahead_s = janus_config_get(config, config_general, janus_config_type_item, "remote_readahead_s");
+    if (item_remote_readahead_s != NULL && item_remote_readahead_s->value != NULL)
+      play_options.remote_readahead_s = atoi(item_remote_readahead_s->value);
+    /* 本地文件读取调度 */
+    janus_config_item *item_io_threads = janus_config_get(config, config_general, janus_config_type_item, "io_threads");
+    if (item_io_threads != NULL && item_io_threads->value != NULL)
+      play_options.io_threads = atoi(item_io_threads->value);
+    janus_config_item *item_io_block_kb = janus_config_get(config, config_general, janus_config_type_item, "io_block_kb");
+    if (item_io_block_kb != NULL && item_io_block_kb->value != NULL)
+      play_options.io_block_kb = atoi(item_io_block_kb->value);
+    janus_config_item *item_io_readahead_ms = janus_config_get(config, config_general, janus_config_type_item, "io_readahead_ms");
+    if (item_io_readahead_ms != NULL && item_io_readahead_ms->value != NULL)
+      play_options.io_readahead_ms = atoi(item_io_readahead_ms->value);
+    JANUS_LOG(LOG_VERB, "[TmsPlay] 本地文件读取调度：每个设备 %d 个读取线程，块大小 %d KB，预读 %d 毫秒\n", play_options.io_threads, play_options.io_block_kb, play_options.io_readahead_ms);
+    janus_config_array *array_remote_prefixes = janus_config_get(config, config_general, janus_config_type_array, "remote_prefixes");
+    if (array_remote_prefixes != NULL)
+    {
+      GList *items = janus_config_get_items(config, array_remote_prefixes), *item;
+      remote_prefixes = g_malloc0(sizeof(gchar *) * (g_list_length(items) + 1));
+      int i = 0;
+      for (item = items; item; item = item->next)
+      {
+        janus_config_item *item_prefix = (janus_config_item *)item->data;
+        if (item_prefix->value != NULL && tms_play_is_url(item_prefix->value))
+          remote_prefixes[i++] = g_strdup(item_prefix->value);
+      }
+      g_list_free(items);
+    }
+    janus_config_item *item_live_probesize = janus_config_get(config, config_general, janus_config_type_item, "live_probesize");
+    if (item_live_probesize != NULL && item_live_probesize->value != NULL)
+      play_options.live_probesize = atoi(item_live_probesize->value);
+    janus_config_item *item_live_analyze_ms = janus_config_get(config, config_general, janus_config_type_item, "live_analyze_ms");
+    if (item_live_analyze_ms != NULL && item_live_analyze_ms->value != NULL)
+      play_options.live_analyze_ms = atoi(item_live_analyze_ms->value);
+    janus_config_item *item_audio_codec = janus_config_get(config, config_general, janus_config_type_item, "audio_codec");
+    if (item_audio_codec != NULL && item_audio_codec->value != NULL)
+    {
+      int codec = tms_audio_codec_from_name(item_audio_codec->value);
+      if (codec < 0 || !tms_audio_codec_available(codec))
+        JANUS_LOG(LOG_WARN, "[TmsPlay] 不支持的音频编码 %s，使用pcma\n", item_audio_codec->value);
+      else
+        play_options.audio_codec = codec;
+    }
+    janus_config_item *item_opus_kbps = janus_config_get(config, config_general, janus_config_type_item, "opus_kbps");
+    if (item_opus_kbps != NULL && item_opus_kbps->value != NULL)
+      play_options.opus_kbps = atoi(item_opus_kbps->value);
+    janus_config_item *item_opus_complexity = janus_config_get(config, config_general, janus_config_type_item, "opus_complexity");
+    if (item_opus_complexity != NULL && item_opus_complexity->value != NULL)
+      play_options.opus_complexity = atoi(item_opus_complexity->value);
+    janus_config_item *item_opus_frame_ms = janus_config_get(config, config_general, janus_config_type_item, "opus_frame_ms");
+    if (item_opus_frame_ms != NULL && item_opus_frame_ms->value != NULL)
+      play_options.opus_frame_ms = atoi(item_opus_frame_ms->value);
+    if (play_options.opus_kbps < 6 || play_options.opus_kbps > 510)
+      play_options.opus_kbps = 24;
+    JANUS_LOG(LOG_VERB, "[TmsPlay] 音频输出编码 %s，opus %d kbps，复杂度 %d，帧长 %d 毫秒\n", tms_audio_codec_name(play_options.audio_codec), play_options.opus_kbps, play_options.opus_complexity, play_options.opus_frame_ms);
+    janus_config_item *item_drop_policy = janus_config_get(config, config_general, janus_config_type_item, "drop_policy");
+    if (item_drop_policy != NULL && item_drop_policy->value != NULL)
+    {
+      int policy = tms_drop_policy_from_name(item_drop_policy->value);
+      if (policy < 0)
+        JANUS_LOG(LOG_WARN, "[TmsPlay] 不支持的丢帧策略 %s，不丢帧\n", item_drop_policy->value);
+      else
+        play_options.drop_policy = policy;
+    }
+    janus_config_item *item_drop_loss = janus_config_get(config, config_general, janus_config_type_item, "drop_loss");
+    if (item_drop_loss != NULL && item_drop_loss->value != NULL)
+      play_options.drop_loss = atoi(item_drop_loss->value);
+    janus_config_item *item_drop_lateness_ms = janus_config_get(config, config_general, janus_config_type_item, "drop_lateness_ms");
+    if (item_drop_lateness_ms != NULL && item_drop_lateness_ms->value != NULL)
+      play_options.drop_lateness_ms = atoi(item_drop_lateness_ms->value);
+    JANUS_LOG(LOG_VERB, "[TmsPlay] 拥塞丢帧策略 %s，丢包率超过千分之 %d 或发送延迟超过 %d 毫秒时丢帧\n", tms_drop_policy_name(play_options.drop_policy), play_options.drop_loss, play_options.drop_lateness_ms);
+    janus_config_item *item_capture_dir = janus_config_get(config, config_general, janus_config_type_item, "capture_dir");
+    if (item_capture_dir != NULL && item_capture_dir->value != NULL)
+      capture_dir = g_strdup(item_capture_dir->value);
+    JANUS_LOG(LOG_VERB, "[TmsPlay] 抓包目录 %s\n", capture_dir ? capture_dir : "(无)");
+    JANUS_LOG(LOG_VERB, "[TmsPlay] 直播：探测 %d 字节，分析 %d 毫秒\n", play_options.live_probesize, play_options.live_analyze_ms);
+    JANUS_LOG(LOG_VERB, "[TmsPlay] 远程文件：允许 %d 个地址前缀，块缓存目录 %s，预算 %d MB，块大小 %d KB，预读 %d 秒\n", remote_prefixes ? g_strv_length(remote_prefixes) : 0, play_options.remote_cache_dir ? play_options.remote_cache_dir : "(无)", play_options.remote_cache_mb, play_options.remote_block_kb, play_options.remote_readahead_s);
+    /* 消息处理线程 */
+    janus_config_item *item_message_workers = janus_config_get(config, config_general, janus_config_type_item, "message_workers");
+    if (item_message_workers != NULL && item_message_workers->value != NULL)
+      nb_message_workers = atoi(item_message_workers->value);
+    if (nb_message_workers < 1)
+      nb_message_workers = 1;
+    else if (nb_message_workers > TMS_PLAY_MAX_MESSAGE_WORKERS)
+      nb_message_workers = TMS_PLAY_MAX_MESSAGE_WORKERS;
+    JANUS_LOG(LOG_VERB, "[TmsPlay] 消息处理线程 %d 个\n", nb_message_workers);
+    /* 准入控制 */
+    janus_config_item *item_max_playbacks = janus_config_get(config, config_general, janus_config_type_item, "max_playbacks");
+    if (item_max_playbacks != NULL && item_max_playbacks->value != NULL)
+      max_playbacks = atoi(item_max_playbacks->value);
+    janus_config_item *item_max_lateness_ms = janus_config_get(config, config_general, janus_config_type_item, "max_lateness_ms");
+    if (item_max_lateness_ms != NULL && item_max_lateness_ms->value != NULL)
+      max_lateness_ms = atoi(item_max_lateness_ms->value);
+    janus_config_item *item_min_cpu_idle = janus_config_get(config, config_general, janus_config_type_item, "min_cpu_idle");
+    if (item_min_cpu_idle != NULL && item_min_cpu_idle->value != NULL)
+      min_cpu_idle = atoi(item_min_cpu_idle->value);
+    janus_config_item *item_overload_action = janus_config_get(config, config_general, janus_config_type_item, "overload_action");
+    if (item_overload_action != NULL && item_overload_action->value != NULL)
+      overload_audio = !strcasecmp(item_overload_action->value, "audio");
+    JANUS_LOG(LOG_VERB, "[TmsPlay] 准入控制：最大播放数 %d，最大发送延迟 %d 毫秒，最小CPU空闲 %d%%，过载时%s\n", max_playbacks, max_lateness_ms, min_cpu_idle, overload_audio ? "只播放音频" : "拒绝");
+    /* 播放线程调度 */
+    janus_config_item *item_playback_cpus = janus_config_get(config, config_general, janus_config_type_item, "playback_cpus");
+    if (item_playback_cpus != NULL && item_playback_cpus->value != NULL)
+      playback_affinity = tms_play_parse_cpus(item_playback_cpus->value, &playback_cpus);
+    janus_config_item *item_playback_policy = janus_config_get(config, config_general, janus_config_type_item, "playback_policy");
+    if (item_playback_policy != NULL && item_playback_policy->value != NULL)
+    {
+      if (!strcasecmp(item_playback_policy->value, "fifo"))
+        playback_policy = SCHED_FIFO;
+      else if (!strcasecmp(item_playback_policy->value, "rr"))
+        playback_policy = SCHED_RR;
+    }
+    janus_config_item *item_playback_priority = janus_config_get(config, config_general, janus_config_type_item, "playback_priority");
+    if (item_playback_priority != NULL && item_playback_priority->value != NULL)
+      playback_priority = atoi(item_playback_priority->value);
+    if (playback_policy != SCHED_OTHER)
+      playback_priority = FFMIN(FFMAX(playback_priority, sched_get_priority_min(playback_policy)), sched_get_priority_max(playback_policy));
+    janus_config_item *item_playback_nice = janus_config_get(config, config_general, janus_config_type_item, "playback_nice");
+    if (item_playback_nice != NULL && item_playback_nice->value != NULL)
+      playback_nice = atoi(item_playback_nice->value);
+    JANUS_LOG(LOG_VERB, "[TmsPlay] 播放线程：绑定 %d 个CPU，调度策略 %d，优先级 %d，nice %d\n", playback_affinity ? CPU_COUNT(&playback_cpus) : 0, playback_policy, playback_priority, playback_nice);
+    /* 快速启动 */
+    janus_config_item *item_fast_start_ms = janus_config_get(config, config_general, janus_config_type_item, "fast_start_ms");
+    if (item_fast_start_ms != NULL && item_fast_start_ms->value != NULL)
+      play_options.fast_start_ms = atoi(item_fast_start_ms->value);
+    janus_config_item *item_fast_start_kbps = janus_config_get(config, config_general, janus_config_type_item, "fast_start_kbps");
+    if (item_fast_start_kbps != NULL && item_fast_start_kbps->value != NULL)
+      play_options.fast_start_kbps = atoi(item_fast_start_kbps->value);
+    JANUS_LOG(LOG_VERB, "[TmsPlay] 快速启动：领先 %d 毫秒，限速 %d kbps\n", play_options.fast_start_ms, play_options.fast_start_kbps);
+    /* 文件预热 */
+    janus_config_array *array_prewarm = janus_config_get(config, config_general, janus_config_type_array, "prewarm");
+    if (array_prewarm != NULL)
+    {
+      GList *items = janus_config_get_items(config, array_prewarm), *item;
+      prewarm_files = g_malloc0(sizeof(gchar *) * (g_list_length(items) + 1));
+      int i = 0;
+      for (item = items; item; item = item->next)
+      {
+        janus_config_item *item_file = (janus_config_item *)item->data;
+        if (item_file->value != NULL)
+          prewarm_files[i++] = g_strdup(item_file->value);
+      }
+      g_list_free(items);
+    }
+    janus_config_item *item_prewarm_auto = janus_config_get(config, config_general, janus_config_type_item, "prewarm_auto");
+    if (item_prewarm_auto != NULL && item_prewarm_auto->value != NULL)
+      prewarm_auto = atoi(item_prewarm_auto->value);
+    janus_config_item *item_popularity_file = janus_config_get(config, config_general, janus_config_type_item, "popularity_file");
+    if (item_popularity_file != NULL && item_popularity_file->value != NULL)
+      popularity_file = g_strdup(item_popularity_file->value);
+    JANUS_LOG(LOG_VERB, "[TmsPlay] 文件预热：指定 %d 个文件，自动预热 %d 个文件，播放次数保存在 %s\n", prewarm_files ? g_strv_length(prewarm_files) : 0, prewarm_auto, popularity_file ? popularity_file : "(无)");
   }
 
   g_atomic_int_set(&initialized, 1);
 
-  /* 需要异步处理的消息 */
-  messages = g_async_queue_new_full((GDestroyNotify)tms_play_message_free);
+  /* 初始化播放模块 */
+  tms_play_init(&play_options);
+
+  /* 会话注册表 */
+  tms_play_sessions_init();
+
+  /* 播放次数 */
+  play_counts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  janus_mutex_init(&play_counts_mutex);
+  tms_play_counts_load();
+
   /* This is the callback we'll need to invoke to contact the Janus core */
   gateway = callback;
 
-  /* Launch the thread that will handle incoming messages */
+  /* 需要异步处理的消息，每个处理线程1个队列 */
   GError *error = NULL;
-  message_handle_thread = g_thread_try_new("TmsPlay message thread", tms_play_async_message_thread, NULL, &error);
-  if (error != NULL)
+  int i = 0;
+  for (; i < nb_message_workers; i++)
   {
-    g_atomic_int_set(&initialized, 0);
-    JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Rtprx handler thread...\n", error->code, error->message ? error->message : "??");
-    return -1;
+    messages[i] = g_async_queue_new_full((GDestroyNotify)tms_play_message_free);
+    char tname[16];
+    g_snprintf(tname, sizeof(tname), "TmsPlay msg %d", i);
+    message_handle_threads[i] = g_thread_try_new(tname, tms_play_async_message_thread, messages[i], &error);
+    if (error != NULL)
+    {
+      g_atomic_int_set(&initialized, 0);
+      JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Rtprx handler thread...\n", error->code, error->message ? error->message : "??");
+      return -1;
+    }
+  }
+
+  /* 在后台预热文件 */
+  if ((prewarm_files && prewarm_files[0]) || prewarm_auto > 0)
+  {
+    prewarm_thread = g_thread_try_new("TmsPlay prewarm thread", tms_play_prewarm_thread, NULL, &error);
+    if (error != NULL)
+    {
+      JANUS_LOG(LOG_WARN, "[TmsPlay] 启动文件预热线程发生错误：%d (%s)\n", error->code, error->message ? error->message : "??");
+      g_error_free(error);
+      prewarm_thread = NULL;
+    }
   }
 
   return 0;
 }
 
+static void tms_play_bench_destroy(void);
 /* 销毁插件，释放资源 */
 void janus_plugin_destroy_tms_play(void)
 {
   if (!g_atomic_int_get(&initialized))
     return;
 
-  g_async_queue_push(messages, &exit_message);
-  if (message_handle_thread != NULL)
+  /* 等待压测结束，压测使用会话和播放模块 */
+  tms_play_bench_destroy();
+
+  /* 等待预热结束，预热使用播放模块的缓存 */
+  g_atomic_int_set(&prewarm_stopping, 1);
+  if (prewarm_thread != NULL)
+  {
+    g_thread_join(prewarm_thread);
+    prewarm_thread = NULL;
+  }
+  g_strfreev(prewarm_files);
+  prewarm_files = NULL;
+
+  int i = 0;
+  for (; i < nb_message_workers; i++)
   {
-    g_thread_join(message_handle_thread);
-    message_handle_thread = NULL;
+    if (messages[i] == NULL)
+      continue;
+    g_async_queue_push(messages[i], &exit_message);
+    if (message_handle_threads[i] != NULL)
+    {
+      g_thread_join(message_handle_threads[i]);
+      message_handle_threads[i] = NULL;
+    }
+    g_async_queue_unref(messages[i]);
+    messages[i] = NULL;
   }
-  g_async_queue_unref(messages);
-  messages = NULL;
+
+  /* 停止所有播放，播放线程结束后才能释放播放模块的缓存 */
+  tms_play_sessions_stop(NULL);
+  tms_play_sessions_join(TMS_PLAY_JOIN_TIMEOUT_US);
+
+  tms_play_destroy();
 
   g_atomic_int_set(&initialized, 0);
 
+  /* 保存播放次数 */
+  janus_mutex_lock(&play_counts_mutex);
+  tms_play_counts_save();
+  g_hash_table_destroy(play_counts);
+  play_counts = NULL;
+  janus_mutex_unlock(&play_counts_mutex);
+  g_free(popularity_file);
+  popularity_file = NULL;
+
+  tms_play_sessions_destroy();
+
   /* 释放配置文件数据 */
   janus_config_destroy(config);
   g_free(media_root);
+  g_free(play_options.remote_cache_dir);
+  play_options.remote_cache_dir = NULL;
+  g_strfreev(remote_prefixes);
+  remote_prefixes = NULL;
+  g_free(capture_dir);
+  capture_dir = NULL;
 
   JANUS_LOG(LOG_INFO, "销毁插件 %s\n", TMS_JANUS_PLUGIN_PLAY_NAME);
 }
@@ -523,24 +1744,52 @@ void janus_plugin_create_session_tms_play(janus_plugin_session *handle, int *err
   tms_play_session *session = g_malloc0(sizeof(tms_play_session));
   session->handle = handle;
   session->webrtcup = 0;
+  session->destroyed = 0;
+  janus_mutex_init(&session->mutex);
+  janus_refcount_init(&session->ref, tms_play_session_ref_free);
   handle->plugin_handle = session;
   session->create_time_us = av_gettime_relative();
+  session->trace = tms_trace_ring_new();
+  session->audio_codec = play_options.audio_codec;
+
+  tms_play_session_register(session);
 }
 /* 必须有，怎么用？返回json对象，记录和session关联的业务信息 */
 json_t *janus_plugin_query_session_tms_play(janus_plugin_session *handle)
 {
   JANUS_LOG(LOG_VERB, "[%s][%p] 查找会话\n", TMS_JANUS_PLUGIN_PLAY_NAME, handle);
 
-  return NULL;
+  tms_play_session *session = tms_play_session_lookup(handle);
+  if (!session)
+    return NULL;
+
+  /* 管理接口通过id指定会话 */
+  json_t *info = json_object();
+  json_object_set_new(info, "id", json_integer(session->id));
+  json_object_set_new(info, "state", json_string(tms_play_session_state_names[tms_play_session_state(session)]));
+  janus_refcount_decrease(&session->ref);
+
+  return info;
 }
 /* 销毁插件 */
 void janus_plugin_destroy_session_tms_play(janus_plugin_session *handle, int *error)
 {
   /* 释放资源 */
-  if (handle->plugin_handle)
+  tms_play_session *session = tms_play_session_lookup(handle);
+  if (session)
   {
-    tms_play_session *session = (tms_play_session *)handle->plugin_handle;
-    tms_play_session_free(session);
+    g_atomic_int_set(&session->destroyed, 1);
+    /* 停止播放，等待中的请求和播放线程持有的引用释放后，释放会话 */
+    janus_mutex_lock(&session->mutex);
+    if (session->ffmpeg)
+    {
+      g_atomic_int_set(&session->ffmpeg->playing, 0);
+      tms_play_ffmpeg_destroy(session->ffmpeg);
+    }
+    janus_mutex_unlock(&session->mutex);
+    handle->plugin_handle = NULL;
+    tms_play_session_unregister(handle);
+    janus_refcount_decrease(&session->ref);
   }
 
   JANUS_LOG(LOG_VERB, "[%s][%p] 完成销毁会话\n", TMS_JANUS_PLUGIN_PLAY_NAME, handle);
@@ -554,24 +1803,41 @@ void janus_plugin_setup_media_tms_play(janus_plugin_session *handle)
 {
   JANUS_LOG(LOG_VERB, "[%s][%p] Webrtc连接已建立\n", TMS_JANUS_PLUGIN_PLAY_NAME, handle);
 
-  if (handle->plugin_handle)
+  tms_play_session *session = tms_play_session_lookup(handle);
+  if (session)
   {
-    tms_play_session *session = (tms_play_session *)handle->plugin_handle;
     g_atomic_int_set(&session->webrtcup, 1);
+    janus_refcount_decrease(&session->ref);
   }
 }
+/* 接收端发来的rtcp，记录REMB和接收报告中的丢包率，用于切换码率 */
+void janus_plugin_incoming_rtcp_tms_play(janus_plugin_session *handle, janus_plugin_rtcp *packet)
+{
+  tms_play_session *session = tms_play_session_lookup(handle);
+  if (session == NULL)
+    return;
+
+  janus_mutex_lock(&session->mutex);
+  if (session->ffmpeg)
+    tms_play_feedback_rtcp(&session->ffmpeg->feedback, packet->video, packet->buffer, packet->length);
+  janus_mutex_unlock(&session->mutex);
+  janus_refcount_decrease(&session->ref);
+}
 void janus_plugin_hangup_media_tms_play(janus_plugin_session *handle)
 {
   JANUS_LOG(LOG_VERB, "[%s][%p] Webrtc连接已挂断\n", TMS_JANUS_PLUGIN_PLAY_NAME, handle);
 
-  if (handle->plugin_handle)
+  tms_play_session *session = tms_play_session_lookup(handle);
+  if (session)
   {
-    tms_play_session *session = (tms_play_session *)handle->plugin_handle;
     g_atomic_int_set(&session->webrtcup, 0);
+    janus_mutex_lock(&session->mutex);
     if (session->ffmpeg)
     {
       g_atomic_int_set(&session->ffmpeg->webrtcup, 0);
     }
+    janus_mutex_unlock(&session->mutex);
+    janus_refcount_decrease(&session->ref);
   }
 }
 
@@ -597,92 +1863,844 @@ struct janus_plugin_result *janus_plugin_handle_message_tms_play(janus_plugin_se
 
     return janus_plugin_result_new(JANUS_PLUGIN_OK, NULL, response);
   }
-  else if (!strcasecmp(request_text, "probe.file"))
+  else if (!strcasecmp(request_text, "probe.file") && !tms_live_is_url(json_string_value(json_object_get(root, "file"))))
   {
-    /* 指定要播放的文件 */
+    /* 指定要播放的文件，直播地址的探测可能等待数秒，放入会话的消息队列处理 */
     char fullpath[512]; // 要播放文件的完整路径
     memset(fullpath, 9, 512);
     json_t *file = json_object_get(root, "file");
     const char *filename = json_string_value(file);
-    g_snprintf(fullpath, 512, "%s/%s", media_root, filename);
-
-    /* 应该检查文件是否存在！！！ */
-    int ret;
-    AVFormatContext *ictx = NULL;
-    /* 打开指定的媒体文件 */
-    if ((ret = avformat_open_input(&ictx, fullpath, NULL, NULL)) < 0)
+    if (tms_play_is_url(filename))
     {
-      JANUS_LOG(LOG_VERB, "[TmsPlay] 无法打开媒体文件 %s\n", fullpath);
-
-      response = json_object();
-      json_object_set_new(response, "code", json_integer(404));
-      json_object_set_new(response, "path", json_string(fullpath));
-
-      return janus_plugin_result_new(JANUS_PLUGIN_OK, NULL, response);
+      char *url = tms_play_fullpath(filename);
+      g_strlcpy(fullpath, url ? url : "", 512);
+      g_free(url);
     }
-
-    /* 获得指定的视频文件的信息 */
-    if ((ret = avformat_find_stream_info(ictx, NULL)) < 0)
+    else
     {
-      JANUS_LOG(LOG_VERB, "[TmsPlay] 无法获取文件媒体流信息 %s\n", fullpath);
-
-      response = json_object();
-      json_object_set_new(response, "code", json_integer(400));
-      json_object_set_new(response, "path", json_string(fullpath));
-      json_object_set_new(response, "reason", json_string("无法获取文件媒体流信息"));
-
-      return janus_plugin_result_new(JANUS_PLUGIN_OK, NULL, response);
+      g_snprintf(fullpath, 512, "%s/%s", media_root, filename);
     }
 
-    JANUS_LOG(LOG_VERB, "[TmsPlay] 媒体文件 %s nb_streams = %d , duration = %ld\n", fullpath, ictx->nb_streams, ictx->duration);
-
-    response = json_object();
-    json_object_set_new(response, "code", json_integer(0));
-    json_object_set_new(response, "streams", json_integer(ictx->nb_streams));
-    json_object_set_new(response, "duration", json_integer(ictx->duration));
+    response = tms_play_probe_result(fullpath);
 
     return janus_plugin_result_new(JANUS_PLUGIN_OK, NULL, response);
   }
   /* 如果没有关联session无法处理后续逻辑 */
-  if (!handle->plugin_handle)
+  tms_play_session *session = tms_play_session_lookup(handle);
+  if (!session)
   {
     return janus_plugin_result_new(JANUS_PLUGIN_ERROR, "未正确建立和插件的绑定，无法能执行指定操作", NULL);
   }
 
   /* 放入队列异步处理的消息 */
-  if (!strcasecmp(request_text, "request.offer") || NULL != strstr(request_text, ".play"))
+  if (!strcasecmp(request_text, "request.offer") || NULL != strstr(request_text, ".play") || !strcasecmp(request_text, "probe.file"))
   {
-    if (NULL != strstr(request_text, ".play"))
+    if (!strcasecmp(request_text, "request.offer"))
+    {
+      /* 检查指定的音频编码 */
+      json_t *audio_codec = json_object_get(root, "audio_codec");
+      int codec = json_is_string(audio_codec) ? tms_audio_codec_from_name(json_string_value(audio_codec)) : play_options.audio_codec;
+      if (codec < 0 || !tms_audio_codec_available(codec))
+      {
+        janus_refcount_decrease(&session->ref);
+        response = json_object();
+        json_object_set_new(response, "code", json_integer(400));
+        json_object_set_new(response, "reason", json_string("不支持指定的音频编码"));
+        return janus_plugin_result_new(JANUS_PLUGIN_OK, NULL, response);
+      }
+    }
+    else if (NULL != strstr(request_text, ".play"))
     {
       /* 检查指定的播放文件 */
       if (!strcasecmp(request_text, "ctrl.play"))
       {
         json_t *file = json_object_get(root, "file");
-        if (NULL == file)
+        if (!json_is_string(file))
         {
+          janus_refcount_decrease(&session->ref);
           response = json_object();
           json_object_set_new(response, "code", json_integer(400));
           json_object_set_new(response, "reason", json_string("没有指定要播放的文件"));
           return janus_plugin_result_new(JANUS_PLUGIN_OK, NULL, response);
         }
       }
+      else if (!strcasecmp(request_text, "ctrl.playlist"))
+      {
+        json_t *files = json_object_get(root, "files");
+        if (!json_is_array(files) || json_array_size(files) == 0 || json_array_size(files) > TMS_PLAY_MAX_PLAYLIST)
+        {
+          janus_refcount_decrease(&session->ref);
+          response = json_object();
+          json_object_set_new(response, "code", json_integer(400));
+          json_object_set_new(response, "reason", json_string("没有指定要播放的文件列表，或者文件数量超过限制"));
+          return janus_plugin_result_new(JANUS_PLUGIN_OK, NULL, response);
+        }
+      }
       /* 检查通道连接情况 */
-      tms_play_session *session = (tms_play_session *)handle->plugin_handle;
-      if (!session->webrtcup)
+      if (!g_atomic_int_get(&session->webrtcup))
       {
+        janus_refcount_decrease(&session->ref);
         return janus_plugin_result_new(JANUS_PLUGIN_ERROR, "Webrtc连接未建立，不能执行指定操作", NULL);
       }
     }
 
     tms_play_message *msg = g_malloc(sizeof(tms_play_message));
     msg->handle = handle;
+    msg->session = session; // 消息持有查找时增加的引用
     msg->transaction = transaction;
     msg->message = root;
     msg->jsep = jsep;
+    msg->received_us = janus_get_monotonic_time();
 
-    JANUS_LOG(LOG_VERB, "[%s][%p] 收到客户端请求[%s][%s]，进入队列等待处理\n", TMS_JANUS_PLUGIN_PLAY_NAME, handle, request_text, msg->transaction);
-    g_async_queue_push(messages, msg);
+    /* 同一个会话的请求进入同一个队列，保证按顺序处理 */
+    int worker = session->id % nb_message_workers;
+    msg->queue_wait_us = 0;
+
+    JANUS_LOG(LOG_VERB, "[%s][%p] 收到客户端请求[%s][%s]，进入队列 #%d 等待处理\n", TMS_JANUS_PLUGIN_PLAY_NAME, handle, request_text, msg->transaction, worker);
+    g_async_queue_push(messages[worker], msg);
+  }
+  else
+  {
+    janus_refcount_decrease(&session->ref);
   }
 
   return janus_plugin_result_new(JANUS_PLUGIN_OK_WAIT, NULL, NULL);
 }
+/*************************************
+ * 压测任务
+ *
+ * 压测在独立的线程中执行，管理接口立即返回任务标识，通过bench.status查询结果。
+ * 同时只执行1个压测；只在节点上没有正在进行的播放时开始（先进入下线模式并等待播放结束），
+ * 执行期间拒绝新的播放，进程资源占用的变化只来自压测自己的会话。
+ *************************************/
+typedef struct tms_play_bench_job tms_play_bench_job;
+typedef json_t *(*tms_play_bench_func)(tms_play_bench_job *job);
+struct tms_play_bench_job
+{
+  guint64 id;
+  char *request;            // 压测请求的名称
+  json_t *params;           // 检查过的压测参数
+  tms_play_bench_func func; // 执行压测，返回结果
+  GThread *thread;
+  volatile gint done;     // 是否已经结束
+  volatile gint stopping; // 要求提前结束
+  int64_t begin_us;
+  int64_t end_us;
+  json_t *result; // 压测结果，结束后有效
+};
+static janus_mutex bench_mutex = JANUS_MUTEX_INITIALIZER;
+static tms_play_bench_job *bench_job = NULL; // 正在执行或者最近结束的压测
+static guint64 bench_job_id = 0;
+
+/* 执行压测的线程 */
+static void *tms_play_bench_thread(void *data)
+{
+  tms_play_bench_job *job = (tms_play_bench_job *)data;
+  JANUS_LOG(LOG_INFO, "[TmsPlay] 开始压测 %s，任务 %" PRIu64 "\n", job->request, job->id);
+  json_t *result = job->func(job);
+
+  janus_mutex_lock(&bench_mutex);
+  job->result = result;
+  job->end_us = av_gettime_relative();
+  g_atomic_int_set(&job->done, 1);
+  janus_mutex_unlock(&bench_mutex);
+  /* 结束后才接受新的播放和压测 */
+  g_atomic_int_set(&benching, 0);
+
+  JANUS_LOG(LOG_INFO, "[TmsPlay] 结束压测 %s，任务 %" PRIu64 "\n", job->request, job->id);
+
+  return NULL;
+}
+/* 释放压测任务，等待线程结束 */
+static void tms_play_bench_job_free(tms_play_bench_job *job)
+{
+  if (job->thread)
+    g_thread_join(job->thread);
+  g_free(job->request);
+  json_decref(job->params);
+  if (job->result)
+    json_decref(job->result);
+  g_free(job);
+}
+/**
+ * 开始压测任务，params为检查过的参数，任务持有引用
+ *
+ * 返回任务标识；不能开始时返回0，reason为原因
+ */
+static guint64 tms_play_bench_start(const char *request, tms_play_bench_func func, json_t *params, const char **reason)
+{
+  janus_mutex_lock(&bench_mutex);
+  if (!g_atomic_int_compare_and_exchange(&benching, 0, 1))
+  {
+    janus_mutex_unlock(&bench_mutex);
+    *reason = "正在执行其它压测";
+    return 0;
+  }
+  /* 已经拒绝新的播放，再检查正在进行的播放 */
+  if (g_atomic_int_get(&nb_active_playbacks) > 0)
+  {
+    g_atomic_int_set(&benching, 0);
+    janus_mutex_unlock(&bench_mutex);
+    *reason = "节点上有正在进行的播放，先进入下线模式并等待播放结束";
+    return 0;
+  }
+  /* 之前的压测已经结束，释放保留的结果 */
+  if (bench_job)
+    tms_play_bench_job_free(bench_job);
+
+  tms_play_bench_job *job = g_malloc0(sizeof(tms_play_bench_job));
+  job->id = ++bench_job_id;
+  job->request = g_strdup(request);
+  job->params = json_incref(params);
+  job->func = func;
+  job->begin_us = av_gettime_relative();
+  bench_job = job;
+
+  GError *error = NULL;
+  job->thread = g_thread_try_new("tmsplay bench", tms_play_bench_thread, job, &error);
+  if (error != NULL)
+  {
+    JANUS_LOG(LOG_ERR, "[TmsPlay] 启动压测线程发生错误：%d (%s)\n", error->code, error->message ? error->message : "??");
+    g_error_free(error);
+    job->thread = NULL;
+    tms_play_bench_job_free(job);
+    bench_job = NULL;
+    g_atomic_int_set(&benching, 0);
+    janus_mutex_unlock(&bench_mutex);
+    *reason = "启动压测线程失败";
+    return 0;
+  }
+  guint64 id = job->id;
+  janus_mutex_unlock(&bench_mutex);
+
+  return id;
+}
+/* 压测任务的状态，结束后包含结果，不是最近的任务时返回NULL */
+static json_t *tms_play_bench_status(guint64 id)
+{
+  json_t *status = NULL;
+  janus_mutex_lock(&bench_mutex);
+  tms_play_bench_job *job = bench_job;
+  if (job && job->id == id)
+  {
+    gboolean done = g_atomic_int_get(&job->done);
+    status = json_object();
+    json_object_set_new(status, "job", json_integer(job->id));
+    json_object_set_new(status, "request", json_string(job->request));
+    json_object_set_new(status, "running", json_boolean(!done));
+    json_object_set_new(status, "elapse_ms", json_integer(((done ? job->end_us : av_gettime_relative()) - job->begin_us) / 1000));
+    if (done && job->result)
+      json_object_set_new(status, "result", json_incref(job->result));
+  }
+  janus_mutex_unlock(&bench_mutex);
+
+  return status;
+}
+/* 要求压测提前结束，返回任务是否在执行 */
+static gboolean tms_play_bench_stop(guint64 id)
+{
+  gboolean running = FALSE;
+  janus_mutex_lock(&bench_mutex);
+  if (bench_job && bench_job->id == id && !g_atomic_int_get(&bench_job->done))
+  {
+    g_atomic_int_set(&bench_job->stopping, 1);
+    running = TRUE;
+  }
+  janus_mutex_unlock(&bench_mutex);
+
+  return running;
+}
+/* 开始压测任务，在管理接口的响应中返回任务标识或者不能开始的原因 */
+static void tms_play_bench_response(json_t *response, const char *request, tms_play_bench_func func, json_t *params)
+{
+  const char *reason = NULL;
+  guint64 id = tms_play_bench_start(request, func, params, &reason);
+  if (id == 0)
+  {
+    json_object_set_new(response, "code", json_integer(TMS_PLAY_REJECT_BUSY));
+    json_object_set_new(response, "reason", json_string(reason));
+    return;
+  }
+  json_object_set_new(response, "code", json_integer(0));
+  json_object_set_new(response, "job", json_integer(id));
+}
+/* 销毁插件时结束压测，释放任务 */
+static void tms_play_bench_destroy(void)
+{
+  janus_mutex_lock(&bench_mutex);
+  tms_play_bench_job *job = bench_job;
+  bench_job = NULL;
+  janus_mutex_unlock(&bench_mutex);
+  if (job)
+  {
+    g_atomic_int_set(&job->stopping, 1);
+    tms_play_bench_job_free(job);
+  }
+}
+/*************************************
+ * 泄漏检查
+ *
+ * 通过不发送任何数据的janus接口，反复执行创建会话，探测文件，播放，停止，挂断和销毁会话，
+ * 比较预热后和结束时进程的常驻内存，文件描述符数和线程数，超过限制时认为存在泄漏
+ *************************************/
+static int tms_soak_push_event(janus_plugin_session *handle, janus_plugin *plugin, const char *transaction, json_t *message, json_t *jsep)
+{
+  return 0;
+}
+static void tms_soak_relay_rtp(janus_plugin_session *handle, janus_plugin_rtp *packet)
+{
+}
+static void tms_soak_relay_rtcp(janus_plugin_session *handle, janus_plugin_rtcp *packet)
+{
+}
+static janus_callbacks soak_gateway = {.push_event = tms_soak_push_event, .relay_rtp = tms_soak_relay_rtp, .relay_rtcp = tms_soak_relay_rtcp};
+
+/* 进程的资源占用 */
+typedef struct tms_play_usage
+{
+  int64_t rss_kb; // 常驻内存，千字节
+  int nb_fds;     // 打开的文件描述符数
+  int nb_threads; // 线程数
+} tms_play_usage;
+
+/* 从/proc读取进程的资源占用 */
+static void tms_play_usage_get(tms_play_usage *usage)
+{
+  memset(usage, 0, sizeof(tms_play_usage));
+  FILE *status = fopen("/proc/self/status", "r");
+  if (status)
+  {
+    char line[256];
+    while (fgets(line, sizeof(line), status))
+    {
+      if (!strncmp(line, "VmRSS:", 6))
+        usage->rss_kb = strtoll(line + 6, NULL, 10);
+      else if (!strncmp(line, "Threads:", 8))
+        usage->nb_threads = atoi(line + 8);
+    }
+    fclose(status);
+  }
+  GDir *dir = g_dir_open("/proc/self/fd", 0, NULL);
+  if (dir)
+  {
+    while (g_dir_read_name(dir))
+      usage->nb_fds++;
+    g_dir_close(dir);
+    usage->nb_fds--; // 不包括读取目录使用的描述符
+  }
+}
+/* 在会话中开始播放，和ctrl.play相同，不发送数据，失败时返回NULL */
+static tms_play_ffmpeg *tms_soak_launch(tms_play_session *session, const char *filename, gboolean virtual_clock, gboolean loop)
+{
+  tms_play_ffmpeg *ffmpeg = NULL;
+  if (tms_play_ffmpeg_create(&ffmpeg, session->handle, &filename, 1, session->create_time_us) < 0)
+    return NULL;
+  ffmpeg->audio_codec = session->audio_codec;
+  ffmpeg->virtual_clock = virtual_clock;
+  ffmpeg->loop = loop;
+  ffmpeg->nocache = TRUE; // 每次都打开和解封装文件，不从片段缓存播放
+  ffmpeg->gateway = &soak_gateway;
+  ffmpeg->trace = session->trace;
+  tms_trace_ring_ref(ffmpeg->trace);
+  tms_play_session_set_ffmpeg(session, ffmpeg);
+
+  if (tms_play_ffmpeg_launch(ffmpeg, session->id) < 0)
+    return NULL;
+
+  return ffmpeg;
+}
+/* 在会话中播放1次，stop为TRUE时启动后立即停止，等待播放线程结束 */
+static void tms_soak_play(tms_play_session *session, const char *filename, gboolean stop)
+{
+  tms_play_ffmpeg *ffmpeg = tms_soak_launch(session, filename, TRUE, FALSE);
+  if (ffmpeg == NULL)
+    return;
+  if (stop)
+    g_atomic_int_set(&ffmpeg->playing, 0);
+  tms_play_ffmpeg_join(ffmpeg);
+}
+/**
+ * 执行cycles次会话的完整过程，预热阶段之后资源占用的增长超过max_rss_kb或者有文件描述符、线程增长时passed为false
+ *
+ * 每个播放线程都在压测线程中等待结束，不依赖节点上的播放数
+ */
+static json_t *tms_play_soak(tms_play_bench_job *job)
+{
+  const char *filename = json_string_value(json_object_get(job->params, "file"));
+  int nb_cycles = json_integer_value(json_object_get(job->params, "cycles"));
+  int64_t max_rss_growth_kb = json_integer_value(json_object_get(job->params, "max_rss_kb"));
+  char *fullpath = tms_play_fullpath(filename);
+  int nb_warmup = FFMAX(1, FFMIN(nb_cycles / 10, 100));
+  tms_play_usage before, after;
+  memset(&before, 0, sizeof(before));
+  int64_t begin_us = av_gettime_relative();
+  int i = 0, nb_probe_errors = 0;
+  for (; i < nb_warmup + nb_cycles && !g_atomic_int_get(&job->stopping); i++)
+  {
+    if (i == nb_warmup)
+      tms_play_usage_get(&before);
+
+    janus_plugin_session handle;
+    memset(&handle, 0, sizeof(handle));
+    int error = 0;
+    janus_plugin_create_session_tms_play(&handle, &error);
+    tms_play_session *session = tms_play_session_lookup(&handle);
+    if (session == NULL)
+      break;
+    janus_plugin_setup_media_tms_play(&handle);
+    /* 不使用基本信息缓存，每次都打开文件 */
+    tms_play_probe_info info;
+    tms_play_probe_forget(fullpath);
+    if (tms_play_probe(fullpath, &info) < 0)
+      nb_probe_errors++;
+    /* 播放到结尾，然后开始新的播放并立即停止，等待之前的播放线程 */
+    tms_soak_play(session, filename, FALSE);
+    tms_soak_play(session, filename, TRUE);
+    janus_refcount_decrease(&session->ref);
+    janus_plugin_hangup_media_tms_play(&handle);
+    janus_plugin_destroy_session_tms_play(&handle, &error);
+  }
+  g_free(fullpath);
+  tms_play_usage_get(&after);
+  int64_t elapse_us = av_gettime_relative() - begin_us;
+
+  int64_t rss_growth_kb = after.rss_kb - before.rss_kb;
+  int fd_growth = after.nb_fds - before.nb_fds;
+  int thread_growth = after.nb_threads - before.nb_threads;
+  gboolean passed = i == nb_warmup + nb_cycles && rss_growth_kb <= max_rss_growth_kb && fd_growth <= 0 && thread_growth <= 0;
+
+  json_t *result = json_object();
+  json_object_set_new(result, "file", json_string(filename));
+  json_object_set_new(result, "cycles", json_integer(FFMAX(i - nb_warmup, 0)));
+  json_object_set_new(result, "stopped", json_boolean(g_atomic_int_get(&job->stopping)));
+  json_object_set_new(result, "warmup_cycles", json_integer(nb_warmup));
+  json_object_set_new(result, "elapse_ms", json_real(elapse_us / 1000.0));
+  json_object_set_new(result, "probe_errors", json_integer(nb_probe_errors));
+  json_object_set_new(result, "rss_kb", json_integer(after.rss_kb));
+  json_object_set_new(result, "rss_growth_kb", json_integer(rss_growth_kb));
+  json_object_set_new(result, "fds", json_integer(after.nb_fds));
+  json_object_set_new(result, "fd_growth", json_integer(fd_growth));
+  json_object_set_new(result, "threads", json_integer(after.nb_threads));
+  json_object_set_new(result, "thread_growth", json_integer(thread_growth));
+  json_object_set_new(result, "passed", json_boolean(passed));
+  JANUS_LOG(LOG_INFO, "[TmsPlay] 泄漏检查 %s %d 次，内存增长 %" PRId64 " KB，文件描述符增长 %d，线程增长 %d\n", filename, i - nb_warmup, rss_growth_kb, fd_growth, thread_growth);
+
+  return result;
+}
+/* 为fullpath的视频流打开nb_decoders个解码器，返回每个解码器增加的常驻内存，千字节，没有视频流或者打开失败时返回-1 */
+static double tms_play_bench_decoders(const char *fullpath, int nb_decoders)
+{
+  AVFormatContext *ictx = NULL;
+  if (avformat_open_input(&ictx, fullpath, NULL, NULL) < 0)
+    return -1;
+
+  double decoder_kb = -1;
+  int index = avformat_find_stream_info(ictx, NULL) >= 0 ? av_find_best_stream(ictx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0) : -1;
+  AVCodec *codec = index >= 0 ? avcodec_find_decoder(ictx->streams[index]->codecpar->codec_id) : NULL;
+  if (codec)
+  {
+    AVCodecContext **decoders = g_malloc0(sizeof(AVCodecContext *) * nb_decoders);
+    tms_play_usage before, after;
+    tms_play_usage_get(&before);
+    int i = 0, nb_opened = 0;
+    for (; i < nb_decoders; i++)
+    {
+      AVCodecContext *cctx = avcodec_alloc_context3(codec);
+      avcodec_parameters_to_context(cctx, ictx->streams[index]->codecpar);
+      if (avcodec_open2(cctx, codec, NULL) < 0)
+      {
+        avcodec_free_context(&cctx);
+        break;
+      }
+      decoders[nb_opened++] = cctx;
+    }
+    tms_play_usage_get(&after);
+    if (nb_opened > 0)
+      decoder_kb = (double)(after.rss_kb - before.rss_kb) / nb_opened;
+    for (i = 0; i < nb_opened; i++)
+      avcodec_free_context(&decoders[i]);
+    g_free(decoders);
+  }
+  avformat_close_input(&ictx);
+
+  return decoder_kb;
+}
+/**
+ * 同时播放sessions个会话，测量每个会话增加的常驻内存、线程和文件描述符
+ *
+ * 不使用片段缓存，先播放1次预热共享的缓存，然后按实时速度循环播放，settle_ms后测量，停止并等待每个播放线程结束。
+ * 修改前的版本每个会话还为视频流打开1个解码器，decoder_kb为在本版本中直接打开同样多的解码器测得的每个解码器的内存，
+ * 修改前每个会话的内存约为rss_per_session_kb加上decoder_kb，两者在同一个进程、同一个文件上测量。
+ */
+static json_t *tms_play_bench_sessions(tms_play_bench_job *job)
+{
+  const char *filename = json_string_value(json_object_get(job->params, "file"));
+  int nb_sessions = json_integer_value(json_object_get(job->params, "sessions"));
+  int settle_ms = json_integer_value(json_object_get(job->params, "settle_ms"));
+
+  /* 预热探测信息、读取调度和编码器等所有会话共享的资源 */
+  janus_plugin_session warmup;
+  memset(&warmup, 0, sizeof(warmup));
+  int error = 0;
+  janus_plugin_create_session_tms_play(&warmup, &error);
+  tms_play_session *session = tms_play_session_lookup(&warmup);
+  if (session)
+  {
+    janus_plugin_setup_media_tms_play(&warmup);
+    tms_soak_play(session, filename, FALSE);
+    janus_refcount_decrease(&session->ref);
+    janus_plugin_hangup_media_tms_play(&warmup);
+    janus_plugin_destroy_session_tms_play(&warmup, &error);
+  }
+
+  tms_play_usage before, during, after;
+  tms_play_usage_get(&before);
+
+  janus_plugin_session *handles = g_malloc0(sizeof(janus_plugin_session) * nb_sessions);
+  tms_play_ffmpeg **ffmpegs = g_malloc0(sizeof(tms_play_ffmpeg *) * nb_sessions);
+  int i = 0, nb_created = 0, nb_playing = 0;
+  for (; i < nb_sessions && !g_atomic_int_get(&job->stopping); i++, nb_created++)
+  {
+    janus_plugin_create_session_tms_play(&handles[i], &error);
+    session = tms_play_session_lookup(&handles[i]);
+    if (session == NULL)
+      break;
+    janus_plugin_setup_media_tms_play(&handles[i]);
+    if ((ffmpegs[i] = tms_soak_launch(session, filename, FALSE, TRUE)) != NULL)
+    {
+      janus_refcount_increase(&ffmpegs[i]->ref);
+      nb_playing++;
+    }
+    janus_refcount_decrease(&session->ref);
+  }
+  int64_t settle_us = av_gettime_relative();
+  while (av_gettime_relative() - settle_us < (int64_t)settle_ms * 1000 && !g_atomic_int_get(&job->stopping))
+    g_usleep(10000);
+  tms_play_usage_get(&during);
+  /* 播放线程在测量期间是否一直在执行 */
+  int nb_running = 0;
+  for (i = 0; i < nb_created; i++)
+  {
+    if (ffmpegs[i] && g_atomic_int_get(&ffmpegs[i]->running))
+      nb_running++;
+  }
+
+  for (i = 0; i < nb_created; i++)
+  {
+    if (ffmpegs[i])
+    {
+      g_atomic_int_set(&ffmpegs[i]->playing, 0);
+      tms_play_ffmpeg_join(ffmpegs[i]);
+      janus_refcount_decrease(&ffmpegs[i]->ref);
+    }
+    janus_plugin_hangup_media_tms_play(&handles[i]);
+    janus_plugin_destroy_session_tms_play(&handles[i], &error);
+  }
+  tms_play_usage_get(&after);
+  g_free(ffmpegs);
+  g_free(handles);
+
+  char *fullpath = tms_play_fullpath(filename);
+  double decoder_kb = nb_playing > 0 && !tms_play_is_url(fullpath) ? tms_play_bench_decoders(fullpath, nb_playing) : -1;
+  g_free(fullpath);
+
+  int64_t rss_growth_kb = during.rss_kb - before.rss_kb;
+  double rss_per_session_kb = nb_playing > 0 ? (double)rss_growth_kb / nb_playing : 0;
+  json_t *result = json_object();
+  json_object_set_new(result, "file", json_string(filename));
+  json_object_set_new(result, "sessions", json_integer(nb_created));
+  json_object_set_new(result, "playing", json_integer(nb_playing));
+  json_object_set_new(result, "running", json_integer(nb_running));
+  json_object_set_new(result, "settle_ms", json_integer(settle_ms));
+  json_object_set_new(result, "stopped", json_boolean(g_atomic_int_get(&job->stopping)));
+  json_object_set_new(result, "rss_before_kb", json_integer(before.rss_kb));
+  json_object_set_new(result, "rss_during_kb", json_integer(during.rss_kb));
+  json_object_set_new(result, "rss_after_kb", json_integer(after.rss_kb));
+  json_object_set_new(result, "rss_per_session_kb", json_real(rss_per_session_kb));
+  json_object_set_new(result, "threads_per_session", json_real(nb_playing > 0 ? (double)(during.nb_threads - before.nb_threads) / nb_playing : 0));
+  json_object_set_new(result, "fds_per_session", json_real(nb_playing > 0 ? (double)(during.nb_fds - before.nb_fds) / nb_playing : 0));
+  if (decoder_kb >= 0)
+    json_object_set_new(result, "decoder_kb", json_real(decoder_kb));
+  JANUS_LOG(LOG_INFO, "[TmsPlay] 同时播放 %d 个会话 %s，内存增长 %" PRId64 " KB，每个会话 %.1f KB，每个视频解码器 %.1f KB\n", nb_playing, filename, rss_growth_kb, rss_per_session_kb, decoder_kb);
+
+  return result;
+}
+/* 用虚拟时钟播放file，检查rtp时间戳没有累计误差，文件不能打开时结果为NULL */
+static json_t *tms_play_bench_drift(tms_play_bench_job *job)
+{
+  const char *filename = json_string_value(json_object_get(job->params, "file"));
+  char *fullpath = tms_play_fullpath(filename);
+  json_t *result = tms_play_drift_check(fullpath, &play_options, &job->stopping);
+  g_free(fullpath);
+
+  return result;
+}
+/**
+ * 管理接口请求
+ * 
+ * trace.dump：输出会话最近的跟踪记录，session为query_session返回的id，max为最多输出的记录数，同时返回视频帧和音频帧晚于媒体时间的百分位数
+ * count.sessions：按播放状态统计会话数量
+ * list.sessions：列出所有会话的id，状态，播放的文件和统计
+ * stop.file：停止所有正在播放file的会话，没有指定file时停止所有会话
+ * admission.status：准入控制的状态和拒绝计数
+ * remote.status：远程文件块缓存的命中率和下载用时
+ * io.status：本地文件读取调度每个设备的队列深度和读取用时
+ * live.status：正在转发的直播和观看者数量
+ * bench.play：用虚拟时钟播放file，runs为次数，不发送rtp包，返回吞吐量上限
+ * bench.resample：常见的音频输入转换为8k PCMA，比较自动选择的重采样方式和libswresample的耗时，frames为每种输入的帧数
+ * bench.soak：反复创建会话，探测和播放file，停止并销毁会话，cycles为次数，检查内存，文件描述符和线程是否增长，在后台执行，返回任务标识
+ * bench.status：查询压测任务job的状态，结束后返回结果
+ * bench.stop：要求压测任务job提前结束
+ * bench.drift：用虚拟时钟完整播放file，检查最后1个视频和音频rtp包的时间戳没有累计误差，音视频发送偏差为0，在后台执行，返回任务标识
+ * bench.sessions：同时播放sessions个会话，settle_ms后测量每个会话占用的常驻内存，线程和文件描述符，以及视频解码器的内存，在后台执行，返回任务标识
+ * drain：enable为true时进入下线模式，拒绝新的播放，为false时恢复
+ */
+json_t *janus_plugin_handle_admin_message_tms_play(json_t *message)
+{
+  json_t *response = json_object();
+  const char *request_text = json_string_value(json_object_get(message, "request"));
+  if (request_text == NULL)
+  {
+    json_object_set_new(response, "code", json_integer(400));
+    json_object_set_new(response, "reason", json_string("没有指定请求"));
+    return response;
+  }
+
+  if (!strcasecmp(request_text, "trace.dump"))
+  {
+    guint64 id = json_integer_value(json_object_get(message, "session"));
+    int max_records = json_integer_value(json_object_get(message, "max"));
+
+    /* 复制记录时会话可能被销毁，持有跟踪记录的引用 */
+    TmsTraceRing *trace = NULL;
+    tms_play_session *session = tms_play_session_find(id);
+    if (session)
+    {
+      trace = session->trace;
+      if (trace)
+        tms_trace_ring_ref(trace);
+      janus_refcount_decrease(&session->ref);
+    }
+
+    if (trace == NULL)
+    {
+      json_object_set_new(response, "code", json_integer(404));
+      json_object_set_new(response, "session", json_integer(id));
+      return response;
+    }
+
+    json_object_set_new(response, "code", json_integer(0));
+    json_object_set_new(response, "session", json_integer(id));
+    json_object_set_new(response, "fields", json_string("time_us,type,seq,size,lateness_us,extra"));
+    json_object_set_new(response, "records", tms_trace_ring_dump(trace, max_records));
+    json_object_set_new(response, "lateness", tms_trace_ring_lateness(trace));
+    tms_trace_ring_unref(trace);
+  }
+  else if (!strcasecmp(request_text, "count.sessions"))
+  {
+    int counts[TMS_PLAY_SESSION_NB_STATES];
+    tms_play_sessions_count(counts);
+    json_t *states = json_object();
+    int i = 0, total = 0;
+    for (; i < TMS_PLAY_SESSION_NB_STATES; i++)
+    {
+      json_object_set_new(states, tms_play_session_state_names[i], json_integer(counts[i]));
+      total += counts[i];
+    }
+    json_object_set_new(response, "code", json_integer(0));
+    json_object_set_new(response, "total", json_integer(total));
+    json_object_set_new(response, "states", states);
+  }
+  else if (!strcasecmp(request_text, "list.sessions"))
+  {
+    json_t *list = json_array();
+    GList *sessions = tms_play_sessions_snapshot(), *item;
+    for (item = sessions; item; item = item->next)
+    {
+      tms_play_session *session = (tms_play_session *)item->data;
+      json_t *info = json_object();
+      json_object_set_new(info, "id", json_integer(session->id));
+      json_object_set_new(info, "state", json_string(tms_play_session_state_names[tms_play_session_state(session)]));
+      json_object_set_new(info, "webrtcup", json_boolean(g_atomic_int_get(&session->webrtcup)));
+      janus_mutex_lock(&session->mutex);
+      if (session->ffmpeg)
+      {
+        json_t *files = json_array();
+        int i = 0;
+        for (; session->ffmpeg->playlist[i]; i++)
+          json_array_append_new(files, json_string(tms_play_relpath(session->ffmpeg->playlist[i])));
+        json_object_set_new(info, "files", files);
+        json_object_set_new(info, "stats", tms_play_ffmpeg_stats(session->ffmpeg));
+      }
+      janus_mutex_unlock(&session->mutex);
+      json_array_append_new(list, info);
+    }
+    tms_play_sessions_release(sessions);
+    json_object_set_new(response, "code", json_integer(0));
+    json_object_set_new(response, "sessions", list);
+  }
+  else if (!strcasecmp(request_text, "stop.file"))
+  {
+    const char *filename = json_string_value(json_object_get(message, "file"));
+    char *fullpath = filename ? tms_play_fullpath(filename) : NULL;
+    int nb_stopped = tms_play_sessions_stop(fullpath);
+    JANUS_LOG(LOG_INFO, "[TmsPlay] 停止播放 %s 的会话 %d 个\n", fullpath ? fullpath : "任意文件", nb_stopped);
+    g_free(fullpath);
+    json_object_set_new(response, "code", json_integer(0));
+    json_object_set_new(response, "stopped", json_integer(nb_stopped));
+  }
+  else if (!strcasecmp(request_text, "admission.status"))
+  {
+    json_object_set_new(response, "code", json_integer(0));
+    json_object_set_new(response, "admission", tms_play_admission_status());
+  }
+  else if (!strcasecmp(request_text, "remote.status"))
+  {
+    json_object_set_new(response, "code", json_integer(0));
+    json_object_set_new(response, "remote", tms_remote_cache_status());
+  }
+  else if (!strcasecmp(request_text, "io.status"))
+  {
+    json_object_set_new(response, "code", json_integer(0));
+    json_object_set_new(response, "io", tms_io_status());
+  }
+  else if (!strcasecmp(request_text, "bench.play"))
+  {
+    const char *filename = json_string_value(json_object_get(message, "file"));
+    json_t *runs = json_object_get(message, "runs");
+    int nb_runs = json_is_integer(runs) ? json_integer_value(runs) : 1;
+    char *fullpath = filename ? tms_play_fullpath(filename) : NULL;
+    if (fullpath == NULL || tms_live_is_url(fullpath) || nb_runs < 1 || nb_runs > TMS_PLAY_MAX_BENCH_RUNS)
+    {
+      json_object_set_new(response, "code", json_integer(400));
+      json_object_set_new(response, "reason", json_string("没有指定可以播放的文件或者次数超出范围"));
+    }
+    else
+    {
+      json_object_set_new(response, "code", json_integer(0));
+      json_object_set_new(response, "bench", tms_play_benchmark(fullpath, nb_runs, &play_options));
+    }
+    g_free(fullpath);
+  }
+  else if (!strcasecmp(request_text, "bench.resample"))
+  {
+    json_t *frames = json_object_get(message, "frames");
+    int nb_frames = json_is_integer(frames) ? json_integer_value(frames) : 1000;
+    json_t *bench = NULL;
+    if (nb_frames < 1 || nb_frames > TMS_PLAY_MAX_BENCH_FRAMES)
+    {
+      json_object_set_new(response, "code", json_integer(400));
+      json_object_set_new(response, "reason", json_string("帧数超出范围"));
+    }
+    else if ((bench = tms_play_resample_benchmark(nb_frames)) == NULL)
+    {
+      json_object_set_new(response, "code", json_integer(500));
+      json_object_set_new(response, "reason", json_string("无法创建音频编码器"));
+    }
+    else
+    {
+      json_object_set_new(response, "code", json_integer(0));
+      json_object_set_new(response, "bench", bench);
+    }
+  }
+  else if (!strcasecmp(request_text, "bench.soak"))
+  {
+    const char *filename = json_string_value(json_object_get(message, "file"));
+    json_t *cycles = json_object_get(message, "cycles");
+    int nb_cycles = json_is_integer(cycles) ? json_integer_value(cycles) : 1000;
+    json_t *max_rss_kb = json_object_get(message, "max_rss_kb");
+    char *fullpath = filename ? tms_play_fullpath(filename) : NULL;
+    if (fullpath == NULL || tms_live_is_url(fullpath) || nb_cycles < 1 || nb_cycles > TMS_PLAY_MAX_SOAK_CYCLES)
+    {
+      json_object_set_new(response, "code", json_integer(400));
+      json_object_set_new(response, "reason", json_string("没有指定可以播放的文件或者次数超出范围"));
+    }
+    else
+    {
+      json_t *params = json_object();
+      json_object_set_new(params, "file", json_string(filename));
+      json_object_set_new(params, "cycles", json_integer(nb_cycles));
+      json_object_set_new(params, "max_rss_kb", json_integer(json_is_integer(max_rss_kb) ? json_integer_value(max_rss_kb) : TMS_PLAY_SOAK_MAX_RSS_KB));
+      tms_play_bench_response(response, request_text, tms_play_soak, params);
+      json_decref(params);
+    }
+    g_free(fullpath);
+  }
+  else if (!strcasecmp(request_text, "bench.drift"))
+  {
+    const char *filename = json_string_value(json_object_get(message, "file"));
+    char *fullpath = filename ? tms_play_fullpath(filename) : NULL;
+    if (fullpath == NULL || tms_live_is_url(fullpath) || tms_remote_is_url(fullpath))
+    {
+      json_object_set_new(response, "code", json_integer(400));
+      json_object_set_new(response, "reason", json_string("没有指定可以播放的本地文件"));
+    }
+    else
+    {
+      json_t *params = json_object();
+      json_object_set_new(params, "file", json_string(filename));
+      tms_play_bench_response(response, request_text, tms_play_bench_drift, params);
+      json_decref(params);
+    }
+    g_free(fullpath);
+  }
+  else if (!strcasecmp(request_text, "bench.status"))
+  {
+    guint64 id = json_integer_value(json_object_get(message, "job"));
+    json_t *status = tms_play_bench_status(id);
+    json_object_set_new(response, "code", json_integer(status ? 0 : 404));
+    json_object_set_new(response, "job", json_integer(id));
+    if (status)
+      json_object_set_new(response, "bench", status);
+  }
+  else if (!strcasecmp(request_text, "bench.stop"))
+  {
+    guint64 id = json_integer_value(json_object_get(message, "job"));
+    json_object_set_new(response, "code", json_integer(tms_play_bench_stop(id) ? 0 : 404));
+    json_object_set_new(response, "job", json_integer(id));
+  }
+  else if (!strcasecmp(request_text, "bench.sessions"))
+  {
+    const char *filename = json_string_value(json_object_get(message, "file"));
+    json_t *sessions = json_object_get(message, "sessions");
+    int nb_sessions = json_is_integer(sessions) ? json_integer_value(sessions) : 100;
+    json_t *settle_ms = json_object_get(message, "settle_ms");
+    int settle = json_is_integer(settle_ms) ? json_integer_value(settle_ms) : TMS_PLAY_BENCH_SETTLE_MS;
+    char *fullpath = filename ? tms_play_fullpath(filename) : NULL;
+    if (fullpath == NULL || tms_live_is_url(fullpath) || nb_sessions < 1 || nb_sessions > TMS_PLAY_MAX_BENCH_SESSIONS || settle < 0 || settle > 60000)
+    {
+      json_object_set_new(response, "code", json_integer(400));
+      json_object_set_new(response, "reason", json_string("没有指定可以播放的文件或者会话数、时长超出范围"));
+    }
+    else
+    {
+      json_t *params = json_object();
+      json_object_set_new(params, "file", json_string(filename));
+      json_object_set_new(params, "sessions", json_integer(nb_sessions));
+      json_object_set_new(params, "settle_ms", json_integer(settle));
+      tms_play_bench_response(response, request_text, tms_play_bench_sessions, params);
+      json_decref(params);
+    }
+    g_free(fullpath);
+  }
+  else if (!strcasecmp(request_text, "live.status"))
+  {
+    json_object_set_new(response, "code", json_integer(0));
+    json_object_set_new(response, "live", tms_live_status());
+  }
+  else if (!strcasecmp(request_text, "drain"))
+  {
+    json_t *enable = json_object_get(message, "enable");
+    g_atomic_int_set(&draining, enable == NULL || json_is_true(enable));
+    JANUS_LOG(LOG_INFO, "[TmsPlay] %s下线模式，正在播放 %d 个\n", g_atomic_int_get(&draining) ? "进入" : "退出", g_atomic_int_get(&nb_active_playbacks));
+    json_object_set_new(response, "code", json_integer(0));
+    json_object_set_new(response, "admission", tms_play_admission_status());
+  }
+  else
+  {
+    json_object_set_new(response, "code", json_integer(400));
+    json_object_set_new(response, "reason", json_string("不支持的请求"));
+  }
+
+  return response;
+}
@@ -1,7 +1,12 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+
 #include <plugins/plugin.h>
 
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
+#include <libavutil/audio_fifo.h>
 #include <libavutil/avassert.h>
 #include <libavutil/intreadwrite.h>
 #include <libavutil/log.h>
@@ -13,25 +18,65 @@
 #include <libswresample/swresample.h>
 
 #include "tms_play.h"
+#include "tms_play_rtcp.h"
 #include "tms_play_h264.h"
 #include "tms_play_pcma.h"
 #include "tms_play_stream.h"
+#include "tms_play_cache.h"
+#include "tms_play_remote.h"
+#include "tms_play_io.h"
+#include "tms_play_live.h"
+#include "tms_play_abr.h"
+#include "tms_play_sched.h"
+#include "tms_play_trace.h"
+
+#define TMS_PLAY_PREFETCH_THREADS 4      // 预先打开播放列表中下一个文件的线程数
+#define TMS_PLAY_PREWARM_READ_SIZE 65536 // 预热时读取文件的块大小，字节
+
+/* 记录1个打开的媒体文件 */
+typedef struct TmsPlayInput
+{
+  char *filename;          // 文件的完整路径
+  AVFormatContext *ictx;   // 媒体文件
+  TmsRemoteFile *remote;   // 通过块缓存读取的远程文件，本地文件为NULL
+  TmsIoReader *io;         // 通过读取调度读取的本地文件，远程文件为NULL
+  volatile gint *playing;  // 会话的播放状态，停止播放时中断远程文件的读取，NULL表示不中断
+  AVBSFContext *h264bsfc;  // mp4转h264，将sps和pps放到推送流中
+  Resampler resampler;     // 音频重采样
+  PCMAEnc pcma_enc;        // 音频编码
+  int audio_codec;         // 音频输出的编码
+  TmsInputStream **ists;   // 记录媒体流信息，按流序号索引，没有选择的流为NULL
+  int nb_ists;             // ists的长度，文件中的媒体流数量
+  int nb_streams;          // 选择播放的媒体流数量
+  int video_track;         // 指定的视频流序号，TMS_PLAY_TRACK_AUTO：自动选择，TMS_PLAY_TRACK_NONE：不播放
+  int audio_track;         // 指定的音频流序号，同上
+  gboolean doaudio;        // 是否播放音频
+  gboolean dovideo;        // 是否播放视频
+  /* 预先打开 */
+  int ret;              // 打开文件的结果
+  volatile gint opened; // 是否已经完成打开，0：未完成，1：完成
+  janus_mutex mutex;
+  janus_condition cond;
+} TmsPlayInput;
 
 /***********************************
  * 解析mp4，mp3，wav文件，通过janus进行转发
  * 
- * 输出h264和pcma
+ * 输出h264和pcma或opus
  * 支持播放控制，暂停，恢复，停止 
  ***********************************/
 /* 初始化播放器上下文对象 */
-static int tms_init_play_context(janus_callbacks *gateway, janus_plugin_session *handle, tms_play_ffmpeg *ffmpeg, TmsPlayContext *play)
+static int tms_init_play_context(janus_callbacks *gateway, janus_plugin_session *handle, tms_play_ffmpeg *ffmpeg, TmsClock *clock, TmsPlayContext *play)
 {
+  play->clock = clock;
   play->nb_streams = 0;
   play->doaudio = FALSE;
   play->dovideo = FALSE;
-  play->start_time_us = av_gettime_relative(); // 单位是微秒
+  play->audio_only = ffmpeg->audio_only;
+  play->start_time_us = tms_clock_now(clock); // 单位是微秒
   play->end_time_us = 0;
   play->pause_duration_us = 0;
+  play->input_offset_us = 0;
   play->nb_packets = 0;
   play->nb_video_packets = 0;
   play->nb_before_video_rtps = ffmpeg->nb_video_rtps;
@@ -40,6 +85,21 @@ static int tms_init_play_context(janus_callbacks *gateway, janus_plugin_session
   play->nb_pcma_frames = 0;
   play->nb_audio_rtps = 0;
   play->nb_before_audio_rtps = ffmpeg->nb_audio_rtps;
+  play->nb_video_octets = 0;
+  play->nb_audio_octets = 0;
+  play->input_end_us = 0;
+  play->nopacing = FALSE;
+  play->clip = NULL;
+  play->fast_start_us = (int64_t)ffmpeg->options.fast_start_ms * 1000;
+  play->fast_start_rate = (int64_t)ffmpeg->options.fast_start_kbps * 1000 / 8;
+  play->fast_start_begin_us = play->start_time_us;
+  play->request_time_us = ffmpeg->request_time_us;
+  play->first_frame_us = 0;
+  play->trace = ffmpeg->trace;
+  play->video_deadline_us = 0;
+  play->audio_deadline_us = 0;
+  play->capture = NULL;
+  play->nb_dropped_frames = 0;
   play->gateway = gateway;
   play->handle = handle;
 
@@ -51,16 +111,38 @@ static void tms_free_input_streams(TmsInputStream **ists, int nb_streams)
   int i = 0;
   for (; i < nb_streams; i++)
   {
-    free(ists[i]);
+    if (ists[i])
+      tms_free_input_stream(ists[i]);
   }
+  g_free(ists);
+}
+/* 打开媒体文件，远程文件通过块缓存读取，本地文件通过读取调度读取，playing为停止时中断远程读取的播放状态 */
+static int tms_open_input_file(AVFormatContext **ictx, const char *filename, volatile gint *playing, TmsRemoteFile **remote, TmsIoReader **io)
+{
+  *remote = NULL;
+  *io = NULL;
+  if (tms_remote_is_url(filename))
+    return tms_remote_open_input(ictx, filename, playing, remote);
+
+  return tms_io_open_input(ictx, filename, io);
+}
+/* 关闭tms_open_input_file打开的媒体文件 */
+static void tms_close_input_file(AVFormatContext **ictx, TmsRemoteFile **remote, TmsIoReader **io)
+{
+  if (*io)
+    tms_io_close_input(ictx, io);
+  else
+    tms_remote_close_input(ictx, remote);
 }
 /* 打开指定的文件，获得媒体流信息 */
-static int tms_open_file(char *filename, AVFormatContext **ictx, AVBSFContext **h264bsfc, Resampler *resampler, PCMAEnc *pcma_enc, TmsInputStream **ists, TmsPlayContext *play)
+static int tms_open_file(TmsPlayInput *input)
 {
   int ret = 0;
+  char *filename = input->filename;
+  AVFormatContext **ictx = &input->ictx;
 
   /* 打开指定的媒体文件 */
-  if ((ret = avformat_open_input(ictx, filename, NULL, NULL)) < 0)
+  if ((ret = tms_open_input_file(ictx, filename, input->playing, &input->remote, &input->io)) < 0)
   {
     JANUS_LOG(LOG_VERB, "无法打开媒体文件 %s\n", filename);
     return -1;
@@ -72,85 +154,444 @@ static int tms_open_file(char *filename, AVFormatContext **ictx, AVBSFContext **
     JANUS_LOG(LOG_VERB, "无法获取媒体文件信息 %s\n", filename);
     return -1;
   }
+  /* 按媒体码率预读远程文件，计算本地文件预读的截止时间 */
+  if (input->remote)
+    input->remote->bit_rate = (*ictx)->bit_rate;
+  if (input->io)
+    input->io->bit_rate = (*ictx)->bit_rate;
 
   int nb_streams = (*ictx)->nb_streams;
 
   JANUS_LOG(LOG_VERB, "媒体文件 %s nb_streams = %d , duration = %s\n", filename, nb_streams, av_ts2str((*ictx)->duration));
 
+  /* 选择1路视频和1路音频，其它的流由解封装器直接丢弃，不读取数据，也不打开解码器 */
+  int video_index = tms_select_stream(*ictx, AVMEDIA_TYPE_VIDEO, input->video_track, -1);
+  int audio_index = tms_select_stream(*ictx, AVMEDIA_TYPE_AUDIO, input->audio_track, video_index);
+  JANUS_LOG(LOG_VERB, "媒体文件 %s 选择视频流 #%d，音频流 #%d\n", filename, video_index, audio_index);
+
+  input->ists = g_malloc0(sizeof(TmsInputStream *) * nb_streams);
+  input->nb_ists = nb_streams;
+
   int i = 0;
   for (; i < nb_streams; i++)
   {
+    if (i != video_index && i != audio_index)
+    {
+      (*ictx)->streams[i]->discard = AVDISCARD_ALL;
+      continue;
+    }
     TmsInputStream *ist = malloc(sizeof(TmsInputStream));
-    tms_init_input_stream(*ictx, i, ist);
+    if (tms_init_input_stream(*ictx, i, ist) < 0)
+    {
+      free(ist);
+      (*ictx)->streams[i]->discard = AVDISCARD_ALL;
+      continue;
+    }
     tms_dump_stream_format(ist);
+    /* 所有媒体流使用相同的文件起点，保证音视频同步 */
+    if ((*ictx)->start_time != AV_NOPTS_VALUE)
+      ist->origin_ts = av_rescale_q((*ictx)->start_time, AV_TIME_BASE_Q, ist->st->time_base);
 
-    ists[i] = ist;
+    input->ists[i] = ist;
+    input->nb_streams++;
 
     if (ist->codec->type == AVMEDIA_TYPE_VIDEO)
     {
       const AVBitStreamFilter *filter = av_bsf_get_by_name("h264_mp4toannexb");
-      ret = av_bsf_alloc(filter, h264bsfc);
-      avcodec_parameters_copy((*h264bsfc)->par_in, ist->st->codecpar);
-      av_bsf_init(*h264bsfc);
-      play->dovideo = TRUE;
+      ret = av_bsf_alloc(filter, &input->h264bsfc);
+      avcodec_parameters_copy(input->h264bsfc->par_in, ist->st->codecpar);
+      av_bsf_init(input->h264bsfc);
+      input->dovideo = TRUE;
     }
     else if (ist->codec->type == AVMEDIA_TYPE_AUDIO)
     {
-      if ((ret = tms_init_pcma_encoder(pcma_enc)) < 0)
+      if ((ret = tms_init_audio_encoder(&input->pcma_enc, input->audio_codec)) < 0)
       {
         return -1;
       }
-      /* 设置重采样，将解码出的fltp采样格式，转换为s16采样格式 */
-      if ((ret = tms_init_audio_resampler(ist->dec_ctx, pcma_enc->cctx, resampler)) < 0)
+      /* 设置重采样，将解码出的音频转换为编码器的采样率（PCMA为8k，Opus为48k），单声道s16采样格式 */
+      if ((ret = tms_init_audio_resampler(ist->dec_ctx, input->pcma_enc.cctx, &input->resampler)) < 0)
       {
         return -1;
       }
-      play->doaudio = TRUE;
+      input->doaudio = TRUE;
     }
   }
 
+  return 0;
+}
+/* 创建要打开的媒体文件，video_track和audio_track为指定的流序号，audio_codec为音频输出的编码 */
+static TmsPlayInput *tms_new_input(char *filename, int video_track, int audio_track, int audio_codec)
+{
+  TmsPlayInput *input = g_malloc0(sizeof(TmsPlayInput));
+  input->filename = filename;
+  input->ictx = NULL;
+  input->remote = NULL;
+  input->io = NULL;
+  input->playing = NULL;
+  input->h264bsfc = NULL;
+  input->resampler.max_nb_samples = 0;
+  input->pcma_enc.nb_samples = 0;
+  input->audio_codec = audio_codec;
+  input->ists = NULL;
+  input->nb_ists = 0;
+  input->nb_streams = 0;
+  input->video_track = video_track;
+  input->audio_track = audio_track;
+  input->doaudio = FALSE;
+  input->dovideo = FALSE;
+  input->ret = 0;
+  input->opened = 0;
+  janus_mutex_init(&input->mutex);
+  janus_condition_init(&input->cond);
+
+  return input;
+}
+/* 关闭媒体文件，释放资源 */
+static void tms_free_input(TmsPlayInput *input)
+{
+  if (input->ists)
+    tms_free_input_streams(input->ists, input->nb_ists);
+
+  if (input->dovideo)
+    if (input->h264bsfc)
+      av_bsf_free(&input->h264bsfc);
+
+  if (input->doaudio)
+    tms_free_audio_resampler(&input->resampler);
+  tms_free_audio_encoder(&input->pcma_enc);
+
+  tms_close_input_file(&input->ictx, &input->remote, &input->io);
+
+  janus_mutex_destroy(&input->mutex);
+  janus_condition_destroy(&input->cond);
+  g_free(input);
+}
+/**
+ * 预先打开播放列表中的下一个文件
+ * 
+ * 在共享的线程池中执行，不需要为每个文件启动线程
+ */
+static GThreadPool *prefetch_pool = NULL;
+
+static void tms_prefetch_input(gpointer data, gpointer user_data)
+{
+  TmsPlayInput *input = (TmsPlayInput *)data;
+
+  int ret = tms_open_file(input);
+
+  janus_mutex_lock(&input->mutex);
+  input->ret = ret;
+  g_atomic_int_set(&input->opened, 1);
+  janus_condition_signal(&input->cond);
+  janus_mutex_unlock(&input->mutex);
+}
+/* 开始预先打开文件，如果无法放入线程池，等到使用时再打开 */
+static void tms_start_prefetch_input(TmsPlayInput *input)
+{
+  if (prefetch_pool == NULL || !g_thread_pool_push(prefetch_pool, input, NULL))
+  {
+    input->ret = tms_open_file(input);
+    g_atomic_int_set(&input->opened, 1);
+  }
+}
+/* 等待完成文件打开 */
+static int tms_wait_input(TmsPlayInput *input)
+{
+  janus_mutex_lock(&input->mutex);
+  while (!g_atomic_int_get(&input->opened))
+    janus_condition_wait(&input->cond, &input->mutex);
+  janus_mutex_unlock(&input->mutex);
+
+  return input->ret;
+}
+/**
+ * 切换到播放列表中的下一个文件
+ * 
+ * 下一个文件的起点接在上一个文件已发送媒体的终点上，保证RTP时间戳连续，没有间隙
+ */
+static void tms_switch_input(TmsPlayContext *play, int nb_streams, gboolean doaudio, gboolean dovideo, TmsAudioRtpContext *audio_rtp_ctx, TmsVideoRtpContext *video_rtp_ctx)
+{
+  if (play->input_end_us > 0)
+    tms_clock_next_input(play, play->input_end_us);
+  play->input_end_us = 0;
+  tms_trace(play->trace, TMS_TRACE_SWITCH_INPUT, 0, nb_streams, 0, 0);
   play->nb_streams = nb_streams;
+  play->doaudio = doaudio;
+  play->dovideo = dovideo && !play->audio_only;
+}
+/* 按播放请求指定的媒体流创建要打开的文件，只播放音频时不读取视频 */
+static TmsPlayInput *tms_new_play_input(tms_play_ffmpeg *ffmpeg, char *filename)
+{
+  int video_track = ffmpeg->audio_only ? TMS_PLAY_TRACK_NONE : ffmpeg->video_track;
+  TmsPlayInput *input = tms_new_input(filename, video_track, ffmpeg->audio_track, ffmpeg->audio_codec);
+  input->playing = &ffmpeg->playing;
 
-  return 0;
+  return input;
+}
+/* 是否可以使用和记录缓存的片段，要求自动选择媒体流且只有1个码率，压测可以要求不使用 */
+static gboolean tms_use_clip_cache(tms_play_ffmpeg *ffmpeg)
+{
+  return !ffmpeg->nocache && ffmpeg->video_track == TMS_PLAY_TRACK_AUTO && ffmpeg->audio_track == TMS_PLAY_TRACK_AUTO && ffmpeg->renditions == NULL;
 }
+/* 获得播放列表中的下一个位置，循环播放时回到开头，没有时返回-1 */
+static int tms_next_playlist_index(tms_play_ffmpeg *ffmpeg, int index)
+{
+  if (ffmpeg->playlist[index + 1])
+    return index + 1;
+  return ffmpeg->loop ? 0 : -1;
+}
+/* 预先打开播放列表中的下一个文件，已经缓存的文件不需要打开 */
+static TmsPlayInput *tms_prefetch_next(tms_play_ffmpeg *ffmpeg, int index)
+{
+  int next_index = tms_next_playlist_index(ffmpeg, index);
+  if (next_index < 0 || tms_live_is_url(ffmpeg->playlist[next_index]))
+    return NULL;
 
-/*************************************
- * 执行入口 
- *************************************/
-int tms_play_main(janus_callbacks *gateway, janus_plugin_session *handle, tms_play_ffmpeg *ffmpeg)
+  TmsClip *clip = tms_use_clip_cache(ffmpeg) ? tms_clip_cache_get(ffmpeg->playlist[next_index], ffmpeg->audio_codec) : NULL;
+  if (clip)
+  {
+    janus_refcount_decrease(&clip->ref);
+    return NULL;
+  }
+
+  TmsPlayInput *next = tms_new_play_input(ffmpeg, ffmpeg->playlist[next_index]);
+  tms_start_prefetch_input(next);
+
+  return next;
+}
+/**
+ * 同一内容的多个码率
+ * 
+ * 主文件提供音频和0号码率的视频，其它码率的文件只读取视频。发送其它码率时，按解码时间和主文件的包交错读取；
+ * 只在主文件的关键帧上切换（GOP对齐时所有码率在这里都是关键帧），切换到其它码率时定位到同一时间的关键帧。
+ */
+typedef struct TmsRenditionSet
 {
-  int ret = 0;
+  TmsPlayInput *inputs[TMS_PLAY_MAX_RENDITIONS]; // 0为主文件，在后台预先打开其它码率
+  TmsAbr abr;
+  AVPacket *pkt;    // 从正在发送的码率读取、还没有发送的视频包
+  gboolean pending; // pkt中是否有包
+  int audio_kbps;   // 音频占用的带宽，千比特/秒
+} TmsRenditionSet;
 
-  TmsInputStream *ists[2]; // 记录媒体流信息
-  AVFormatContext *ictx = NULL;
-  AVBSFContext *h264bsfc; // mp4转h264，将sps和pps放到推送流中
+/* 媒体流的时间戳换算为相对于文件起点的微秒 */
+static int64_t tms_input_ts_us(TmsPlayInput *input, AVPacket *pkt, int64_t ts)
+{
+  TmsInputStream *ist = input->ists[pkt->stream_index];
+  return av_rescale_q(ts - ist->origin_ts, ist->st->time_base, AV_TIME_BASE_Q);
+}
+/* 包的解码时间，微秒 */
+static int64_t tms_input_dts_us(TmsPlayInput *input, AVPacket *pkt)
+{
+  return tms_input_ts_us(input, pkt, pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts);
+}
+/* 视频码率，千比特/秒，没有记录时按文件的码率 */
+static int tms_input_video_kbps(TmsPlayInput *input)
+{
+  int i = 0;
+  for (; i < input->nb_ists; i++)
+  {
+    if (input->ists[i] && input->ists[i]->codec->type == AVMEDIA_TYPE_VIDEO && input->ists[i]->st->codecpar->bit_rate > 0)
+      return input->ists[i]->st->codecpar->bit_rate / 1000;
+  }
+  return input->ictx->bit_rate > 0 ? input->ictx->bit_rate / 1000 : 0;
+}
+/* 打开主文件以外的码率，只读取视频 */
+static TmsRenditionSet *tms_new_rendition_set(tms_play_ffmpeg *ffmpeg, TmsPlayInput *primary)
+{
+  TmsRenditionSet *set = g_malloc0(sizeof(TmsRenditionSet));
+  set->inputs[0] = primary;
+  int nb_renditions = 1;
+  for (; ffmpeg->renditions[nb_renditions - 1] && nb_renditions < TMS_PLAY_MAX_RENDITIONS; nb_renditions++)
+  {
+    set->inputs[nb_renditions] = tms_new_input(ffmpeg->renditions[nb_renditions - 1], TMS_PLAY_TRACK_AUTO, TMS_PLAY_TRACK_NONE, ffmpeg->audio_codec);
+    set->inputs[nb_renditions]->playing = &ffmpeg->playing;
+    tms_start_prefetch_input(set->inputs[nb_renditions]);
+  }
+  tms_abr_init(&set->abr, nb_renditions);
+  set->abr.kbps[0] = tms_input_video_kbps(primary);
+  set->pkt = av_packet_alloc();
+  set->audio_kbps = ffmpeg->audio_codec == TMS_AUDIO_CODEC_OPUS ? ffmpeg->options.opus_kbps : ALAW_BIT_RATE / 1000;
+  g_atomic_int_set(&ffmpeg->rendition, 0);
+  g_atomic_int_set(&ffmpeg->video_kbps, set->abr.kbps[0]);
 
-  /* 音频重采样 */
-  Resampler resampler = {.max_nb_samples = 0};
-  PCMAEnc pcma_enc = {.nb_samples = 0};
+  return set;
+}
+static void tms_free_rendition_set(TmsRenditionSet *set)
+{
+  int i = 1;
+  for (; i < set->abr.nb_renditions; i++)
+  {
+    tms_wait_input(set->inputs[i]);
+    tms_free_input(set->inputs[i]);
+  }
+  av_packet_free(&set->pkt);
+  JANUS_LOG(LOG_VERB, "多码率播放切换 %d 次\n", set->abr.nb_switches);
+  g_free(set);
+}
+/* 记录已经打开的码率的视频码率，打开失败或者没有视频的码率不能使用 */
+static void tms_rendition_check_opened(TmsRenditionSet *set)
+{
+  int i = 1;
+  for (; i < set->abr.nb_renditions; i++)
+  {
+    TmsPlayInput *input = set->inputs[i];
+    if (set->abr.kbps[i] == 0 && g_atomic_int_get(&input->opened) && input->ret == 0 && input->dovideo)
+      set->abr.kbps[i] = FFMAX(tms_input_video_kbps(input), 1);
+  }
+}
+/* 从非主文件的码率读取下一个视频包 */
+static int tms_rendition_read_video(TmsPlayInput *input, AVPacket *pkt)
+{
+  int ret;
+  while ((ret = av_read_frame(input->ictx, pkt)) == 0)
+  {
+    TmsInputStream *ist = pkt->stream_index < input->nb_ists ? input->ists[pkt->stream_index] : NULL;
+    if (ist && ist->codec->type == AVMEDIA_TYPE_VIDEO)
+      return 0;
+    av_packet_unref(pkt);
+  }
+  return ret;
+}
+/* 将码率定位到显示时间为key_us的关键帧，读取该关键帧，关键帧不对齐时返回-1 */
+static int tms_rendition_seek(TmsPlayInput *input, int64_t key_us, AVPacket *pkt)
+{
+  int i = 0;
+  for (; i < input->nb_ists; i++)
+  {
+    TmsInputStream *ist = input->ists[i];
+    if (ist == NULL || ist->codec->type != AVMEDIA_TYPE_VIDEO)
+      continue;
+    int64_t ts = av_rescale_q(key_us, AV_TIME_BASE_Q, ist->st->time_base) + ist->origin_ts;
+    if (av_seek_frame(input->ictx, i, ts, AVSEEK_FLAG_BACKWARD) < 0)
+      return -1;
+    break;
+  }
+  while (tms_rendition_read_video(input, pkt) == 0)
+  {
+    int64_t pts_us = tms_input_ts_us(input, pkt, pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts);
+    if (pts_us > key_us + TMS_ABR_ALIGN_US)
+      break;
+    if ((pkt->flags & AV_PKT_FLAG_KEY) && pts_us >= key_us - TMS_ABR_ALIGN_US)
+      return 0;
+    av_packet_unref(pkt);
+  }
+  av_packet_unref(pkt);
+  JANUS_LOG(LOG_WARN, "多码率文件 %s 在 %" PRId64 " 微秒没有对齐的关键帧\n", input->filename, key_us);
 
-  /* 初始化播放状态 */
-  TmsPlayContext play;
-  if ((ret = tms_init_play_context(gateway, handle, ffmpeg, &play)) < 0)
+  return -1;
+}
+/**
+ * 将正在发送的码率（非主文件）中解码时间早于until_us的视频包放入调度队列
+ * 
+ * until_us为INT64_MAX时发送到文件结尾
+ */
+static int tms_rendition_pull(TmsPlayContext *play, TmsRenditionSet *set, int64_t until_us, TmsScheduler *sched)
+{
+  int ret = 0;
+  while (set->abr.active > 0)
   {
-    goto clean;
+    TmsPlayInput *input = set->inputs[set->abr.active];
+    if (!set->pending)
+    {
+      if ((ret = tms_rendition_read_video(input, set->pkt)) == AVERROR_EOF)
+        return 0;
+      else if (ret < 0)
+        return -1;
+      set->pending = TRUE;
+    }
+    if (tms_input_dts_us(input, set->pkt) >= until_us)
+      return 0;
+    set->pending = FALSE;
+    ret = tms_handle_video_packet(play, input->ists[set->pkt->stream_index], set->pkt, input->h264bsfc, sched);
+    av_packet_unref(set->pkt);
+    if (ret < 0)
+      return -1;
   }
+  return 0;
+}
+/**
+ * 处理主文件的视频包，返回是否发送这个包
+ * 
+ * 在关键帧上按接收端反馈选择码率，切换到其它码率时定位到同一时间的关键帧并立即放入调度队列
+ */
+static gboolean tms_rendition_use_primary(TmsPlayContext *play, tms_play_ffmpeg *ffmpeg, TmsRenditionSet *set, AVPacket *pkt, TmsScheduler *sched)
+{
+  TmsAbr *abr = &set->abr;
+  if (!(pkt->flags & AV_PKT_FLAG_KEY))
+    return abr->active == 0;
+
+  int64_t now_us = tms_clock_now(play->clock);
+  tms_rendition_check_opened(set);
+  tms_abr_update(abr, &ffmpeg->feedback, set->audio_kbps, now_us);
+  if (abr->target == abr->active)
+    return abr->active == 0;
 
-  if ((ret = tms_open_file(ffmpeg->filename, &ictx, &h264bsfc, &resampler, &pcma_enc, ists, &play)) < 0)
+  int target = abr->target;
+  if (target > 0)
   {
-    goto clean;
+    TmsPlayInput *input = set->inputs[target];
+    int64_t key_us = tms_input_ts_us(set->inputs[0], pkt, pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts);
+    if (set->pending)
+      av_packet_unref(set->pkt);
+    set->pending = FALSE;
+    if (tms_rendition_seek(input, key_us, set->pkt) < 0)
+    {
+      /* 不能切换，继续发送当前码率，之前的码率需要重新定位 */
+      abr->kbps[target] = -1;
+      abr->target = abr->active;
+      if (abr->active > 0 && tms_rendition_seek(set->inputs[abr->active], key_us, set->pkt) == 0)
+        set->pending = TRUE;
+      return abr->active == 0;
+    }
+    set->pending = TRUE;
+  }
+  else if (set->pending)
+  {
+    /* 回到主文件，丢弃之前码率读取的包 */
+    av_packet_unref(set->pkt);
+    set->pending = FALSE;
   }
 
-  /* 初始化音视频流rtp上下文 */
-  TmsAudioRtpContext audio_rtp_ctx;
-  tms_init_audio_rtp_context(&audio_rtp_ctx, ffmpeg->base_timestamp);
-  TmsVideoRtpContext video_rtp_ctx;
-  uint8_t video_buf[1470];
-  tms_init_video_rtp_context(&video_rtp_ctx, video_buf, ffmpeg->base_timestamp);
+  JANUS_LOG(LOG_INFO, "多码率播放在 %" PRId64 " 微秒从码率 #%d（%d kbps）切换到 #%d（%d kbps），估计带宽 %d kbps，丢包率 %d‰\n", tms_input_dts_us(set->inputs[0], pkt), abr->active, abr->kbps[abr->active], target, abr->kbps[target], g_atomic_int_get(&ffmpeg->feedback.remb_kbps), g_atomic_int_get(&ffmpeg->feedback.video_loss));
+  tms_trace(play->trace, TMS_TRACE_RENDITION, target, abr->kbps[target], 0, g_atomic_int_get(&ffmpeg->feedback.remb_kbps));
+  tms_abr_switched(abr, target, now_us);
+  g_atomic_int_set(&ffmpeg->rendition, target);
+  g_atomic_int_set(&ffmpeg->video_kbps, abr->kbps[target]);
+  g_atomic_int_inc(&ffmpeg->nb_rendition_switches);
+  if (target == 0)
+    return TRUE;
 
-  /* 解析文件开始播放 */
-  AVPacket *pkt = av_packet_alloc(); // ffmpeg媒体包
-  AVFrame *frame = av_frame_alloc(); // ffmpeg媒体帧
+  /* 定位到的关键帧立即放入调度队列 */
+  tms_rendition_pull(play, set, tms_input_dts_us(set->inputs[target], set->pkt) + 1, sched);
+
+  return FALSE;
+}
+/* 等待并发送调度队列中发送时间最早的帧 */
+static void tms_play_send_next(TmsPlayContext *play, TmsScheduler *sched, TmsAudioRtpContext *audio_rtp_ctx, TmsVideoRtpContext *video_rtp_ctx)
+{
+  int stream = TMS_SCHED_VIDEO;
+  TmsSchedUnit *unit = tms_sched_pop(sched, &stream);
+  if (unit == NULL)
+    return;
+
+  if (stream == TMS_SCHED_VIDEO)
+    tms_send_video_unit(play, unit, video_rtp_ctx, sched);
+  else
+    tms_send_audio_unit(play, unit, audio_rtp_ctx, sched);
+  tms_sched_free_unit(unit);
+}
+/**
+ * 播放打开的文件，renditions不为NULL时按接收端反馈在多个码率之间切换视频
+ * 
+ * 音视频包处理后放入调度队列，按发送时间交替发送，不受文件中交错顺序的影响
+ * 返回0：播放到文件结尾，1：停止播放，-1：发生错误
+ */
+static int tms_play_input(TmsPlayContext *play, tms_play_ffmpeg *ffmpeg, TmsPlayInput *input, TmsRenditionSet *renditions, AVPacket *pkt, AVFrame *frame, TmsScheduler *sched, TmsAudioRtpContext *audio_rtp_ctx, TmsVideoRtpContext *video_rtp_ctx)
+{
+  int ret = 0;
+  gboolean eof = FALSE; // 文件是否已经读完
 
   while (1)
   {
@@ -159,66 +600,677 @@ int tms_play_main(janus_callbacks *gateway, janus_plugin_session *handle, tms_pl
      */
     if (g_atomic_int_get(&ffmpeg->playing) == 0)
     {
-      play.end_time_us = av_gettime_relative();
-      goto end;
+      tms_sched_clear(sched);
+      play->end_time_us = tms_clock_now(play->clock);
+      return 1;
     }
     /**
      * 判断是否暂停播放
      */
     if (g_atomic_int_get(&ffmpeg->playing) == 2)
     {
-      usleep(100000);                   // 暂停100毫秒
-      play.pause_duration_us += 100000; // 记录累计暂停时间
+      tms_clock_pause(play, 100000); // 暂停100毫秒，记录累计暂停时间
       continue;
     }
+    /**
+     * 发送到期的帧，每个流都有排队的帧时才能确定发送顺序
+     */
+    if (tms_sched_ready(sched, play->dovideo, play->doaudio, eof))
+    {
+      tms_play_send_next(play, sched, audio_rtp_ctx, video_rtp_ctx);
+      continue;
+    }
+    if (eof)
+    {
+      play->end_time_us = tms_clock_now(play->clock);
+      return 0;
+    }
     /**
      * 从文件中读取编码数据包
      */
-    play.nb_packets++;
-    if ((ret = av_read_frame(ictx, pkt)) == AVERROR_EOF)
+    play->nb_packets++;
+    if ((ret = av_read_frame(input->ictx, pkt)) == AVERROR_EOF)
     {
-      play.end_time_us = av_gettime_relative();
-      break;
+      /* 发送其它码率中剩余的视频 */
+      if (renditions && play->dovideo && tms_rendition_pull(play, renditions, INT64_MAX, sched) < 0)
+      {
+        tms_sched_clear(sched);
+        return -1;
+      }
+      eof = TRUE;
+      continue;
     }
     else if (ret < 0)
     {
-      JANUS_LOG(LOG_VERB, "读取媒体包 #%d 失败 %s\n", play.nb_packets, av_err2str(ret));
+      JANUS_LOG(LOG_VERB, "读取媒体包 #%d 失败 %s\n", play->nb_packets, av_err2str(ret));
       av_packet_unref(pkt);
-      goto clean;
+      tms_sched_clear(sched);
+      return -1;
     }
     /**
      * 分别处理音视频包
      */
-    TmsInputStream *ist = ists[pkt->stream_index];
-    if (ist->codec->type == AVMEDIA_TYPE_VIDEO)
+    TmsInputStream *ist = pkt->stream_index < input->nb_ists ? input->ists[pkt->stream_index] : NULL;
+    if (ist && renditions && play->dovideo && pkt->dts != AV_NOPTS_VALUE)
     {
-      if ((ret = tms_handle_video_packet(&play, ist, pkt, h264bsfc, &video_rtp_ctx)) < 0)
+      /* 先处理正在发送的码率中解码时间更早的视频 */
+      if ((ret = tms_rendition_pull(play, renditions, tms_input_dts_us(input, pkt), sched)) < 0)
       {
         av_packet_unref(pkt);
-        goto clean;
+        tms_sched_clear(sched);
+        return -1;
+      }
+    }
+    if (!ist)
+    {
+      /* 没有选择的流，或者打开文件后新出现的流 */
+    }
+    else if (ist->codec->type == AVMEDIA_TYPE_VIDEO && play->dovideo)
+    {
+      if (renditions && !tms_rendition_use_primary(play, ffmpeg, renditions, pkt, sched))
+      {
+        /* 发送其它码率的视频，丢弃主文件的视频 */
+      }
+      else if ((ret = tms_handle_video_packet(play, ist, pkt, input->h264bsfc, sched)) < 0)
+      {
+        av_packet_unref(pkt);
+        tms_sched_clear(sched);
+        return -1;
       }
     }
     else if (ist->codec->type == AVMEDIA_TYPE_AUDIO)
     {
-      if ((ret = tms_handle_audio_packet(&play, ist, &resampler, &pcma_enc, pkt, frame, &audio_rtp_ctx)) < 0)
+      if ((ret = tms_handle_audio_packet(play, ist, &input->resampler, &input->pcma_enc, pkt, frame, sched)) < 0)
       {
         av_packet_unref(pkt);
-        goto clean;
+        tms_sched_clear(sched);
+        return -1;
       }
     }
 
     av_packet_unref(pkt);
   }
+}
+/**
+ * 播放直播，收到转发的包后立即发送，不按媒体时间控制发送速度
+ * 
+ * 从第1个关键帧开始播放，暂停时丢弃收到的包，恢复后从下一个关键帧继续
+ * 返回0：直播结束，1：停止播放，-1：无法打开直播
+ */
+static int tms_play_live(TmsPlayContext *play, tms_play_ffmpeg *ffmpeg, char *url, TmsAudioRtpContext *audio_rtp_ctx, TmsVideoRtpContext *video_rtp_ctx)
+{
+  int ret = 0;
+
+  TmsLiveSubscriber *sub = tms_live_subscribe(url, ffmpeg->audio_codec);
+  if (!sub)
+    return -1;
+  TmsLiveFeed *feed = sub->feed;
+  tms_switch_input(play, feed->nb_streams, feed->doaudio, feed->dovideo, audio_rtp_ctx, video_rtp_ctx);
+
+  gboolean nopacing = play->nopacing;
+  play->nopacing = TRUE;
+  int64_t origin_us = AV_NOPTS_VALUE; // 开始观看时直播的媒体时间
+  while (1)
+  {
+    /**
+     * 判断是否停止播放
+     */
+    if (g_atomic_int_get(&ffmpeg->playing) == 0)
+    {
+      ret = 1;
+      break;
+    }
+    AVPacket *pkt = g_async_queue_timeout_pop(sub->queue, 100000);
+    if (pkt == NULL)
+      continue;
+    if (pkt == &tms_live_eof)
+    {
+      ret = 0;
+      break;
+    }
+    /**
+     * 暂停时丢弃，直播不能从暂停的位置继续
+     */
+    if (g_atomic_int_get(&ffmpeg->playing) == 2)
+    {
+      g_atomic_int_set(&sub->need_keyframe, 1);
+    }
+    else if (pkt->stream_index == TMS_LIVE_VIDEO && play->dovideo)
+    {
+      if (!(pkt->flags & AV_PKT_FLAG_KEY) && g_atomic_int_get(&sub->need_keyframe))
+      {
+        /* 等待关键帧 */
+      }
+      else
+      {
+        g_atomic_int_set(&sub->need_keyframe, 0);
+        if (origin_us == AV_NOPTS_VALUE)
+          origin_us = pkt->pts;
+        int64_t media_us = pkt->pts - origin_us;
+        play->nb_video_packets++;
+        tms_schedule_video_frame(video_rtp_ctx, media_us, media_us, AV_TIME_BASE_Q, play);
+        tms_rtp_send_h264(video_rtp_ctx, pkt->data, pkt->size, pkt->duration, play);
+        play->input_end_us = FFMAX(play->input_end_us, media_us + pkt->duration);
+      }
+    }
+    else if (pkt->stream_index == TMS_LIVE_AUDIO && (!play->dovideo || origin_us != AV_NOPTS_VALUE))
+    {
+      /* 有视频时，和视频从同一个时间点开始 */
+      int64_t media_us = pkt->pts - (origin_us != AV_NOPTS_VALUE ? origin_us : (origin_us = pkt->pts));
+      play->nb_audio_frames++;
+      uint32_t timestamp = tms_clock_rtp_timestamp(play, audio_rtp_ctx->base_timestamp, audio_rtp_ctx->clock_rate, media_us, AV_TIME_BASE_Q);
+      tms_rtp_send_audio_frame(pkt->data, pkt->size, timestamp, play, audio_rtp_ctx);
+      play->input_end_us = FFMAX(play->input_end_us, media_us + pkt->duration);
+    }
+    av_packet_free(&pkt);
+  }
+  play->nopacing = nopacing;
+  play->end_time_us = tms_clock_now(play->clock);
+  tms_live_unsubscribe(sub);
+
+  return ret;
+}
+/* 拥塞时丢弃缓存片段中从offset开始的视频帧，由帧中第1个图像数据的负载决定是否可以丢弃，返回TRUE：已丢弃 */
+static gboolean tms_drop_clip_frame(TmsVideoRtpContext *video_rtp_ctx, TmsClip *clip, size_t offset, TmsPlayContext *play)
+{
+  TmsFrameDropper *dropper = &video_rtp_ctx->dropper;
+  gboolean congested = tms_frame_dropper_congested(dropper, play);
+  if (!congested && !dropper->skip_to_anchor)
+    return FALSE;
+
+  int kind = -1, size = 0;
+  while (offset < clip->size)
+  {
+    TmsClipPacket *packet = (TmsClipPacket *)(clip->data + offset);
+    if (!packet->video)
+      break;
+    if (kind < 0)
+      kind = tms_h264_payload_kind((const uint8_t *)(packet + 1), packet->size);
+    size += packet->size;
+    if (packet->marker)
+      break;
+    offset += TMS_CLIP_PACKET_SIZE(packet->size);
+  }
+  if (kind < 0 || !tms_frame_dropper_should_drop(dropper, kind, congested))
+    return FALSE;
+
+  tms_frame_dropper_drop(dropper, size, play);
+
+  return TRUE;
+}
+/**
+ * 播放缓存的片段，不需要读取文件和转码
+ * 
+ * 片段中的包已经是按发送时间调度后的顺序，直接发送，只通过sched记录音视频发送偏差
+ * 返回0：播放到片段结尾，1：停止播放
+ */
+static int tms_play_clip(TmsPlayContext *play, tms_play_ffmpeg *ffmpeg, TmsClip *clip, TmsScheduler *sched, TmsAudioRtpContext *audio_rtp_ctx, TmsVideoRtpContext *video_rtp_ctx)
+{
+  size_t offset = 0;
+  gboolean drop_frame = FALSE; // 正在丢弃的视频帧
+  while (offset < clip->size)
+  {
+    /**
+     * 判断是否停止播放
+     */
+    if (g_atomic_int_get(&ffmpeg->playing) == 0)
+    {
+      play->end_time_us = tms_clock_now(play->clock);
+      return 1;
+    }
+    /**
+     * 判断是否暂停播放
+     */
+    if (g_atomic_int_get(&ffmpeg->playing) == 2)
+    {
+      tms_clock_pause(play, 100000); // 暂停100毫秒，记录累计暂停时间
+      continue;
+    }
+
+    TmsClipPacket *packet = (TmsClipPacket *)(clip->data + offset);
+    const uint8_t *payload = (const uint8_t *)(packet + 1);
+    if (packet->video && !play->dovideo)
+    {
+      /* 只播放音频 */
+    }
+    else if (packet->video)
+    {
+      if (packet->first)
+      {
+        play->nb_video_packets++;
+        tms_sched_sent(sched, TMS_SCHED_VIDEO, tms_schedule_video_frame(video_rtp_ctx, packet->pts_us, packet->rtp_us, AV_TIME_BASE_Q, play));
+        drop_frame = tms_drop_clip_frame(video_rtp_ctx, clip, offset, play);
+        if (!drop_frame)
+          tms_video_pacer_begin_frame(&video_rtp_ctx->pacer, packet->duration_us);
+      }
+      if (!drop_frame)
+      {
+        tms_rtp_send_video_frame(video_rtp_ctx, payload, packet->size, packet->marker, play);
+        if (packet->marker)
+          tms_video_pacer_end_frame(&video_rtp_ctx->pacer, play->trace);
+      }
+    }
+    else
+    {
+      play->nb_audio_frames++;
+      tms_sched_sent(sched, TMS_SCHED_AUDIO, tms_add_audio_frame_send_delay(packet->pts_us, packet->duration_us, play));
+      uint32_t timestamp = tms_clock_rtp_timestamp(play, audio_rtp_ctx->base_timestamp, audio_rtp_ctx->clock_rate, packet->rtp_us, AV_TIME_BASE_Q);
+      tms_rtp_send_audio_frame(payload, packet->size, timestamp, play, audio_rtp_ctx);
+    }
+    offset += TMS_CLIP_PACKET_SIZE(packet->size);
+  }
+  play->input_end_us = clip->end_us;
+  play->end_time_us = tms_clock_now(play->clock);
+
+  return 0;
+}
+
+/**
+ * 媒体文件基本信息缓存
+ * 
+ * 探测文件需要打开文件并解析媒体流，结果按文件路径缓存，文件变化后失效
+ */
+typedef struct TmsProbeEntry
+{
+  tms_play_probe_info info;
+  int64_t mtime;     // 文件的修改时间
+  int64_t file_size; // 文件的字节数
+} TmsProbeEntry;
+
+static GHashTable *probe_cache = NULL; // 文件路径到TmsProbeEntry
+static janus_mutex probe_cache_mutex;
+
+/* 获得文件的基本信息，返回0：成功，-1：无法打开文件，-2：无法获取媒体流信息 */
+int tms_play_probe(const char *filename, tms_play_probe_info *info)
+{
+  int ret;
+  struct stat st;
+  if (tms_live_is_url(filename))
+  {
+    /* 直播没有时长，每次都需要打开 */
+    return tms_live_probe(filename, &info->nb_streams, &info->duration);
+  }
+  else if (tms_remote_is_url(filename))
+  {
+    /* 远程文件按大小判断是否变化 */
+    memset(&st, 0, sizeof(st));
+    if ((st.st_size = tms_remote_file_size(filename)) < 0)
+      return -1;
+  }
+  else if (stat(filename, &st) < 0)
+  {
+    return -1;
+  }
+
+  janus_mutex_lock(&probe_cache_mutex);
+  TmsProbeEntry *entry = probe_cache ? g_hash_table_lookup(probe_cache, filename) : NULL;
+  if (entry && entry->mtime == st.st_mtime && entry->file_size == st.st_size)
+  {
+    *info = entry->info;
+    janus_mutex_unlock(&probe_cache_mutex);
+    return 0;
+  }
+  janus_mutex_unlock(&probe_cache_mutex);
+
+  AVFormatContext *ictx = NULL;
+  TmsRemoteFile *remote = NULL;
+  TmsIoReader *io = NULL;
+  /* 打开指定的媒体文件 */
+  if ((ret = tms_open_input_file(&ictx, filename, NULL, &remote, &io)) < 0)
+  {
+    JANUS_LOG(LOG_VERB, "[TmsPlay] 无法打开媒体文件 %s\n", filename);
+    return -1;
+  }
+  /* 获得指定的视频文件的信息 */
+  if ((ret = avformat_find_stream_info(ictx, NULL)) < 0)
+  {
+    JANUS_LOG(LOG_VERB, "[TmsPlay] 无法获取文件媒体流信息 %s\n", filename);
+    tms_close_input_file(&ictx, &remote, &io);
+    return -2;
+  }
+  info->nb_streams = ictx->nb_streams;
+  info->duration = ictx->duration;
+  tms_close_input_file(&ictx, &remote, &io);
+
+  janus_mutex_lock(&probe_cache_mutex);
+  if (probe_cache)
+  {
+    entry = g_malloc0(sizeof(TmsProbeEntry));
+    entry->info = *info;
+    entry->mtime = st.st_mtime;
+    entry->file_size = st.st_size;
+    g_hash_table_insert(probe_cache, g_strdup(filename), entry);
+  }
+  janus_mutex_unlock(&probe_cache_mutex);
+
+  return 0;
+}
+/* 删除文件的基本信息缓存，下次探测时重新打开文件 */
+void tms_play_probe_forget(const char *filename)
+{
+  janus_mutex_lock(&probe_cache_mutex);
+  if (probe_cache)
+    g_hash_table_remove(probe_cache, filename);
+  janus_mutex_unlock(&probe_cache_mutex);
+}
+/* 将文件读入系统页缓存 */
+static void tms_prewarm_pages(const char *filename)
+{
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return;
+
+  posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+  char *buf = g_malloc(TMS_PLAY_PREWARM_READ_SIZE);
+  while (read(fd, buf, TMS_PLAY_PREWARM_READ_SIZE) > 0)
+    ;
+  g_free(buf);
+  close(fd);
+}
+/* 预热时不发送任何包 */
+static void tms_prewarm_relay_rtp(janus_plugin_session *handle, janus_plugin_rtp *packet)
+{
+}
+static void tms_prewarm_relay_rtcp(janus_plugin_session *handle, janus_plugin_rtcp *packet)
+{
+}
+static janus_callbacks prewarm_gateway = {.relay_rtp = tms_prewarm_relay_rtp, .relay_rtcp = tms_prewarm_relay_rtcp};
+/* 插件默认的音频输出编码，预热时按这种编码填充片段缓存 */
+static int default_audio_codec = TMS_AUDIO_CODEC_PCMA;
+/* 以不发送、不控制速度的方式处理1遍文件，将结果放入片段缓存 */
+static int tms_prewarm_clip(const char *filename)
+{
+  int ret = 0;
+
+  TmsClip *clip = tms_clip_cache_get(filename, default_audio_codec);
+  if (clip)
+  {
+    janus_refcount_decrease(&clip->ref);
+    return 0;
+  }
+  if ((clip = tms_clip_new(filename, default_audio_codec)) == NULL)
+    return 0;
+
+  tms_play_ffmpeg ffmpeg;
+  memset(&ffmpeg, 0, sizeof(tms_play_ffmpeg));
+  ffmpeg.playing = 1;
+  TmsClock clock;
+  tms_init_clock(&clock, FALSE);
+  TmsPlayContext play;
+  tms_init_play_context(&prewarm_gateway, NULL, &ffmpeg, &clock, &play);
+  play.nopacing = TRUE;
+
+  TmsPlayInput *input = tms_new_input((char *)filename, TMS_PLAY_TRACK_AUTO, TMS_PLAY_TRACK_AUTO, default_audio_codec);
+  AVPacket *pkt = av_packet_alloc();
+  AVFrame *frame = av_frame_alloc();
+  if ((ret = tms_open_file(input)) == 0)
+  {
+    TmsAudioRtpContext audio_rtp_ctx;
+    tms_init_audio_rtp_context(&audio_rtp_ctx, 0, default_audio_codec);
+    TmsVideoRtpContext video_rtp_ctx;
+    uint8_t video_buf[1470];
+    tms_init_video_rtp_context(&video_rtp_ctx, video_buf, 0);
+    tms_init_video_pacer(&video_rtp_ctx.pacer, &clock, 0, 0);
+
+    tms_switch_input(&play, input->nb_streams, input->doaudio, input->dovideo, &audio_rtp_ctx, &video_rtp_ctx);
+    clip->nb_streams = input->nb_streams;
+    clip->doaudio = input->doaudio;
+    clip->dovideo = input->dovideo;
+    play.clip = clip;
+    TmsScheduler sched;
+    tms_init_scheduler(&sched, NULL);
+    ret = tms_play_input(&play, &ffmpeg, input, NULL, pkt, frame, &sched, &audio_rtp_ctx, &video_rtp_ctx);
+  }
+  if (ret == 0)
+    tms_clip_cache_put(clip);
+  else
+    janus_refcount_decrease(&clip->ref);
+
+  av_frame_free(&frame);
+  av_packet_free(&pkt);
+  tms_free_input(input);
+
+  return ret;
+}
+/**
+ * 预热文件，在流量到来前完成文件读取、探测和转码
+ * 
+ * 读入系统页缓存，填充基本信息缓存和片段缓存
+ */
+int tms_play_prewarm(const char *filename)
+{
+  int64_t begin_us = av_gettime_relative();
+
+  /* 直播不需要预热 */
+  if (tms_live_is_url(filename))
+    return 0;
+
+  tms_prewarm_pages(filename);
+
+  tms_play_probe_info info;
+  if (tms_play_probe(filename, &info) < 0)
+    return -1;
+
+  int ret = tms_prewarm_clip(filename);
+
+  JANUS_LOG(LOG_VERB, "[TmsPlay] 完成文件预热 %s，用时：%ld微秒\n", filename, av_gettime_relative() - begin_us);
+
+  return ret;
+}
+
+/* 初始化播放模块 */
+int tms_play_init(tms_play_options *options)
+{
+  tms_clip_cache_init(options->clip_cache_mb, options->clip_cache_max_kb);
+  tms_remote_cache_init(options->remote_cache_dir, options->remote_cache_mb, options->remote_block_kb, options->remote_readahead_s);
+  tms_io_init(options->io_threads, options->io_block_kb, options->io_readahead_ms);
+  tms_live_init(options->live_probesize, options->live_analyze_ms);
+  tms_opus_init(options->opus_kbps, options->opus_complexity, options->opus_frame_ms);
+  default_audio_codec = options->audio_codec;
+
+  probe_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  janus_mutex_init(&probe_cache_mutex);
+
+  GError *error = NULL;
+  prefetch_pool = g_thread_pool_new(tms_prefetch_input, NULL, TMS_PLAY_PREFETCH_THREADS, FALSE, &error);
+  if (error != NULL)
+  {
+    JANUS_LOG(LOG_ERR, "[TmsPlay] 创建预先打开文件的线程池发生错误：%d (%s)\n", error->code, error->message ? error->message : "??");
+    g_error_free(error);
+    prefetch_pool = NULL;
+    return -1;
+  }
+
+  return 0;
+}
+/* 释放播放模块资源 */
+void tms_play_destroy(void)
+{
+  if (prefetch_pool != NULL)
+  {
+    g_thread_pool_free(prefetch_pool, FALSE, TRUE);
+    prefetch_pool = NULL;
+  }
+  tms_clip_cache_destroy();
+  tms_remote_cache_destroy();
+  tms_io_destroy();
+  tms_live_destroy();
+
+  janus_mutex_lock(&probe_cache_mutex);
+  g_hash_table_destroy(probe_cache);
+  probe_cache = NULL;
+  janus_mutex_unlock(&probe_cache_mutex);
+}
+/*************************************
+ * 执行入口 
+ *************************************/
+int tms_play_main(janus_callbacks *gateway, janus_plugin_session *handle, tms_play_ffmpeg *ffmpeg)
+{
+  int ret = 0;
+
+  TmsPlayInput *input = NULL; // 正在播放的文件
+  TmsPlayInput *next = NULL;  // 预先打开的下一个文件
+  TmsClip *clip = NULL;       // 正在播放的缓存片段
+  int index = 0;              // 正在播放的文件在播放列表中的位置
+  int nb_inputs = 0;          // 已经播放的文件数
+  int nb_loop_rtps = 0;       // 循环播放开始时已发送的rtp包数量
+  AVPacket *pkt = NULL;       // ffmpeg媒体包
+  AVFrame *frame = NULL;      // ffmpeg媒体帧
+
+  /* 初始化播放状态，虚拟时钟不等待 */
+  TmsClock clock;
+  tms_init_clock(&clock, ffmpeg->virtual_clock);
+  TmsPlayContext play;
+  if ((ret = tms_init_play_context(gateway, handle, ffmpeg, &clock, &play)) < 0)
+  {
+    goto clean;
+  }
+  /* 记录发送的rtp包 */
+  if (ffmpeg->capture_file)
+    play.capture = tms_capture_open(ffmpeg->capture_file);
+
+  /* 初始化音视频流rtp上下文 */
+  TmsAudioRtpContext audio_rtp_ctx;
+  tms_init_audio_rtp_context(&audio_rtp_ctx, ffmpeg->base_timestamp, ffmpeg->audio_codec);
+  TmsVideoRtpContext video_rtp_ctx;
+  uint8_t video_buf[1470];
+  tms_init_video_rtp_context(&video_rtp_ctx, video_buf, ffmpeg->base_timestamp);
+  tms_init_video_pacer(&video_rtp_ctx.pacer, &clock, ffmpeg->options.pacing_peak_kbps, ffmpeg->options.pacing_spread);
+  tms_init_frame_dropper(&video_rtp_ctx.dropper, ffmpeg);
+  /* 音视频按发送时间统一调度 */
+  TmsScheduler sched;
+  tms_init_scheduler(&sched, ffmpeg);
+
+  /* 解析文件开始播放 */
+  pkt = av_packet_alloc();
+  frame = av_frame_alloc();
+
+  while (index >= 0)
+  {
+    char *filename = ffmpeg->playlist[index];
+    if (tms_live_is_url(filename))
+    {
+      /* 观看直播，和其它观看者共用读取线程 */
+      JANUS_LOG(LOG_VERB, "播放直播 %s\n", filename);
+      if (!next)
+        next = tms_prefetch_next(ffmpeg, index);
+      ret = tms_play_live(&play, ffmpeg, filename, &audio_rtp_ctx, &video_rtp_ctx);
+    }
+    else if (tms_use_clip_cache(ffmpeg) && (clip = tms_clip_cache_get(filename, ffmpeg->audio_codec)) != NULL)
+    {
+      /* 播放缓存的片段 */
+      JANUS_LOG(LOG_VERB, "播放缓存的片段 %s\n", filename);
+      if (next && next->filename == filename)
+      {
+        tms_wait_input(next);
+        tms_free_input(next);
+        next = NULL;
+      }
+      tms_switch_input(&play, clip->nb_streams, clip->doaudio, clip->dovideo, &audio_rtp_ctx, &video_rtp_ctx);
+      if (!next)
+        next = tms_prefetch_next(ffmpeg, index);
+      if (ffmpeg->opened)
+        ffmpeg->opened[index] = TRUE;
+      ret = tms_play_clip(&play, ffmpeg, clip, &sched, &audio_rtp_ctx, &video_rtp_ctx);
+      janus_refcount_decrease(&clip->ref);
+      clip = NULL;
+    }
+    else
+    {
+      /* 使用预先打开的文件 */
+      if (next && next->filename == filename)
+      {
+        input = next;
+        next = NULL;
+        ret = tms_wait_input(input);
+      }
+      else
+      {
+        input = tms_new_play_input(ffmpeg, filename);
+        ret = tms_open_file(input);
+      }
+      if (ret < 0)
+      {
+        goto end;
+      }
+      if (ffmpeg->opened)
+        ffmpeg->opened[index] = TRUE;
+      tms_switch_input(&play, input->nb_streams, input->doaudio, input->dovideo, &audio_rtp_ctx, &video_rtp_ctx);
+      /* 播放当前文件时，预先打开下一个文件 */
+      if (!next)
+        next = tms_prefetch_next(ffmpeg, index);
+      /* 第1次播放时记录处理结果，完整播放后放入缓存，只播放音频或者指定了媒体流时不缓存 */
+      if (!play.audio_only && tms_use_clip_cache(ffmpeg) && (play.clip = tms_clip_new(filename, ffmpeg->audio_codec)) != NULL)
+      {
+        play.clip->nb_streams = input->nb_streams;
+        play.clip->doaudio = input->doaudio;
+        play.clip->dovideo = input->dovideo;
+      }
+      /* 第1个文件有其它码率时，按接收端反馈切换 */
+      TmsRenditionSet *renditions = NULL;
+      if (index == 0 && ffmpeg->renditions && input->dovideo && play.dovideo)
+        renditions = tms_new_rendition_set(ffmpeg, input);
+      ret = tms_play_input(&play, ffmpeg, input, renditions, pkt, frame, &sched, &audio_rtp_ctx, &video_rtp_ctx);
+      if (renditions)
+        tms_free_rendition_set(renditions);
+      if (play.clip)
+      {
+        if (ret == 0)
+          tms_clip_cache_put(play.clip);
+        else
+          janus_refcount_decrease(&play.clip->ref);
+        play.clip = NULL;
+      }
+      tms_free_input(input);
+      input = NULL;
+    }
+    nb_inputs++;
+    if (ret < 0 || ret == 1)
+      goto end;
+
+    /* 继续播放列表中的下一个文件 */
+    int next_index = tms_next_playlist_index(ffmpeg, index);
+    if (next_index == 0)
+    {
+      /* 循环播放，如果一轮没有发送任何包，停止播放 */
+      if (play.nb_video_rtps + play.nb_audio_rtps == nb_loop_rtps)
+        break;
+      nb_loop_rtps = play.nb_video_rtps + play.nb_audio_rtps;
+    }
+    if (next_index >= 0)
+      JANUS_LOG(LOG_VERB, "完成播放列表中第 %d 个文件 %s，切换到 %s\n", nb_inputs, filename, ffmpeg->playlist[next_index]);
+    index = next_index;
+  }
 
 end:
+  /* 播放列表中间的文件出错时也从这里退出，累计已经发送的包数，记录首帧时间，清除拥塞状态 */
   ffmpeg->nb_video_rtps += play.nb_video_rtps;
   ffmpeg->nb_audio_rtps += play.nb_audio_rtps;
+  if (play.first_frame_us > 0 && play.request_time_us > 0)
+    ffmpeg->ttff_us = play.first_frame_us - play.request_time_us;
+  if (video_rtp_ctx.pacer.nb_frames > 0)
+  {
+    TmsVideoPacer *pacer = &video_rtp_ctx.pacer;
+    JANUS_LOG(LOG_INFO, "完成文件播放 %s，视频帧突发包数，平滑前：平均 %.1f 最大 %d，平滑后：平均 %.1f 最大 %d\n", ffmpeg->playlist[0], (double)pacer->sum_burst_before / pacer->nb_frames, pacer->max_burst_before, (double)pacer->sum_burst_after / pacer->nb_frames, pacer->max_burst_after);
+  }
+  if (play.nb_dropped_frames > 0)
+    JANUS_LOG(LOG_INFO, "完成文件播放 %s，拥塞时丢弃 %d 个视频帧，会话累计丢弃 %d 个\n", ffmpeg->playlist[0], play.nb_dropped_frames, g_atomic_int_get(&ffmpeg->nb_dropped_frames));
+  g_atomic_int_set(&ffmpeg->congested, 0);
+  if (sched.nb_skews > 0)
+    JANUS_LOG(LOG_INFO, "完成文件播放 %s，音视频发送偏差：平均 %" PRId64 " 微秒，最大 %" PRId64 " 微秒\n", ffmpeg->playlist[0], sched.sum_skew_us / sched.nb_skews, sched.max_skew_us);
   /* Log end */
-  JANUS_LOG(LOG_VERB, "完成文件播放 %s，共读取 %d 个包，包含：%d 个视频包，%d 个音频包，%d 个音频帧，转换 %d 个PCMA音频帧，开始时间：%ld，结束时间：%ld，用时：%ld微秒，本次发送 %d 个RTP视频包，累计发送 %d 个视频RTP包，本次发送 %d 个RTP音频包，累计发送 %d 个音频RTP包\n", ffmpeg->filename, play.nb_packets, play.nb_video_packets, play.nb_audio_packets, play.nb_audio_frames, play.nb_pcma_frames, play.start_time_us, play.end_time_us, play.end_time_us - play.start_time_us, play.nb_video_rtps, ffmpeg->nb_video_rtps, play.nb_audio_rtps, ffmpeg->nb_audio_rtps);
+  JANUS_LOG(LOG_VERB, "完成文件播放 %s，共播放 %d 个文件，读取 %d 个包，包含：%d 个视频包，%d 个音频包，%d 个音频帧，转码 %d 个音频帧，开始时间：%ld，结束时间：%ld，用时：%ld微秒，本次发送 %d 个RTP视频包，累计发送 %d 个视频RTP包，本次发送 %d 个RTP音频包，累计发送 %d 个音频RTP包\n", ffmpeg->playlist[0], nb_inputs, play.nb_packets, play.nb_video_packets, play.nb_audio_packets, play.nb_audio_frames, play.nb_pcma_frames, play.start_time_us, play.end_time_us, play.end_time_us - play.start_time_us, play.nb_video_rtps, ffmpeg->nb_video_rtps, play.nb_audio_rtps, ffmpeg->nb_audio_rtps);
 
 clean:
-  if (play.nb_streams > 0)
-    tms_free_input_streams(ists, play.nb_streams);
+  if (next)
+  {
+    /* 预先打开的文件可能还在线程池中处理 */
+    tms_wait_input(next);
+    tms_free_input(next);
+  }
+
+  if (input)
+    tms_free_input(input);
 
   if (frame)
     av_frame_free(&frame);
@@ -226,18 +1278,380 @@ clean:
   if (pkt)
     av_packet_free(&pkt);
 
-  if (play.dovideo)
-    if (h264bsfc)
-      av_bsf_free(&h264bsfc);
+  if (play.capture)
+    tms_capture_close(play.capture);
+
+  JANUS_LOG(LOG_VERB, "[TmsPlay] 退出播放线程\n");
+
+  return 0;
+}
+/**
+ * 用虚拟时钟播放文件nb_runs次，不发送rtp包，测量播放的吞吐量上限
+ * 
+ * 发送时间和rtp时间戳的计算和实时播放相同，只是不等待；按播放线程的CPU时间计算单核每秒可以播放的文件数
+ */
+json_t *tms_play_benchmark(const char *filename, int nb_runs, tms_play_options *options)
+{
+  char *playlist[2] = {(char *)filename, NULL};
+  tms_play_ffmpeg ffmpeg;
+  memset(&ffmpeg, 0, sizeof(tms_play_ffmpeg));
+  ffmpeg.playlist = playlist;
+  ffmpeg.options = *options;
+  ffmpeg.video_track = TMS_PLAY_TRACK_AUTO;
+  ffmpeg.audio_track = TMS_PLAY_TRACK_AUTO;
+  ffmpeg.audio_codec = options->audio_codec;
+  ffmpeg.virtual_clock = TRUE;
+
+  struct timespec cpu_begin, cpu_end;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_begin);
+  int64_t begin_us = av_gettime_relative();
+  int i = 0;
+  for (; i < nb_runs; i++)
+  {
+    g_atomic_int_set(&ffmpeg.playing, 1);
+    tms_play_main(&prewarm_gateway, NULL, &ffmpeg);
+  }
+  int64_t elapse_us = av_gettime_relative() - begin_us;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+  int64_t cpu_us = (int64_t)(cpu_end.tv_sec - cpu_begin.tv_sec) * G_USEC_PER_SEC + (cpu_end.tv_nsec - cpu_begin.tv_nsec) / 1000;
+
+  json_t *result = json_object();
+  json_object_set_new(result, "runs", json_integer(nb_runs));
+  json_object_set_new(result, "elapse_ms", json_real(elapse_us / 1000.0));
+  json_object_set_new(result, "cpu_ms", json_real(cpu_us / 1000.0));
+  json_object_set_new(result, "files_per_sec", json_real(elapse_us > 0 ? (double)nb_runs * AV_TIME_BASE / elapse_us : 0));
+  json_object_set_new(result, "files_per_cpu_sec", json_real(cpu_us > 0 ? (double)nb_runs * AV_TIME_BASE / cpu_us : 0));
+  json_object_set_new(result, "video_rtps", json_integer(ffmpeg.nb_video_rtps));
+  json_object_set_new(result, "audio_rtps", json_integer(ffmpeg.nb_audio_rtps));
+  JANUS_LOG(LOG_INFO, "[TmsPlay] 虚拟时钟播放 %s %d 次，用时：%ld微秒，CPU时间：%ld微秒\n", filename, nb_runs, elapse_us, cpu_us);
+
+  return result;
+}
+/* 重采样压测的输入：采样格式，采样率，声道数 */
+static const struct
+{
+  int sample_fmt;
+  int sample_rate;
+  int channels;
+} tms_resample_bench_inputs[] = {
+    {AV_SAMPLE_FMT_FLTP, 48000, 2},
+    {AV_SAMPLE_FMT_FLTP, 32000, 1},
+    {AV_SAMPLE_FMT_S16, 16000, 1},
+    {AV_SAMPLE_FMT_FLTP, 44100, 2},
+    {AV_SAMPLE_FMT_S16, 8000, 1},
+};
+/* 生成20毫秒1k正弦波的音频帧 */
+static AVFrame *tms_resample_bench_frame(int sample_fmt, int sample_rate, int channels)
+{
+  AVFrame *frame = av_frame_alloc();
+  if (!frame)
+    return NULL;
+
+  frame->format = sample_fmt;
+  frame->sample_rate = sample_rate;
+  frame->channels = channels;
+  frame->channel_layout = av_get_default_channel_layout(channels);
+  frame->nb_samples = sample_rate / 50;
+  if (av_frame_get_buffer(frame, 0) < 0)
+  {
+    av_frame_free(&frame);
+    return NULL;
+  }
+
+  int i = 0, c;
+  for (; i < frame->nb_samples; i++)
+  {
+    float sample = 0.5f * sinf(2 * M_PI * 1000 * i / sample_rate);
+    for (c = 0; c < channels; c++)
+    {
+      if (sample_fmt == AV_SAMPLE_FMT_FLTP)
+        ((float *)frame->extended_data[c])[i] = sample;
+      else
+        ((int16_t *)frame->extended_data[0])[i * channels + c] = (int16_t)(sample * 32767);
+    }
+  }
+
+  return frame;
+}
+/* 用同1帧重采样nb_frames次，force_swr为TRUE时不管输入参数都用libswresample，返回选择的方式和耗时 */
+static int tms_resample_bench_run(PCMAEnc *encoder, AVFrame *frame, int nb_frames, gboolean force_swr, int *mode, int64_t *elapse_us)
+{
+  int ret;
+  Resampler resampler;
+  memset(&resampler, 0, sizeof(Resampler));
+
+  if ((ret = tms_config_resampler(&resampler, frame->format, frame->sample_rate, frame->channels, encoder->cctx)) < 0)
+    goto end;
+  if (force_swr && resampler.mode != TMS_RESAMPLE_SWR)
+  {
+    tms_free_decimator(&resampler.decimator);
+    resampler.mode = TMS_RESAMPLE_SWR;
+    if ((ret = tms_init_swr(&resampler, encoder->cctx)) < 0)
+      goto end;
+  }
+  resampler.data = av_calloc(1, sizeof(*resampler.data));
+  if (!resampler.data)
+  {
+    ret = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  int i = 0;
+  for (; i < nb_frames; i++)
+  {
+    if ((ret = tms_audio_resample(&resampler, frame, encoder)) < 0)
+      goto end;
+  }
+  *mode = resampler.mode;
+  *elapse_us = resampler.elapse_us[resampler.mode];
+
+end:
+  tms_free_audio_resampler(&resampler);
+
+  return ret < 0 ? ret : 0;
+}
+/**
+ * 比较每种常见输入自动选择的重采样方式（抽取或直接复制）和libswresample转换为8k PCMA的耗时
+ * 
+ * 每种输入用20毫秒的正弦波帧重采样nb_frames次，耗时是重采样自身的统计，不包括编码
+ */
+json_t *tms_play_resample_benchmark(int nb_frames)
+{
+  PCMAEnc encoder;
+  memset(&encoder, 0, sizeof(PCMAEnc));
+  if (tms_init_audio_encoder(&encoder, TMS_AUDIO_CODEC_PCMA) < 0)
+    return NULL;
+
+  json_t *result = json_array();
+  int i = 0;
+  for (; i < (int)(sizeof(tms_resample_bench_inputs) / sizeof(tms_resample_bench_inputs[0])); i++)
+  {
+    int sample_fmt = tms_resample_bench_inputs[i].sample_fmt;
+    int sample_rate = tms_resample_bench_inputs[i].sample_rate;
+    int channels = tms_resample_bench_inputs[i].channels;
+    AVFrame *frame = tms_resample_bench_frame(sample_fmt, sample_rate, channels);
+    if (!frame)
+      continue;
 
-  if (play.doaudio)
-    if (resampler.swrctx)
-      swr_free(&resampler.swrctx);
+    int mode = TMS_RESAMPLE_SWR, swr_mode = TMS_RESAMPLE_SWR;
+    int64_t elapse_us = 0, swr_elapse_us = 0;
+    if (tms_resample_bench_run(&encoder, frame, nb_frames, FALSE, &mode, &elapse_us) == 0 && tms_resample_bench_run(&encoder, frame, nb_frames, TRUE, &swr_mode, &swr_elapse_us) == 0)
+    {
+      json_t *item = json_object();
+      json_object_set_new(item, "format", json_string(av_get_sample_fmt_name(sample_fmt)));
+      json_object_set_new(item, "sample_rate", json_integer(sample_rate));
+      json_object_set_new(item, "channels", json_integer(channels));
+      json_object_set_new(item, "mode", json_string(tms_resample_mode_names[mode]));
+      json_object_set_new(item, "us_per_frame", json_real((double)elapse_us / nb_frames));
+      json_object_set_new(item, "swr_us_per_frame", json_real((double)swr_elapse_us / nb_frames));
+      json_object_set_new(item, "speedup", json_real(elapse_us > 0 ? (double)swr_elapse_us / elapse_us : 0));
+      json_array_append_new(result, item);
+      JANUS_LOG(LOG_INFO, "[TmsPlay] 重采样压测 %s %d %d 声道，%s 耗时：%" PRId64 "微秒，swr 耗时：%" PRId64 "微秒，%d 帧\n", av_get_sample_fmt_name(sample_fmt), sample_rate, channels, tms_resample_mode_names[mode], elapse_us, swr_elapse_us, nb_frames);
+    }
+    av_frame_free(&frame);
+  }
+  tms_free_audio_encoder(&encoder);
 
-  if (ictx)
+  return result;
+}
+/* 漂移检查中1路媒体流第1帧和最后1帧的时间戳 */
+typedef struct TmsDriftTrack
+{
+  int nb_frames;
+  int64_t first_ts; // 文件中：相对于文件起点的媒体时间（流的时间基）；发送的：rtp时间戳
+  int64_t last_ts;
+} TmsDriftTrack;
+/* 漂移检查记录发送的rtp包，通过会话的plugin_handle传给relay_rtp */
+typedef struct TmsDriftCollector
+{
+  TmsDriftTrack video;
+  TmsDriftTrack audio;
+  tms_play_ffmpeg *ffmpeg;
+  volatile gint *stopping; // 不为0时停止播放
+} TmsDriftCollector;
+
+static void tms_drift_track_add(TmsDriftTrack *track, int64_t ts)
+{
+  if (track->nb_frames == 0)
+    track->first_ts = ts;
+  track->last_ts = ts;
+  track->nb_frames++;
+}
+static void tms_drift_relay_rtp(janus_plugin_session *handle, janus_plugin_rtp *packet)
+{
+  TmsDriftCollector *collector = (TmsDriftCollector *)handle->plugin_handle;
+  janus_rtp_header *header = (janus_rtp_header *)packet->buffer;
+  tms_drift_track_add(packet->video ? &collector->video : &collector->audio, ntohl(header->timestamp));
+  if (collector->stopping && g_atomic_int_get(collector->stopping))
+    g_atomic_int_set(&collector->ffmpeg->playing, 0);
+}
+static janus_callbacks drift_gateway = {.relay_rtp = tms_drift_relay_rtp, .relay_rtcp = tms_prewarm_relay_rtcp};
+/**
+ * 不经过播放，直接读取文件中视频包和解码后音频帧的时间戳
+ * 
+ * 选择媒体流，文件起点和缺少时间戳时的推算和播放相同，*_tb返回流的时间基
+ */
+static int tms_drift_scan(const char *filename, TmsDriftTrack *video, AVRational *video_tb, TmsDriftTrack *audio, AVRational *audio_tb)
+{
+  AVFormatContext *ictx = NULL;
+  if (avformat_open_input(&ictx, filename, NULL, NULL) < 0)
+    return -1;
+  if (avformat_find_stream_info(ictx, NULL) < 0)
+  {
     avformat_close_input(&ictx);
+    return -1;
+  }
 
-  JANUS_LOG(LOG_VERB, "[TmsPlay] 退出播放线程\n");
+  int video_index = tms_select_stream(ictx, AVMEDIA_TYPE_VIDEO, TMS_PLAY_TRACK_AUTO, -1);
+  int audio_index = tms_select_stream(ictx, AVMEDIA_TYPE_AUDIO, TMS_PLAY_TRACK_AUTO, video_index);
+  TmsInputStream *ist = NULL;
+  if (audio_index >= 0)
+  {
+    ist = malloc(sizeof(TmsInputStream));
+    if (tms_init_input_stream(ictx, audio_index, ist) < 0)
+    {
+      free(ist);
+      ist = NULL;
+      audio_index = -1;
+    }
+  }
+  int64_t video_origin = 0, audio_origin = 0, video_next = AV_NOPTS_VALUE, audio_next = AV_NOPTS_VALUE;
+  if (video_index >= 0)
+  {
+    *video_tb = ictx->streams[video_index]->time_base;
+    if (ictx->start_time != AV_NOPTS_VALUE)
+      video_origin = av_rescale_q(ictx->start_time, AV_TIME_BASE_Q, *video_tb);
+  }
+  if (audio_index >= 0)
+  {
+    *audio_tb = ictx->streams[audio_index]->time_base;
+    if (ictx->start_time != AV_NOPTS_VALUE)
+      audio_origin = av_rescale_q(ictx->start_time, AV_TIME_BASE_Q, *audio_tb);
+  }
+
+  AVPacket *pkt = av_packet_alloc();
+  AVFrame *frame = av_frame_alloc();
+  while (av_read_frame(ictx, pkt) >= 0)
+  {
+    if (pkt->stream_index == video_index)
+    {
+      int64_t dts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+      if (dts == AV_NOPTS_VALUE)
+        dts = video_next != AV_NOPTS_VALUE ? video_next : video_origin;
+      int64_t pts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : dts;
+      AVStream *st = ictx->streams[video_index];
+      int64_t duration = pkt->duration;
+      if (duration <= 0)
+        duration = st->avg_frame_rate.num ? av_rescale_q(1, av_inv_q(st->avg_frame_rate), *video_tb) : av_rescale_q(40000, AV_TIME_BASE_Q, *video_tb);
+      video_next = dts + duration;
+      tms_drift_track_add(video, pts - video_origin);
+    }
+    else if (pkt->stream_index == audio_index && avcodec_send_packet(ist->dec_ctx, pkt) == 0)
+    {
+      while (avcodec_receive_frame(ist->dec_ctx, frame) == 0)
+      {
+        int64_t pts = frame->best_effort_timestamp;
+        if (pts == AV_NOPTS_VALUE)
+          pts = audio_next != AV_NOPTS_VALUE ? audio_next : audio_origin;
+        audio_next = pts + av_rescale_q(frame->nb_samples, (AVRational){1, frame->sample_rate}, *audio_tb);
+        tms_drift_track_add(audio, pts - audio_origin);
+      }
+    }
+    av_packet_unref(pkt);
+  }
+  av_frame_free(&frame);
+  av_packet_free(&pkt);
+  if (ist)
+    tms_free_input_stream(ist);
+  avformat_close_input(&ictx);
 
   return 0;
-}
\ No newline at end of file
+}
+/* 发送的rtp时间戳和文件中时间戳的换算结果之差，rtp时间戳的单位 */
+static json_t *tms_drift_result(TmsDriftTrack *sent, TmsDriftTrack *file, AVRational time_base, int clock_rate, int64_t *drift)
+{
+  /* 基准时间戳按开始播放的时间计算，用第1个包换算出来 */
+  AVRational rtp_tb = {1, clock_rate};
+  uint32_t base = (uint32_t)sent->first_ts - (uint32_t)av_rescale_q(file->first_ts, time_base, rtp_tb);
+  uint32_t expected = base + (uint32_t)av_rescale_q(file->last_ts, time_base, rtp_tb);
+  *drift = (int32_t)((uint32_t)sent->last_ts - expected);
+
+  json_t *result = json_object();
+  json_object_set_new(result, "frames", json_integer(file->nb_frames));
+  json_object_set_new(result, "rtps", json_integer(sent->nb_frames));
+  json_object_set_new(result, "last_pts", json_integer(file->last_ts));
+  json_object_set_new(result, "last_rtp_timestamp", json_integer((uint32_t)sent->last_ts));
+  json_object_set_new(result, "expected_rtp_timestamp", json_integer(expected));
+  json_object_set_new(result, "drift", json_integer(*drift));
+
+  return result;
+}
+/**
+ * 用虚拟时钟完整播放1遍文件，检查长时间播放后rtp时间戳没有累计误差
+ * 
+ * 最后1个视频rtp包和音频rtp包的时间戳必须等于基准时间戳加上对应帧的时间戳用av_rescale_q换算的结果，
+ * 差值为0；虚拟时钟下音视频都准时发送，音视频发送偏差必须为0。
+ * 关闭发包平滑、快速启动和片段缓存，音频输出PCMA，每个音频帧编码为1个rtp包。
+ * stopping不为0时停止播放，结果不通过。
+ */
+json_t *tms_play_drift_check(const char *filename, tms_play_options *options, volatile gint *stopping)
+{
+  TmsDriftTrack file_video, file_audio;
+  memset(&file_video, 0, sizeof(TmsDriftTrack));
+  memset(&file_audio, 0, sizeof(TmsDriftTrack));
+  AVRational video_tb = {1, RTP_H264_TIME_BASE}, audio_tb = {1, RTP_PCMA_TIME_BASE};
+  if (tms_drift_scan(filename, &file_video, &video_tb, &file_audio, &audio_tb) < 0)
+    return NULL;
+
+  char *playlist[2] = {(char *)filename, NULL};
+  tms_play_ffmpeg ffmpeg;
+  memset(&ffmpeg, 0, sizeof(tms_play_ffmpeg));
+  ffmpeg.playlist = playlist;
+  ffmpeg.options = *options;
+  ffmpeg.options.pacing_peak_kbps = 0;
+  ffmpeg.options.fast_start_ms = 0;
+  ffmpeg.options.drop_policy = TMS_DROP_NONE;
+  ffmpeg.video_track = TMS_PLAY_TRACK_AUTO;
+  ffmpeg.audio_track = TMS_PLAY_TRACK_AUTO;
+  ffmpeg.audio_codec = TMS_AUDIO_CODEC_PCMA;
+  ffmpeg.virtual_clock = TRUE;
+  ffmpeg.nocache = TRUE;
+
+  TmsDriftCollector collector;
+  memset(&collector, 0, sizeof(TmsDriftCollector));
+  collector.ffmpeg = &ffmpeg;
+  collector.stopping = stopping;
+  janus_plugin_session handle;
+  memset(&handle, 0, sizeof(janus_plugin_session));
+  handle.plugin_handle = &collector;
+
+  int64_t begin_us = av_gettime_relative();
+  g_atomic_int_set(&ffmpeg.playing, 1);
+  tms_play_main(&drift_gateway, &handle, &ffmpeg);
+  int64_t elapse_us = av_gettime_relative() - begin_us;
+
+  int64_t video_drift = 0, audio_drift = 0;
+  gboolean stopped = stopping && g_atomic_int_get(stopping);
+  gboolean passed = !stopped;
+  json_t *result = json_object();
+  json_object_set_new(result, "file", json_string(filename));
+  json_object_set_new(result, "elapse_ms", json_real(elapse_us / 1000.0));
+  if (file_video.nb_frames > 0)
+  {
+    json_object_set_new(result, "video", tms_drift_result(&collector.video, &file_video, video_tb, RTP_H264_TIME_BASE, &video_drift));
+    passed = passed && collector.video.nb_frames > 0 && video_drift == 0;
+  }
+  if (file_audio.nb_frames > 0)
+  {
+    json_object_set_new(result, "audio", tms_drift_result(&collector.audio, &file_audio, audio_tb, RTP_PCMA_TIME_BASE, &audio_drift));
+    passed = passed && collector.audio.nb_frames == file_audio.nb_frames && audio_drift == 0;
+  }
+  gint max_av_skew_us = g_atomic_int_get(&ffmpeg.max_av_skew_us);
+  passed = passed && max_av_skew_us == 0;
+  json_object_set_new(result, "max_av_skew_us", json_integer(max_av_skew_us));
+  json_object_set_new(result, "stopped", json_boolean(stopped));
+  json_object_set_new(result, "passed", json_boolean(passed));
+  JANUS_LOG(LOG_INFO, "[TmsPlay] 漂移检查 %s，视频 %" PRId64 "，音频 %" PRId64 "，音视频发送偏差 %d 微秒，%s\n", filename, video_drift, audio_drift, max_av_skew_us, passed ? "通过" : "不通过");
+
+  return result;
+}
@@ -5,11 +5,70 @@
 
 #include <rtp.h>
 
+#define TMS_PLAY_TRACK_AUTO -1 // 自动选择媒体流
+#define TMS_PLAY_TRACK_NONE -2 // 不播放这种媒体流
+
+#define TMS_AUDIO_CODEC_PCMA 0 // 音频输出为PCMA，8k
+#define TMS_AUDIO_CODEC_OPUS 1 // 音频输出为Opus，48k
+
+#define TMS_PLAY_MAX_RENDITIONS 4 // 同一内容最多的码率数量，包括主文件
+
+#define TMS_DROP_NONE 0     // 不丢弃视频帧
+#define TMS_DROP_NONREF 1   // 拥塞时丢弃非参考帧（nal_ref_idc为0）
+#define TMS_DROP_NONREF_B 2 // 拥塞时丢弃非参考帧和B帧，丢弃被参考的B帧后丢弃到下一个P帧或IDR
+
+/* 会话的跟踪记录，见tms_play_trace.h */
+typedef struct TmsTraceRing TmsTraceRing;
+/* 会话的抓包文件，见tms_play_capture.h */
+typedef struct TmsCapture TmsCapture;
+/* 播放使用的时钟，见tms_play_clock.h */
+typedef struct TmsClock TmsClock;
+
+/* 插件配置中和播放相关的选项 */
+typedef struct tms_play_options
+{
+  int pacing_peak_kbps; // 视频帧内发包平滑的峰值速率，千比特/秒，0表示不平滑
+  int pacing_spread;    // 1帧的包最多分散在帧间隔的百分之多少内
+  int clip_cache_mb;     // 片段缓存的内存预算，兆字节，0表示不缓存
+  int clip_cache_max_kb; // 单个片段的最大字节数，千字节，超过的文件不缓存
+  int fast_start_ms;     // 快速启动时媒体最多领先实时多少毫秒，0表示不快速启动
+  int fast_start_kbps;   // 快速启动时领先部分的限速，千比特/秒，0表示不限速
+  char *remote_cache_dir;  // 远程文件块缓存的目录，NULL表示不缓存
+  int remote_cache_mb;     // 远程文件块缓存的磁盘预算，兆字节
+  int remote_block_kb;     // 远程文件块的大小，千字节
+  int remote_readahead_s;  // 按码率预读多少秒的远程文件
+  int io_threads;          // 本地文件读取调度每个设备的读取线程数，0表示不调度，由ffmpeg直接读取
+  int io_block_kb;         // 本地文件读取的块大小，千字节
+  int io_readahead_ms;     // 按码率预读多少毫秒的本地文件
+  int live_probesize;      // 打开直播时探测的字节数
+  int live_analyze_ms;     // 打开直播时分析的时长，毫秒
+  int audio_codec;         // 默认的音频输出编码，TMS_AUDIO_CODEC_PCMA或TMS_AUDIO_CODEC_OPUS
+  int opus_kbps;           // opus编码的比特率，千比特/秒
+  int opus_complexity;     // opus编码的复杂度，0-10
+  int opus_frame_ms;       // opus每帧的时长，毫秒，10，20，40或60
+  int drop_policy;         // 拥塞时丢弃视频帧的策略，TMS_DROP_NONE，TMS_DROP_NONREF或TMS_DROP_NONREF_B
+  int drop_loss;           // 视频丢包率（千分比）超过时认为拥塞
+  int drop_lateness_ms;    // 视频帧晚于媒体时间超过多少毫秒时认为拥塞
+} tms_play_options;
+
+/* 接收端的反馈，janus的rtcp回调写入，播放线程读取 */
+typedef struct tms_play_feedback
+{
+  volatile gint remb_kbps;  // 最近1次REMB中的估计带宽，千比特/秒，0表示没有收到
+  volatile gint video_loss; // 视频接收报告中的丢包率，千分比，平滑后的值
+  volatile gint audio_loss; // 音频接收报告中的丢包率，千分比，平滑后的值
+  volatile gint nb_rtcps;   // 收到的rtcp包数
+} tms_play_feedback;
+
 /* 记录单次Webrtc连接播放的过程和状态 */
 typedef struct tms_play_ffmpeg
 {
   /* 播放文件信息 */
-  char *filename; // 要播放的文件
+  char **playlist; // 要播放的文件，按顺序连续播放，以NULL结尾
+  char **renditions; // 和第1个文件内容相同、GOP对齐的其它码率的文件，以NULL结尾，NULL表示只有1个码率
+  char **names;      // 请求中的文件名，和playlist对应，以NULL结尾，用于统计播放次数
+  gboolean *opened;  // 播放列表中的文件是否成功打开过，和playlist对应，由播放线程设置，NULL表示不记录
+  tms_play_options options;
   janus_plugin_session *handle;
   janus_refcount ref;
   janus_mutex mutex;
@@ -17,7 +76,30 @@ typedef struct tms_play_ffmpeg
   int64_t base_timestamp;
   volatile gint webrtcup;  // Webrtc连接是否可用，只有可用时才可以播放，0：不可用，1：可用
   volatile gint playing;   // 播放状态，0：停止，1：播放，2：暂停
+  volatile gint running;   // 播放线程是否在执行，0：已结束，1：执行中
   volatile gint destroyed; // 如果session已不可用，ffmpeg应处于销毁状态
+  gboolean loop;           // 是否循环播放
+  gboolean audio_only;     // 只播放音频，节点过载时降级
+  int video_track;         // 指定的视频流序号，TMS_PLAY_TRACK_AUTO：自动选择，TMS_PLAY_TRACK_NONE：不播放
+  int audio_track;         // 指定的音频流序号，同上
+  int audio_codec;         // 音频输出的编码，协商sdp时确定
+  int64_t request_time_us; // 收到播放请求的时间（单调时钟），微秒
+  int64_t ttff_us;         // 从收到播放请求到第1个关键帧最后1个包发出的时间，微秒，0表示还没有发出
+  TmsTraceRing *trace;     // 会话的跟踪记录，持有1个引用
+  char *capture_file;      // 记录发送的rtp包的pcap文件，NULL表示不抓包
+  gboolean virtual_clock;  // 使用虚拟时钟，不等待，按CPU的最快速度播放
+  gboolean nocache;        // 不使用也不记录片段缓存，压测时每次都读取文件
+  gboolean admitted;       // 占用了准入控制的播放名额，播放线程结束时释放，压测的播放不占用
+  janus_callbacks *gateway; // 发送rtp和事件使用的接口，NULL表示使用janus的接口
+  GThread *thread;          // 播放线程，开始下一次播放前等待结束，释放时没有等待的线程分离
+  tms_play_feedback feedback; // 接收端的反馈
+  volatile gint rendition;    // 正在发送的码率，0为主文件，i为renditions[i-1]
+  volatile gint video_kbps;   // 正在发送的码率的视频码率，千比特/秒
+  volatile gint nb_rendition_switches; // 切换码率的次数
+  volatile gint congested;          // 是否正在因为拥塞丢弃视频帧
+  volatile gint nb_dropped_frames;  // 拥塞时丢弃的视频帧数，会话中多次播放累计
+  volatile gint av_skew_us;         // 最近的音视频发送偏差，视频晚于发送时间的时长减去音频的，微秒
+  volatile gint max_av_skew_us;     // 绝对值最大的音视频发送偏差，微秒，会话中多次播放累计
   /* 保留播放状态 */
   int nb_video_rtps; // 视频rtp包累计发送数量，解决多次播放，生成seq的问题
   int nb_audio_rtps; // 音频rtp包累计发送数量，解决多次播放，生成seq的问题
@@ -30,26 +112,80 @@ typedef struct TmsPlayContext
   int nb_streams;   // 包含的媒体流数量
   gboolean doaudio; // 是否播放音频
   gboolean dovideo; // 是否播放视频
+  gboolean audio_only; // 只播放音频，忽略文件中的视频
   /* 时间 */
+  TmsClock *clock;           // 读取时间和等待使用的时钟
   int64_t start_time_us;     // 播放开始时间，微秒
   int64_t end_time_us;       // 播放结束时间，微秒
   int64_t pause_duration_us; // 暂停状态持续的时间，微秒
+  int64_t input_offset_us;   // 播放列表中之前文件的总时长，当前文件的起点，微秒
+  int64_t input_end_us;      // 当前文件已发送媒体的结束位置（相对于文件起始时间），微秒
+  gboolean nopacing;         // 不按媒体时间控制发送速度，预热时尽快处理
+  struct TmsClip *clip;      // 第1次播放时记录要缓存的片段
+  /* 快速启动 */
+  int64_t fast_start_us;       // 媒体最多领先实时的时长，微秒，0表示不快速启动
+  int64_t fast_start_rate;     // 领先部分的限速，字节/秒，0表示不限速
+  int64_t fast_start_begin_us; // 开始快速启动的时间，微秒
+  /* 首帧时间 */
+  int64_t request_time_us;  // 收到播放请求的时间，微秒
+  int64_t first_frame_us;   // 第1个关键帧最后1个包的发送时间，微秒，0表示还没有发出
+  /* 跟踪 */
+  TmsTraceRing *trace;       // 会话的跟踪记录，NULL表示不记录
+  int64_t video_deadline_us; // 当前视频帧按媒体时间的发送时间，微秒
+  int64_t audio_deadline_us; // 当前音频帧按媒体时间的发送时间，微秒
+  TmsCapture *capture;       // 抓包，NULL表示不抓包
+  /* 拥塞丢帧 */
+  int nb_dropped_frames;     // 本次播放拥塞时丢弃的视频帧数
   /* 计数器 */
   int nb_packets;       // 累计读取的包数量
   int nb_video_packets; // 累计读取的视频包数量
   int nb_audio_packets; // 累计读取的音频包数量
   int nb_audio_frames;  // 累计读取的音频帧数量（mp4文件中的原始编码）
-  int nb_pcma_frames;   // 累计转码的音频帧数量（转换为pcma）
+  int nb_pcma_frames;   // 累计转码的音频帧数量（转换为pcma或opus）
   /* rtp */
   int nb_video_rtps;        // 本次播放累计发送的视频rtp包数量
   int nb_before_video_rtps; // 已经发送的视频rtp包数量，解决seq问题
   int nb_audio_rtps;        // 本次播放累计发送的音频rtp包数量
   int nb_before_audio_rtps; // 已经发送的音频rtp包数量，解决seq问题
+  int64_t nb_video_octets;  // 本次播放累计发送的视频rtp负载字节数
+  int64_t nb_audio_octets;  // 本次播放累计发送的音频rtp负载字节数
   /* janus */
   janus_callbacks *gateway;
   janus_plugin_session *handle;
 } TmsPlayContext;
 
+/* 媒体文件的基本信息 */
+typedef struct tms_play_probe_info
+{
+  int nb_streams;   // 包含的媒体流数量
+  int64_t duration; // 时长，AV_TIME_BASE
+} tms_play_probe_info;
+
+int tms_play_init(tms_play_options *options);
+void tms_play_destroy(void);
+int tms_play_lateness(void);
+gboolean tms_remote_is_url(const char *filename);
+json_t *tms_remote_cache_status(void);
+json_t *tms_io_status(void);
+gboolean tms_live_is_url(const char *filename);
+json_t *tms_live_status(void);
+const char *tms_audio_codec_name(int audio_codec);
+int tms_audio_codec_from_name(const char *name);
+gboolean tms_audio_codec_available(int audio_codec);
+const char *tms_drop_policy_name(int drop_policy);
+int tms_drop_policy_from_name(const char *name);
+void tms_play_feedback_rtcp(tms_play_feedback *feedback, gboolean video, char *buf, int len);
+int tms_play_probe(const char *filename, tms_play_probe_info *info);
+void tms_play_probe_forget(const char *filename);
+int tms_play_prewarm(const char *filename);
+TmsTraceRing *tms_trace_ring_new(void);
+void tms_trace_ring_ref(TmsTraceRing *ring);
+void tms_trace_ring_unref(TmsTraceRing *ring);
+json_t *tms_trace_ring_dump(TmsTraceRing *ring, int max_records);
+json_t *tms_trace_ring_lateness(TmsTraceRing *ring);
 int tms_play_main(janus_callbacks *gateway, janus_plugin_session *handle, tms_play_ffmpeg *ffmpeg);
+json_t *tms_play_benchmark(const char *filename, int nb_runs, tms_play_options *options);
+json_t *tms_play_resample_benchmark(int nb_frames);
+json_t *tms_play_drift_check(const char *filename, tms_play_options *options, volatile gint *stopping);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,114 @@
+#ifndef TMS_PLAY_ABR_H
+#define TMS_PLAY_ABR_H
+
+#include "tms_play.h"
+
+#define TMS_ABR_HEADROOM 85              // 视频最多使用估计带宽的百分比
+#define TMS_ABR_DOWN_LOSS 80             // 视频丢包率（千分比）超过时降低码率
+#define TMS_ABR_UP_LOSS 20               // 视频丢包率（千分比）低于时才允许提高码率
+#define TMS_ABR_UP_HOLD_US 6000000       // 条件持续满足多长时间才提高码率，微秒
+#define TMS_ABR_MIN_INTERVAL_US 2000000  // 两次切换的最小间隔，微秒
+#define TMS_ABR_ALIGN_US 1000            // 不同码率的关键帧时间允许的误差，微秒
+
+/**
+ * 多码率切换
+ *
+ * 同一内容的多个码率（GOP对齐），按接收端反馈（REMB估计带宽，接收报告中的丢包率）选择要发送的码率，
+ * 只在关键帧上切换，rtp的seq和时间戳由同一个发送上下文生成，切换前后保持连续。
+ * 带宽不足或者丢包严重时立即降低码率，条件持续满足一段时间后才逐级提高，避免来回切换。
+ */
+typedef struct TmsAbr
+{
+  int nb_renditions;                    // 码率数量
+  int kbps[TMS_PLAY_MAX_RENDITIONS];    // 每个码率的视频码率，千比特/秒，0表示还不能使用
+  int active;                           // 正在发送的码率
+  int target;                           // 要切换到的码率，和active相同表示不切换
+  int64_t last_switch_us;               // 最近1次切换的时间，微秒
+  int64_t up_since_us;                  // 开始满足提高码率条件的时间，0表示不满足
+  int nb_switches;                      // 切换次数
+} TmsAbr;
+
+/* 初始化，从主文件（序号0）开始发送 */
+static void tms_abr_init(TmsAbr *abr, int nb_renditions)
+{
+  memset(abr, 0, sizeof(TmsAbr));
+  abr->nb_renditions = nb_renditions;
+}
+/* 码率低于index的码率中最高的，没有时返回-1 */
+static int tms_abr_lower(TmsAbr *abr, int index)
+{
+  int i = 0, found = -1;
+  for (; i < abr->nb_renditions; i++)
+  {
+    if (abr->kbps[i] > 0 && abr->kbps[i] < abr->kbps[index] && (found < 0 || abr->kbps[i] > abr->kbps[found]))
+      found = i;
+  }
+  return found;
+}
+/* 码率高于index的码率中最低的，没有时返回-1 */
+static int tms_abr_higher(TmsAbr *abr, int index)
+{
+  int i = 0, found = -1;
+  for (; i < abr->nb_renditions; i++)
+  {
+    if (abr->kbps[i] > abr->kbps[index] && (found < 0 || abr->kbps[i] < abr->kbps[found]))
+      found = i;
+  }
+  return found;
+}
+/**
+ * 按接收端反馈选择要发送的码率，结果记录在target中
+ *
+ * audio_kbps为音频占用的带宽；没有收到REMB时只按丢包率调整
+ */
+static void tms_abr_update(TmsAbr *abr, tms_play_feedback *feedback, int audio_kbps, int64_t now_us)
+{
+  if (abr->nb_renditions < 2 || abr->kbps[abr->active] == 0)
+    return;
+  if (abr->last_switch_us > 0 && now_us - abr->last_switch_us < TMS_ABR_MIN_INTERVAL_US)
+    return;
+
+  int remb_kbps = g_atomic_int_get(&feedback->remb_kbps);
+  int loss = g_atomic_int_get(&feedback->video_loss);
+  int budget_kbps = remb_kbps > 0 ? remb_kbps * TMS_ABR_HEADROOM / 100 - audio_kbps : INT_MAX;
+
+  abr->target = abr->active;
+  if (loss > TMS_ABR_DOWN_LOSS || abr->kbps[abr->active] > budget_kbps)
+  {
+    /* 降低码率，直接降到估计带宽能够承受的码率 */
+    int lower = tms_abr_lower(abr, abr->active);
+    while (lower >= 0)
+    {
+      abr->target = lower;
+      if (abr->kbps[lower] <= budget_kbps)
+        break;
+      lower = tms_abr_lower(abr, lower);
+    }
+    abr->up_since_us = 0;
+    return;
+  }
+
+  int higher = tms_abr_higher(abr, abr->active);
+  if (higher >= 0 && loss < TMS_ABR_UP_LOSS && abr->kbps[higher] <= budget_kbps)
+  {
+    if (abr->up_since_us == 0)
+      abr->up_since_us = now_us;
+    else if (now_us - abr->up_since_us >= TMS_ABR_UP_HOLD_US)
+      abr->target = higher;
+  }
+  else
+  {
+    abr->up_since_us = 0;
+  }
+}
+/* 完成切换 */
+static void tms_abr_switched(TmsAbr *abr, int index, int64_t now_us)
+{
+  abr->active = index;
+  abr->target = index;
+  abr->last_switch_us = now_us;
+  abr->up_since_us = 0;
+  abr->nb_switches++;
+}
+
+#endif
@@ -0,0 +1,251 @@
+#ifndef TMS_PLAY_CACHE_H
+#define TMS_PLAY_CACHE_H
+
+#include <sys/stat.h>
+
+#include "tms_play.h"
+
+/**
+ * 短音视频片段的内存缓存
+ * 
+ * 保存完成处理的视频rtp负载和编码后的音频包（8k PCMA或Opus），再次播放时不需要读取文件、解析和转码。
+ * 第1次播放时填充，缓存总量超过预算时淘汰最久没有使用的片段。同一个文件按音频编码分别缓存。
+ */
+
+/* 片段中的1个负载，负载数据紧跟在后面 */
+typedef struct TmsClipPacket
+{
+  int8_t video;        // 1：视频rtp负载，0：编码后的音频包
+  int8_t first;        // 是否为所属帧的第1个负载
+  int8_t marker;       // 视频rtp包的marker位
+  uint16_t size;       // 负载字节数
+  int64_t pts_us;      // 所属帧的发送时间（相对于文件起始时间），微秒
+  int64_t rtp_us;      // 所属帧的显示时间（相对于文件起始时间），微秒，用于计算rtp时间戳
+  int64_t duration_us; // 所属帧的时长，微秒
+} TmsClipPacket;
+
+#define TMS_CLIP_PACKET_SIZE(size) FFALIGN(sizeof(TmsClipPacket) + (size), 8)
+
+/* 缓存的片段 */
+typedef struct TmsClip
+{
+  char *filename;     // 文件的完整路径
+  char *key;          // 在缓存中的键，音频编码和文件路径
+  int64_t mtime;      // 文件的修改时间，文件变化后缓存失效
+  int64_t file_size;  // 文件的字节数
+  int nb_streams;     // 包含的媒体流数量
+  gboolean doaudio;   // 是否包含音频
+  gboolean dovideo;   // 是否包含视频
+  int64_t end_us;     // 媒体的结束位置，微秒
+  uint8_t *data;      // 按发送顺序排列的负载
+  size_t size;        // 已使用的字节数
+  size_t capacity;    // 分配的字节数
+  int overflow;       // 超过单个片段的大小限制，不再缓存
+  /* 记录中的帧 */
+  int8_t frame_video;
+  int8_t frame_first;
+  int64_t frame_pts_us;
+  int64_t frame_rtp_us;
+  int64_t frame_duration_us;
+  janus_refcount ref;
+} TmsClip;
+
+/* 缓存 */
+static GHashTable *clip_cache = NULL; // 音频编码和文件路径到片段
+static GQueue clip_lru;               // 按使用时间排列的片段，头部是最近使用的
+static size_t clip_cache_size = 0;    // 缓存的片段占用的字节数
+static size_t clip_cache_budget = 0;  // 缓存的预算，字节
+static size_t clip_max_size = 0;      // 单个片段的最大字节数
+static janus_mutex clip_cache_mutex;
+
+int tms_clip_cache_init(int budget_mb, int max_clip_kb);
+void tms_clip_cache_destroy(void);
+TmsClip *tms_clip_cache_get(const char *filename, int audio_codec);
+TmsClip *tms_clip_new(const char *filename, int audio_codec);
+void tms_clip_begin_frame(TmsClip *clip, gboolean video, int64_t pts_us, int64_t rtp_us, int64_t duration_us);
+void tms_clip_add_payload(TmsClip *clip, const uint8_t *buf, int size, int marker);
+void tms_clip_cache_put(TmsClip *clip);
+
+/* 释放片段，通过引用计数调用 */
+static void tms_clip_ref_free(const janus_refcount *clip_ref)
+{
+  TmsClip *clip = janus_refcount_containerof(clip_ref, TmsClip, ref);
+  g_free(clip->filename);
+  g_free(clip->key);
+  g_free(clip->data);
+  g_free(clip);
+}
+/* 获得文件的修改时间和大小 */
+static int tms_clip_stat(const char *filename, int64_t *mtime, int64_t *file_size)
+{
+  struct stat st;
+  if (stat(filename, &st) < 0)
+    return -1;
+  *mtime = st.st_mtime;
+  *file_size = st.st_size;
+  return 0;
+}
+/* 初始化缓存，budget_mb为0时不缓存 */
+int tms_clip_cache_init(int budget_mb, int max_clip_kb)
+{
+  clip_cache_budget = (size_t)budget_mb * 1024 * 1024;
+  clip_max_size = FFMIN((size_t)max_clip_kb * 1024, clip_cache_budget);
+  clip_cache_size = 0;
+  clip_cache = g_hash_table_new(g_str_hash, g_str_equal);
+  g_queue_init(&clip_lru);
+  janus_mutex_init(&clip_cache_mutex);
+
+  return 0;
+}
+/* 释放缓存，正在播放的片段由引用计数释放 */
+void tms_clip_cache_destroy(void)
+{
+  if (clip_cache == NULL)
+    return;
+
+  janus_mutex_lock(&clip_cache_mutex);
+  TmsClip *clip;
+  while ((clip = g_queue_pop_head(&clip_lru)) != NULL)
+    janus_refcount_decrease(&clip->ref);
+  g_hash_table_destroy(clip_cache);
+  clip_cache = NULL;
+  clip_cache_size = 0;
+  janus_mutex_unlock(&clip_cache_mutex);
+}
+/* 从缓存中移除片段，需要先加锁 */
+static void tms_clip_cache_remove(TmsClip *clip)
+{
+  g_hash_table_remove(clip_cache, clip->key);
+  g_queue_remove(&clip_lru, clip);
+  clip_cache_size -= clip->size;
+  janus_refcount_decrease(&clip->ref);
+}
+/* 查找缓存的片段，找到时引用加1，使用后需要减1 */
+TmsClip *tms_clip_cache_get(const char *filename, int audio_codec)
+{
+  if (clip_cache == NULL || clip_cache_budget == 0)
+    return NULL;
+
+  int64_t mtime, file_size;
+  if (tms_clip_stat(filename, &mtime, &file_size) < 0)
+    return NULL;
+
+  char *key = g_strdup_printf("%s:%s", tms_audio_codec_name(audio_codec), filename);
+  janus_mutex_lock(&clip_cache_mutex);
+  TmsClip *clip = g_hash_table_lookup(clip_cache, key);
+  g_free(key);
+  if (clip && (clip->mtime != mtime || clip->file_size != file_size))
+  {
+    /* 文件已经变化 */
+    JANUS_LOG(LOG_VERB, "[TmsPlay] 文件 %s 已经变化，缓存的片段失效\n", filename);
+    tms_clip_cache_remove(clip);
+    clip = NULL;
+  }
+  if (clip)
+  {
+    g_queue_remove(&clip_lru, clip);
+    g_queue_push_head(&clip_lru, clip);
+    janus_refcount_increase(&clip->ref);
+  }
+  janus_mutex_unlock(&clip_cache_mutex);
+
+  return clip;
+}
+/* 创建要记录的片段，不缓存时返回NULL */
+TmsClip *tms_clip_new(const char *filename, int audio_codec)
+{
+  if (clip_cache == NULL || clip_cache_budget == 0)
+    return NULL;
+
+  TmsClip *clip = g_malloc0(sizeof(TmsClip));
+  if (tms_clip_stat(filename, &clip->mtime, &clip->file_size) < 0)
+  {
+    g_free(clip);
+    return NULL;
+  }
+  clip->filename = g_strdup(filename);
+  clip->key = g_strdup_printf("%s:%s", tms_audio_codec_name(audio_codec), filename);
+  janus_refcount_init(&clip->ref, tms_clip_ref_free);
+
+  return clip;
+}
+/* 开始记录1帧，pts_us为发送时间，rtp_us为显示时间 */
+void tms_clip_begin_frame(TmsClip *clip, gboolean video, int64_t pts_us, int64_t rtp_us, int64_t duration_us)
+{
+  clip->frame_video = video;
+  clip->frame_first = 1;
+  clip->frame_pts_us = pts_us;
+  clip->frame_rtp_us = rtp_us;
+  clip->frame_duration_us = duration_us;
+  clip->end_us = FFMAX(clip->end_us, rtp_us + duration_us);
+}
+/* 放弃记录，片段不完整或者太大，不缓存 */
+static void tms_clip_discard(TmsClip *clip)
+{
+  clip->overflow = 1;
+  g_free(clip->data);
+  clip->data = NULL;
+  clip->size = clip->capacity = 0;
+}
+/* 记录帧中的1个负载 */
+void tms_clip_add_payload(TmsClip *clip, const uint8_t *buf, int size, int marker)
+{
+  if (clip->overflow)
+    return;
+
+  size_t packet_size = TMS_CLIP_PACKET_SIZE(size);
+  if (clip->size + packet_size > clip_max_size)
+  {
+    /* 片段太大，放弃记录 */
+    tms_clip_discard(clip);
+    return;
+  }
+  if (clip->size + packet_size > clip->capacity)
+  {
+    clip->capacity = FFMIN(FFMAX(clip->capacity * 2, clip->size + packet_size), clip_max_size);
+    clip->data = g_realloc(clip->data, clip->capacity);
+  }
+
+  TmsClipPacket *packet = (TmsClipPacket *)(clip->data + clip->size);
+  packet->video = clip->frame_video;
+  packet->first = clip->frame_first;
+  packet->marker = marker;
+  packet->size = size;
+  packet->pts_us = clip->frame_pts_us;
+  packet->rtp_us = clip->frame_rtp_us;
+  packet->duration_us = clip->frame_duration_us;
+  memcpy(packet + 1, buf, size);
+
+  clip->size += packet_size;
+  clip->frame_first = 0;
+}
+/* 将完整记录的片段放入缓存，超过预算时淘汰最久没有使用的片段。调用后不能再使用clip。 */
+void tms_clip_cache_put(TmsClip *clip)
+{
+  if (clip->overflow || clip->size == 0 || clip_cache == NULL)
+  {
+    janus_refcount_decrease(&clip->ref);
+    return;
+  }
+  /* 释放多分配的空间 */
+  clip->data = g_realloc(clip->data, clip->size);
+  clip->capacity = clip->size;
+
+  janus_mutex_lock(&clip_cache_mutex);
+  TmsClip *old = g_hash_table_lookup(clip_cache, clip->key);
+  if (old)
+    tms_clip_cache_remove(old);
+  while (clip_cache_size + clip->size > clip_cache_budget && !g_queue_is_empty(&clip_lru))
+  {
+    TmsClip *lru = g_queue_peek_tail(&clip_lru);
+    JANUS_LOG(LOG_VERB, "[TmsPlay] 淘汰缓存的片段 %s，%zu 字节\n", lru->filename, lru->size);
+    tms_clip_cache_remove(lru);
+  }
+  g_hash_table_insert(clip_cache, clip->key, clip);
+  g_queue_push_head(&clip_lru, clip);
+  clip_cache_size += clip->size;
+  JANUS_LOG(LOG_VERB, "[TmsPlay] 缓存片段 %s，%zu 字节，缓存共 %zu 字节\n", clip->key, clip->size, clip_cache_size);
+  janus_mutex_unlock(&clip_cache_mutex);
+}
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef TMS_PLAY_CAPTURE_H
+#define TMS_PLAY_CAPTURE_H
+
+#include <errno.h>
+#include <stdio.h>
+
+#include "tms_play.h"
+#include "tms_play_clock.h"
+
+#define TMS_CAPTURE_LINKTYPE_RAW 101   // pcap链路类型，包直接从IPv4头开始
+#define TMS_CAPTURE_SNAPLEN 65535      // 每个包最多记录的字节数
+#define TMS_CAPTURE_IP_HEADER_SIZE 20  // IPv4头的字节数
+#define TMS_CAPTURE_UDP_HEADER_SIZE 8  // UDP头的字节数
+#define TMS_CAPTURE_SRC_PORT 5000      // 记录的UDP源端口
+#define TMS_CAPTURE_AUDIO_PORT 5002    // 音频rtp包的UDP目的端口
+#define TMS_CAPTURE_VIDEO_PORT 5004    // 视频rtp包的UDP目的端口
+
+/**
+ * 抓包
+ *
+ * 将交给janus发送（relay_rtp）的每个rtp包写入pcap文件，时间为交给janus时的系统时间（微秒）。
+ * 包前面加上IPv4和UDP头，音频和视频使用不同的目的端口，可以用wireshark按rtp解析，查看包数和包间隔。
+ * 只记录发出的包，不检查打包是否符合RFC 6184/3551，也没有和其它打包实现的输出做对比。
+ */
+struct TmsCapture
+{
+  FILE *file;
+  char *path;
+  int64_t nb_packets; // 写入的包数
+  int64_t nb_bytes;   // 写入的rtp字节数
+  uint16_t ip_id;     // IPv4头中的标识，每个包加1
+  /* 包间隔，0：音频，1：视频 */
+  int64_t nb_media_packets[2]; // 每种媒体写入的包数
+  int64_t last_us[2];          // 上一个包的时间，微秒
+  int64_t sum_gap_us[2];       // 包间隔的累计，微秒
+  int64_t max_gap_us[2];       // 最大的包间隔，微秒
+};
+
+TmsCapture *tms_capture_open(const char *path);
+void tms_capture_close(TmsCapture *capture);
+
+/* pcap文件头，字段使用本机字节序，读取时按magic判断 */
+typedef struct TmsPcapHeader
+{
+  uint32_t magic;
+  uint16_t version_major;
+  uint16_t version_minor;
+  int32_t thiszone;
+  uint32_t sigfigs;
+  uint32_t snaplen;
+  uint32_t linktype;
+} TmsPcapHeader;
+/* pcap中每个包的头 */
+typedef struct TmsPcapRecord
+{
+  uint32_t ts_sec;
+  uint32_t ts_usec;
+  uint32_t incl_len;
+  uint32_t orig_len;
+} TmsPcapRecord;
+
+/* 打开要写入的pcap文件，失败时返回NULL */
+TmsCapture *tms_capture_open(const char *path)
+{
+  FILE *file = fopen(path, "wb");
+  if (file == NULL)
+  {
+    JANUS_LOG(LOG_WARN, "[TmsPlay] 无法创建抓包文件 %s：%s\n", path, strerror(errno));
+    return NULL;
+  }
+  TmsPcapHeader header = {.magic = 0xa1b2c3d4, .version_major = 2, .version_minor = 4, .thiszone = 0, .sigfigs = 0, .snaplen = TMS_CAPTURE_SNAPLEN, .linktype = TMS_CAPTURE_LINKTYPE_RAW};
+  if (fwrite(&header, sizeof(header), 1, file) != 1)
+  {
+    JANUS_LOG(LOG_WARN, "[TmsPlay] 无法写入抓包文件 %s\n", path);
+    fclose(file);
+    return NULL;
+  }
+
+  TmsCapture *capture = g_malloc0(sizeof(TmsCapture));
+  capture->file = file;
+  capture->path = g_strdup(path);
+  JANUS_LOG(LOG_VERB, "[TmsPlay] 开始抓包 %s\n", path);
+
+  return capture;
+}
+/* IPv4头的校验和 */
+static uint16_t tms_capture_ip_checksum(const uint8_t *header, int len)
+{
+  uint32_t sum = 0;
+  int i = 0;
+  for (; i < len; i += 2)
+    sum += (header[i] << 8) | header[i + 1];
+  while (sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+
+  return (uint16_t)~sum;
+}
+/* 写入1个rtp包，real_us为发送时的系统时间，微秒 */
+static void tms_capture_write(TmsCapture *capture, gboolean video, const char *buffer, int length, int64_t real_us)
+{
+  uint8_t header[TMS_CAPTURE_IP_HEADER_SIZE + TMS_CAPTURE_UDP_HEADER_SIZE];
+  int total = sizeof(header) + length;
+  int udp_length = TMS_CAPTURE_UDP_HEADER_SIZE + length;
+  uint16_t dst_port = video ? TMS_CAPTURE_VIDEO_PORT : TMS_CAPTURE_AUDIO_PORT;
+
+  /* IPv4头，127.0.0.1到127.0.0.1 */
+  memset(header, 0, sizeof(header));
+  header[0] = 0x45;
+  AV_WB16(header + 2, total);
+  AV_WB16(header + 4, capture->ip_id++);
+  header[8] = 64; // ttl
+  header[9] = 17; // udp
+  AV_WB32(header + 12, 0x7f000001);
+  AV_WB32(header + 16, 0x7f000001);
+  AV_WB16(header + 10, tms_capture_ip_checksum(header, TMS_CAPTURE_IP_HEADER_SIZE));
+  /* UDP头，不计算校验和 */
+  AV_WB16(header + 20, TMS_CAPTURE_SRC_PORT);
+  AV_WB16(header + 22, dst_port);
+  AV_WB16(header + 24, udp_length);
+
+  TmsPcapRecord record = {.ts_sec = (uint32_t)(real_us / G_USEC_PER_SEC), .ts_usec = (uint32_t)(real_us % G_USEC_PER_SEC), .incl_len = total, .orig_len = total};
+  if (fwrite(&record, sizeof(record), 1, capture->file) != 1 || fwrite(header, sizeof(header), 1, capture->file) != 1 || fwrite(buffer, length, 1, capture->file) != 1)
+    return;
+
+  capture->nb_packets++;
+  capture->nb_bytes += length;
+  int media = video ? 1 : 0;
+  if (capture->nb_media_packets[media]++ > 0)
+  {
+    int64_t gap_us = real_us - capture->last_us[media];
+    capture->sum_gap_us[media] += gap_us;
+    capture->max_gap_us[media] = FFMAX(capture->max_gap_us[media], gap_us);
+  }
+  capture->last_us[media] = real_us;
+}
+/* 关闭pcap文件 */
+void tms_capture_close(TmsCapture *capture)
+{
+  fclose(capture->file);
+  JANUS_LOG(LOG_INFO, "[TmsPlay] 完成抓包 %s，共 %" PRId64 " 个rtp包，%" PRId64 " 字节\n", capture->path, capture->nb_packets, capture->nb_bytes);
+  int media = 0;
+  for (; media < 2; media++)
+  {
+    int64_t nb_gaps = capture->nb_media_packets[media] - 1;
+    if (nb_gaps > 0)
+      JANUS_LOG(LOG_INFO, "[TmsPlay] 抓包 %s %s %" PRId64 " 个包，平均间隔 %.3f 毫秒，最大间隔 %.3f 毫秒\n", capture->path, media ? "视频" : "音频", capture->nb_media_packets[media], capture->sum_gap_us[media] / 1000.0 / nb_gaps, capture->max_gap_us[media] / 1000.0);
+  }
+  g_free(capture->path);
+  g_free(capture);
+}
+/* 将rtp包交给janus发送，需要抓包时同时写入pcap文件 */
+static void tms_relay_rtp(TmsPlayContext *play, janus_plugin_rtp *packet)
+{
+  play->gateway->relay_rtp(play->handle, packet);
+  if (play->capture)
+    tms_capture_write(play->capture, packet->video, packet->buffer, packet->length, tms_clock_real(play->clock));
+}
+
+#endif
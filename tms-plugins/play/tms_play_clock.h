@@ -0,0 +1,121 @@
+#ifndef TMS_PLAY_CLOCK_H
+#define TMS_PLAY_CLOCK_H
+
+#include "tms_play.h"
+
+/**
+ * 媒体时钟
+ *
+ * 发送时间和rtp时间戳都由流中的时间戳通过有理数换算（av_rescale_q）得到，每次从绝对值计算，不累加每帧的时长，
+ * 可变帧率和长时间播放不会产生累计误差。
+ * 播放列表中之前文件的时长和暂停的时长作为偏移量（微秒）记录在播放上下文中：
+ *   发送时间 = 开始播放时间 + 偏移量 + 媒体时间
+ *   rtp时间戳 = 基准时间戳 + 偏移量 + 媒体时间
+ * 媒体时间是相对于文件起点的时间戳，可以使用流的时间基，也可以是微秒（AV_TIME_BASE_Q）。
+ *
+ * 播放过程中读取时间和等待都通过TmsClock，可以替换为虚拟时钟：
+ * 虚拟时钟的等待不休眠，只将当前时间推进到等待结束的时间，播放按CPU的最快速度执行，
+ * 发送时间和rtp时间戳的计算和实时播放完全相同，用于测量吞吐量上限和可重复的时间测试。
+ */
+struct TmsClock
+{
+  int64_t (*now_us)(TmsClock *clock);                // 当前时间，单调时钟，微秒
+  void (*sleep_us)(TmsClock *clock, int64_t sleep_us); // 等待sleep_us微秒
+  int64_t (*real_us)(TmsClock *clock);               // 当前时间对应的系统时间，用于抓包，微秒
+  gboolean is_virtual;                               // 是否为虚拟时钟，虚拟时钟不更新发送延迟统计
+  int64_t virtual_us;                                // 虚拟时钟的当前时间，微秒
+  int64_t real_offset_us;                            // 虚拟时钟到系统时间的偏移量，微秒
+};
+
+static int64_t tms_real_clock_now(TmsClock *clock)
+{
+  return av_gettime_relative();
+}
+static void tms_real_clock_sleep(TmsClock *clock, int64_t sleep_us)
+{
+  if (sleep_us > 0)
+    usleep(sleep_us);
+}
+static int64_t tms_real_clock_real(TmsClock *clock)
+{
+  return janus_get_real_time();
+}
+static int64_t tms_virtual_clock_now(TmsClock *clock)
+{
+  return clock->virtual_us;
+}
+static void tms_virtual_clock_sleep(TmsClock *clock, int64_t sleep_us)
+{
+  if (sleep_us > 0)
+    clock->virtual_us += sleep_us;
+}
+static int64_t tms_virtual_clock_real(TmsClock *clock)
+{
+  return clock->virtual_us + clock->real_offset_us;
+}
+/* 初始化时钟，虚拟时钟从当前时间开始 */
+static void tms_init_clock(TmsClock *clock, gboolean is_virtual)
+{
+  memset(clock, 0, sizeof(TmsClock));
+  clock->is_virtual = is_virtual;
+  if (is_virtual)
+  {
+    clock->now_us = tms_virtual_clock_now;
+    clock->sleep_us = tms_virtual_clock_sleep;
+    clock->real_us = tms_virtual_clock_real;
+    clock->virtual_us = av_gettime_relative();
+    clock->real_offset_us = janus_get_real_time() - clock->virtual_us;
+  }
+  else
+  {
+    clock->now_us = tms_real_clock_now;
+    clock->sleep_us = tms_real_clock_sleep;
+    clock->real_us = tms_real_clock_real;
+  }
+}
+static inline int64_t tms_clock_now(TmsClock *clock)
+{
+  return clock->now_us(clock);
+}
+static inline void tms_clock_sleep(TmsClock *clock, int64_t sleep_us)
+{
+  clock->sleep_us(clock, sleep_us);
+}
+static inline int64_t tms_clock_real(TmsClock *clock)
+{
+  return clock->real_us(clock);
+}
+
+/* 媒体时间（微秒）对应的发送时间，单调时钟，微秒 */
+static inline int64_t tms_clock_deadline_us(TmsPlayContext *play, int64_t media_us)
+{
+  return play->start_time_us + play->pause_duration_us + media_us;
+}
+/* 媒体时间对应的rtp时间戳，clock_rate为rtp时钟频率 */
+static inline uint32_t tms_clock_rtp_timestamp(TmsPlayContext *play, uint32_t base_timestamp, int clock_rate, int64_t media_ts, AVRational time_base)
+{
+  int64_t offset = av_rescale(play->input_offset_us + play->pause_duration_us, clock_rate, AV_TIME_BASE);
+  int64_t media = av_rescale_q(media_ts, time_base, (AVRational){1, clock_rate});
+
+  return base_timestamp + (uint32_t)(offset + media);
+}
+/* 全局的时间点到现在经过的时间对应的rtp时间戳，作为基准时间戳 */
+static inline uint32_t tms_clock_base_timestamp(int64_t base_time_us, int clock_rate)
+{
+  return (uint32_t)av_rescale(av_gettime_relative() - base_time_us, clock_rate, AV_TIME_BASE);
+}
+/* 暂停播放sleep_us，按实际经过的时间记录暂停时长 */
+static void tms_clock_pause(TmsPlayContext *play, int64_t sleep_us)
+{
+  int64_t begin_us = tms_clock_now(play->clock);
+  tms_clock_sleep(play->clock, sleep_us);
+  play->pause_duration_us += tms_clock_now(play->clock) - begin_us;
+}
+/* 切换到下一个文件，下一个文件的起点接在上一个文件的结束位置（微秒）上 */
+static void tms_clock_next_input(TmsPlayContext *play, int64_t input_end_us)
+{
+  play->start_time_us += input_end_us;
+  play->input_offset_us += input_end_us;
+}
+
+#endif
@@ -0,0 +1,228 @@
+#ifndef TMS_PLAY_DECIMATE_H
+#define TMS_PLAY_DECIMATE_H
+
+#include <math.h>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "tms_play.h"
+
+#define TMS_DECIMATE_TAPS_PER_FACTOR 16 // 每个抽取倍数的滤波器阶数，48k->8k为97阶
+#define TMS_DECIMATE_CUTOFF_RATIO 0.45  // 抗混叠低通滤波器的截止频率相对于输出采样率的比例，低于奈奎斯特频率（8k输出为3.6k）
+#define TMS_DECIMATE_MAX_FACTOR 12      // 支持的最大抽取倍数，96k->8k
+
+/**
+ * 整数倍抽取
+ *
+ * 输入采样率是输出采样率的整数倍时（48k，32k，16k->8k），先混合为单声道，经过加窗sinc低通滤波器后每factor个采样取1个。
+ * 只计算保留的输出采样，滤波是连续内存上的点积，用SIMD计算。
+ * 缓冲区中保留滤波器长度减1个历史采样，帧之间的滤波是连续的。
+ */
+typedef struct TmsDecimator
+{
+  int factor;      // 抽取倍数
+  int nb_taps;     // 滤波器阶数
+  float *taps;     // 滤波器系数
+  float *buf;      // 历史采样和当前帧的单声道采样
+  int buf_size;    // 缓冲区能容纳的采样数
+  int nb_buffered; // 缓冲区中的采样数
+} TmsDecimator;
+
+/* 是否支持帧的采样格式 */
+static int tms_decimator_supports_format(int format)
+{
+  return format == AV_SAMPLE_FMT_FLTP || format == AV_SAMPLE_FMT_FLT || format == AV_SAMPLE_FMT_S16P || format == AV_SAMPLE_FMT_S16;
+}
+/* 初始化抽取，计算布莱克曼窗sinc低通滤波器的系数 */
+static int tms_init_decimator(TmsDecimator *decimator, int in_sample_rate, int out_sample_rate)
+{
+  memset(decimator, 0, sizeof(TmsDecimator));
+  if (out_sample_rate <= 0 || in_sample_rate % out_sample_rate != 0)
+    return -1;
+  int factor = in_sample_rate / out_sample_rate;
+  if (factor < 2 || factor > TMS_DECIMATE_MAX_FACTOR)
+    return -1;
+
+  int nb_taps = TMS_DECIMATE_TAPS_PER_FACTOR * factor + 1;
+  decimator->taps = av_malloc_array(nb_taps, sizeof(float));
+  if (!decimator->taps)
+    return AVERROR(ENOMEM);
+
+  double fc = TMS_DECIMATE_CUTOFF_RATIO * out_sample_rate / in_sample_rate; // 归一化截止频率，按输出采样率计算，PCMA和Opus都适用
+  double sum = 0;
+  int i = 0;
+  for (; i < nb_taps; i++)
+  {
+    double n = i - (nb_taps - 1) / 2.0;
+    double sinc = n == 0 ? 2 * fc : sin(2 * M_PI * fc * n) / (M_PI * n);
+    double window = 0.42 - 0.5 * cos(2 * M_PI * i / (nb_taps - 1)) + 0.08 * cos(4 * M_PI * i / (nb_taps - 1));
+    decimator->taps[i] = (float)(sinc * window);
+    sum += decimator->taps[i];
+  }
+  /* 直流增益为1 */
+  for (i = 0; i < nb_taps; i++)
+    decimator->taps[i] /= sum;
+
+  decimator->factor = factor;
+  decimator->nb_taps = nb_taps;
+  /* 用0填充历史采样，输出和输入对齐 */
+  decimator->nb_buffered = nb_taps - 1;
+  decimator->buf_size = nb_taps - 1;
+  decimator->buf = av_mallocz(decimator->buf_size * sizeof(float));
+  if (!decimator->buf)
+    return AVERROR(ENOMEM);
+
+  return 0;
+}
+static void tms_free_decimator(TmsDecimator *decimator)
+{
+  av_freep(&decimator->taps);
+  av_freep(&decimator->buf);
+  decimator->nb_buffered = 0;
+  decimator->buf_size = 0;
+}
+/**
+ * 滤波器输出1个采样
+ *
+ * 浮点加法不满足结合律，不加-ffast-math时编译器不会向量化只有1个累加变量的循环。
+ * 用2组4路SIMD累加（x86为SSE，ARM为NEON），没有SIMD时用4个标量累加变量，不足1组的系数单独累加。
+ */
+static inline float tms_decimate_dot(const float *restrict taps, const float *restrict samples, int nb_taps)
+{
+  float sum;
+  int i = 0;
+#if defined(__SSE__)
+  __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+  for (; i + 8 <= nb_taps; i += 8)
+  {
+    acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(taps + i), _mm_loadu_ps(samples + i)));
+    acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(taps + i + 4), _mm_loadu_ps(samples + i + 4)));
+  }
+  float lanes[4];
+  _mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+  sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(__ARM_NEON)
+  float32x4_t acc0 = vdupq_n_f32(0), acc1 = vdupq_n_f32(0);
+  for (; i + 8 <= nb_taps; i += 8)
+  {
+    acc0 = vmlaq_f32(acc0, vld1q_f32(taps + i), vld1q_f32(samples + i));
+    acc1 = vmlaq_f32(acc1, vld1q_f32(taps + i + 4), vld1q_f32(samples + i + 4));
+  }
+  float32x4_t acc = vaddq_f32(acc0, acc1);
+  sum = (vgetq_lane_f32(acc, 0) + vgetq_lane_f32(acc, 1)) + (vgetq_lane_f32(acc, 2) + vgetq_lane_f32(acc, 3));
+#else
+  float sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+  for (; i + 4 <= nb_taps; i += 4)
+  {
+    sum0 += taps[i] * samples[i];
+    sum1 += taps[i + 1] * samples[i + 1];
+    sum2 += taps[i + 2] * samples[i + 2];
+    sum3 += taps[i + 3] * samples[i + 3];
+  }
+  sum = (sum0 + sum1) + (sum2 + sum3);
+#endif
+  for (; i < nb_taps; i++)
+    sum += taps[i] * samples[i];
+  return sum;
+}
+/* 将帧的采样混合为单声道，追加到缓冲区 */
+static int tms_decimator_append(TmsDecimator *decimator, AVFrame *frame)
+{
+  int nb_samples = frame->nb_samples;
+  int channels = frame->channels > 0 ? frame->channels : 1;
+  if (decimator->nb_buffered + nb_samples > decimator->buf_size)
+  {
+    int buf_size = decimator->nb_buffered + nb_samples;
+    float *buf = av_realloc_array(decimator->buf, buf_size, sizeof(float));
+    if (!buf)
+      return AVERROR(ENOMEM);
+    decimator->buf = buf;
+    decimator->buf_size = buf_size;
+  }
+
+  float *dst = decimator->buf + decimator->nb_buffered;
+  float scale = 1.0f / channels;
+  int i, c;
+  switch (frame->format)
+  {
+  case AV_SAMPLE_FMT_FLTP:
+    memcpy(dst, frame->extended_data[0], nb_samples * sizeof(float));
+    for (c = 1; c < channels; c++)
+    {
+      const float *src = (const float *)frame->extended_data[c];
+      for (i = 0; i < nb_samples; i++)
+        dst[i] += src[i];
+    }
+    if (channels > 1)
+      for (i = 0; i < nb_samples; i++)
+        dst[i] *= scale;
+    break;
+  case AV_SAMPLE_FMT_FLT:
+  {
+    const float *src = (const float *)frame->data[0];
+    for (i = 0; i < nb_samples; i++)
+    {
+      float sum = 0;
+      for (c = 0; c < channels; c++)
+        sum += src[i * channels + c];
+      dst[i] = sum * scale;
+    }
+    break;
+  }
+  case AV_SAMPLE_FMT_S16P:
+    scale /= 32768.0f;
+    for (i = 0; i < nb_samples; i++)
+      dst[i] = 0;
+    for (c = 0; c < channels; c++)
+    {
+      const int16_t *src = (const int16_t *)frame->extended_data[c];
+      for (i = 0; i < nb_samples; i++)
+        dst[i] += src[i];
+    }
+    for (i = 0; i < nb_samples; i++)
+      dst[i] *= scale;
+    break;
+  case AV_SAMPLE_FMT_S16:
+  {
+    const int16_t *src = (const int16_t *)frame->data[0];
+    scale /= 32768.0f;
+    for (i = 0; i < nb_samples; i++)
+    {
+      int sum = 0;
+      for (c = 0; c < channels; c++)
+        sum += src[i * channels + c];
+      dst[i] = sum * scale;
+    }
+    break;
+  }
+  default:
+    return AVERROR(EINVAL);
+  }
+  decimator->nb_buffered += nb_samples;
+
+  return 0;
+}
+/* 抽取1帧，输出s16单声道采样，返回输出的采样数 */
+static int tms_decimate(TmsDecimator *decimator, AVFrame *frame, int16_t *out, int max_out)
+{
+  int ret;
+  if ((ret = tms_decimator_append(decimator, frame)) < 0)
+    return ret;
+
+  int nb_out = 0, pos = 0;
+  for (; pos + decimator->nb_taps <= decimator->nb_buffered && nb_out < max_out; pos += decimator->factor)
+  {
+    float sample = tms_decimate_dot(decimator->taps, decimator->buf + pos, decimator->nb_taps) * 32768.0f;
+    out[nb_out++] = (int16_t)av_clip_int16(lrintf(sample));
+  }
+  /* 保留没有使用的采样 */
+  decimator->nb_buffered -= pos;
+  memmove(decimator->buf, decimator->buf + pos, decimator->nb_buffered * sizeof(float));
+
+  return nb_out;
+}
+
+#endif
@@ -0,0 +1,246 @@
+#ifndef TMS_PLAY_DROP_H
+#define TMS_PLAY_DROP_H
+
+#include "tms_play.h"
+#include "tms_play_cache.h"
+#include "tms_play_clock.h"
+#include "tms_play_trace.h"
+
+#define TMS_DROP_RATE_WINDOW_US 1000000 // 统计发送速率的窗口，微秒
+#define TMS_DROP_HOLD_US 1000000        // 拥塞信号消失后继续丢帧的时长，微秒
+
+#define TMS_DROP_REASON_REMB 1     // 发送速率超过接收端估计的带宽
+#define TMS_DROP_REASON_LOSS 2     // 视频丢包率超过限制
+#define TMS_DROP_REASON_LATENESS 4 // 视频帧晚于媒体时间超过限制，janus发送跟不上
+
+/* 图像数据的类型，决定是否可以丢弃 */
+#define TMS_H264_SLICE_ANCHOR 0 // IDR，I帧和P帧等参考帧，必须发送
+#define TMS_H264_SLICE_NONREF 1 // 不被参考的帧（nal_ref_idc为0）
+#define TMS_H264_SLICE_REF_B 2  // 被参考的B帧（B帧金字塔的中间层）
+
+/**
+ * 拥塞时丢弃视频帧
+ *
+ * 接收端估计的带宽低于发送速率，丢包率过高，或者发送跟不上媒体时间时，认为观看者拥塞，
+ * 丢弃不被其它帧参考的帧（nal_ref_idc为0），按策略也可以丢弃B帧，不需要转码就可以降低发送量。
+ * IDR和参考帧（I帧，P帧）始终发送，丢弃的帧后面的帧仍然可以正确解码；rtp的seq由发送的包数生成，保持连续。
+ * nonref_b丢弃被参考的B帧后，参考它的帧也无法解码，因此一直丢弃到下一个P帧或IDR，即使拥塞已经结束；
+ * 假定P帧不参考B帧（常见编码器的B帧金字塔都是这样），否则到下一个IDR之前可能花屏。
+ * 拥塞信号消失后继续丢帧一段时间，避免在拥塞边缘反复切换。
+ */
+typedef struct TmsFrameDropper
+{
+  int policy;                 // 丢帧策略，TMS_DROP_NONE表示不丢帧
+  int max_loss;               // 视频丢包率（千分比）超过时认为拥塞，0表示不检查
+  int64_t max_lateness_us;    // 视频帧晚于媒体时间超过时认为拥塞，微秒，0表示不检查
+  tms_play_ffmpeg *ffmpeg;    // 读取接收端反馈，记录会话的丢帧数
+  int64_t window_start_us;    // 发送速率窗口的开始时间，微秒
+  int64_t window_octets;      // 发送速率窗口开始时已发送的字节数
+  int send_kbps;              // 最近1个窗口的发送速率，千比特/秒
+  int64_t congested_until_us; // 拥塞状态持续到的时间，微秒
+  int reasons;                // 最近1次检查到的拥塞原因，TMS_DROP_REASON_*的组合
+  gboolean congested;         // 是否正在丢帧
+  gboolean skip_to_anchor;    // 丢弃了被参考的B帧，下一个P帧或IDR之前的帧都要丢弃
+} TmsFrameDropper;
+
+/* 丢帧策略的名称 */
+const char *tms_drop_policy_name(int drop_policy)
+{
+  if (drop_policy == TMS_DROP_NONREF)
+    return "nonref";
+  if (drop_policy == TMS_DROP_NONREF_B)
+    return "nonref_b";
+
+  return "none";
+}
+/* 按名称获得丢帧策略，不支持的名称返回-1 */
+int tms_drop_policy_from_name(const char *name)
+{
+  if (name == NULL || !g_ascii_strcasecmp(name, "none"))
+    return TMS_DROP_NONE;
+  if (!g_ascii_strcasecmp(name, "nonref"))
+    return TMS_DROP_NONREF;
+  if (!g_ascii_strcasecmp(name, "nonref_b"))
+    return TMS_DROP_NONREF_B;
+
+  return -1;
+}
+/* 按播放的设置初始化，ffmpeg为NULL时不丢帧 */
+static void tms_init_frame_dropper(TmsFrameDropper *dropper, tms_play_ffmpeg *ffmpeg)
+{
+  memset(dropper, 0, sizeof(TmsFrameDropper));
+  if (ffmpeg == NULL)
+    return;
+
+  dropper->policy = ffmpeg->options.drop_policy;
+  dropper->max_loss = ffmpeg->options.drop_loss;
+  dropper->max_lateness_us = (int64_t)ffmpeg->options.drop_lateness_ms * 1000;
+  dropper->ffmpeg = ffmpeg;
+}
+/* 读取无符号指数哥伦布码，bit为读取位置，超出范围时返回-1 */
+static int tms_h264_read_ue(const uint8_t *buf, int len, int *bit)
+{
+  int zeros = 0;
+  while (*bit < len * 8 && !((buf[*bit >> 3] >> (7 - (*bit & 7))) & 1))
+  {
+    if (++zeros > 31)
+      return -1;
+    (*bit)++;
+  }
+  if (*bit >= len * 8)
+    return -1;
+  (*bit)++;
+
+  uint32_t value = 0;
+  int i = 0;
+  for (; i < zeros; i++, (*bit)++)
+  {
+    if (*bit >= len * 8)
+      return -1;
+    value = (value << 1) | ((buf[*bit >> 3] >> (7 - (*bit & 7))) & 1);
+  }
+
+  return (int)((1u << zeros) - 1 + value);
+}
+/**
+ * nal的图像数据类型，header为nal头，data为之后的slice数据
+ *
+ * 返回-1：不是图像数据（SPS，PPS，SEI等），否则为TMS_H264_SLICE_*
+ * 只读取slice头开始的2个字段，不处理防竞争字节（0x000003），不会出现在这么靠前的位置
+ */
+static int tms_h264_slice_kind(uint8_t header, const uint8_t *data, int len)
+{
+  int nal_unit_type = header & 0x1f;
+  if (nal_unit_type < 1 || nal_unit_type > 5)
+    return -1;
+  if (nal_unit_type == 5)
+    return TMS_H264_SLICE_ANCHOR;
+  if (((header >> 5) & 0x03) == 0)
+    return TMS_H264_SLICE_NONREF;
+  if (nal_unit_type == 1 || nal_unit_type == 2)
+  {
+    int bit = 0;
+    if (tms_h264_read_ue(data, len, &bit) >= 0 && tms_h264_read_ue(data, len, &bit) % 5 == 1)
+      return TMS_H264_SLICE_REF_B; // slice_type为1或6是B帧
+  }
+
+  return TMS_H264_SLICE_ANCHOR;
+}
+/* rtp负载的图像数据类型，支持单个nal，STAP-A和FU-A，返回值同上 */
+static int tms_h264_payload_kind(const uint8_t *buf, int len)
+{
+  if (len < 2)
+    return -1;
+
+  int nal_unit_type = buf[0] & 0x1f;
+  if (nal_unit_type == 28)
+  {
+    /* 只有第1个分片包含slice头 */
+    if (!(buf[1] & 0x80))
+      return -1;
+    return tms_h264_slice_kind((buf[0] & 0xe0) | (buf[1] & 0x1f), buf + 2, len - 2);
+  }
+  if (nal_unit_type == 24)
+  {
+    const uint8_t *p = buf + 1, *end = buf + len;
+    while (p + 2 < end)
+    {
+      int size = FFMIN(AV_RB16(p), end - p - 2);
+      int kind = size > 0 ? tms_h264_slice_kind(p[2], p + 3, size - 1) : -1;
+      if (kind >= 0)
+        return kind;
+      p += 2 + size;
+    }
+    return -1;
+  }
+
+  return tms_h264_slice_kind(buf[0], buf + 1, len - 1);
+}
+/**
+ * 在每个视频帧发送前检查是否拥塞
+ *
+ * 发送速率按窗口统计音视频负载的字节数；不按媒体时间控制速度时（直播，预热）不检查发送延迟
+ */
+static gboolean tms_frame_dropper_congested(TmsFrameDropper *dropper, TmsPlayContext *play)
+{
+  if (dropper->policy == TMS_DROP_NONE)
+    return FALSE;
+
+  int64_t now_us = tms_clock_now(play->clock);
+  int64_t nb_octets = play->nb_video_octets + play->nb_audio_octets;
+  if (dropper->window_start_us == 0)
+  {
+    dropper->window_start_us = now_us;
+    dropper->window_octets = nb_octets;
+  }
+  else if (now_us - dropper->window_start_us >= TMS_DROP_RATE_WINDOW_US)
+  {
+    dropper->send_kbps = (int)((nb_octets - dropper->window_octets) * 8000 / (now_us - dropper->window_start_us));
+    dropper->window_start_us = now_us;
+    dropper->window_octets = nb_octets;
+  }
+
+  int reasons = 0;
+  int remb_kbps = g_atomic_int_get(&dropper->ffmpeg->feedback.remb_kbps);
+  if (remb_kbps > 0 && dropper->send_kbps > remb_kbps)
+    reasons |= TMS_DROP_REASON_REMB;
+  if (dropper->max_loss > 0 && g_atomic_int_get(&dropper->ffmpeg->feedback.video_loss) > dropper->max_loss)
+    reasons |= TMS_DROP_REASON_LOSS;
+  if (!play->nopacing && dropper->max_lateness_us > 0 && play->video_deadline_us > 0 && now_us - play->video_deadline_us > dropper->max_lateness_us)
+    reasons |= TMS_DROP_REASON_LATENESS;
+
+  if (reasons)
+  {
+    dropper->reasons = reasons;
+    dropper->congested_until_us = now_us + TMS_DROP_HOLD_US;
+  }
+  gboolean congested = now_us < dropper->congested_until_us;
+  if (congested != dropper->congested)
+  {
+    dropper->congested = congested;
+    g_atomic_int_set(&dropper->ffmpeg->congested, congested ? 1 : 0);
+    if (congested)
+      JANUS_LOG(LOG_VERB, "[TmsPlay] 开始拥塞丢帧，原因 %d，发送 %d kbps，估计带宽 %d kbps\n", dropper->reasons, dropper->send_kbps, remb_kbps);
+    else
+      JANUS_LOG(LOG_VERB, "[TmsPlay] 结束拥塞丢帧，本次播放已丢弃 %d 帧\n", play->nb_dropped_frames);
+  }
+
+  return congested;
+}
+/**
+ * 按丢帧策略决定是否丢弃帧，kind为帧中第1个图像数据的类型，congested为是否拥塞
+ *
+ * 丢弃被参考的B帧后不论是否拥塞，都丢弃到下一个P帧或IDR
+ */
+static gboolean tms_frame_dropper_should_drop(TmsFrameDropper *dropper, int kind, gboolean congested)
+{
+  if (kind == TMS_H264_SLICE_ANCHOR)
+  {
+    dropper->skip_to_anchor = FALSE;
+    return FALSE;
+  }
+  if (dropper->skip_to_anchor)
+    return TRUE;
+  if (!congested)
+    return FALSE;
+  if (kind == TMS_H264_SLICE_REF_B)
+  {
+    if (dropper->policy != TMS_DROP_NONREF_B)
+      return FALSE;
+    dropper->skip_to_anchor = TRUE;
+  }
+
+  return TRUE;
+}
+/* 记录丢弃的帧，size为帧的字节数 */
+static void tms_frame_dropper_drop(TmsFrameDropper *dropper, int size, TmsPlayContext *play)
+{
+  play->nb_dropped_frames++;
+  g_atomic_int_inc(&dropper->ffmpeg->nb_dropped_frames);
+  /* 要缓存的片段缺少了帧，不能再缓存 */
+  if (play->clip && !play->clip->overflow)
+    tms_clip_discard(play->clip);
+  tms_trace(play->trace, TMS_TRACE_VIDEO_DROP, dropper->reasons, size, tms_clock_now(play->clock) - play->video_deadline_us, dropper->send_kbps);
+}
+
+#endif
@@ -2,7 +2,17 @@
 #define TMS_PLAY_H264_H
 
 #include "tms_play.h"
+#include "tms_play_cache.h"
+#include "tms_play_capture.h"
+#include "tms_play_clock.h"
+#include "tms_play_drop.h"
+#include "tms_play_pacer.h"
+#include "tms_play_rtcp.h"
+#include "tms_play_sched.h"
 #include "tms_play_stream.h"
+#include "tms_play_trace.h"
+
+#define RTP_H264_TIME_BASE 90000 // RTP中h264流的时间
 
 /**/
 typedef struct TmsVideoRtpContext
@@ -18,10 +28,17 @@ typedef struct TmsVideoRtpContext
   // int nal_length_size;
   int buffered_nals;
   int flags;
+  int64_t last_rtp_us; // 最近1个rtp包的发送时间，微秒
+  /* 帧内发包平滑 */
+  TmsVideoPacer pacer;
+  /* 拥塞丢帧 */
+  TmsFrameDropper dropper;
+  /* 首帧时间 */
+  int frame_idr; // 当前帧是否包含IDR
 } TmsVideoRtpContext;
 
 int tms_init_video_rtp_context(TmsVideoRtpContext *rtp_ctx, uint8_t *video_buf, uint32_t base_timestamp);
-int tms_handle_video_packet(TmsPlayContext *play, TmsInputStream *ist, AVPacket *pkt, AVBSFContext *h264bsfc, TmsVideoRtpContext *rtp_ctx);
+int tms_handle_video_packet(TmsPlayContext *play, TmsInputStream *ist, AVPacket *pkt, AVBSFContext *h264bsfc, TmsScheduler *sched);
 
 /* 初始化视频rtp发送上下文 */
 int tms_init_video_rtp_context(TmsVideoRtpContext *rtp_ctx, uint8_t *video_buf, uint32_t base_timestamp)
@@ -30,24 +47,68 @@ int tms_init_video_rtp_context(TmsVideoRtpContext *rtp_ctx, uint8_t *video_buf,
   rtp_ctx->max_payload_size = 1400;
   rtp_ctx->buffered_nals = 0;
   rtp_ctx->flags = 0;
+  rtp_ctx->last_rtp_us = 0;
+  rtp_ctx->frame_idr = 0;
+  tms_init_frame_dropper(&rtp_ctx->dropper, NULL);
 
   rtp_ctx->cur_timestamp = 0;
   // rtp_ctx->base_timestamp = base_timestamp;
   /**
    * base_timestamp是个全局的时间点，rtp对应的是一个文件的播放，需要把文件的起点和全局的起点对齐 
    */
-  rtp_ctx->base_timestamp = (av_gettime_relative() - base_timestamp) / 1000 * 90; // h264/90000
+  rtp_ctx->base_timestamp = tms_clock_base_timestamp(base_timestamp, RTP_H264_TIME_BASE);
 
   rtp_ctx->payload_type = H264_PAYLOAD_TYPE;
 
   return 0;
 }
+/* rtp负载中是否包含IDR，支持单个nal，STAP-A和FU-A */
+static int tms_h264_payload_has_idr(const uint8_t *buf, int len)
+{
+  if (len < 1)
+    return 0;
+
+  int nal_unit_type = buf[0] & 0x1f;
+  if (nal_unit_type == 5)
+    return 1;
+  if (nal_unit_type == 28)
+    return len > 1 && (buf[1] & 0x1f) == 5;
+  if (nal_unit_type == 24)
+  {
+    const uint8_t *p = buf + 1, *end = buf + len;
+    while (p + 2 < end)
+    {
+      int size = AV_RB16(p);
+      if ((p[2] & 0x1f) == 5)
+        return 1;
+      p += 2 + size;
+    }
+  }
+
+  return 0;
+}
+/* 第1个关键帧的最后1个包发出后，记录首帧时间 */
+static void tms_video_first_frame(TmsVideoRtpContext *rtp_ctx, const uint8_t *buf, int len, int m, TmsPlayContext *play)
+{
+  if (play->first_frame_us > 0)
+    return;
+
+  if (tms_h264_payload_has_idr(buf, len))
+    rtp_ctx->frame_idr = 1;
+  if (m)
+  {
+    if (rtp_ctx->frame_idr)
+    {
+      play->first_frame_us = rtp_ctx->last_rtp_us;
+      if (play->request_time_us > 0)
+        JANUS_LOG(LOG_INFO, "首帧时间 %" PRId64 " 毫秒，第1个关键帧在第 %d 个视频rtp包发出\n", (play->first_frame_us - play->request_time_us) / 1000, play->nb_video_rtps);
+    }
+    rtp_ctx->frame_idr = 0;
+  }
+}
 /* 发送1帧RTP */
 static void tms_rtp_send_video_frame(TmsVideoRtpContext *rtp_ctx, const uint8_t *buf1, int len, int m, TmsPlayContext *play)
 {
-  janus_callbacks *gateway = play->gateway;
-  janus_plugin_session *handle = play->handle;
-
   rtp_ctx->timestamp = rtp_ctx->cur_timestamp;
   int16_t seq = play->nb_before_video_rtps + play->nb_video_rtps + 1;
 
@@ -66,14 +127,24 @@ static void tms_rtp_send_video_frame(TmsVideoRtpContext *rtp_ctx, const uint8_t
 
   uint16_t length = RTP_HEADER_SIZE + len;
 
+  tms_video_pacer_wait(&rtp_ctx->pacer, length);
+
   janus_plugin_rtp janus_rtp = {.video = TRUE, .buffer = (char *)buffer, .length = length};
-  gateway->relay_rtp(handle, &janus_rtp);
+  tms_relay_rtp(play, &janus_rtp);
 
   play->nb_video_rtps++;
+  play->nb_video_octets += len;
+  rtp_ctx->last_rtp_us = tms_clock_now(play->clock);
+
+  /* 记录到要缓存的片段 */
+  if (play->clip)
+    tms_clip_add_payload(play->clip, buf1, len, m);
+
+  tms_video_first_frame(rtp_ctx, buf1, len, m, play);
 
   g_free(buffer);
 
-  JANUS_LOG(LOG_VERB, "完成第 %d 个视频RTP帧发送 seq=%d timestamp=%d\n", play->nb_video_rtps, seq, rtp_ctx->timestamp);
+  tms_trace(play->trace, TMS_TRACE_VIDEO_RTP, seq, len, rtp_ctx->last_rtp_us - play->video_deadline_us, rtp_ctx->timestamp);
 }
 /* 将多个nal缓存起来一起发送 */
 static void tms_flush_nal_buffered(TmsVideoRtpContext *rtp_ctx, int last, TmsPlayContext *play)
@@ -98,7 +169,7 @@ static void tms_flush_nal_buffered(TmsVideoRtpContext *rtp_ctx, int last, TmsPla
 static void tms_send_h264_nal(TmsVideoRtpContext *rtp_ctx, const uint8_t *buf, int size, int last, TmsPlayContext *play)
 {
   int nalu_type = buf[0] & 0x1F;
-  JANUS_LOG(LOG_VERB, "Sending NAL %x of len %d M=%d\n", nalu_type, size, last);
+  tms_trace(play->trace, TMS_TRACE_VIDEO_NAL, 0, size, 0, nalu_type);
 
   if (size <= rtp_ctx->max_payload_size)
   {
@@ -147,7 +218,6 @@ static void tms_send_h264_nal(TmsVideoRtpContext *rtp_ctx, const uint8_t *buf, i
     //   JANUS_LOG(LOG_VERB, "NAL size %d > %d, try -slice-max-size %d\n", size, rtp_ctx->max_payload_size, rtp_ctx->max_payload_size);
     //   return;
     // }
-    JANUS_LOG(LOG_VERB, "NAL size %d > %d\n", size, rtp_ctx->max_payload_size);
 
     uint8_t type = buf[0] & 0x1F;
     uint8_t nri = buf[0] & 0x60;
@@ -227,11 +297,45 @@ static const uint8_t *tms_avc_find_startcode(const uint8_t *p, const uint8_t *en
   return out;
 }
 
-static void tms_rtp_send_h264(TmsVideoRtpContext *rtp_ctx, const uint8_t *buf1, int size, TmsPlayContext *play)
+/* 拥塞时丢弃整帧，由帧中第1个图像数据的nal决定是否可以丢弃，返回1：已丢弃 */
+static int tms_drop_h264_frame(TmsVideoRtpContext *rtp_ctx, const uint8_t *buf1, int size, TmsPlayContext *play)
 {
+  TmsFrameDropper *dropper = &rtp_ctx->dropper;
+  gboolean congested = tms_frame_dropper_congested(dropper, play);
+  if (!congested && !dropper->skip_to_anchor)
+    return 0;
+
   const uint8_t *r, *end = buf1 + size;
+  r = tms_avc_find_startcode(buf1, end);
+  while (r < end)
+  {
+    const uint8_t *r1;
+
+    while (!*(r++))
+      ;
+    r1 = tms_avc_find_startcode(r, end);
+    int kind = r < r1 ? tms_h264_slice_kind(r[0], r + 1, r1 - r - 1) : -1;
+    if (kind >= 0)
+    {
+      if (!tms_frame_dropper_should_drop(dropper, kind, congested))
+        return 0;
+      tms_frame_dropper_drop(dropper, size, play);
+      return 1;
+    }
+    r = r1;
+  }
+
+  return 0;
+}
+static void tms_rtp_send_h264(TmsVideoRtpContext *rtp_ctx, const uint8_t *buf1, int size, int64_t duration_us, TmsPlayContext *play)
+{
+  const uint8_t *r, *end = buf1 + size;
+
+  if (tms_drop_h264_frame(rtp_ctx, buf1, size, play))
+    return;
 
   rtp_ctx->buf_ptr = rtp_ctx->buf;
+  tms_video_pacer_begin_frame(&rtp_ctx->pacer, duration_us);
 
   r = tms_avc_find_startcode(buf1, end);
   while (r < end)
@@ -246,26 +350,43 @@ static void tms_rtp_send_h264(TmsVideoRtpContext *rtp_ctx, const uint8_t *buf1,
   }
 
   tms_flush_nal_buffered(rtp_ctx, 1, play);
+  tms_video_pacer_end_frame(&rtp_ctx->pacer, play->trace);
 }
-/* 输出调试信息 */
+/* 记录读取的视频包 */
 static void tms_dump_video_packet(AVPacket *pkt, TmsPlayContext *play)
 {
-  int64_t dts = pkt->dts == INT64_MIN ? -1 : pkt->dts;
-  int64_t pts = pkt->pts == INT64_MIN ? -1 : pkt->pts;
-  uint8_t *pkt_data = pkt->data;
+  int nal_unit_type = pkt->size > 4 ? pkt->data[4] & 0x1f : 0; // 5 bit
+  tms_trace(play->trace, TMS_TRACE_VIDEO_PACKET, 0, pkt->size, 0, nal_unit_type);
+}
 
-  JANUS_LOG(LOG_VERB, "读取媒体包 #%d 所属媒体流 #%d size= %d dts = %" PRId64 " pts = %" PRId64 "\n", play->nb_video_packets, pkt->stream_index, pkt->size, dts, pts);
-  if (play->nb_video_packets < 8)
-  {
-    JANUS_LOG(LOG_VERB, "av_read_frame.packet 前12个字节 %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x\n", pkt_data[0], pkt_data[1], pkt_data[2], pkt_data[3], pkt_data[4], pkt_data[5], pkt_data[6], pkt_data[7], pkt_data[8], pkt_data[9], pkt_data[10], pkt_data[11]);
-  }
+/* 按帧的dts（微秒）添加发送间隔，并按帧的pts（time_base）计算帧的rtp时间戳，返回晚于发送时间的时长，微秒 */
+static int64_t tms_schedule_video_frame(TmsVideoRtpContext *rtp_ctx, int64_t dts_us, int64_t pts, AVRational time_base, TmsPlayContext *play)
+{
+  /* 添加发送间隔 */
+  play->video_deadline_us = tms_clock_deadline_us(play, dts_us);
+  tms_wait_media_time(play, dts_us);
+  int64_t lateness_us = tms_clock_now(play->clock) - play->video_deadline_us;
+  tms_trace(play->trace, TMS_TRACE_VIDEO_FRAME, 0, 0, lateness_us, 0);
+
+  /* 计算时间戳 */
+  rtp_ctx->cur_timestamp = tms_clock_rtp_timestamp(play, rtp_ctx->base_timestamp, RTP_H264_TIME_BASE, pts, time_base);
 
-  int nal_unit_type = pkt_data[4] & 0x1f; // 5 bit
-  JANUS_LOG(LOG_VERB, "媒体包 #%d 视频包 #%d nal_unit_type = %d\n", play->nb_packets, play->nb_video_packets, nal_unit_type);
+  return lateness_us;
 }
+/* 等待到排队的视频帧的发送时间后发送 */
+static void tms_send_video_unit(TmsPlayContext *play, TmsSchedUnit *unit, TmsVideoRtpContext *rtp_ctx, TmsScheduler *sched)
+{
+  int64_t lateness_us = tms_schedule_video_frame(rtp_ctx, unit->deadline_us, unit->media_ts, unit->time_base, play);
+  if (!play->nopacing)
+    tms_sched_sent(sched, TMS_SCHED_VIDEO, lateness_us);
 
-/* 处理视频媒体包 */
-int tms_handle_video_packet(TmsPlayContext *play, TmsInputStream *ist, AVPacket *pkt, AVBSFContext *h264bsfc, TmsVideoRtpContext *rtp_ctx)
+  /* 发送RTP包 */
+  if (play->clip)
+    tms_clip_begin_frame(play->clip, TRUE, unit->deadline_us, unit->pts_us, unit->duration_us);
+  tms_rtp_send_h264(rtp_ctx, unit->pkt->data, unit->pkt->size, unit->duration_us, play);
+}
+/* 处理视频媒体包，转为annexb格式后放入调度队列 */
+int tms_handle_video_packet(TmsPlayContext *play, TmsInputStream *ist, AVPacket *pkt, AVBSFContext *h264bsfc, TmsScheduler *sched)
 {
   int ret = 0;
 
@@ -281,42 +402,37 @@ int tms_handle_video_packet(TmsPlayContext *play, TmsInputStream *ist, AVPacket
 
   tms_dump_video_packet(pkt, play);
 
-  /* 处理视频包 */
-  if (!ist->saw_first_ts)
-  {
-    ist->dts = ist->st->avg_frame_rate.num ? -ist->dec_ctx->has_b_frames * AV_TIME_BASE / av_q2d(ist->st->avg_frame_rate) : 0;
-    ist->next_dts = ist->dts;
-    ist->saw_first_ts = 1;
-  }
-  else
-  {
-    ist->dts = ist->next_dts;
-  }
-
-  /* 添加发送间隔 */
-  int64_t dts_us = ist->dts; // 单位微秒
-  int64_t elapse_us = av_gettime_relative() - play->start_time_us - play->pause_duration_us;
-  if (dts_us > elapse_us)
-    usleep(dts_us - elapse_us);
-
-  ist->next_dts += av_rescale_q(pkt->duration, ist->st->time_base, AV_TIME_BASE_Q); // 通过帧的播放时长，计算dts（相对于文件起始时间），单位微秒
-
-  /* 计算时间戳 */
-  int64_t video_ts = dts_us; // 微秒
-  if (play->pause_duration_us > 0)
-  {
-    video_ts += play->pause_duration_us;
-  }
-  rtp_ctx->cur_timestamp = rtp_ctx->base_timestamp + (video_ts / 1000 * 90); // 每毫秒90个采样
-  // if (!play->first_rtcp_video)
-  // {
-  //   tms_video_rtcp_first_sr(play, rtp_ctx);
-  // }
-
-  JANUS_LOG(LOG_VERB, "elapse = %ld dts = %ld base_timestamp = %d video_ts = %ld\n", elapse_us, dts_us, rtp_ctx->base_timestamp, video_ts);
-
-  /* 发送RTP包 */
-  tms_rtp_send_h264(rtp_ctx, pkt->data, pkt->size, play);
+  /* 处理视频包，使用包中的时间戳，没有时间戳时按上一个包的时长推算 */
+  AVRational time_base = ist->st->time_base;
+  int64_t dts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+  if (dts == AV_NOPTS_VALUE)
+    dts = ist->saw_first_ts ? ist->next_ts : ist->origin_ts;
+  int64_t pts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : dts;
+  ist->saw_first_ts = 1;
+
+  int64_t duration = pkt->duration;
+  if (duration <= 0)
+    duration = ist->st->avg_frame_rate.num ? av_rescale_q(1, av_inv_q(ist->st->avg_frame_rate), time_base) : av_rescale_q(40000, AV_TIME_BASE_Q, time_base);
+  ist->next_ts = dts + duration;
+
+  /* 相对于文件起点的媒体时间 */
+  int64_t dts_us = av_rescale_q(dts - ist->origin_ts, time_base, AV_TIME_BASE_Q);
+  int64_t pts_us = av_rescale_q(pts - ist->origin_ts, time_base, AV_TIME_BASE_Q);
+  int64_t frame_us = av_rescale_q(duration, time_base, AV_TIME_BASE_Q);
+  ist->dts = dts_us;
+  ist->next_dts = av_rescale_q(ist->next_ts - ist->origin_ts, time_base, AV_TIME_BASE_Q);
+  play->input_end_us = FFMAX(play->input_end_us, pts_us + frame_us);
+
+  /* 等待按发送时间调度 */
+  TmsSchedUnit *unit = tms_sched_new_unit(pkt);
+  if (unit == NULL)
+    return -1;
+  unit->deadline_us = dts_us;
+  unit->pts_us = pts_us;
+  unit->duration_us = frame_us;
+  unit->media_ts = pts - ist->origin_ts;
+  unit->time_base = time_base;
+  tms_sched_push(sched, TMS_SCHED_VIDEO, unit);
 
   return 0;
 }
@@ -0,0 +1,642 @@
+#ifndef TMS_PLAY_IO_H
+#define TMS_PLAY_IO_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include "tms_play.h"
+
+/**
+ * 本地媒体文件的读取调度
+ *
+ * 解封装器通过自定义的AVIOContext按块读取本地文件，读取不直接发给磁盘，而是放入文件所在设备的队列，
+ * 由每个设备固定数量的线程按截止时间从早到晚执行，设备上同时进行的读取不超过线程数。
+ * 截止时间按会话的播放位置计算：解封装器正在等待的块立即需要，预读的块按媒体码率在播放到该块时需要。
+ * 播放高码率大文件的会话已经预读了较多数据，它的预读排在即将读空的会话后面，不会占满磁盘队列，
+ * 各会话按各自的播放进度分享设备的读取能力。
+ * 同一个文件的块被所有打开它的会话共享，正在读取或者已经读取的块不会重复读取，多个会话播放同一个文件时合并预读。
+ * 最后1个会话关闭文件时丢弃还没有开始读取的块，并释放文件的块。
+ * 块完成读取时只唤醒等待同一个文件的读取者。文件的块数超过限制时只淘汰不在任何读取者预读范围内的块，合并的预读不会被淘汰后重复读取。
+ */
+
+#define TMS_IO_BUFFER_SIZE 32768         // 解封装器读取缓冲区的大小，字节
+#define TMS_IO_MAX_READAHEAD 16          // 每个会话最多预读的块数
+#define TMS_IO_MAX_FILE_BLOCKS 32        // 每个文件至少可以保留的块数，读取者多时按读取者数量和预读块数增加
+#define TMS_IO_DEFAULT_BYTE_RATE 125000  // 还不知道媒体码率时（探测文件）假定的播放速度，字节/秒
+
+/* 块的状态 */
+enum
+{
+  TMS_IO_BLOCK_QUEUED = 0, // 在设备的队列中等待读取
+  TMS_IO_BLOCK_READING,    // 正在读取
+  TMS_IO_BLOCK_READY,      // 已经读取
+  TMS_IO_BLOCK_ERROR       // 读取失败，再次请求时重新读取
+};
+
+/* 存放媒体文件的设备，每个设备有独立的队列和读取线程 */
+typedef struct TmsIoDevice
+{
+  dev_t dev;
+  char *name;            // 主设备号:次设备号
+  GQueue pending;        // 等待读取的块
+  janus_condition cond;  // 有块等待读取或者停止
+  GThread **threads;     // 读取线程
+  int nb_threads;
+  gboolean stopping;     // 是否停止读取线程
+  int nb_reading;        // 正在读取的块数
+  int max_depth;         // 最大的队列深度，等待和正在读取的块数
+  /* 统计 */
+  int64_t nb_reads;       // 完成的读取次数，包括失败的
+  int64_t nb_read_errors; // 读取失败的次数
+  int64_t nb_late_reads;  // 完成时已经晚于截止时间的读取次数
+  int64_t read_bytes;     // 读取的字节数
+  int64_t sum_latency_us; // 从放入队列到读取完成的累计用时，微秒
+  int64_t max_latency_us; // 从放入队列到读取完成的最长用时，微秒
+  int64_t sum_service_us; // 读取的累计用时，不包括排队，微秒
+} TmsIoDevice;
+
+/* 打开的本地文件，打开同一个文件的会话共用 */
+typedef struct TmsIoFile
+{
+  char *key;           // 设备号，inode，大小和修改时间，文件变化后不再共享旧的块
+  int fd;
+  int64_t size;        // 文件的字节数
+  TmsIoDevice *device; // 文件所在的设备
+  GHashTable *blocks;  // 块序号到TmsIoBlock
+  janus_condition cond; // 文件有块完成读取
+  GList *readers;      // 打开文件的读取者，淘汰块时不淘汰它们预读范围内的块
+  int nb_readers;      // 打开文件的读取者数量
+  int nb_refs;         // 读取者，排队和正在读取的块各持有1个引用
+} TmsIoFile;
+
+/* 文件的块 */
+typedef struct TmsIoBlock
+{
+  TmsIoFile *file;
+  int64_t index;       // 块的序号
+  int state;           // 块的状态
+  uint8_t *data;       // 读取的数据
+  int len;             // 读取的字节数
+  int64_t deadline_us; // 所有请求中最早的截止时间，微秒
+  int64_t queued_us;   // 放入队列的时间，微秒
+  const void *owner;   // 发起读取的读取者，只用于统计共享的请求
+  int nb_waiters;      // 等待读取完成的读取者数量，大于0时不淘汰
+  int64_t last_use;    // 最近使用的序号，用于淘汰
+} TmsIoBlock;
+
+/* 会话打开的本地文件，提供给解封装器 */
+typedef struct TmsIoReader
+{
+  TmsIoFile *file;
+  int64_t pos;         // 解封装器读取的位置
+  int64_t bit_rate;    // 媒体的码率，比特/秒，用于计算预读的截止时间，0表示未知
+  int64_t block_index; // 正在读取的块的序号，-1表示没有
+  AVIOContext *pb;     // 提供给解封装器的读取接口
+} TmsIoReader;
+
+static int64_t io_block_size = 0;      // 块的字节数
+static int io_nb_threads = 0;          // 每个设备的读取线程数
+static int64_t io_readahead_us = 0;    // 按码率预读多少时长的媒体，微秒
+static GHashTable *io_files = NULL;    // 文件的键到TmsIoFile
+static GHashTable *io_devices = NULL;  // 设备号到TmsIoDevice
+static janus_mutex io_mutex;
+static int64_t io_tick = 0;            // 块的使用序号
+
+static int64_t io_nb_requests = 0;     // 请求块的次数
+static int64_t io_nb_shared = 0;       // 请求的块已经由其它会话读取或者正在读取的次数
+
+static void tms_io_block_free(gpointer data)
+{
+  TmsIoBlock *block = (TmsIoBlock *)data;
+  g_free(block->data);
+  g_free(block);
+}
+/* 释放文件的1个引用，没有引用时关闭文件并释放块 */
+static void tms_io_file_unref_locked(TmsIoFile *file)
+{
+  if (--file->nb_refs > 0)
+    return;
+
+  g_hash_table_remove(io_files, file->key);
+  g_hash_table_destroy(file->blocks);
+  janus_condition_destroy(&file->cond);
+  close(file->fd);
+  g_free(file->key);
+  g_free(file);
+}
+/* 完整读取len字节，文件结尾时返回已经读取的字节数，失败时返回-1 */
+static int tms_io_pread(int fd, uint8_t *buf, int len, int64_t offset)
+{
+  int nb_read = 0;
+  while (nb_read < len)
+  {
+    ssize_t n = pread(fd, buf + nb_read, len - nb_read, offset + nb_read);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return -1;
+    if (n == 0)
+      break;
+    nb_read += n;
+  }
+
+  return nb_read;
+}
+/* 设备的读取线程，每次读取截止时间最早的块 */
+static gpointer tms_io_worker(gpointer data)
+{
+  TmsIoDevice *device = (TmsIoDevice *)data;
+
+  janus_mutex_lock(&io_mutex);
+  while (1)
+  {
+    while (!device->stopping && device->pending.length == 0)
+      janus_condition_wait(&device->cond, &io_mutex);
+    if (device->stopping)
+      break;
+
+    GList *earliest = device->pending.head, *link = earliest->next;
+    for (; link; link = link->next)
+      if (((TmsIoBlock *)link->data)->deadline_us < ((TmsIoBlock *)earliest->data)->deadline_us)
+        earliest = link;
+    TmsIoBlock *block = (TmsIoBlock *)earliest->data;
+    g_queue_delete_link(&device->pending, earliest);
+    block->state = TMS_IO_BLOCK_READING;
+    device->nb_reading++;
+    TmsIoFile *file = block->file;
+    int64_t offset = block->index * io_block_size;
+    int len = (int)FFMIN(io_block_size, file->size - offset);
+    int fd = file->fd;
+    janus_mutex_unlock(&io_mutex);
+
+    int64_t begin_us = av_gettime_relative();
+    uint8_t *buf = g_malloc(len);
+    int ret = tms_io_pread(fd, buf, len, offset);
+    int err = ret < 0 ? errno : 0;
+    int64_t end_us = av_gettime_relative();
+
+    janus_mutex_lock(&io_mutex);
+    device->nb_reading--;
+    device->nb_reads++;
+    device->sum_service_us += end_us - begin_us;
+    int64_t latency_us = end_us - block->queued_us;
+    device->sum_latency_us += latency_us;
+    device->max_latency_us = FFMAX(device->max_latency_us, latency_us);
+    if (end_us > block->deadline_us)
+      device->nb_late_reads++;
+    if (ret > 0)
+    {
+      block->data = buf;
+      block->len = ret;
+      block->state = TMS_IO_BLOCK_READY;
+      device->read_bytes += ret;
+    }
+    else
+    {
+      g_free(buf);
+      block->state = TMS_IO_BLOCK_ERROR;
+      device->nb_read_errors++;
+      JANUS_LOG(LOG_WARN, "[TmsPlay] 读取设备 %s 上文件的第 %" PRId64 " 块失败 %s\n", device->name, block->index, ret < 0 ? g_strerror(err) : "文件变短");
+    }
+    janus_condition_broadcast(&file->cond);
+    tms_io_file_unref_locked(file);
+  }
+  janus_mutex_unlock(&io_mutex);
+
+  return NULL;
+}
+/* 获得设备，第1次使用时启动设备的读取线程 */
+static TmsIoDevice *tms_io_device_get_locked(dev_t dev)
+{
+  gint64 key = (gint64)dev;
+  TmsIoDevice *device = g_hash_table_lookup(io_devices, &key);
+  if (device)
+    return device;
+
+  device = g_malloc0(sizeof(TmsIoDevice));
+  device->dev = dev;
+  device->name = g_strdup_printf("%u:%u", major(dev), minor(dev));
+  g_queue_init(&device->pending);
+  janus_condition_init(&device->cond);
+  device->threads = g_malloc0(sizeof(GThread *) * io_nb_threads);
+  int i = 0;
+  for (; i < io_nb_threads; i++)
+  {
+    GError *error = NULL;
+    char tname[16];
+    g_snprintf(tname, sizeof(tname), "tms io %s", device->name);
+    device->threads[device->nb_threads] = g_thread_try_new(tname, tms_io_worker, device, &error);
+    if (error != NULL)
+    {
+      JANUS_LOG(LOG_ERR, "[TmsPlay] 创建设备 %s 的读取线程发生错误：%d (%s)\n", device->name, error->code, error->message ? error->message : "??");
+      g_error_free(error);
+      continue;
+    }
+    device->nb_threads++;
+  }
+  gint64 *dev_key = g_malloc(sizeof(gint64));
+  *dev_key = key;
+  g_hash_table_insert(io_devices, dev_key, device);
+  JANUS_LOG(LOG_INFO, "[TmsPlay] 设备 %s 启动 %d 个读取线程\n", device->name, device->nb_threads);
+
+  return device;
+}
+/* 停止设备的读取线程，释放设备 */
+static void tms_io_device_free(gpointer data)
+{
+  TmsIoDevice *device = (TmsIoDevice *)data;
+  janus_mutex_lock(&io_mutex);
+  device->stopping = TRUE;
+  janus_condition_broadcast(&device->cond);
+  janus_mutex_unlock(&io_mutex);
+  int i = 0;
+  for (; i < device->nb_threads; i++)
+    g_thread_join(device->threads[i]);
+
+  g_queue_clear(&device->pending);
+  janus_condition_destroy(&device->cond);
+  g_free(device->threads);
+  g_free(device->name);
+  g_free(device);
+}
+/* 块是否在文件的某个读取者正在读取或者预读的范围内 */
+static gboolean tms_io_block_ahead_locked(TmsIoFile *file, TmsIoBlock *block)
+{
+  GList *link = file->readers;
+  for (; link; link = link->next)
+  {
+    TmsIoReader *reader = (TmsIoReader *)link->data;
+    if (reader->block_index >= 0 && block->index >= reader->block_index && block->index <= reader->block_index + TMS_IO_MAX_READAHEAD)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+/**
+ * 文件的块超过限制时，淘汰最久没有使用、没有读取者等待、不在读取者预读范围内的块
+ *
+ * 限制按读取者数量增加，保证每个读取者的预读都能保留
+ */
+static void tms_io_evict_locked(TmsIoFile *file)
+{
+  guint max_blocks = FFMAX(TMS_IO_MAX_FILE_BLOCKS, file->nb_readers * (TMS_IO_MAX_READAHEAD + 1));
+  if (g_hash_table_size(file->blocks) < max_blocks)
+    return;
+
+  TmsIoBlock *victim = NULL;
+  GHashTableIter iter;
+  gpointer value;
+  g_hash_table_iter_init(&iter, file->blocks);
+  while (g_hash_table_iter_next(&iter, NULL, &value))
+  {
+    TmsIoBlock *block = (TmsIoBlock *)value;
+    if ((block->state == TMS_IO_BLOCK_READY || block->state == TMS_IO_BLOCK_ERROR) && block->nb_waiters == 0 && (victim == NULL || block->last_use < victim->last_use) && !tms_io_block_ahead_locked(file, block))
+      victim = block;
+  }
+  if (victim)
+    g_hash_table_remove(file->blocks, &victim->index);
+}
+/* 将块放入设备的队列 */
+static void tms_io_enqueue_locked(TmsIoBlock *block, int64_t deadline_us, int64_t now_us)
+{
+  TmsIoDevice *device = block->file->device;
+  block->state = TMS_IO_BLOCK_QUEUED;
+  block->deadline_us = deadline_us;
+  block->queued_us = now_us;
+  block->file->nb_refs++;
+  g_queue_push_tail(&device->pending, block);
+  device->max_depth = FFMAX(device->max_depth, (int)device->pending.length + device->nb_reading);
+  janus_condition_signal(&device->cond);
+}
+/**
+ * 请求读取者文件的第index块，deadline_us为需要的时间
+ *
+ * 块已经在队列中时提前截止时间，已经读取或者正在读取时不重复读取
+ */
+static TmsIoBlock *tms_io_request_locked(TmsIoReader *reader, int64_t index, int64_t deadline_us, int64_t now_us)
+{
+  TmsIoFile *file = reader->file;
+  io_nb_requests++;
+  TmsIoBlock *block = g_hash_table_lookup(file->blocks, &index);
+  if (block)
+  {
+    if (block->owner != reader)
+      io_nb_shared++;
+    if (block->state == TMS_IO_BLOCK_ERROR)
+    {
+      block->owner = reader;
+      tms_io_enqueue_locked(block, deadline_us, now_us);
+    }
+    else if (block->state == TMS_IO_BLOCK_QUEUED && deadline_us < block->deadline_us)
+    {
+      block->deadline_us = deadline_us;
+    }
+    block->last_use = ++io_tick;
+    return block;
+  }
+
+  tms_io_evict_locked(file);
+  block = g_malloc0(sizeof(TmsIoBlock));
+  block->file = file;
+  block->index = index;
+  block->owner = reader;
+  block->last_use = ++io_tick;
+  g_hash_table_insert(file->blocks, &block->index, block);
+  tms_io_enqueue_locked(block, deadline_us, now_us);
+
+  return block;
+}
+/* 读到第index块时，按媒体码率预读后面的块，截止时间为按码率播放到块的开始位置的时间 */
+static void tms_io_readahead_locked(TmsIoReader *reader, int64_t index, int64_t now_us)
+{
+  TmsIoFile *file = reader->file;
+  int64_t byte_rate = reader->bit_rate >= 8 ? reader->bit_rate / 8 : TMS_IO_DEFAULT_BYTE_RATE;
+  int nb_readahead = (int)av_clip64((byte_rate * io_readahead_us / AV_TIME_BASE + io_block_size - 1) / io_block_size, 1, TMS_IO_MAX_READAHEAD);
+  int64_t nb_blocks = (file->size + io_block_size - 1) / io_block_size;
+  int64_t last = FFMIN(index + nb_readahead, nb_blocks - 1);
+  int64_t i = index + 1;
+  for (; i <= last; i++)
+    tms_io_request_locked(reader, i, now_us + (i * io_block_size - reader->pos) * AV_TIME_BASE / byte_rate, now_us);
+}
+/* 解封装器读取数据，等待需要的块读取完成 */
+static int tms_io_read(void *opaque, uint8_t *buf, int buf_size)
+{
+  TmsIoReader *reader = (TmsIoReader *)opaque;
+  TmsIoFile *file = reader->file;
+  if (reader->pos >= file->size)
+    return AVERROR_EOF;
+
+  int64_t index = reader->pos / io_block_size;
+  int64_t now_us = av_gettime_relative();
+  janus_mutex_lock(&io_mutex);
+  TmsIoBlock *block = tms_io_request_locked(reader, index, now_us, now_us);
+  block->nb_waiters++; // 预读淘汰块时不淘汰这个块
+  if (index != reader->block_index)
+  {
+    reader->block_index = index;
+    tms_io_readahead_locked(reader, index, now_us);
+  }
+  while (block->state == TMS_IO_BLOCK_QUEUED || block->state == TMS_IO_BLOCK_READING)
+    janus_condition_wait(&file->cond, &io_mutex);
+  block->nb_waiters--;
+
+  int len = AVERROR(EIO);
+  if (block->state == TMS_IO_BLOCK_READY)
+  {
+    int offset = (int)(reader->pos - index * io_block_size);
+    len = FFMIN(buf_size, block->len - offset);
+    if (len <= 0)
+      len = AVERROR_EOF;
+    else
+    {
+      memcpy(buf, block->data + offset, len);
+      reader->pos += len;
+    }
+  }
+  janus_mutex_unlock(&io_mutex);
+
+  return len;
+}
+/* 解封装器跳转 */
+static int64_t tms_io_seek(void *opaque, int64_t offset, int whence)
+{
+  TmsIoReader *reader = (TmsIoReader *)opaque;
+  if (whence & AVSEEK_SIZE)
+    return reader->file->size;
+
+  int64_t pos;
+  switch (whence & ~AVSEEK_FORCE)
+  {
+  case SEEK_SET:
+    pos = offset;
+    break;
+  case SEEK_CUR:
+    pos = reader->pos + offset;
+    break;
+  case SEEK_END:
+    pos = reader->file->size + offset;
+    break;
+  default:
+    return AVERROR(EINVAL);
+  }
+  if (pos < 0)
+    return AVERROR(EINVAL);
+  reader->pos = pos;
+
+  return pos;
+}
+/* 打开本地文件，同一个文件（内容没有变化）的读取者共用块，不是普通文件时返回NULL */
+static TmsIoReader *tms_io_open(const char *filename)
+{
+  struct stat st;
+  if (stat(filename, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+    return NULL;
+
+  char *key = g_strdup_printf("%" PRIu64 ":%" PRIu64 ":%" PRId64 ":%" PRId64, (uint64_t)st.st_dev, (uint64_t)st.st_ino, (int64_t)st.st_size, (int64_t)st.st_mtime);
+  int fd = open(filename, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    g_free(key);
+    return NULL;
+  }
+
+  TmsIoReader *reader = g_malloc0(sizeof(TmsIoReader));
+  reader->block_index = -1;
+
+  janus_mutex_lock(&io_mutex);
+  TmsIoFile *file = g_hash_table_lookup(io_files, key);
+  if (file)
+  {
+    close(fd);
+    g_free(key);
+  }
+  else
+  {
+    /* 设备没有读取线程时由ffmpeg直接读取 */
+    TmsIoDevice *device = tms_io_device_get_locked(st.st_dev);
+    if (device->nb_threads == 0)
+    {
+      janus_mutex_unlock(&io_mutex);
+      close(fd);
+      g_free(key);
+      g_free(reader);
+      return NULL;
+    }
+    file = g_malloc0(sizeof(TmsIoFile));
+    file->key = key;
+    file->fd = fd;
+    file->size = st.st_size;
+    file->device = device;
+    file->blocks = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, tms_io_block_free);
+    janus_condition_init(&file->cond);
+    g_hash_table_insert(io_files, file->key, file);
+  }
+  reader->file = file;
+  file->readers = g_list_prepend(file->readers, reader);
+  file->nb_readers++;
+  file->nb_refs++;
+  janus_mutex_unlock(&io_mutex);
+
+  return reader;
+}
+/* 关闭读取者，最后1个读取者关闭时丢弃文件还在排队的块 */
+static void tms_io_close(TmsIoReader *reader)
+{
+  if (reader->pb)
+  {
+    av_freep(&reader->pb->buffer);
+    avio_context_free(&reader->pb);
+  }
+
+  janus_mutex_lock(&io_mutex);
+  TmsIoFile *file = reader->file;
+  file->readers = g_list_remove(file->readers, reader);
+  if (--file->nb_readers == 0)
+  {
+    GList *link = file->device->pending.head;
+    while (link)
+    {
+      GList *next = link->next;
+      TmsIoBlock *block = (TmsIoBlock *)link->data;
+      if (block->file == file)
+      {
+        g_queue_delete_link(&file->device->pending, link);
+        g_hash_table_remove(file->blocks, &block->index);
+        file->nb_refs--;
+      }
+      link = next;
+    }
+  }
+  tms_io_file_unref_locked(file);
+  janus_mutex_unlock(&io_mutex);
+
+  g_free(reader);
+}
+/**
+ * 打开媒体文件，本地的普通文件通过读取调度读取
+ *
+ * 使用读取调度时io返回打开的读取者，需要通过tms_io_close_input关闭；没有启用或者不是普通文件时由ffmpeg直接读取
+ */
+int tms_io_open_input(AVFormatContext **ictx, const char *filename, TmsIoReader **io)
+{
+  *io = NULL;
+  if (io_files == NULL)
+    return avformat_open_input(ictx, filename, NULL, NULL);
+
+  TmsIoReader *reader = tms_io_open(filename);
+  if (reader == NULL)
+    return avformat_open_input(ictx, filename, NULL, NULL);
+
+  uint8_t *buffer = av_malloc(TMS_IO_BUFFER_SIZE);
+  reader->pb = buffer ? avio_alloc_context(buffer, TMS_IO_BUFFER_SIZE, 0, reader, tms_io_read, NULL, tms_io_seek) : NULL;
+  if (reader->pb == NULL || (*ictx = avformat_alloc_context()) == NULL)
+  {
+    if (reader->pb == NULL)
+      av_free(buffer);
+    tms_io_close(reader);
+    return AVERROR(ENOMEM);
+  }
+  (*ictx)->pb = reader->pb;
+  (*ictx)->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+  int ret = avformat_open_input(ictx, filename, NULL, NULL);
+  if (ret < 0)
+  {
+    tms_io_close(reader);
+    return ret;
+  }
+  *io = reader;
+
+  return ret;
+}
+/* 关闭打开的媒体文件 */
+void tms_io_close_input(AVFormatContext **ictx, TmsIoReader **io)
+{
+  if (*ictx)
+    avformat_close_input(ictx);
+  if (*io)
+  {
+    tms_io_close(*io);
+    *io = NULL;
+  }
+}
+/* 初始化读取调度，nb_threads为0时不启用，由ffmpeg直接读取本地文件 */
+int tms_io_init(int nb_threads, int block_kb, int readahead_ms)
+{
+  if (nb_threads <= 0 || block_kb <= 0)
+    return 0;
+
+  janus_mutex_init(&io_mutex);
+  io_nb_threads = nb_threads;
+  io_block_size = (int64_t)block_kb * 1024;
+  io_readahead_us = (int64_t)FFMAX(readahead_ms, 0) * 1000;
+  io_files = g_hash_table_new(g_str_hash, g_str_equal);
+  io_devices = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, tms_io_device_free);
+
+  return 0;
+}
+/* 释放读取调度，应在所有会话关闭文件后调用 */
+void tms_io_destroy(void)
+{
+  if (io_devices == NULL)
+    return;
+  /* 还有没有结束的播放在读取时保留读取线程 */
+  janus_mutex_lock(&io_mutex);
+  guint nb_files = g_hash_table_size(io_files);
+  janus_mutex_unlock(&io_mutex);
+  if (nb_files > 0)
+  {
+    JANUS_LOG(LOG_WARN, "[TmsPlay] 还有 %u 个本地文件没有关闭，不释放读取调度\n", nb_files);
+    return;
+  }
+
+  g_hash_table_destroy(io_devices);
+  io_devices = NULL;
+  g_hash_table_destroy(io_files);
+  io_files = NULL;
+}
+/* 每个设备的队列深度和读取用时 */
+json_t *tms_io_status(void)
+{
+  json_t *status = json_object();
+  json_object_set_new(status, "enabled", json_boolean(io_devices != NULL));
+  if (io_devices == NULL)
+    return status;
+
+  janus_mutex_lock(&io_mutex);
+  json_object_set_new(status, "threads_per_device", json_integer(io_nb_threads));
+  json_object_set_new(status, "block_bytes", json_integer(io_block_size));
+  json_object_set_new(status, "files", json_integer(g_hash_table_size(io_files)));
+  json_object_set_new(status, "requests", json_integer(io_nb_requests));
+  json_object_set_new(status, "shared_requests", json_integer(io_nb_shared));
+  json_t *devices = json_array();
+  GHashTableIter iter;
+  gpointer value;
+  g_hash_table_iter_init(&iter, io_devices);
+  while (g_hash_table_iter_next(&iter, NULL, &value))
+  {
+    TmsIoDevice *device = (TmsIoDevice *)value;
+    json_t *item = json_object();
+    json_object_set_new(item, "device", json_string(device->name));
+    json_object_set_new(item, "queue_depth", json_integer(device->pending.length + device->nb_reading));
+    json_object_set_new(item, "reading", json_integer(device->nb_reading));
+    json_object_set_new(item, "max_queue_depth", json_integer(device->max_depth));
+    json_object_set_new(item, "reads", json_integer(device->nb_reads));
+    json_object_set_new(item, "read_errors", json_integer(device->nb_read_errors));
+    json_object_set_new(item, "late_reads", json_integer(device->nb_late_reads));
+    json_object_set_new(item, "read_bytes", json_integer(device->read_bytes));
+    json_object_set_new(item, "latency_avg_ms", json_real(device->nb_reads > 0 ? device->sum_latency_us / 1000.0 / device->nb_reads : 0));
+    json_object_set_new(item, "latency_max_ms", json_real(device->max_latency_us / 1000.0));
+    json_object_set_new(item, "service_avg_ms", json_real(device->nb_reads > 0 ? device->sum_service_us / 1000.0 / device->nb_reads : 0));
+    json_array_append_new(devices, item);
+  }
+  json_object_set_new(status, "devices", devices);
+  janus_mutex_unlock(&io_mutex);
+
+  return status;
+}
+
+#endif
@@ -0,0 +1,603 @@
+#ifndef TMS_PLAY_LIVE_H
+#define TMS_PLAY_LIVE_H
+
+#include "tms_play.h"
+#include "tms_play_stream.h"
+#include "tms_play_pcma.h"
+
+#define TMS_LIVE_VIDEO 0                  // 转发给观看者的视频包的流序号
+#define TMS_LIVE_AUDIO 1                  // 转发给观看者的音频包（PCMA或Opus）的流序号
+#define TMS_LIVE_MAX_QUEUE 500            // 观看者的队列最多缓存的包数，超过时丢弃，等待下一个关键帧
+#define TMS_LIVE_READ_TIMEOUT_US 10000000 // 读取直播源超时，微秒
+#define TMS_LIVE_PROBE_TIMEOUT_US 5000000 // 探测直播源超时，微秒
+#define TMS_LIVE_MAX_GAP_US 5000000       // 时间戳跳变超过这个值时认为直播源重新开始，微秒
+
+/**
+ * 直播转发
+ *
+ * 从rtsp，udp（mpegts），rtp，srt地址读取直播流，不需要按媒体时间控制发送速度，收到后立即转发。
+ * 同一个地址的所有观看者共用1个读取线程，视频只做annexb转换，音频只转码1次为PCMA或Opus，按包复制给每个观看者的队列。
+ * 输出不同音频编码的观看者使用不同的读取线程。
+ * 观看者处理不过来时丢弃队列中放不下的包，从下一个关键帧开始继续播放。
+ * 时间戳换算为相对于直播开始的微秒，直播源重新开始（时间戳跳变）时保持连续。
+ */
+typedef struct TmsLiveFeed
+{
+  char *url;
+  char *key;                  // 在live_feeds中的键，音频编码和地址
+  int audio_codec;            // 音频输出的编码
+  int64_t probesize;          // 打开直播源时探测的字节数
+  int64_t analyzeduration;    // 打开直播源时分析的时长，微秒
+  AVFormatContext *ictx;
+  int video_index;            // 选择的视频流序号，-1表示没有
+  int audio_index;            // 选择的音频流序号，-1表示没有
+  AVBSFContext *h264bsfc;     // extradata为avcC格式时转为annexb，否则为NULL
+  TmsInputStream *audio_ist;  // 音频流，需要解码
+  Resampler resampler;        // 音频重采样
+  PCMAEnc pcma_enc;           // 音频编码
+  int nb_streams;             // 转发的媒体流数量
+  gboolean doaudio;           // 是否有音频
+  gboolean dovideo;           // 是否有视频
+  /* 直播时钟，微秒 */
+  int64_t origin_us;          // 第1个时间戳，AV_NOPTS_VALUE表示还没有收到
+  int64_t offset_us;          // 直播源重新开始后累计的偏移量
+  int64_t last_us;            // 最近转发的媒体时间
+  /* 观看者 */
+  GList *subscribers;         // TmsLiveSubscriber
+  int refs;                   // 观看者数量加读取线程，由live_mutex保护
+  volatile gint stopping;     // 没有观看者，停止读取
+  volatile gint ended;        // 直播源结束或者发生错误
+  volatile int64_t last_read_us; // 最近一次读取到包的时间，用于读取超时
+  gboolean ready;             // 是否完成打开
+  int ret;                    // 打开的结果
+  janus_mutex mutex;
+  janus_condition cond;
+  /* 统计 */
+  int64_t start_us;            // 开始读取的时间
+  int64_t nb_video_packets;    // 转发的视频包数
+  int64_t nb_audio_packets;    // 转发的音频包数
+  int64_t nb_dropped;          // 观看者队列满时丢弃的包数
+  int64_t nb_discontinuities;  // 时间戳跳变次数
+} TmsLiveFeed;
+
+typedef struct TmsLiveSubscriber
+{
+  TmsLiveFeed *feed;
+  GAsyncQueue *queue;          // 转发的包，AVPacket，tms_live_eof表示直播结束
+  volatile gint need_keyframe; // 丢弃过包，要等到下一个关键帧
+} TmsLiveSubscriber;
+
+gboolean tms_live_is_url(const char *filename);
+TmsLiveSubscriber *tms_live_subscribe(const char *url, int audio_codec);
+void tms_live_unsubscribe(TmsLiveSubscriber *sub);
+int tms_live_probe(const char *url, int *nb_streams, int64_t *duration);
+int tms_live_init(int probesize, int analyze_ms);
+void tms_live_destroy(void);
+
+static int64_t live_probesize = 32768;         // 打开直播源时探测的字节数
+static int64_t live_analyzeduration = 500000;  // 打开直播源时分析的时长，微秒
+static GHashTable *live_feeds = NULL;           // 音频编码和地址到TmsLiveFeed
+static janus_mutex live_mutex;
+static AVPacket tms_live_eof;         // 直播结束的标记
+
+/* 是否为直播地址 */
+gboolean tms_live_is_url(const char *filename)
+{
+  return filename && (g_str_has_prefix(filename, "rtsp://") || g_str_has_prefix(filename, "rtsps://") || g_str_has_prefix(filename, "udp://") || g_str_has_prefix(filename, "rtp://") || g_str_has_prefix(filename, "srt://"));
+}
+static void tms_live_free_packet(gpointer data)
+{
+  AVPacket *pkt = (AVPacket *)data;
+  if (pkt != &tms_live_eof)
+    av_packet_free(&pkt);
+}
+/* 读取直播源的中断回调，停止或者读取超时时中断 */
+static int tms_live_interrupt(void *opaque)
+{
+  TmsLiveFeed *feed = (TmsLiveFeed *)opaque;
+
+  return g_atomic_int_get(&feed->stopping) || av_gettime_relative() - feed->last_read_us > TMS_LIVE_READ_TIMEOUT_US;
+}
+/* 探测直播源的中断回调，opaque为截止时间，超过时中断 */
+static int tms_live_probe_interrupt(void *opaque)
+{
+  int64_t *deadline_us = (int64_t *)opaque;
+
+  return av_gettime_relative() > *deadline_us;
+}
+/**
+ * 打开直播源，获得媒体流信息
+ *
+ * 只探测少量数据，尽快开始转发；rtsp使用tcp传输，避免丢包
+ */
+int tms_live_open_input(AVFormatContext **ictx, const char *url, int64_t probesize, int64_t analyzeduration, AVIOInterruptCB *interrupt)
+{
+  int ret;
+  AVDictionary *options = NULL;
+  if (g_str_has_prefix(url, "rtsp"))
+    av_dict_set(&options, "rtsp_transport", "tcp", 0);
+  av_dict_set(&options, "fflags", "nobuffer", 0);
+
+  if ((*ictx = avformat_alloc_context()) == NULL)
+  {
+    av_dict_free(&options);
+    return AVERROR(ENOMEM);
+  }
+  (*ictx)->probesize = probesize;
+  (*ictx)->max_analyze_duration = analyzeduration;
+  if (interrupt)
+    (*ictx)->interrupt_callback = *interrupt;
+
+  ret = avformat_open_input(ictx, url, NULL, &options);
+  av_dict_free(&options);
+  if (ret < 0)
+    return ret;
+
+  if ((ret = avformat_find_stream_info(*ictx, NULL)) < 0)
+  {
+    avformat_close_input(ictx);
+    return ret;
+  }
+
+  return 0;
+}
+/* 时间戳换算为直播的媒体时间，直播源重新开始时接在之前的媒体时间上 */
+static int64_t tms_live_media_us(TmsLiveFeed *feed, int64_t ts, AVRational time_base)
+{
+  int64_t us = av_rescale_q(ts, time_base, AV_TIME_BASE_Q);
+  if (feed->origin_us == AV_NOPTS_VALUE)
+    feed->origin_us = us;
+
+  int64_t media_us = us - feed->origin_us + feed->offset_us;
+  if (feed->last_us != AV_NOPTS_VALUE && (media_us > feed->last_us + TMS_LIVE_MAX_GAP_US || media_us < feed->last_us - TMS_LIVE_MAX_GAP_US))
+  {
+    JANUS_LOG(LOG_INFO, "[TmsPlay] 直播 %s 时间戳跳变 %ld 微秒\n", feed->url, media_us - feed->last_us);
+    feed->offset_us += feed->last_us - media_us;
+    media_us = feed->last_us;
+    feed->nb_discontinuities++;
+  }
+  feed->last_us = FFMAX(feed->last_us, media_us);
+
+  return media_us;
+}
+/* 将包复制给所有观看者，队列满的观看者丢弃，等待下一个关键帧 */
+static void tms_live_fanout(TmsLiveFeed *feed, AVPacket *pkt)
+{
+  janus_mutex_lock(&feed->mutex);
+  GList *item = feed->subscribers;
+  for (; item; item = item->next)
+  {
+    TmsLiveSubscriber *sub = (TmsLiveSubscriber *)item->data;
+    if (g_async_queue_length(sub->queue) >= TMS_LIVE_MAX_QUEUE)
+    {
+      g_atomic_int_set(&sub->need_keyframe, 1);
+      feed->nb_dropped++;
+      continue;
+    }
+    AVPacket *clone = av_packet_clone(pkt);
+    if (clone)
+      g_async_queue_push(sub->queue, clone);
+  }
+  janus_mutex_unlock(&feed->mutex);
+}
+/* 转发编码后的音频包，时间为帧的媒体时间加上包在帧中的位置，微秒 */
+typedef struct TmsLiveAudioSender
+{
+  TmsLiveFeed *feed;
+  int64_t media_us;
+} TmsLiveAudioSender;
+
+static void tms_live_send_audio_packet(AVPacket *packet, int64_t offset, void *opaque)
+{
+  TmsLiveAudioSender *sender = (TmsLiveAudioSender *)opaque;
+  int sample_rate = sender->feed->pcma_enc.cctx->sample_rate;
+  packet->stream_index = TMS_LIVE_AUDIO;
+  packet->pts = packet->dts = sender->media_us + av_rescale(offset, AV_TIME_BASE, sample_rate);
+  packet->duration = av_rescale(packet->duration, AV_TIME_BASE, sample_rate);
+  tms_live_fanout(sender->feed, packet);
+  sender->feed->nb_audio_packets++;
+}
+/* 解码音频包，转码为PCMA或Opus后转发 */
+static int tms_live_handle_audio(TmsLiveFeed *feed, AVPacket *pkt, AVFrame *frame)
+{
+  int ret;
+  TmsInputStream *ist = feed->audio_ist;
+  if ((ret = avcodec_send_packet(ist->dec_ctx, pkt)) < 0)
+  {
+    JANUS_LOG(LOG_VERB, "[TmsPlay] 直播 %s 音频包解码失败 %s\n", feed->url, av_err2str(ret));
+    return 0;
+  }
+  while ((ret = avcodec_receive_frame(ist->dec_ctx, frame)) == 0)
+  {
+    AVRational time_base = ist->st->time_base;
+    int64_t pts = frame->best_effort_timestamp;
+    if (pts == AV_NOPTS_VALUE)
+      pts = ist->saw_first_ts ? ist->next_ts : 0;
+    ist->saw_first_ts = 1;
+    ist->next_ts = pts + av_rescale_q(frame->nb_samples, (AVRational){1, frame->sample_rate}, time_base);
+
+    TmsLiveAudioSender sender = {.feed = feed, .media_us = tms_live_media_us(feed, pts, time_base)};
+    ret = tms_encode_audio_frame(&feed->resampler, &feed->pcma_enc, frame, tms_live_send_audio_packet, &sender);
+    av_frame_unref(frame);
+    if (ret < 0)
+      return -1;
+  }
+
+  return 0;
+}
+/* 视频包转为annexb格式后转发，sps和pps在extradata中时添加到关键帧前 */
+static int tms_live_handle_video(TmsLiveFeed *feed, AVPacket *pkt)
+{
+  int ret;
+  AVStream *st = feed->ictx->streams[feed->video_index];
+  if (feed->h264bsfc)
+  {
+    if ((ret = av_bsf_send_packet(feed->h264bsfc, pkt)) < 0)
+      return 0;
+    while ((ret = av_bsf_receive_packet(feed->h264bsfc, pkt)) == 0)
+      ;
+  }
+  else if ((pkt->flags & AV_PKT_FLAG_KEY) && st->codecpar->extradata_size > 0)
+  {
+    AVPacket *out = av_packet_alloc();
+    if (out == NULL || av_new_packet(out, st->codecpar->extradata_size + pkt->size) < 0)
+    {
+      av_packet_free(&out);
+      return -1;
+    }
+    av_packet_copy_props(out, pkt);
+    memcpy(out->data, st->codecpar->extradata, st->codecpar->extradata_size);
+    memcpy(out->data + st->codecpar->extradata_size, pkt->data, pkt->size);
+    av_packet_unref(pkt);
+    av_packet_move_ref(pkt, out);
+    av_packet_free(&out);
+  }
+  if (pkt->size <= 0)
+    return 0;
+
+  int64_t ts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+  if (ts == AV_NOPTS_VALUE)
+    return 0;
+  int64_t duration_us = pkt->duration > 0 ? av_rescale_q(pkt->duration, st->time_base, AV_TIME_BASE_Q) : st->avg_frame_rate.num ? av_rescale_q(1, av_inv_q(st->avg_frame_rate), AV_TIME_BASE_Q) : 40000;
+
+  pkt->stream_index = TMS_LIVE_VIDEO;
+  pkt->pts = pkt->dts = tms_live_media_us(feed, ts, st->time_base);
+  pkt->duration = duration_us;
+  tms_live_fanout(feed, pkt);
+  feed->nb_video_packets++;
+
+  return 0;
+}
+/* 打开直播源，选择1路h264视频和1路音频 */
+static int tms_live_open_feed(TmsLiveFeed *feed)
+{
+  int ret;
+  AVIOInterruptCB interrupt = {.callback = tms_live_interrupt, .opaque = feed};
+  if ((ret = tms_live_open_input(&feed->ictx, feed->url, feed->probesize, feed->analyzeduration, &interrupt)) < 0)
+  {
+    JANUS_LOG(LOG_WARN, "[TmsPlay] 无法打开直播 %s %s\n", feed->url, av_err2str(ret));
+    return -1;
+  }
+
+  AVFormatContext *ictx = feed->ictx;
+  feed->video_index = tms_select_stream(ictx, AVMEDIA_TYPE_VIDEO, TMS_PLAY_TRACK_AUTO, -1);
+  feed->audio_index = tms_select_stream(ictx, AVMEDIA_TYPE_AUDIO, TMS_PLAY_TRACK_AUTO, feed->video_index);
+  unsigned int i = 0;
+  for (; i < ictx->nb_streams; i++)
+  {
+    if ((int)i != feed->video_index && (int)i != feed->audio_index)
+      ictx->streams[i]->discard = AVDISCARD_ALL;
+  }
+
+  if (feed->video_index >= 0)
+  {
+    AVCodecParameters *par = ictx->streams[feed->video_index]->codecpar;
+    if (par->extradata_size > 0 && par->extradata[0] == 1)
+    {
+      const AVBitStreamFilter *filter = av_bsf_get_by_name("h264_mp4toannexb");
+      if (av_bsf_alloc(filter, &feed->h264bsfc) < 0 || avcodec_parameters_copy(feed->h264bsfc->par_in, par) < 0 || av_bsf_init(feed->h264bsfc) < 0)
+        return -1;
+    }
+    feed->dovideo = TRUE;
+    feed->nb_streams++;
+  }
+  if (feed->audio_index >= 0)
+  {
+    feed->audio_ist = malloc(sizeof(TmsInputStream));
+    if (tms_init_input_stream(ictx, feed->audio_index, feed->audio_ist) < 0)
+    {
+      free(feed->audio_ist);
+      feed->audio_ist = NULL;
+      ictx->streams[feed->audio_index]->discard = AVDISCARD_ALL;
+      feed->audio_index = -1;
+    }
+    else if (tms_init_audio_encoder(&feed->pcma_enc, feed->audio_codec) < 0 || tms_init_audio_resampler(feed->audio_ist->dec_ctx, feed->pcma_enc.cctx, &feed->resampler) < 0)
+    {
+      return -1;
+    }
+    else
+    {
+      feed->doaudio = TRUE;
+      feed->nb_streams++;
+    }
+  }
+  if (feed->nb_streams == 0)
+  {
+    JANUS_LOG(LOG_WARN, "[TmsPlay] 直播 %s 没有可以播放的媒体流\n", feed->url);
+    return -1;
+  }
+  JANUS_LOG(LOG_INFO, "[TmsPlay] 打开直播 %s 视频流 #%d，音频流 #%d，用时：%ld微秒\n", feed->url, feed->video_index, feed->audio_index, av_gettime_relative() - feed->start_us);
+
+  return 0;
+}
+static void tms_live_feed_free(TmsLiveFeed *feed)
+{
+  if (feed->h264bsfc)
+    av_bsf_free(&feed->h264bsfc);
+  if (feed->audio_ist)
+  {
+    if (feed->doaudio)
+      tms_free_audio_resampler(&feed->resampler);
+    tms_free_audio_encoder(&feed->pcma_enc);
+    tms_free_input_stream(feed->audio_ist);
+  }
+  if (feed->ictx)
+    avformat_close_input(&feed->ictx);
+  janus_mutex_destroy(&feed->mutex);
+  janus_condition_destroy(&feed->cond);
+  g_free(feed->url);
+  g_free(feed->key);
+  g_free(feed);
+}
+/* 释放观看者或读取线程持有的引用 */
+static void tms_live_feed_unref(TmsLiveFeed *feed)
+{
+  janus_mutex_lock(&live_mutex);
+  gboolean last = --feed->refs == 0;
+  janus_mutex_unlock(&live_mutex);
+  if (last)
+    tms_live_feed_free(feed);
+}
+/* 不再接受新的观看者，需要持有live_mutex */
+static void tms_live_feed_remove_locked(TmsLiveFeed *feed)
+{
+  if (live_feeds && g_hash_table_lookup(live_feeds, feed->key) == feed)
+    g_hash_table_remove(live_feeds, feed->key);
+}
+/* 读取直播源的线程，没有观看者或者直播结束时退出 */
+static void *tms_live_ingest_thread(void *data)
+{
+  TmsLiveFeed *feed = (TmsLiveFeed *)data;
+
+  int ret = tms_live_open_feed(feed);
+  janus_mutex_lock(&feed->mutex);
+  feed->ret = ret;
+  feed->ready = TRUE;
+  janus_condition_broadcast(&feed->cond);
+  janus_mutex_unlock(&feed->mutex);
+
+  AVPacket *pkt = av_packet_alloc();
+  AVFrame *frame = av_frame_alloc();
+  while (ret == 0 && !g_atomic_int_get(&feed->stopping))
+  {
+    if ((ret = av_read_frame(feed->ictx, pkt)) < 0)
+    {
+      if (!g_atomic_int_get(&feed->stopping))
+        JANUS_LOG(LOG_INFO, "[TmsPlay] 直播 %s 结束 %s\n", feed->url, av_err2str(ret));
+      break;
+    }
+    feed->last_read_us = av_gettime_relative();
+    if (pkt->stream_index == feed->video_index)
+      ret = tms_live_handle_video(feed, pkt);
+    else if (pkt->stream_index == feed->audio_index)
+      ret = tms_live_handle_audio(feed, pkt, frame);
+    av_packet_unref(pkt);
+  }
+  av_frame_free(&frame);
+  av_packet_free(&pkt);
+
+  /* 通知所有观看者直播结束 */
+  janus_mutex_lock(&live_mutex);
+  tms_live_feed_remove_locked(feed);
+  janus_mutex_unlock(&live_mutex);
+  janus_mutex_lock(&feed->mutex);
+  g_atomic_int_set(&feed->ended, 1);
+  GList *item = feed->subscribers;
+  for (; item; item = item->next)
+    g_async_queue_push(((TmsLiveSubscriber *)item->data)->queue, &tms_live_eof);
+  janus_mutex_unlock(&feed->mutex);
+
+  JANUS_LOG(LOG_INFO, "[TmsPlay] 退出直播读取线程 %s，转发 %ld 个视频包，%ld 个音频包，丢弃 %ld 个包，用时：%ld微秒\n", feed->url, feed->nb_video_packets, feed->nb_audio_packets, feed->nb_dropped, av_gettime_relative() - feed->start_us);
+  tms_live_feed_unref(feed);
+
+  return NULL;
+}
+/* 创建直播源并启动读取线程，需要持有live_mutex */
+static TmsLiveFeed *tms_live_feed_new_locked(const char *key, const char *url, int audio_codec)
+{
+  TmsLiveFeed *feed = g_malloc0(sizeof(TmsLiveFeed));
+  feed->url = g_strdup(url);
+  feed->key = g_strdup(key);
+  feed->audio_codec = audio_codec;
+  feed->probesize = live_probesize;
+  feed->analyzeduration = live_analyzeduration;
+  feed->video_index = -1;
+  feed->audio_index = -1;
+  feed->origin_us = AV_NOPTS_VALUE;
+  feed->last_us = AV_NOPTS_VALUE;
+  feed->start_us = av_gettime_relative();
+  feed->last_read_us = feed->start_us;
+  feed->refs = 1; // 读取线程
+  janus_mutex_init(&feed->mutex);
+  janus_condition_init(&feed->cond);
+
+  GError *error = NULL;
+  GThread *thread = g_thread_try_new("tms live", tms_live_ingest_thread, feed, &error);
+  if (error != NULL)
+  {
+    JANUS_LOG(LOG_ERR, "[TmsPlay] 启动直播读取线程发生错误：%d (%s)\n", error->code, error->message ? error->message : "??");
+    g_error_free(error);
+    tms_live_feed_free(feed);
+    return NULL;
+  }
+  g_thread_unref(thread);
+  g_hash_table_insert(live_feeds, feed->key, feed);
+
+  return feed;
+}
+/**
+ * 观看直播，同一个地址和音频编码的观看者共用1个读取线程
+ *
+ * 等待直播源完成打开，失败时返回NULL
+ */
+TmsLiveSubscriber *tms_live_subscribe(const char *url, int audio_codec)
+{
+  janus_mutex_lock(&live_mutex);
+  if (live_feeds == NULL)
+  {
+    janus_mutex_unlock(&live_mutex);
+    return NULL;
+  }
+  char *key = g_strdup_printf("%s:%s", tms_audio_codec_name(audio_codec), url);
+  TmsLiveFeed *feed = g_hash_table_lookup(live_feeds, key);
+  if (feed == NULL)
+    feed = tms_live_feed_new_locked(key, url, audio_codec);
+  g_free(key);
+  if (feed == NULL)
+  {
+    janus_mutex_unlock(&live_mutex);
+    return NULL;
+  }
+  TmsLiveSubscriber *sub = g_malloc0(sizeof(TmsLiveSubscriber));
+  sub->feed = feed;
+  sub->queue = g_async_queue_new_full(tms_live_free_packet);
+  sub->need_keyframe = 1;
+  feed->refs++;
+  janus_mutex_lock(&feed->mutex);
+  feed->subscribers = g_list_append(feed->subscribers, sub);
+  janus_mutex_unlock(&feed->mutex);
+  janus_mutex_unlock(&live_mutex);
+
+  janus_mutex_lock(&feed->mutex);
+  while (!feed->ready)
+    janus_condition_wait(&feed->cond, &feed->mutex);
+  int ret = feed->ret;
+  janus_mutex_unlock(&feed->mutex);
+  if (ret < 0)
+  {
+    tms_live_unsubscribe(sub);
+    return NULL;
+  }
+  JANUS_LOG(LOG_VERB, "[TmsPlay] 观看直播 %s\n", url);
+
+  return sub;
+}
+/* 停止观看直播，最后1个观看者离开时停止读取 */
+void tms_live_unsubscribe(TmsLiveSubscriber *sub)
+{
+  TmsLiveFeed *feed = sub->feed;
+
+  janus_mutex_lock(&live_mutex);
+  janus_mutex_lock(&feed->mutex);
+  feed->subscribers = g_list_remove(feed->subscribers, sub);
+  if (feed->subscribers == NULL)
+  {
+    g_atomic_int_set(&feed->stopping, 1);
+    tms_live_feed_remove_locked(feed);
+  }
+  janus_mutex_unlock(&feed->mutex);
+  janus_mutex_unlock(&live_mutex);
+
+  g_async_queue_unref(sub->queue);
+  g_free(sub);
+  tms_live_feed_unref(feed);
+}
+/**
+ * 获得直播的媒体流数量，直播没有时长
+ *
+ * 在会话的消息处理线程中调用，直播源没有响应时最多等待TMS_LIVE_PROBE_TIMEOUT_US
+ */
+int tms_live_probe(const char *url, int *nb_streams, int64_t *duration)
+{
+  AVFormatContext *ictx = NULL;
+  int64_t deadline_us = av_gettime_relative() + TMS_LIVE_PROBE_TIMEOUT_US;
+  AVIOInterruptCB interrupt = {.callback = tms_live_probe_interrupt, .opaque = &deadline_us};
+  int ret = tms_live_open_input(&ictx, url, live_probesize, live_analyzeduration, &interrupt);
+  if (ret < 0)
+  {
+    JANUS_LOG(LOG_VERB, "[TmsPlay] 无法打开直播 %s %s\n", url, av_err2str(ret));
+    return -1;
+  }
+  *nb_streams = ictx->nb_streams;
+  *duration = AV_NOPTS_VALUE;
+  avformat_close_input(&ictx);
+
+  return 0;
+}
+/* 初始化直播转发，probesize和analyze_ms为0时使用默认值 */
+int tms_live_init(int probesize, int analyze_ms)
+{
+  if (probesize > 0)
+    live_probesize = probesize;
+  if (analyze_ms > 0)
+    live_analyzeduration = (int64_t)analyze_ms * 1000;
+  avformat_network_init();
+  janus_mutex_init(&live_mutex);
+  live_feeds = g_hash_table_new(g_str_hash, g_str_equal);
+
+  return 0;
+}
+/* 停止所有直播源的读取，观看者收到直播结束 */
+void tms_live_destroy(void)
+{
+  janus_mutex_lock(&live_mutex);
+  if (live_feeds != NULL)
+  {
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, live_feeds);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+      g_atomic_int_set(&((TmsLiveFeed *)value)->stopping, 1);
+    g_hash_table_destroy(live_feeds);
+    live_feeds = NULL;
+  }
+  janus_mutex_unlock(&live_mutex);
+  avformat_network_deinit();
+}
+/* 正在转发的直播源和观看者数量 */
+json_t *tms_live_status(void)
+{
+  json_t *feeds = json_array();
+
+  janus_mutex_lock(&live_mutex);
+  if (live_feeds != NULL)
+  {
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, live_feeds);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+    {
+      TmsLiveFeed *feed = (TmsLiveFeed *)value;
+      json_t *item = json_object();
+      janus_mutex_lock(&feed->mutex);
+      json_object_set_new(item, "url", json_string(feed->url));
+      json_object_set_new(item, "audio_codec", json_string(tms_audio_codec_name(feed->audio_codec)));
+      json_object_set_new(item, "ready", json_boolean(feed->ready && feed->ret == 0));
+      json_object_set_new(item, "viewers", json_integer(g_list_length(feed->subscribers)));
+      json_object_set_new(item, "video", json_boolean(feed->dovideo));
+      json_object_set_new(item, "audio", json_boolean(feed->doaudio));
+      json_object_set_new(item, "video_packets", json_integer(feed->nb_video_packets));
+      json_object_set_new(item, "audio_packets", json_integer(feed->nb_audio_packets));
+      json_object_set_new(item, "dropped", json_integer(feed->nb_dropped));
+      json_object_set_new(item, "discontinuities", json_integer(feed->nb_discontinuities));
+      json_object_set_new(item, "uptime_ms", json_integer((av_gettime_relative() - feed->start_us) / 1000));
+      janus_mutex_unlock(&feed->mutex);
+      json_array_append_new(feeds, item);
+    }
+  }
+  janus_mutex_unlock(&live_mutex);
+
+  return feeds;
+}
+
+#endif
@@ -0,0 +1,168 @@
+#ifndef TMS_PLAY_PACER_H
+#define TMS_PLAY_PACER_H
+
+#include "tms_play.h"
+#include "tms_play_clock.h"
+#include "tms_play_trace.h"
+
+#define TMS_PACER_BUCKET_SIZE 6000 // 令牌桶容量，字节，允许4个满包连续发送
+
+/**
+ * 视频帧内发包平滑
+ * 
+ * 关键帧拆分出的几十上百个FU-A包如果连续发送，会在受限的接入链路上造成丢包。
+ * 用令牌桶按峰值速率发送1帧中的包，并把发送时间分散在帧间隔的一部分内，
+ * 最后1个包的发送时间不会晚于截止时间。
+ */
+typedef struct TmsVideoPacer
+{
+  int enabled;
+  TmsClock *clock;       // 读取时间和等待使用的时钟
+  int64_t peak_rate;     // 峰值速率，字节/秒
+  int spread;            // 1帧的包最多分散在帧间隔的百分之多少内
+  int64_t tokens;        // 令牌桶中剩余的令牌，字节
+  int64_t last_fill_us;  // 最近1次补充令牌的时间，微秒
+  int64_t deadline_us;   // 当前帧最后1个包的发送截止时间，微秒
+  /* 突发统计，连续发送（中间没有等待）的包数为1次突发 */
+  int nb_frame_rtps;     // 当前帧的rtp包数量，即不平滑时的突发包数
+  int cur_burst;         // 当前突发的包数
+  int max_frame_burst;   // 当前帧平滑后的最大突发包数
+  int nb_frames;         // 累计发送的帧数
+  int64_t sum_burst_before; // 累计平滑前的突发包数
+  int64_t sum_burst_after;  // 累计平滑后的突发包数
+  int max_burst_before;  // 平滑前的最大突发包数
+  int max_burst_after;   // 平滑后的最大突发包数
+} TmsVideoPacer;
+
+int tms_init_video_pacer(TmsVideoPacer *pacer, TmsClock *clock, int peak_kbps, int spread);
+void tms_video_pacer_begin_frame(TmsVideoPacer *pacer, int64_t frame_duration_us);
+void tms_video_pacer_wait(TmsVideoPacer *pacer, int size);
+void tms_video_pacer_end_frame(TmsVideoPacer *pacer, TmsTraceRing *trace);
+
+/**
+ * 所有播放的发送延迟
+ * 
+ * 按媒体时间应该发送到实际发送之间的延迟，指数加权平均，微秒。节点过载时延迟会整体增加，用于准入控制。
+ */
+#define TMS_LATENESS_STALE_US 2000000 // 超过这个时间没有更新，认为没有延迟
+
+static volatile gint lateness_avg_us = 0;
+static int64_t lateness_update_us = 0;
+
+/* 更新发送延迟，多个播放线程并发更新，只是统计数据，不要求精确 */
+static void tms_update_lateness(int64_t lateness_us)
+{
+  gint avg = g_atomic_int_get(&lateness_avg_us);
+  lateness_us = FFMIN(FFMAX(lateness_us, 0), AV_TIME_BASE);
+  g_atomic_int_set(&lateness_avg_us, avg + (gint)((lateness_us - avg) / 16));
+  lateness_update_us = av_gettime_relative();
+}
+/* 获得所有播放最近的平均发送延迟，微秒 */
+int tms_play_lateness(void)
+{
+  if (av_gettime_relative() - lateness_update_us > TMS_LATENESS_STALE_US)
+    return 0;
+
+  return g_atomic_int_get(&lateness_avg_us);
+}
+/**
+ * 等待到媒体时间media_us（相对于文件起始时间）的发送时间，返回等待前已经播放的时间，微秒
+ * 
+ * 启用快速启动时，媒体最多可以领先实时fast_start_us发送，让浏览器尽快填满抖动缓冲区并收到完整的关键帧。
+ * 领先的部分按fast_start_rate限速发送，领先量达到上限后按正常速度发送，一直保持领先。
+ */
+static int64_t tms_wait_media_time(TmsPlayContext *play, int64_t media_us)
+{
+  int64_t now_us = tms_clock_now(play->clock);
+  int64_t elapse_us = now_us - play->start_time_us - play->pause_duration_us;
+  if (play->nopacing)
+    return elapse_us;
+
+  int64_t deadline_us = tms_clock_deadline_us(play, media_us);
+  if (play->fast_start_us > 0)
+  {
+    int64_t lead_us = deadline_us - play->fast_start_us;
+    if (play->fast_start_rate > 0)
+    {
+      /* 从开始播放到现在发送的字节数不超过限速 */
+      int64_t nb_octets = play->nb_video_octets + play->nb_audio_octets;
+      lead_us = FFMAX(lead_us, play->fast_start_begin_us + nb_octets * AV_TIME_BASE / play->fast_start_rate);
+    }
+    deadline_us = FFMIN(deadline_us, lead_us);
+  }
+  if (deadline_us > now_us)
+    tms_clock_sleep(play->clock, deadline_us - now_us);
+  /* 虚拟时钟没有延迟，不计入节点的发送延迟 */
+  if (!play->clock->is_virtual)
+    tms_update_lateness(tms_clock_now(play->clock) - deadline_us);
+
+  return elapse_us;
+}
+/* 初始化视频发包平滑，peak_kbps为0时不平滑 */
+int tms_init_video_pacer(TmsVideoPacer *pacer, TmsClock *clock, int peak_kbps, int spread)
+{
+  memset(pacer, 0, sizeof(TmsVideoPacer));
+  pacer->clock = clock;
+  pacer->enabled = peak_kbps > 0;
+  pacer->peak_rate = (int64_t)peak_kbps * 1000 / 8;
+  pacer->spread = spread > 0 && spread <= 100 ? spread : 50;
+  pacer->tokens = TMS_PACER_BUCKET_SIZE;
+  pacer->last_fill_us = tms_clock_now(clock);
+
+  return 0;
+}
+/* 开始发送1帧，根据帧时长计算最后1个包的截止时间 */
+void tms_video_pacer_begin_frame(TmsVideoPacer *pacer, int64_t frame_duration_us)
+{
+  pacer->deadline_us = tms_clock_now(pacer->clock) + frame_duration_us * pacer->spread / 100;
+  pacer->nb_frame_rtps = 0;
+  pacer->cur_burst = 0;
+  pacer->max_frame_burst = 0;
+}
+/* 发送1个包前等待令牌，等待不超过当前帧的截止时间 */
+void tms_video_pacer_wait(TmsVideoPacer *pacer, int size)
+{
+  pacer->nb_frame_rtps++;
+
+  if (pacer->enabled)
+  {
+    int64_t now_us = tms_clock_now(pacer->clock);
+    pacer->tokens = FFMIN(pacer->tokens + (now_us - pacer->last_fill_us) * pacer->peak_rate / AV_TIME_BASE, TMS_PACER_BUCKET_SIZE);
+    pacer->last_fill_us = now_us;
+    if (pacer->tokens < size)
+    {
+      int64_t wake_us = FFMIN(now_us + (size - pacer->tokens) * AV_TIME_BASE / pacer->peak_rate, pacer->deadline_us);
+      if (wake_us > now_us)
+      {
+        tms_clock_sleep(pacer->clock, wake_us - now_us);
+        /* 等待后开始新的突发 */
+        pacer->max_frame_burst = FFMAX(pacer->max_frame_burst, pacer->cur_burst);
+        pacer->cur_burst = 0;
+        now_us = tms_clock_now(pacer->clock);
+        pacer->tokens = FFMIN(pacer->tokens + (now_us - pacer->last_fill_us) * pacer->peak_rate / AV_TIME_BASE, TMS_PACER_BUCKET_SIZE);
+        pacer->last_fill_us = now_us;
+      }
+    }
+    /* 超过截止时间时直接发送，令牌可以透支 */
+    pacer->tokens -= size;
+  }
+
+  pacer->cur_burst++;
+}
+/* 完成1帧发送，统计并在跟踪记录中记录平滑前后的突发包数 */
+void tms_video_pacer_end_frame(TmsVideoPacer *pacer, TmsTraceRing *trace)
+{
+  if (pacer->nb_frame_rtps == 0)
+    return;
+
+  pacer->max_frame_burst = FFMAX(pacer->max_frame_burst, pacer->cur_burst);
+  pacer->nb_frames++;
+  pacer->sum_burst_before += pacer->nb_frame_rtps;
+  pacer->sum_burst_after += pacer->max_frame_burst;
+  pacer->max_burst_before = FFMAX(pacer->max_burst_before, pacer->nb_frame_rtps);
+  pacer->max_burst_after = FFMAX(pacer->max_burst_after, pacer->max_frame_burst);
+
+  tms_trace(trace, TMS_TRACE_VIDEO_BURST, pacer->nb_frames, pacer->nb_frame_rtps, 0, pacer->max_frame_burst);
+}
+
+#endif
@@ -2,6 +2,9 @@
 #define ALAW_SAMPLE_RATE 8000 // alaw采样率
 #define ALAW_PAYLOAD_TYPE 8
 #define RTP_PCMA_TIME_BASE 8000 // RTP中pcma流的时间
+#define OPUS_SAMPLE_RATE 48000  // opus编码的采样率
+#define OPUS_PAYLOAD_TYPE 111   // opus的动态负载类型，和sdp中的rtpmap一致
+#define RTP_OPUS_TIME_BASE 48000 // RTP中opus流的时间，固定为48k
 
 #ifndef TMS_PLAY_PCMA_H
 #define TMS_PLAY_PCMA_H
@@ -9,27 +12,59 @@
 #include <rtp.h>
 
 #include "tms_play.h"
+#include "tms_play_cache.h"
+#include "tms_play_capture.h"
+#include "tms_play_clock.h"
+#include "tms_play_decimate.h"
+#include "tms_play_rtcp.h"
+#include "tms_play_sched.h"
 #include "tms_play_stream.h"
+#include "tms_play_trace.h"
 /**
- * PCMA编码器 
+ * 音频编码器，PCMA或Opus
+ * 
+ * PCMA每个重采样后的帧直接编码；Opus要求固定的帧长，重采样后的采样先放入fifo，凑够1帧再编码
  */
 typedef struct PCMAEnc
 {
+  int audio_codec; // TMS_AUDIO_CODEC_PCMA或TMS_AUDIO_CODEC_OPUS
   AVCodec *codec;
   AVCodecContext *cctx;
   int nb_samples;
+  int frame_size;       // 每次编码的采样数，0表示不限制
+  AVAudioFifo *fifo;    // 不足1帧的采样，只有frame_size不为0时使用
   AVFrame *frame;
   AVPacket packet;
 } PCMAEnc;
+/* 重采样的方式 */
+enum
+{
+  TMS_RESAMPLE_SWR = 0,   // 通用重采样，libswresample
+  TMS_RESAMPLE_BYPASS,    // 输入已经是8k单声道s16，直接复制
+  TMS_RESAMPLE_DECIMATE,  // 整数倍抽取
+  TMS_RESAMPLE_NB_MODES
+};
+
+static const char *tms_resample_mode_names[TMS_RESAMPLE_NB_MODES] = {"swr", "bypass", "decimate"};
 /**
  * 重采样 
  */
 typedef struct Resampler
 {
+  int mode; // 重采样的方式
   SwrContext *swrctx;
+  TmsDecimator decimator;
+  /* 选择重采样方式时的输入参数，帧的参数变化时重新选择 */
+  int in_sample_fmt;
+  int in_sample_rate;
+  int in_channels;
   int max_nb_samples; // 重采样缓冲区最大采样数
   int linesize;       // 声道平面尺寸
   uint8_t **data;     // 重采样缓冲区
+  /* 每种方式的耗时统计 */
+  int64_t nb_frames[TMS_RESAMPLE_NB_MODES];
+  int64_t nb_samples[TMS_RESAMPLE_NB_MODES];
+  int64_t elapse_us[TMS_RESAMPLE_NB_MODES];
 } Resampler;
 /**
  * rtp包发送 
@@ -39,25 +74,76 @@ typedef struct TmsAudioRtpContext
   uint32_t base_timestamp;
   uint32_t cur_timestamp; //
   int8_t payload_type;
+  int clock_rate;         // rtp时间戳的频率，PCMA为8k，Opus为48k
+  int64_t last_rtp_us; // 最近1个rtp包的发送时间，微秒
 } TmsAudioRtpContext;
 
 int tms_init_pcma_encoder(PCMAEnc *encoder);
+int tms_init_opus_encoder(PCMAEnc *encoder);
+int tms_init_audio_encoder(PCMAEnc *encoder, int audio_codec);
+void tms_free_audio_encoder(PCMAEnc *encoder);
+int tms_opus_init(int kbps, int complexity, int frame_ms);
 int tms_init_audio_resampler(AVCodecContext *input_codec_context,
                              AVCodecContext *output_codec_context,
                              Resampler *resampler);
-int tms_init_audio_rtp_context(TmsAudioRtpContext *audio_rtp_ctx, uint32_t base_timestamp);
+void tms_free_audio_resampler(Resampler *resampler);
+int tms_init_audio_rtp_context(TmsAudioRtpContext *audio_rtp_ctx, uint32_t base_timestamp, int audio_codec);
+
+static int opus_bit_rate = 24000;  // opus编码的比特率
+static int opus_complexity = 5;    // opus编码的复杂度，0-10，越大音质越好，CPU占用越高
+static int opus_frame_ms = 20;     // opus每帧的时长，毫秒
+
+/* 音频编码的名称 */
+const char *tms_audio_codec_name(int audio_codec)
+{
+  return audio_codec == TMS_AUDIO_CODEC_OPUS ? "opus" : "pcma";
+}
+/* 按名称获得音频编码，不支持的名称返回-1 */
+int tms_audio_codec_from_name(const char *name)
+{
+  if (name == NULL || !g_ascii_strcasecmp(name, "pcma"))
+    return TMS_AUDIO_CODEC_PCMA;
+  if (!g_ascii_strcasecmp(name, "opus"))
+    return TMS_AUDIO_CODEC_OPUS;
+
+  return -1;
+}
+/* 是否有可用的编码器 */
+gboolean tms_audio_codec_available(int audio_codec)
+{
+  if (audio_codec == TMS_AUDIO_CODEC_OPUS)
+    return avcodec_find_encoder_by_name("libopus") != NULL;
+
+  return avcodec_find_encoder(AV_CODEC_ID_PCM_ALAW) != NULL;
+}
+/* 设置opus编码参数，超出范围的参数使用默认值 */
+int tms_opus_init(int kbps, int complexity, int frame_ms)
+{
+  if (kbps >= 6 && kbps <= 510)
+    opus_bit_rate = kbps * 1000;
+  if (complexity >= 0 && complexity <= 10)
+    opus_complexity = complexity;
+  if (frame_ms == 10 || frame_ms == 20 || frame_ms == 40 || frame_ms == 60)
+    opus_frame_ms = frame_ms;
+  JANUS_LOG(LOG_VERB, "[TmsPlay] opus编码：%d bps，复杂度 %d，帧长 %d 毫秒\n", opus_bit_rate, opus_complexity, opus_frame_ms);
+
+  return 0;
+}
 
 /* 初始化音频rtp发送上下文 */
-int tms_init_audio_rtp_context(TmsAudioRtpContext *rtp_ctx, uint32_t base_timestamp)
+int tms_init_audio_rtp_context(TmsAudioRtpContext *rtp_ctx, uint32_t base_timestamp, int audio_codec)
 {
+  rtp_ctx->clock_rate = audio_codec == TMS_AUDIO_CODEC_OPUS ? RTP_OPUS_TIME_BASE : RTP_PCMA_TIME_BASE;
   // rtp_ctx->base_timestamp = base_timestamp;
   /**
    * base_timestamp是个全局的时间点，rtp对应的是一个文件的播放，需要把文件的起点和全局的起点对齐 
    */
-  rtp_ctx->base_timestamp = (av_gettime_relative() - base_timestamp) / 1000 * 8; // pcma/8000
+  rtp_ctx->base_timestamp = tms_clock_base_timestamp(base_timestamp, rtp_ctx->clock_rate);
   rtp_ctx->cur_timestamp = rtp_ctx->base_timestamp;
 
-  rtp_ctx->payload_type = ALAW_PAYLOAD_TYPE;
+  rtp_ctx->payload_type = audio_codec == TMS_AUDIO_CODEC_OPUS ? OPUS_PAYLOAD_TYPE : ALAW_PAYLOAD_TYPE;
+
+  rtp_ctx->last_rtp_us = 0;
 
   return 0;
 }
@@ -97,26 +183,92 @@ int tms_init_pcma_encoder(PCMAEnc *encoder)
   if (avcodec_open2(cctx, c, NULL) < 0)
   {
     JANUS_LOG(LOG_VERB, "打开编码器失败\n");
+    avcodec_free_context(&cctx);
     return -1;
   }
 
+  encoder->audio_codec = TMS_AUDIO_CODEC_PCMA;
   encoder->codec = c;
   encoder->cctx = cctx;
+  encoder->frame_size = 0;
+  encoder->fifo = NULL;
 
   return 0;
 }
 /**
- * Initialize the audio resampler based on the input and encoder codec settings.
- * If the input and encoder sample formats differ, a conversion is required
- * libswresample takes care of this, but requires initialization.
- * @param      input_codec_context  Codec context of the input file
- * @param      output_codec_context Codec context of the encoder file
- * @param[out] resample_context     Resample context for the required conversion
- * @return Error code (0 if successful)
+ * 初始化音频编码器（转换为opus格式）
+ * 
+ * 使用libopus，48k单声道，帧长由opus_frame_ms指定，编码器要求每次送入完整的1帧
  */
-int tms_init_audio_resampler(AVCodecContext *input_codec_context,
-                             AVCodecContext *output_codec_context,
-                             Resampler *resampler)
+int tms_init_opus_encoder(PCMAEnc *encoder)
+{
+  AVCodec *c = avcodec_find_encoder_by_name("libopus");
+  if (!c)
+  {
+    JANUS_LOG(LOG_VERB, "没有找到opus编码器\n");
+    return -1;
+  }
+
+  AVCodecContext *cctx = avcodec_alloc_context3(c);
+  if (!cctx)
+  {
+    JANUS_LOG(LOG_VERB, "分配opus编码器上下文失败\n");
+    return -1;
+  }
+  cctx->bit_rate = opus_bit_rate;
+  cctx->compression_level = opus_complexity;
+  cctx->sample_fmt = AV_SAMPLE_FMT_S16;
+  cctx->sample_rate = OPUS_SAMPLE_RATE;
+  cctx->channel_layout = AV_CH_LAYOUT_MONO;
+  cctx->channels = av_get_channel_layout_nb_channels(cctx->channel_layout);
+
+  AVDictionary *options = NULL;
+  av_dict_set_int(&options, "frame_duration", opus_frame_ms, 0);
+  int ret = avcodec_open2(cctx, c, &options);
+  av_dict_free(&options);
+  if (ret < 0)
+  {
+    JANUS_LOG(LOG_VERB, "打开opus编码器失败 %s\n", av_err2str(ret));
+    avcodec_free_context(&cctx);
+    return -1;
+  }
+  encoder->fifo = av_audio_fifo_alloc(cctx->sample_fmt, cctx->channels, cctx->frame_size);
+  if (!encoder->fifo)
+  {
+    avcodec_free_context(&cctx);
+    return -1;
+  }
+
+  encoder->audio_codec = TMS_AUDIO_CODEC_OPUS;
+  encoder->codec = c;
+  encoder->cctx = cctx;
+  encoder->frame_size = cctx->frame_size;
+
+  return 0;
+}
+/* 按指定的编码初始化音频编码器 */
+int tms_init_audio_encoder(PCMAEnc *encoder, int audio_codec)
+{
+  if (audio_codec == TMS_AUDIO_CODEC_OPUS)
+    return tms_init_opus_encoder(encoder);
+
+  return tms_init_pcma_encoder(encoder);
+}
+/* 释放音频编码器 */
+void tms_free_audio_encoder(PCMAEnc *encoder)
+{
+  if (encoder->cctx)
+    avcodec_free_context(&encoder->cctx);
+  if (encoder->fifo)
+  {
+    av_audio_fifo_free(encoder->fifo);
+    encoder->fifo = NULL;
+  }
+  if (encoder->frame)
+    av_frame_free(&encoder->frame);
+}
+/* 创建libswresample上下文 */
+static int tms_init_swr(Resampler *resampler, AVCodecContext *output_codec_context)
 {
   int error;
 
@@ -133,9 +285,9 @@ int tms_init_audio_resampler(AVCodecContext *input_codec_context,
                                          av_get_default_channel_layout(output_codec_context->channels),
                                          output_codec_context->sample_fmt,
                                          output_codec_context->sample_rate,
-                                         av_get_default_channel_layout(input_codec_context->channels),
-                                         input_codec_context->sample_fmt,
-                                         input_codec_context->sample_rate,
+                                         av_get_default_channel_layout(resampler->in_channels),
+                                         resampler->in_sample_fmt,
+                                         resampler->in_sample_rate,
                                          0, NULL);
   if (!*resample_context)
   {
@@ -150,18 +302,122 @@ int tms_init_audio_resampler(AVCodecContext *input_codec_context,
     return error;
   }
 
-  resampler->data = av_calloc(1, sizeof(**resampler->data));
+  return 0;
+}
+/**
+ * 根据输入参数选择重采样方式
+ *
+ * 输入已经是输出采样率（PCMA为8k，Opus为48k）的单声道s16时不做转换；输入采样率是输出采样率的整数倍时用抽取；其它采样率（例如：44.1k）用libswresample
+ */
+static int tms_config_resampler(Resampler *resampler, int in_sample_fmt, int in_sample_rate, int in_channels, AVCodecContext *output_codec_context)
+{
+  if (resampler->swrctx)
+    swr_free(&resampler->swrctx);
+  tms_free_decimator(&resampler->decimator);
+
+  resampler->in_sample_fmt = in_sample_fmt;
+  resampler->in_sample_rate = in_sample_rate;
+  resampler->in_channels = in_channels;
+
+  int out_sample_rate = output_codec_context->sample_rate;
+  if (in_sample_rate == out_sample_rate && in_channels == 1 && (in_sample_fmt == AV_SAMPLE_FMT_S16 || in_sample_fmt == AV_SAMPLE_FMT_S16P))
+  {
+    resampler->mode = TMS_RESAMPLE_BYPASS;
+  }
+  else if (tms_decimator_supports_format(in_sample_fmt) && tms_init_decimator(&resampler->decimator, in_sample_rate, out_sample_rate) == 0)
+  {
+    resampler->mode = TMS_RESAMPLE_DECIMATE;
+  }
+  else
+  {
+    tms_free_decimator(&resampler->decimator);
+    resampler->mode = TMS_RESAMPLE_SWR;
+    int ret = tms_init_swr(resampler, output_codec_context);
+    if (ret < 0)
+      return ret;
+  }
+  JANUS_LOG(LOG_VERB, "音频重采样方式 %s，输入 format = %s , sample_rate = %d , channels = %d\n", tms_resample_mode_names[resampler->mode], av_get_sample_fmt_name(in_sample_fmt), in_sample_rate, in_channels);
 
   return 0;
 }
+/**
+ * Initialize the audio resampler based on the input and encoder codec settings.
+ * If the input and encoder sample formats differ, a conversion is required
+ * libswresample takes care of this, but requires initialization.
+ * @param      input_codec_context  Codec context of the input file
+ * @param      output_codec_context Codec context of the encoder file
+ * @param[out] resample_context     Resample context for the required conversion
+ * @return Error code (0 if successful)
+ */
+int tms_init_audio_resampler(AVCodecContext *input_codec_context,
+                             AVCodecContext *output_codec_context,
+                             Resampler *resampler)
+{
+  int error;
+
+  if ((error = tms_config_resampler(resampler, input_codec_context->sample_fmt, input_codec_context->sample_rate, input_codec_context->channels, output_codec_context)) < 0)
+    return error;
+
+  resampler->data = av_calloc(1, sizeof(*resampler->data));
+  if (!resampler->data)
+    return AVERROR(ENOMEM);
+
+  return 0;
+}
+/* 释放重采样资源，输出每种方式的耗时统计 */
+void tms_free_audio_resampler(Resampler *resampler)
+{
+  int mode = 0;
+  for (; mode < TMS_RESAMPLE_NB_MODES; mode++)
+  {
+    if (resampler->nb_frames[mode] == 0)
+      continue;
+    JANUS_LOG(LOG_INFO, "音频重采样方式 %s，帧数 %" PRId64 "，采样数 %" PRId64 "，耗时 %" PRId64 " 微秒，平均每帧 %.2f 微秒\n", tms_resample_mode_names[mode], resampler->nb_frames[mode], resampler->nb_samples[mode], resampler->elapse_us[mode], (double)resampler->elapse_us[mode] / resampler->nb_frames[mode]);
+  }
+
+  if (resampler->swrctx)
+    swr_free(&resampler->swrctx);
+  tms_free_decimator(&resampler->decimator);
+  if (resampler->data)
+  {
+    av_freep(&resampler->data[0]);
+    av_freep(&resampler->data);
+  }
+  resampler->max_nb_samples = 0;
+}
 /**
  * 执行音频重采样
+ *
+ * 重采样后的采样数记录在encoder->nb_samples中，可能为0（抽取或swr缓存了不足1个输出采样的输入）
  */
 int tms_audio_resample(Resampler *resampler, AVFrame *frame, PCMAEnc *encoder)
 {
   int ret = 0;
+  int64_t begin_us = av_gettime_relative();
+
+  /* 帧的参数和选择重采样方式时不一致，重新选择 */
+  if (frame->format != resampler->in_sample_fmt || frame->sample_rate != resampler->in_sample_rate || frame->channels != resampler->in_channels)
+  {
+    JANUS_LOG(LOG_VERB, "音频帧参数变化，重新选择重采样方式\n");
+    if ((ret = tms_config_resampler(resampler, frame->format, frame->sample_rate, frame->channels, encoder->cctx)) < 0)
+      goto end;
+  }
 
-  int nb_resample_samples = av_rescale_rnd(swr_get_delay(resampler->swrctx, frame->sample_rate) + frame->nb_samples, encoder->cctx->sample_rate, frame->sample_rate, AV_ROUND_UP);
+  int nb_resample_samples;
+  if (resampler->mode == TMS_RESAMPLE_BYPASS)
+  {
+    nb_resample_samples = frame->nb_samples;
+  }
+  else if (resampler->mode == TMS_RESAMPLE_DECIMATE)
+  {
+    TmsDecimator *decimator = &resampler->decimator;
+    int nb_available = decimator->nb_buffered + frame->nb_samples;
+    nb_resample_samples = nb_available < decimator->nb_taps ? 0 : (nb_available - decimator->nb_taps) / decimator->factor + 1;
+  }
+  else
+  {
+    nb_resample_samples = av_rescale_rnd(swr_get_delay(resampler->swrctx, frame->sample_rate) + frame->nb_samples, encoder->cctx->sample_rate, frame->sample_rate, AV_ROUND_UP);
+  }
 
   /* 分配缓冲区 */
   if (nb_resample_samples > resampler->max_nb_samples)
@@ -178,14 +434,31 @@ int tms_audio_resample(Resampler *resampler, AVFrame *frame, PCMAEnc *encoder)
     resampler->max_nb_samples = nb_resample_samples;
   }
 
-  ret = swr_convert(resampler->swrctx, resampler->data, nb_resample_samples, (const uint8_t **)frame->data, frame->nb_samples);
+  if (resampler->mode == TMS_RESAMPLE_BYPASS)
+  {
+    memcpy(resampler->data[0], frame->extended_data[0], nb_resample_samples * sizeof(int16_t));
+    ret = nb_resample_samples;
+  }
+  else if (resampler->mode == TMS_RESAMPLE_DECIMATE)
+  {
+    ret = tms_decimate(&resampler->decimator, frame, (int16_t *)resampler->data[0], nb_resample_samples);
+  }
+  else
+  {
+    ret = swr_convert(resampler->swrctx, resampler->data, nb_resample_samples, (const uint8_t **)frame->extended_data, frame->nb_samples);
+  }
   if (ret < 0)
   {
-    JANUS_LOG(LOG_VERB, "Could not allocate destination samples\n");
+    JANUS_LOG(LOG_VERB, "Could not convert input samples (error '%s')\n", av_err2str(ret));
     goto end;
   }
 
-  encoder->nb_samples = nb_resample_samples;
+  /* 实际输出的采样数 */
+  encoder->nb_samples = ret;
+
+  resampler->nb_frames[resampler->mode]++;
+  resampler->nb_samples[resampler->mode] += ret;
+  resampler->elapse_us[resampler->mode] += av_gettime_relative() - begin_us;
 
 end:
   return ret;
@@ -202,15 +475,15 @@ void tms_init_pcma_packet(AVPacket *packet)
   packet->size = 0;
 }
 /**
+ * 分配nb_samples个采样的编码帧，记录在encoder->frame中
  * @return Error code (0 if successful)
  */
-int tms_init_pcma_frame(PCMAEnc *encoder, Resampler *resampler)
+int tms_init_pcma_frame(PCMAEnc *encoder, int nb_samples)
 {
   int error;
 
   AVFrame *frame;
   AVCodecContext *cctx = encoder->cctx;
-  int nb_samples = encoder->nb_samples;
 
   /* Create a new frame to store the audio samples. */
   if (!(frame = av_frame_alloc()))
@@ -237,60 +510,38 @@ int tms_init_pcma_frame(PCMAEnc *encoder, Resampler *resampler)
     return error;
   }
 
-  memcpy(frame->data[0], *(resampler->data), nb_samples * 2);
-
   encoder->frame = frame;
 
   return 0;
 }
 
-/* 输出音频帧调试信息 */
-static void tms_dump_audio_frame(AVFrame *frame, TmsPlayContext *play)
+/**
+ * 添加音频帧发送延时，pts_us和duration_us分别为帧的播放时间和时长
+ * 
+ * 和视频使用相同的媒体时钟，按帧的时间戳计算发送时间，不累加帧的时长；返回晚于发送时间的时长，微秒
+ */
+static int64_t tms_add_audio_frame_send_delay(int64_t pts_us, int64_t duration_us, TmsPlayContext *play)
 {
-  // 	uint8_t *frame_dat = frame->extended_data[0];
-  // 	ast_debug(2, "frame前8个字节 %02x %02x %02x %02x %02x %02x %02x %02x \n", frame_dat[0], frame_dat[1], frame_dat[2], frame_dat[3], frame_dat[4], frame_dat[5], frame_dat[6], frame_dat[7]);
+  if (play->nopacing)
+    return 0;
 
-  const char *frame_fmt = av_get_sample_fmt_name(frame->format);
-
-  JANUS_LOG(LOG_VERB, "从音频包 #%d 中读取音频帧 #%d, format = %s , sample_rate = %d , channels = %d , nb_samples = %d, pts = %ld, best_effort_timestamp = %ld\n", play->nb_audio_packets, play->nb_audio_frames, frame_fmt, frame->sample_rate, frame->channels, frame->nb_samples, frame->pts, frame->best_effort_timestamp);
-}
-/* 添加音频帧发送延时 */
-static int tms_add_audio_frame_send_delay(AVFrame *frame, TmsPlayContext *play)
-{
-  int duration;
-  if (play->nb_streams == 2)
-  {
-    int64_t pts = av_rescale(frame->pts, AV_TIME_BASE, frame->sample_rate);
-    int64_t elapse = av_gettime_relative() - play->start_time_us - play->pause_duration_us;
-    JANUS_LOG(LOG_VERB, "计算音频帧 #%d 发送延时 elapse = %ld pts = %ld delay = %ld\n", play->nb_audio_frames, elapse, pts, pts - elapse);
-    duration = pts - elapse;
-    if (duration > 0)
-    {
-      usleep(duration);
-    }
-  }
-  else
-  {
-    /* 添加时间间隔，微秒 */
-    duration = (int)(((float)frame->nb_samples / (float)frame->sample_rate) * 1000 * 1000);
-    JANUS_LOG(LOG_VERB, "添加延迟时间，控制速率 samples = %d, sample_rate = %d, duration = %d \n", frame->nb_samples, frame->sample_rate, duration);
-    usleep(duration);
-  }
+  play->audio_deadline_us = tms_clock_deadline_us(play, pts_us);
+  tms_wait_media_time(play, pts_us);
+  int64_t lateness_us = tms_clock_now(play->clock) - play->audio_deadline_us;
+  tms_trace(play->trace, TMS_TRACE_AUDIO_FRAME, 0, duration_us, lateness_us, 0);
 
-  return duration;
+  return lateness_us;
 }
 /**
- * 发送RTP包
+ * 发送RTP包，size为编码后的字节数（PCMA每个采样1字节）
  * 
  * 应该处理采样数超过限制进行分包的情况 
  */
-static int tms_rtp_send_audio_frame(PCMAEnc *encoder, TmsPlayContext *play, TmsAudioRtpContext *rtp_ctx)
+static int tms_rtp_send_audio_frame(const uint8_t *output_data, int size, uint32_t timestamp, TmsPlayContext *play, TmsAudioRtpContext *rtp_ctx)
 {
-  janus_callbacks *gateway = play->gateway;
-  janus_plugin_session *handle = play->handle;
+  /* 时间戳由媒体时钟按帧的pts计算 */
+  rtp_ctx->cur_timestamp = timestamp;
 
-  uint8_t *output_data = encoder->packet.data;
-  int nb_samples = encoder->nb_samples; // 每个采样1个字节
   int16_t seq = play->nb_before_audio_rtps + play->nb_audio_rtps + 1;
 
   char *buffer = g_malloc0(1500); // 1个包最大的采样数是多少？
@@ -304,23 +555,173 @@ static int tms_rtp_send_audio_frame(PCMAEnc *encoder, TmsPlayContext *play, TmsA
   header->timestamp = htonl(rtp_ctx->cur_timestamp);
   header->ssrc = htonl(1); /* The gateway will fix this anyway */
 
-  memcpy(buffer + RTP_HEADER_SIZE, output_data, nb_samples);
+  memcpy(buffer + RTP_HEADER_SIZE, output_data, size);
 
-  uint16_t length = RTP_HEADER_SIZE + nb_samples; // 每个采样1字节，所以：头长度+采样长度=包长度
+  uint16_t length = RTP_HEADER_SIZE + size;
 
   janus_plugin_rtp janus_rtp = {.video = FALSE, .buffer = (char *)buffer, .length = length};
-  gateway->relay_rtp(handle, &janus_rtp);
+  tms_relay_rtp(play, &janus_rtp);
 
   play->nb_audio_rtps++;
+  play->nb_audio_octets += size;
+  rtp_ctx->last_rtp_us = tms_clock_now(play->clock);
+
+  /* 记录到要缓存的片段 */
+  if (play->clip)
+    tms_clip_add_payload(play->clip, output_data, size, 1);
 
   g_free(buffer);
 
-  JANUS_LOG(LOG_VERB, "完成 #%d 个音频RTP包发送 seq=%d timestamp=%d nb_samples=%d\n", play->nb_audio_rtps, seq, rtp_ctx->cur_timestamp, nb_samples);
+  tms_trace(play->trace, TMS_TRACE_AUDIO_RTP, seq, size, rtp_ctx->last_rtp_us - play->audio_deadline_us, rtp_ctx->cur_timestamp);
 
   return 0;
 }
-/* 处理音频媒体包 */
-int tms_handle_audio_packet(TmsPlayContext *play, TmsInputStream *ist, Resampler *resampler, PCMAEnc *pcma_enc, AVPacket *pkt, AVFrame *frame, TmsAudioRtpContext *rtp_ctx)
+/**
+ * 编码后的音频包的处理函数，opaque为调用者的数据
+ * 
+ * offset为包的第1个采样相对于当前输入帧第1个采样的位置（编码器的采样率），fifo中有之前帧剩余的采样时为负数；
+ * packet->duration为包的采样数
+ */
+typedef void (*TmsAudioPacketCallback)(AVPacket *packet, int64_t offset, void *opaque);
+/* 编码encoder->frame，每个编码后的包调用on_packet，返回编码后的包数 */
+static int tms_encode_audio_samples(PCMAEnc *encoder, int64_t offset, TmsAudioPacketCallback on_packet, void *opaque)
+{
+  int ret = 0;
+  int nb_samples = encoder->frame->nb_samples;
+
+  /* 音频帧送编码器准备编码 */
+  if ((ret = avcodec_send_frame(encoder->cctx, encoder->frame)) < 0)
+  {
+    JANUS_LOG(LOG_VERB, "音频帧发送编码器错误\n");
+    av_frame_free(&encoder->frame);
+    return -1;
+  }
+
+  /* 要输出的包 */
+  tms_init_pcma_packet(&encoder->packet);
+
+  int nb_packets = 0;
+  while (1)
+  {
+    ret = avcodec_receive_packet(encoder->cctx, &encoder->packet);
+    if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+    {
+      break;
+    }
+    else if (ret < 0)
+    {
+      JANUS_LOG(LOG_VERB, "Error encoding audio frame\n");
+      nb_packets = -1;
+      break;
+    }
+    encoder->packet.duration = nb_samples;
+    on_packet(&encoder->packet, offset, opaque);
+    av_packet_unref(&encoder->packet);
+    nb_packets++;
+  }
+  av_packet_unref(&encoder->packet);
+  av_frame_free(&encoder->frame);
+
+  return nb_packets;
+}
+/**
+ * 对解码后的音频帧执行重采样并编码，返回编码后的包数
+ * 
+ * 每个编码后的包调用on_packet，通过rtp发送，或者转发给直播的观看者
+ */
+static int tms_encode_audio_frame(Resampler *resampler, PCMAEnc *encoder, AVFrame *frame, TmsAudioPacketCallback on_packet, void *opaque)
+{
+  int ret = 0;
+
+  /* 对获得的音频帧执行重采样 */
+  if ((ret = tms_audio_resample(resampler, frame, encoder)) < 0)
+    return -1;
+  /* 输入的采样不足1个输出采样，等待下一帧 */
+  if (encoder->nb_samples == 0)
+    return 0;
+
+  /* PCMA：重采样后的采样直接编码 */
+  if (encoder->fifo == NULL)
+  {
+    if ((ret = tms_init_pcma_frame(encoder, encoder->nb_samples)) < 0)
+      return -1;
+    memcpy(encoder->frame->data[0], *(resampler->data), encoder->nb_samples * 2);
+    return tms_encode_audio_samples(encoder, 0, on_packet, opaque);
+  }
+
+  /* Opus：凑够1帧再编码，fifo中剩余的采样在当前帧之前 */
+  int64_t offset = -av_audio_fifo_size(encoder->fifo);
+  if (av_audio_fifo_write(encoder->fifo, (void **)resampler->data, encoder->nb_samples) < encoder->nb_samples)
+  {
+    JANUS_LOG(LOG_VERB, "音频采样写入fifo错误\n");
+    return -1;
+  }
+  int nb_packets = 0;
+  while (av_audio_fifo_size(encoder->fifo) >= encoder->frame_size)
+  {
+    if ((ret = tms_init_pcma_frame(encoder, encoder->frame_size)) < 0)
+      return -1;
+    av_audio_fifo_read(encoder->fifo, (void **)encoder->frame->data, encoder->frame_size);
+    if ((ret = tms_encode_audio_samples(encoder, offset, on_packet, opaque)) < 0)
+      return -1;
+    nb_packets += ret;
+    offset += encoder->frame_size;
+  }
+
+  return nb_packets;
+}
+/**
+ * 将编码后的音频包放入调度队列
+ * 
+ * 同一个输入帧编码出的包使用帧的发送时间；显示时间和rtp时间戳从帧的时间开始，按包在帧中的位置计算
+ */
+typedef struct TmsAudioRtpSender
+{
+  TmsScheduler *sched;
+  int64_t media_ts;     // 输入帧的媒体时间（time_base）
+  AVRational time_base;
+  int64_t pts_us;       // 输入帧的发送时间，微秒
+  int sample_rate;      // 编码器的采样率
+  int ret;              // 包不能放入队列时为-1
+} TmsAudioRtpSender;
+
+static void tms_send_audio_packet(AVPacket *packet, int64_t offset, void *opaque)
+{
+  TmsAudioRtpSender *sender = (TmsAudioRtpSender *)opaque;
+  TmsSchedUnit *unit = tms_sched_new_unit(packet);
+  if (unit == NULL)
+  {
+    sender->ret = -1;
+    return;
+  }
+  unit->deadline_us = sender->pts_us;
+  unit->pts_us = sender->pts_us + av_rescale(offset, AV_TIME_BASE, sender->sample_rate);
+  unit->duration_us = av_rescale(packet->duration, AV_TIME_BASE, sender->sample_rate);
+  unit->media_ts = sender->media_ts;
+  unit->time_base = sender->time_base;
+  unit->offset = offset;
+  unit->sample_rate = sender->sample_rate;
+  tms_sched_push(sender->sched, TMS_SCHED_AUDIO, unit);
+}
+/**
+ * 等待到排队的音频包的发送时间后通过rtp发送
+ * 
+ * 记录片段时每个包作为1帧，保留各自的显示时间
+ */
+static void tms_send_audio_unit(TmsPlayContext *play, TmsSchedUnit *unit, TmsAudioRtpContext *rtp_ctx, TmsScheduler *sched)
+{
+  int64_t lateness_us = tms_add_audio_frame_send_delay(unit->deadline_us, unit->duration_us, play);
+  if (!play->nopacing)
+    tms_sched_sent(sched, TMS_SCHED_AUDIO, lateness_us);
+
+  if (play->clip)
+    tms_clip_begin_frame(play->clip, FALSE, unit->deadline_us, unit->pts_us, unit->duration_us);
+  uint32_t timestamp = tms_clock_rtp_timestamp(play, rtp_ctx->base_timestamp, rtp_ctx->clock_rate, unit->media_ts, unit->time_base);
+  timestamp += (uint32_t)av_rescale(unit->offset, rtp_ctx->clock_rate, unit->sample_rate);
+  tms_rtp_send_audio_frame(unit->pkt->data, unit->pkt->size, timestamp, play, rtp_ctx);
+}
+/* 处理音频媒体包，解码，重采样，编码后放入调度队列 */
+int tms_handle_audio_packet(TmsPlayContext *play, TmsInputStream *ist, Resampler *resampler, PCMAEnc *pcma_enc, AVPacket *pkt, AVFrame *frame, TmsScheduler *sched)
 {
   int ret = 0;
 
@@ -332,20 +733,13 @@ int tms_handle_audio_packet(TmsPlayContext *play, TmsInputStream *ist, Resampler
     return -1;
   }
   int nb_packet_frames = 0;
-  JANUS_LOG(LOG_VERB, "读取音频包 #%d size= %d \n", play->nb_audio_packets, pkt->size);
 
   while (1)
   {
     /* 从解码器获取音频帧 */
     ret = avcodec_receive_frame(ist->dec_ctx, frame);
     if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
-    {
-      if (nb_packet_frames == 0)
-      {
-        JANUS_LOG(LOG_VERB, "未从音频包 #%d 中读取音频帧，原因：%s\n", play->nb_audio_packets, av_err2str(ret));
-      }
       break;
-    }
     else if (ret < 0)
     {
       JANUS_LOG(LOG_VERB, "读取音频帧 #%d 错误 %s\n", play->nb_audio_frames + 1, av_err2str(ret));
@@ -353,64 +747,30 @@ int tms_handle_audio_packet(TmsPlayContext *play, TmsInputStream *ist, Resampler
     }
     nb_packet_frames++;
     play->nb_audio_frames++;
-    tms_dump_audio_frame(frame, play);
-
-    /* 添加发送间隔 */
-    tms_add_audio_frame_send_delay(frame, play);
-
-    /* 对获得的音频帧执行重采样 */
-    ret = tms_audio_resample(resampler, frame, pcma_enc);
-    if (ret < 0)
-    {
-      return -1;
-    }
-    /* 重采样后的媒体帧 */
-    ret = tms_init_pcma_frame(pcma_enc, resampler);
-    if (ret < 0)
-    {
-      return -1;
-    }
-    play->nb_pcma_frames++;
 
-    /* 音频帧送编码器准备编码 */
-    if ((ret = avcodec_send_frame(pcma_enc->cctx, pcma_enc->frame)) < 0)
-    {
-      JANUS_LOG(LOG_VERB, "音频帧发送编码器错误\n");
+    /* 帧的时间戳（流的时间基），没有时间戳时按上一帧的采样数推算 */
+    AVRational time_base = ist->st->time_base;
+    int64_t pts = frame->best_effort_timestamp;
+    if (pts == AV_NOPTS_VALUE)
+      pts = ist->saw_first_ts ? ist->next_ts : ist->origin_ts;
+    ist->saw_first_ts = 1;
+    ist->next_ts = pts + av_rescale_q(frame->nb_samples, (AVRational){1, frame->sample_rate}, time_base);
+
+    /* 相对于文件起点的媒体时间 */
+    int64_t media_ts = pts - ist->origin_ts;
+    int64_t pts_us = av_rescale_q(media_ts, time_base, AV_TIME_BASE_Q);
+    int64_t duration_us = av_rescale(frame->nb_samples, AV_TIME_BASE, frame->sample_rate);
+    play->input_end_us = FFMAX(play->input_end_us, pts_us + duration_us);
+
+    /* 重采样，编码，等待按发送时间调度 */
+    TmsAudioRtpSender sender = {.sched = sched, .media_ts = media_ts, .time_base = time_base, .pts_us = pts_us, .sample_rate = pcma_enc->cctx->sample_rate, .ret = 0};
+    if ((ret = tms_encode_audio_frame(resampler, pcma_enc, frame, tms_send_audio_packet, &sender)) < 0 || sender.ret < 0)
       return -1;
-    }
-
-    /* 要通过rtp输出的包 */
-    tms_init_pcma_packet(&pcma_enc->packet);
-
-    while (1)
-    {
-      ret = avcodec_receive_packet(pcma_enc->cctx, &pcma_enc->packet);
-      if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
-      {
-        break;
-      }
-      else if (ret < 0)
-      {
-        JANUS_LOG(LOG_VERB, "Error encoding audio frame\n");
-        return -1;
-      }
-      /* 计算时间戳 */
-      if (play->pause_duration_us > 0)
-      {
-        rtp_ctx->cur_timestamp += play->pause_duration_us / 1000 * 8; // 每毫秒8个采样
-      }
-      rtp_ctx->cur_timestamp += pcma_enc->nb_samples;
-
-      // if (!play->first_rtcp_auido)
-      // {
-      //   tms_audio_rtcp_first_sr(play, rtp_ctx);
-      // }
-      /* 通过rtp发送音频 */
-      tms_rtp_send_audio_frame(pcma_enc, play, rtp_ctx);
-    }
-    av_packet_unref(&pcma_enc->packet);
-    av_frame_free(&pcma_enc->frame);
+    if (ret > 0)
+      play->nb_pcma_frames++;
   }
+  /* 没有解码出帧的包（解码器延迟）extra为0 */
+  tms_trace(play->trace, TMS_TRACE_AUDIO_PACKET, play->nb_audio_packets, pkt->size, 0, nb_packet_frames);
 
   return 0;
 }
@@ -0,0 +1,632 @@
+#ifndef TMS_PLAY_REMOTE_H
+#define TMS_PLAY_REMOTE_H
+
+#include <sys/stat.h>
+
+#include "tms_play.h"
+
+/**
+ * 远程媒体文件的本地块缓存
+ *
+ * http(s)地址的文件按固定大小分块，通过范围请求下载，块保存为缓存目录中的文件，所有会话共享，超过预算时淘汰最久没有使用的块。
+ * 解封装器通过自定义的AVIOContext读取，读到1个块时，按流的码率在后台预读后面的块。
+ * 没有配置缓存目录时，直接由ffmpeg读取http地址。
+ *
+ * ffmpeg的http协议不提供ETag和Last-Modified，块的键由地址、文件大小和文件开头TMS_REMOTE_FINGERPRINT_SIZE字节的摘要生成，
+ * 替换后大小和开头都相同的对象仍然会读到旧的块，对象内容变化时应该使用新的地址。
+ */
+
+#define TMS_REMOTE_FETCH_THREADS 4      // 后台预读的线程数
+#define TMS_REMOTE_MAX_READAHEAD 16     // 最多预读的块数
+#define TMS_REMOTE_IO_BUFFER_SIZE 32768 // 解封装器读取缓冲区的大小，字节
+#define TMS_REMOTE_RW_TIMEOUT_US 10000000 // 连接和读取远程文件的超时，微秒
+#define TMS_REMOTE_FINGERPRINT_SIZE 4096  // 生成块的键时读取的文件开头的字节数
+
+/* 块的状态 */
+enum
+{
+  TMS_REMOTE_BLOCK_FETCHING = 0, // 正在下载
+  TMS_REMOTE_BLOCK_READY         // 已经保存到缓存目录
+};
+
+/* 缓存的块 */
+typedef struct TmsRemoteBlock
+{
+  char *path;   // 块文件的路径，也是索引的键
+  int64_t size; // 块的字节数
+  int state;    // 块的状态
+  GList *link;  // 在LRU中的位置，正在下载的块不在LRU中
+} TmsRemoteBlock;
+
+/* 打开的远程文件 */
+typedef struct TmsRemoteFile
+{
+  char *url;              // 文件的地址
+  char *key;              // 缓存中块文件名的前缀，由地址、文件大小和文件开头的摘要生成
+  int64_t size;           // 文件的字节数
+  int64_t pos;            // 解封装器读取的位置
+  int64_t bit_rate;       // 媒体的码率，比特/秒，用于计算预读的块数，0表示未知
+  AVIOContext *http;      // 同步下载使用的连接
+  volatile gint *playing; // 播放状态，停止播放时中断下载，NULL表示不中断
+  AVIOContext *pb;        // 提供给解封装器的读取接口
+  uint8_t *block;         // 当前读取的块
+  int64_t block_index;    // 当前读取的块的序号，-1表示没有
+  int block_len;          // 当前读取的块的字节数
+  int64_t next_readahead; // 下一个要预读的块的序号
+} TmsRemoteFile;
+
+/* 后台预读任务 */
+typedef struct TmsRemoteFetchTask
+{
+  char *url;
+  char *key;
+  int64_t index;
+  int64_t file_size;
+} TmsRemoteFetchTask;
+
+/* 缓存 */
+static char *remote_cache_dir = NULL;     // 缓存目录，NULL表示不缓存
+static int64_t remote_block_size = 0;     // 块的字节数
+static int64_t remote_cache_budget = 0;   // 缓存的预算，字节
+static int remote_readahead_s = 0;        // 预读多少秒的媒体
+static GHashTable *remote_blocks = NULL;  // 块文件路径到TmsRemoteBlock
+static GQueue remote_lru;                 // 按使用时间排列的块，头部是最近使用的
+static int64_t remote_cache_size = 0;     // 缓存的块占用的字节数
+static janus_mutex remote_mutex;
+static janus_condition remote_cond;       // 有块完成下载
+static GThreadPool *remote_pool = NULL;   // 后台预读
+static volatile gint remote_stopping = 0; // 正在释放缓存，中断所有下载
+/* 统计，由remote_mutex保护 */
+static int64_t remote_nb_hits = 0;         // 从缓存读取的块数
+static int64_t remote_nb_misses = 0;       // 读取时需要下载的块数
+static int64_t remote_nb_fetches = 0;      // 下载次数，包括预读
+static int64_t remote_nb_fetch_errors = 0; // 下载失败的次数
+static int64_t remote_fetch_us = 0;        // 成功下载的累计用时，微秒
+static int64_t remote_fetch_max_us = 0;    // 成功下载的最长用时，微秒
+static int64_t remote_fetch_bytes = 0;     // 下载的字节数
+
+/* 是否为远程文件的地址 */
+gboolean tms_remote_is_url(const char *filename)
+{
+  return filename && (g_str_has_prefix(filename, "http://") || g_str_has_prefix(filename, "https://"));
+}
+static void tms_remote_block_free(gpointer data)
+{
+  TmsRemoteBlock *block = (TmsRemoteBlock *)data;
+  g_free(block->path);
+  g_free(block);
+}
+static char *tms_remote_block_path(const char *key, int64_t index)
+{
+  return g_strdup_printf("%s/%s.%" PRId64, remote_cache_dir, key, index);
+}
+/* 超过预算时淘汰最久没有使用的块，需要持有remote_mutex */
+static void tms_remote_evict_locked(void)
+{
+  while (remote_cache_size > remote_cache_budget && !g_queue_is_empty(&remote_lru))
+  {
+    TmsRemoteBlock *block = g_queue_pop_tail(&remote_lru);
+    remote_cache_size -= block->size;
+    unlink(block->path);
+    g_hash_table_remove(remote_blocks, block->path);
+  }
+}
+/* 从缓存中移除块，需要持有remote_mutex */
+static void tms_remote_remove_locked(TmsRemoteBlock *block)
+{
+  if (block->link)
+  {
+    g_queue_delete_link(&remote_lru, block->link);
+    remote_cache_size -= block->size;
+  }
+  g_hash_table_remove(remote_blocks, block->path);
+}
+/* 远程读取的中断回调，opaque为播放状态，停止播放或者释放缓存时中断 */
+static int tms_remote_interrupt(void *opaque)
+{
+  volatile gint *playing = (volatile gint *)opaque;
+
+  return g_atomic_int_get(&remote_stopping) || (playing && g_atomic_int_get(playing) == 0);
+}
+/**
+ * 连接远程文件，playing为播放状态，NULL表示只在释放缓存时中断
+ *
+ * 服务器没有响应时最多等待TMS_REMOTE_RW_TIMEOUT_US，避免阻塞播放线程和线程池
+ */
+static int tms_remote_avio_open(AVIOContext **pb, const char *url, volatile gint *playing)
+{
+  AVIOInterruptCB interrupt = {.callback = tms_remote_interrupt, .opaque = (void *)playing};
+  AVDictionary *options = NULL;
+  av_dict_set_int(&options, "rw_timeout", TMS_REMOTE_RW_TIMEOUT_US, 0);
+  int ret = avio_open2(pb, url, AVIO_FLAG_READ, &interrupt, &options);
+  av_dict_free(&options);
+
+  return ret;
+}
+/* 下载文件中从offset开始的size个字节，pb为NULL时建立连接，返回下载的字节数 */
+static int tms_remote_fetch(AVIOContext **pb, const char *url, volatile gint *playing, int64_t offset, uint8_t *buf, int size)
+{
+  int64_t begin_us = av_gettime_relative();
+  int ret = 0, len = 0;
+  if (*pb == NULL && (ret = tms_remote_avio_open(pb, url, playing)) < 0)
+    goto end;
+  if ((ret = avio_seek(*pb, offset, SEEK_SET)) < 0)
+    goto end;
+  while (len < size)
+  {
+    ret = avio_read(*pb, buf + len, size - len);
+    if (ret == AVERROR_EOF || ret == 0)
+      break;
+    else if (ret < 0)
+      goto end;
+    len += ret;
+  }
+  ret = len;
+
+end:
+  janus_mutex_lock(&remote_mutex);
+  remote_nb_fetches++;
+  if (ret < 0)
+  {
+    remote_nb_fetch_errors++;
+  }
+  else
+  {
+    int64_t elapse_us = av_gettime_relative() - begin_us;
+    remote_fetch_us += elapse_us;
+    remote_fetch_max_us = FFMAX(remote_fetch_max_us, elapse_us);
+    remote_fetch_bytes += len;
+  }
+  janus_mutex_unlock(&remote_mutex);
+  if (ret < 0)
+    JANUS_LOG(LOG_WARN, "[TmsPlay] 下载 %s 的 %" PRId64 " 处 %d 字节失败 %s\n", url, offset, size, av_err2str(ret));
+
+  return ret;
+}
+/**
+ * 读取1个块到buf，返回块的字节数
+ *
+ * 优先从缓存读取，其它线程正在下载时等待，没有时下载并保存到缓存。
+ * readahead为TRUE时只保证块在缓存中，不读取内容，已经缓存或者正在下载时直接返回0。
+ * playing为播放状态，停止播放时中断等待和下载，NULL表示不中断。
+ */
+static int tms_remote_load_block(const char *url, const char *key, int64_t index, int64_t file_size, AVIOContext **pb, volatile gint *playing, uint8_t *buf, gboolean readahead)
+{
+  int64_t offset = index * remote_block_size;
+  int size = (int)FFMIN(remote_block_size, file_size - offset);
+  if (size <= 0)
+    return 0;
+
+  char *path = tms_remote_block_path(key, index);
+  TmsRemoteBlock *block = NULL;
+  int ret = 0;
+
+  janus_mutex_lock(&remote_mutex);
+  while ((block = g_hash_table_lookup(remote_blocks, path)) != NULL)
+  {
+    if (block->state == TMS_REMOTE_BLOCK_FETCHING)
+    {
+      if (readahead)
+        goto done;
+      if (tms_remote_interrupt((void *)playing))
+      {
+        ret = AVERROR_EXIT;
+        goto done;
+      }
+      /* 其它线程正在下载，等待完成，下载有超时，定时检查是否停止播放 */
+      janus_condition_wait_until(&remote_cond, &remote_mutex, janus_get_monotonic_time() + G_USEC_PER_SEC);
+      continue;
+    }
+    /* 命中缓存 */
+    g_queue_unlink(&remote_lru, block->link);
+    g_queue_push_head_link(&remote_lru, block->link);
+    if (readahead)
+      goto done;
+    janus_mutex_unlock(&remote_mutex);
+
+    gchar *contents = NULL;
+    gsize length = 0;
+    gboolean loaded = g_file_get_contents(path, &contents, &length, NULL) && length == (gsize)size;
+    if (loaded)
+      memcpy(buf, contents, size);
+    g_free(contents);
+
+    janus_mutex_lock(&remote_mutex);
+    if (loaded)
+    {
+      remote_nb_hits++;
+      ret = size;
+      goto done;
+    }
+    /* 块文件被删除或者不完整，重新下载 */
+    if ((block = g_hash_table_lookup(remote_blocks, path)) != NULL && block->state == TMS_REMOTE_BLOCK_READY)
+      tms_remote_remove_locked(block);
+  }
+  /* 没有缓存，下载 */
+  block = g_malloc0(sizeof(TmsRemoteBlock));
+  block->path = g_strdup(path);
+  block->state = TMS_REMOTE_BLOCK_FETCHING;
+  g_hash_table_insert(remote_blocks, block->path, block);
+  if (!readahead)
+    remote_nb_misses++;
+  janus_mutex_unlock(&remote_mutex);
+
+  ret = tms_remote_fetch(pb, url, playing, offset, buf, size);
+  gboolean stored = ret == size && g_file_set_contents(path, (const gchar *)buf, size, NULL);
+
+  janus_mutex_lock(&remote_mutex);
+  if (stored)
+  {
+    block->state = TMS_REMOTE_BLOCK_READY;
+    block->size = size;
+    g_queue_push_head(&remote_lru, block);
+    block->link = remote_lru.head;
+    remote_cache_size += size;
+    tms_remote_evict_locked();
+  }
+  else
+  {
+    g_hash_table_remove(remote_blocks, path);
+  }
+  janus_condition_broadcast(&remote_cond);
+
+done:
+  janus_mutex_unlock(&remote_mutex);
+  g_free(path);
+
+  return ret;
+}
+/* 执行后台预读任务 */
+static void tms_remote_fetch_task(gpointer data, gpointer user_data)
+{
+  TmsRemoteFetchTask *task = (TmsRemoteFetchTask *)data;
+  AVIOContext *pb = NULL;
+  uint8_t *buf = av_malloc(remote_block_size);
+  if (buf && !g_atomic_int_get(&remote_stopping))
+    tms_remote_load_block(task->url, task->key, task->index, task->file_size, &pb, NULL, buf, TRUE);
+  av_free(buf);
+  avio_closep(&pb);
+
+  g_free(task->url);
+  g_free(task->key);
+  g_free(task);
+}
+/* 读到第index个块后，按媒体码率预读后面的块 */
+static void tms_remote_schedule_readahead(TmsRemoteFile *file, int64_t index)
+{
+  if (remote_pool == NULL)
+    return;
+
+  int nb_readahead = 1;
+  if (file->bit_rate > 0 && remote_readahead_s > 0)
+    nb_readahead = (int)av_clip64((file->bit_rate / 8 * remote_readahead_s + remote_block_size - 1) / remote_block_size, 1, TMS_REMOTE_MAX_READAHEAD);
+  int64_t nb_blocks = (file->size + remote_block_size - 1) / remote_block_size;
+  /* 跳转后重新开始预读 */
+  if (file->next_readahead <= index || file->next_readahead > index + 1 + nb_readahead)
+    file->next_readahead = index + 1;
+  int64_t last = FFMIN(index + nb_readahead, nb_blocks - 1);
+  for (; file->next_readahead <= last; file->next_readahead++)
+  {
+    TmsRemoteFetchTask *task = g_malloc0(sizeof(TmsRemoteFetchTask));
+    task->url = g_strdup(file->url);
+    task->key = g_strdup(file->key);
+    task->index = file->next_readahead;
+    task->file_size = file->size;
+    g_thread_pool_push(remote_pool, task, NULL);
+  }
+}
+/* 解封装器读取数据 */
+static int tms_remote_read(void *opaque, uint8_t *buf, int buf_size)
+{
+  TmsRemoteFile *file = (TmsRemoteFile *)opaque;
+  if (file->pos >= file->size)
+    return AVERROR_EOF;
+
+  int64_t index = file->pos / remote_block_size;
+  if (index != file->block_index)
+  {
+    file->block_index = -1;
+    int ret = tms_remote_load_block(file->url, file->key, index, file->size, &file->http, file->playing, file->block, FALSE);
+    if (ret <= 0)
+      return ret < 0 ? ret : AVERROR_EOF;
+    file->block_index = index;
+    file->block_len = ret;
+    tms_remote_schedule_readahead(file, index);
+  }
+
+  int offset = (int)(file->pos - index * remote_block_size);
+  int len = FFMIN(buf_size, file->block_len - offset);
+  if (len <= 0)
+    return AVERROR_EOF;
+  memcpy(buf, file->block + offset, len);
+  file->pos += len;
+
+  return len;
+}
+/* 解封装器跳转 */
+static int64_t tms_remote_seek(void *opaque, int64_t offset, int whence)
+{
+  TmsRemoteFile *file = (TmsRemoteFile *)opaque;
+  if (whence & AVSEEK_SIZE)
+    return file->size;
+
+  int64_t pos;
+  switch (whence & ~AVSEEK_FORCE)
+  {
+  case SEEK_SET:
+    pos = offset;
+    break;
+  case SEEK_CUR:
+    pos = file->pos + offset;
+    break;
+  case SEEK_END:
+    pos = file->size + offset;
+    break;
+  default:
+    return AVERROR(EINVAL);
+  }
+  if (pos < 0)
+    return AVERROR(EINVAL);
+  file->pos = pos;
+
+  return pos;
+}
+static void tms_remote_close(TmsRemoteFile *file)
+{
+  if (file->pb)
+  {
+    av_freep(&file->pb->buffer);
+    avio_context_free(&file->pb);
+  }
+  avio_closep(&file->http);
+  av_free(file->block);
+  g_free(file->url);
+  g_free(file->key);
+  g_free(file);
+}
+/* 连接远程文件，获得文件大小，无法获得大小（例如：分块传输）时返回NULL */
+static TmsRemoteFile *tms_remote_open(const char *url, volatile gint *playing)
+{
+  AVIOContext *http = NULL;
+  int ret;
+  if ((ret = tms_remote_avio_open(&http, url, playing)) < 0)
+  {
+    JANUS_LOG(LOG_VERB, "[TmsPlay] 无法连接远程文件 %s %s\n", url, av_err2str(ret));
+    return NULL;
+  }
+  int64_t size = avio_size(http);
+  if (size <= 0)
+  {
+    JANUS_LOG(LOG_VERB, "[TmsPlay] 无法获得远程文件 %s 的大小，不使用块缓存\n", url);
+    avio_closep(&http);
+    return NULL;
+  }
+
+  /* 连接已经从文件开头开始传输，读取开头的字节区分同一地址大小相同的不同内容 */
+  uint8_t head[TMS_REMOTE_FINGERPRINT_SIZE];
+  int len = 0;
+  while (len < (int)FFMIN(size, TMS_REMOTE_FINGERPRINT_SIZE))
+  {
+    ret = avio_read(http, head + len, (int)FFMIN(size, TMS_REMOTE_FINGERPRINT_SIZE) - len);
+    if (ret <= 0)
+      break;
+    len += ret;
+  }
+  if (ret < 0)
+  {
+    JANUS_LOG(LOG_VERB, "[TmsPlay] 无法读取远程文件 %s 的开头 %s\n", url, av_err2str(ret));
+    avio_closep(&http);
+    return NULL;
+  }
+
+  TmsRemoteFile *file = g_malloc0(sizeof(TmsRemoteFile));
+  file->url = g_strdup(url);
+  char *id = g_strdup_printf("%s#%" PRId64 "#", url, size);
+  GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA1);
+  g_checksum_update(checksum, (const guchar *)id, -1);
+  g_checksum_update(checksum, head, len);
+  file->key = g_strdup(g_checksum_get_string(checksum));
+  g_checksum_free(checksum);
+  g_free(id);
+  file->size = size;
+  file->http = http;
+  file->playing = playing;
+  file->block = av_malloc(remote_block_size);
+  file->block_index = -1;
+
+  return file;
+}
+/* 获得远程文件的字节数，失败时返回-1 */
+int64_t tms_remote_file_size(const char *url)
+{
+  AVIOContext *http = NULL;
+  if (tms_remote_avio_open(&http, url, NULL) < 0)
+    return -1;
+  int64_t size = avio_size(http);
+  avio_closep(&http);
+
+  return size > 0 ? size : -1;
+}
+/**
+ * 打开媒体文件，远程文件通过块缓存读取
+ *
+ * 使用块缓存时remote返回打开的远程文件，需要通过tms_remote_close_input关闭。
+ * playing为播放状态，停止播放时中断连接和读取，NULL表示只在释放缓存时中断。
+ */
+int tms_remote_open_input(AVFormatContext **ictx, const char *filename, volatile gint *playing, TmsRemoteFile **remote)
+{
+  *remote = NULL;
+  if (!tms_remote_is_url(filename))
+    return avformat_open_input(ictx, filename, NULL, NULL);
+
+  TmsRemoteFile *file = remote_blocks ? tms_remote_open(filename, playing) : NULL;
+  if (file == NULL || file->block == NULL)
+  {
+    if (file)
+      tms_remote_close(file);
+    /* 直接由ffmpeg读取，同样需要超时和中断 */
+    if ((*ictx = avformat_alloc_context()) == NULL)
+      return AVERROR(ENOMEM);
+    (*ictx)->interrupt_callback.callback = tms_remote_interrupt;
+    (*ictx)->interrupt_callback.opaque = (void *)playing;
+    AVDictionary *options = NULL;
+    av_dict_set_int(&options, "rw_timeout", TMS_REMOTE_RW_TIMEOUT_US, 0);
+    int ret = avformat_open_input(ictx, filename, NULL, &options);
+    av_dict_free(&options);
+    return ret;
+  }
+
+  uint8_t *buffer = av_malloc(TMS_REMOTE_IO_BUFFER_SIZE);
+  file->pb = buffer ? avio_alloc_context(buffer, TMS_REMOTE_IO_BUFFER_SIZE, 0, file, tms_remote_read, NULL, tms_remote_seek) : NULL;
+  if (file->pb == NULL || (*ictx = avformat_alloc_context()) == NULL)
+  {
+    if (file->pb == NULL)
+      av_free(buffer);
+    tms_remote_close(file);
+    return AVERROR(ENOMEM);
+  }
+  (*ictx)->pb = file->pb;
+  (*ictx)->flags |= AVFMT_FLAG_CUSTOM_IO;
+  (*ictx)->interrupt_callback.callback = tms_remote_interrupt;
+  (*ictx)->interrupt_callback.opaque = (void *)playing;
+
+  int ret = avformat_open_input(ictx, filename, NULL, NULL);
+  if (ret < 0)
+  {
+    tms_remote_close(file);
+    return ret;
+  }
+  *remote = file;
+
+  return ret;
+}
+/* 关闭打开的媒体文件 */
+void tms_remote_close_input(AVFormatContext **ictx, TmsRemoteFile **remote)
+{
+  if (*ictx)
+    avformat_close_input(ictx);
+  if (*remote)
+  {
+    tms_remote_close(*remote);
+    *remote = NULL;
+  }
+}
+/* 加载缓存目录中已有的块，重启后继续使用 */
+static void tms_remote_cache_load(void)
+{
+  GDir *dir = g_dir_open(remote_cache_dir, 0, NULL);
+  if (dir == NULL)
+    return;
+
+  const gchar *name;
+  while ((name = g_dir_read_name(dir)) != NULL)
+  {
+    char *path = g_strdup_printf("%s/%s", remote_cache_dir, name);
+    struct stat st;
+    if (stat(path, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+    {
+      g_free(path);
+      continue;
+    }
+    TmsRemoteBlock *block = g_malloc0(sizeof(TmsRemoteBlock));
+    block->path = path;
+    block->size = st.st_size;
+    block->state = TMS_REMOTE_BLOCK_READY;
+    g_queue_push_tail(&remote_lru, block);
+    block->link = remote_lru.tail;
+    g_hash_table_insert(remote_blocks, block->path, block);
+    remote_cache_size += block->size;
+  }
+  g_dir_close(dir);
+  tms_remote_evict_locked();
+
+  JANUS_LOG(LOG_INFO, "[TmsPlay] 远程文件缓存目录 %s 中已有 %u 个块，%" PRId64 " 字节\n", remote_cache_dir, g_hash_table_size(remote_blocks), remote_cache_size);
+}
+/* 初始化远程文件块缓存，dir为NULL或者预算为0时不缓存 */
+int tms_remote_cache_init(const char *dir, int budget_mb, int block_kb, int readahead_s)
+{
+  avformat_network_init();
+  g_atomic_int_set(&remote_stopping, 0);
+  if (dir == NULL || budget_mb <= 0 || block_kb <= 0)
+    return 0;
+
+  if (g_mkdir_with_parents(dir, 0755) < 0)
+  {
+    JANUS_LOG(LOG_ERR, "[TmsPlay] 无法创建远程文件缓存目录 %s\n", dir);
+    return -1;
+  }
+
+  janus_mutex_init(&remote_mutex);
+  janus_condition_init(&remote_cond);
+  remote_cache_dir = g_strdup(dir);
+  remote_block_size = (int64_t)block_kb * 1024;
+  remote_cache_budget = (int64_t)budget_mb * 1024 * 1024;
+  remote_readahead_s = readahead_s;
+  remote_blocks = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, tms_remote_block_free);
+  g_queue_init(&remote_lru);
+  remote_cache_size = 0;
+  tms_remote_cache_load();
+
+  GError *error = NULL;
+  remote_pool = g_thread_pool_new(tms_remote_fetch_task, NULL, TMS_REMOTE_FETCH_THREADS, FALSE, &error);
+  if (error != NULL)
+  {
+    JANUS_LOG(LOG_ERR, "[TmsPlay] 创建远程文件预读的线程池发生错误：%d (%s)\n", error->code, error->message ? error->message : "??");
+    g_error_free(error);
+    remote_pool = NULL;
+  }
+
+  return 0;
+}
+/* 释放远程文件块缓存，保留缓存目录中的块 */
+void tms_remote_cache_destroy(void)
+{
+  /* 中断正在进行的下载，线程池中排队的任务不再下载 */
+  g_atomic_int_set(&remote_stopping, 1);
+  if (remote_pool != NULL)
+  {
+    g_thread_pool_free(remote_pool, FALSE, TRUE);
+    remote_pool = NULL;
+  }
+  if (remote_blocks != NULL)
+  {
+    janus_mutex_lock(&remote_mutex);
+    g_queue_clear(&remote_lru);
+    g_hash_table_destroy(remote_blocks);
+    remote_blocks = NULL;
+    remote_cache_size = 0;
+    janus_mutex_unlock(&remote_mutex);
+  }
+  g_free(remote_cache_dir);
+  remote_cache_dir = NULL;
+  avformat_network_deinit();
+}
+/* 块缓存的命中率和下载用时 */
+json_t *tms_remote_cache_status(void)
+{
+  json_t *status = json_object();
+  json_object_set_new(status, "enabled", json_boolean(remote_blocks != NULL));
+  if (remote_blocks == NULL)
+    return status;
+
+  janus_mutex_lock(&remote_mutex);
+  int64_t nb_reads = remote_nb_hits + remote_nb_misses;
+  int64_t nb_fetched = remote_nb_fetches - remote_nb_fetch_errors;
+  json_object_set_new(status, "blocks", json_integer(g_hash_table_size(remote_blocks)));
+  json_object_set_new(status, "cache_bytes", json_integer(remote_cache_size));
+  json_object_set_new(status, "budget_bytes", json_integer(remote_cache_budget));
+  json_object_set_new(status, "block_bytes", json_integer(remote_block_size));
+  json_object_set_new(status, "hits", json_integer(remote_nb_hits));
+  json_object_set_new(status, "misses", json_integer(remote_nb_misses));
+  json_object_set_new(status, "hit_ratio", json_real(nb_reads > 0 ? (double)remote_nb_hits / nb_reads : 0));
+  json_object_set_new(status, "fetches", json_integer(remote_nb_fetches));
+  json_object_set_new(status, "fetch_errors", json_integer(remote_nb_fetch_errors));
+  json_object_set_new(status, "fetch_bytes", json_integer(remote_fetch_bytes));
+  json_object_set_new(status, "fetch_avg_ms", json_real(nb_fetched > 0 ? remote_fetch_us / 1000.0 / nb_fetched : 0));
+  json_object_set_new(status, "fetch_max_ms", json_real(remote_fetch_max_us / 1000.0));
+  janus_mutex_unlock(&remote_mutex);
+
+  return status;
+}
+
+#endif
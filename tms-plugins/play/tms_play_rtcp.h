@@ -0,0 +1,61 @@
+#ifndef TMS_PLAY_RTCP_H
+#define TMS_PLAY_RTCP_H
+
+#include <rtcp.h>
+
+#include "tms_play.h"
+
+/**
+ * 处理接收端的rtcp反馈
+ *
+ * 发送端报告（SR）由janus核心生成：janus按每路媒体最近转发的rtp包的时间戳和自己的SSRC定时发送SR，
+ * 插件通过relay_rtcp交给janus的SR、RR和SDES会被janus_rtcp_filter过滤掉，所以插件不生成SR
+ */
+#define TMS_RTCP_LOSS_SMOOTH 4 // 丢包率的平滑系数，新的报告占1/4
+
+void tms_play_feedback_rtcp(tms_play_feedback *feedback, gboolean video, char *buf, int len);
+
+/* 更新平滑后的丢包率，fraction为报告块中的丢包比例（1/256） */
+static void tms_feedback_update_loss(volatile gint *loss, uint32_t fraction)
+{
+  int permille = fraction * 1000 / 256;
+  int old = g_atomic_int_get(loss);
+  g_atomic_int_set(loss, old + (permille - old) / TMS_RTCP_LOSS_SMOOTH);
+}
+/**
+ * 处理接收端发来的rtcp包，记录REMB中的估计带宽和接收报告中的丢包率
+ * 
+ * 在janus的rtcp回调中调用，复合包中可能包含多个rtcp包
+ */
+void tms_play_feedback_rtcp(tms_play_feedback *feedback, gboolean video, char *buf, int len)
+{
+  g_atomic_int_inc(&feedback->nb_rtcps);
+
+  uint32_t remb = janus_rtcp_get_remb(buf, len);
+  if (remb > 0)
+    g_atomic_int_set(&feedback->remb_kbps, (gint)(remb / 1000));
+
+  char *p = buf;
+  int total = len;
+  while (total >= (int)sizeof(janus_rtcp_header))
+  {
+    janus_rtcp_header *rtcp = (janus_rtcp_header *)p;
+    if (rtcp->version != 2)
+      break;
+    int length = (ntohs(rtcp->length) + 1) * 4;
+    if (length > total)
+      break;
+    /* 只用第1个报告块，插件每种媒体只发送1路 */
+    janus_report_block *rb = NULL;
+    if (rtcp->type == RTCP_RR && rtcp->rc > 0 && length >= (int)sizeof(janus_rtcp_rr))
+      rb = &((janus_rtcp_rr *)rtcp)->rb[0];
+    else if (rtcp->type == RTCP_SR && rtcp->rc > 0 && length >= (int)sizeof(janus_rtcp_sr))
+      rb = &((janus_rtcp_sr *)rtcp)->rb[0];
+    if (rb)
+      tms_feedback_update_loss(video ? &feedback->video_loss : &feedback->audio_loss, ntohl(rb->flcnpl) >> 24);
+    p += length;
+    total -= length;
+  }
+}
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef TMS_PLAY_SCHED_H
+#define TMS_PLAY_SCHED_H
+
+#include "tms_play.h"
+
+#define TMS_SCHED_VIDEO 0
+#define TMS_SCHED_AUDIO 1
+#define TMS_SCHED_NB_STREAMS 2
+
+#define TMS_SCHED_MAX_UNITS 256         // 每个队列最多排队的帧数
+#define TMS_SCHED_MAX_AHEAD_US 2000000  // 只有1个流有帧时，最多提前解封装的媒体时长，微秒
+
+/**
+ * 排队等待发送的1帧
+ *
+ * 视频为转为annexb格式的帧，音频为编码后的包；rtp时间戳在发送时按媒体时钟计算，排队期间暂停不影响时间戳
+ */
+typedef struct TmsSchedUnit
+{
+  AVPacket *pkt;        // 要发送的数据，持有1个引用
+  int64_t deadline_us;  // 按媒体时间的发送时间，相对于文件起点，微秒，视频为dts，音频为输入帧的显示时间
+  int64_t pts_us;       // 显示时间，相对于文件起点，微秒
+  int64_t duration_us;  // 时长，微秒
+  int64_t media_ts;     // 计算rtp时间戳的媒体时间（time_base），音频为输入帧的时间
+  AVRational time_base;
+  int64_t offset;       // 音频包的第1个采样相对于输入帧的位置（编码器的采样率）
+  int sample_rate;      // 编码器的采样率，只用于音频
+} TmsSchedUnit;
+/**
+ * 会话的音视频发送调度
+ *
+ * 解封装并处理（视频转为annexb，音频解码、重采样、编码）后的帧按媒体流分别排队，
+ * 每个要播放的流都有帧时，从所有队列的队首中选择发送时间最早的帧，等待到发送时间后发送，
+ * 文件交错不好或者音频处理耗时时，另一个流的帧不会等在后面。
+ * 只有1个流有帧（另一个流已经结束或者交错很差）时，最多提前TMS_SCHED_MAX_AHEAD_US解封装。
+ *
+ * 发送偏差为最近发送的视频帧和音频帧分别晚于发送时间的时长之差，正数表示视频比音频晚。
+ */
+typedef struct TmsScheduler
+{
+  GQueue queues[TMS_SCHED_NB_STREAMS];         // 每个流按解封装顺序排队的帧，流内发送时间递增
+  int64_t lateness_us[TMS_SCHED_NB_STREAMS];   // 每个流最近发送的帧晚于发送时间的时长，微秒
+  gboolean sent[TMS_SCHED_NB_STREAMS];         // 每个流是否发送过帧
+  int64_t skew_us;                             // 最近的音视频发送偏差，微秒
+  int64_t max_skew_us;                         // 绝对值最大的发送偏差，微秒
+  int64_t sum_skew_us;                         // 累计的发送偏差绝对值，微秒
+  int nb_skews;                                // 统计发送偏差的次数
+  tms_play_ffmpeg *ffmpeg;                     // 记录会话的发送偏差，NULL表示不记录
+} TmsScheduler;
+
+/* 初始化调度，ffmpeg为NULL时不记录会话的发送偏差 */
+static void tms_init_scheduler(TmsScheduler *sched, tms_play_ffmpeg *ffmpeg)
+{
+  memset(sched, 0, sizeof(TmsScheduler));
+  int i = 0;
+  for (; i < TMS_SCHED_NB_STREAMS; i++)
+    g_queue_init(&sched->queues[i]);
+  sched->ffmpeg = ffmpeg;
+}
+/* 释放1帧 */
+static void tms_sched_free_unit(TmsSchedUnit *unit)
+{
+  av_packet_free(&unit->pkt);
+  g_free(unit);
+}
+/* 新建1帧，复制pkt的引用，失败时返回NULL */
+static TmsSchedUnit *tms_sched_new_unit(AVPacket *pkt)
+{
+  AVPacket *clone = av_packet_clone(pkt);
+  if (clone == NULL)
+    return NULL;
+
+  TmsSchedUnit *unit = g_new0(TmsSchedUnit, 1);
+  unit->pkt = clone;
+
+  return unit;
+}
+/* 将1帧放入流的队列 */
+static void tms_sched_push(TmsScheduler *sched, int stream, TmsSchedUnit *unit)
+{
+  g_queue_push_tail(&sched->queues[stream], unit);
+}
+/* 丢弃所有排队的帧，停止播放或者发生错误时调用 */
+static void tms_sched_clear(TmsScheduler *sched)
+{
+  int i = 0;
+  for (; i < TMS_SCHED_NB_STREAMS; i++)
+  {
+    TmsSchedUnit *unit;
+    while ((unit = g_queue_pop_head(&sched->queues[i])) != NULL)
+      tms_sched_free_unit(unit);
+  }
+}
+/**
+ * 是否可以发送队首的帧，不能时应该继续解封装
+ *
+ * dovideo和doaudio为要播放的流，eof为文件是否已经读完
+ */
+static gboolean tms_sched_ready(TmsScheduler *sched, gboolean dovideo, gboolean doaudio, gboolean eof)
+{
+  GQueue *video = &sched->queues[TMS_SCHED_VIDEO], *audio = &sched->queues[TMS_SCHED_AUDIO];
+  if (video->length + audio->length == 0)
+    return FALSE;
+  if (eof)
+    return TRUE;
+  /* 每个要播放的流都有帧，可以确定最早的帧 */
+  if ((!dovideo || video->length > 0) && (!doaudio || audio->length > 0))
+    return TRUE;
+  if (video->length >= TMS_SCHED_MAX_UNITS || audio->length >= TMS_SCHED_MAX_UNITS)
+    return TRUE;
+  /* 另一个流没有帧，不再等待 */
+  GQueue *queue = video->length > 0 ? video : audio;
+  TmsSchedUnit *head = g_queue_peek_head(queue), *tail = g_queue_peek_tail(queue);
+
+  return tail->deadline_us - head->deadline_us >= TMS_SCHED_MAX_AHEAD_US;
+}
+/* 取出发送时间最早的帧，stream为帧所在的流，没有帧时返回NULL */
+static TmsSchedUnit *tms_sched_pop(TmsScheduler *sched, int *stream)
+{
+  TmsSchedUnit *video = g_queue_peek_head(&sched->queues[TMS_SCHED_VIDEO]);
+  TmsSchedUnit *audio = g_queue_peek_head(&sched->queues[TMS_SCHED_AUDIO]);
+  if (video == NULL && audio == NULL)
+    return NULL;
+
+  /* 发送时间相同时先发送音频，音频包小，不占用视频帧的平滑时间 */
+  *stream = audio == NULL || (video && video->deadline_us < audio->deadline_us) ? TMS_SCHED_VIDEO : TMS_SCHED_AUDIO;
+
+  return g_queue_pop_head(&sched->queues[*stream]);
+}
+/* 记录1帧等待结束时晚于发送时间的时长，更新音视频发送偏差 */
+static void tms_sched_sent(TmsScheduler *sched, int stream, int64_t lateness_us)
+{
+  sched->lateness_us[stream] = lateness_us;
+  sched->sent[stream] = TRUE;
+  if (!sched->sent[TMS_SCHED_VIDEO] || !sched->sent[TMS_SCHED_AUDIO])
+    return;
+
+  int64_t skew_us = sched->lateness_us[TMS_SCHED_VIDEO] - sched->lateness_us[TMS_SCHED_AUDIO];
+  sched->skew_us = skew_us;
+  if (FFABS(skew_us) > FFABS(sched->max_skew_us))
+    sched->max_skew_us = skew_us;
+  sched->sum_skew_us += FFABS(skew_us);
+  sched->nb_skews++;
+
+  if (sched->ffmpeg)
+  {
+    gint skew = (gint)FFMIN(FFMAX(skew_us, -INT_MAX), INT_MAX);
+    g_atomic_int_set(&sched->ffmpeg->av_skew_us, skew);
+    if (FFABS(skew) > FFABS(g_atomic_int_get(&sched->ffmpeg->max_av_skew_us)))
+      g_atomic_int_set(&sched->ffmpeg->max_av_skew_us, skew);
+  }
+}
+
+#endif
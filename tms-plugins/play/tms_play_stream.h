@@ -1,12 +1,14 @@
 #ifndef TMS_PLAY_STREAM_H
 #define TMS_PLAY_STREAM_H
 
+#define TMS_STREAM_DECODER_THREADS 1 // 解码器的线程数，音频解码不需要多线程，避免按CPU核数创建线程
+
 /* 记录输入媒体流相关数据 */
 typedef struct TmsInputStream
 {
   int stream_index;
   AVStream *st;
-  AVCodecContext *dec_ctx;
+  AVCodecContext *dec_ctx; // 解码器，只有需要转码的音频流打开，视频流直接转发，为NULL
   AVCodec *codec;
   int bytes_per_sample;
 
@@ -16,13 +18,21 @@ typedef struct TmsInputStream
   /* predicted dts of the next packet read for this stream or (when there are several frames in a packet) of the next frame in current packet (in AV_TIME_BASE units) */
   int64_t next_dts;
   int64_t dts; ///< dts of the last packet read for this stream (in AV_TIME_BASE units)
+  /* 媒体时钟 */
+  int64_t origin_ts; // 文件起点的时间戳（流的时间基）
+  int64_t next_ts;   // 预计的下一个时间戳（流的时间基），没有时间戳的包和帧使用
 } TmsInputStream;
 
 int tms_init_input_stream(AVFormatContext *fctx, int index, TmsInputStream *ist);
+void tms_free_input_stream(TmsInputStream *ist);
 
 void tms_dump_stream_format(TmsInputStream *ist);
 
-/* 生成自己使用的输入媒体流对象。只支持音频流和视频流。 */
+/**
+ * 生成自己使用的输入媒体流对象。只支持音频流和视频流。
+ * 
+ * 视频只转封装，不打开解码器，格式信息从codecpar中获得；音频需要转码为PCMA，打开解码器
+ */
 int tms_init_input_stream(AVFormatContext *fctx, int index, TmsInputStream *ist)
 {
   int ret;
@@ -60,12 +70,20 @@ int tms_init_input_stream(AVFormatContext *fctx, int index, TmsInputStream *ist)
   //   return -1;
   // }
 
-  cctx = avcodec_alloc_context3(codec);
-  avcodec_parameters_to_context(cctx, st->codecpar);
-  if ((ret = avcodec_open2(cctx, codec, NULL)) < 0)
+  cctx = NULL;
+  if (codec->type == AVMEDIA_TYPE_AUDIO)
   {
-    JANUS_LOG(LOG_VERB, "stream #%d 读取媒体流基本信息势失败 %s\n", index, av_err2str(ret));
-    return -1;
+    cctx = avcodec_alloc_context3(codec);
+    if (!cctx)
+      return -1;
+    avcodec_parameters_to_context(cctx, st->codecpar);
+    cctx->thread_count = TMS_STREAM_DECODER_THREADS;
+    if ((ret = avcodec_open2(cctx, codec, NULL)) < 0)
+    {
+      JANUS_LOG(LOG_VERB, "stream #%d 读取媒体流基本信息势失败 %s\n", index, av_err2str(ret));
+      avcodec_free_context(&cctx);
+      return -1;
+    }
   }
 
   memset(ist, 0, sizeof(TmsInputStream));
@@ -73,14 +91,64 @@ int tms_init_input_stream(AVFormatContext *fctx, int index, TmsInputStream *ist)
   ist->st = st;
   ist->dec_ctx = cctx;
   ist->codec = codec;
-  ist->bytes_per_sample = av_get_bytes_per_sample(cctx->sample_fmt);
+  ist->bytes_per_sample = cctx ? av_get_bytes_per_sample(cctx->sample_fmt) : 0;
   ist->start = AV_NOPTS_VALUE;
   ist->next_dts = AV_NOPTS_VALUE;
   ist->dts = AV_NOPTS_VALUE;
+  ist->origin_ts = 0;
+  ist->next_ts = AV_NOPTS_VALUE;
 
   return 0;
 }
 
+/* 释放输入媒体流和解码器 */
+void tms_free_input_stream(TmsInputStream *ist)
+{
+  if (ist->dec_ctx)
+    avcodec_free_context(&ist->dec_ctx);
+  free(ist);
+}
+/* 媒体流是否可以播放，视频只支持h264，不播放封面图片 */
+static gboolean tms_stream_playable(AVStream *st)
+{
+  if (st->disposition & AV_DISPOSITION_ATTACHED_PIC)
+    return FALSE;
+  if (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
+    return st->codecpar->codec_id == AV_CODEC_ID_H264;
+  if (st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO)
+    return avcodec_find_decoder(st->codecpar->codec_id) != NULL;
+
+  return FALSE;
+}
+/**
+ * 选择要播放的媒体流，返回流序号，没有可以播放的流时返回-1
+ * 
+ * wanted为指定的流序号，不能播放时自动选择；自动选择时优先使用ffmpeg认为最好的流，related为关联的流（音频和视频在同一个节目中）
+ */
+static int tms_select_stream(AVFormatContext *ictx, enum AVMediaType type, int wanted, int related)
+{
+  if (wanted == TMS_PLAY_TRACK_NONE)
+    return -1;
+  if (wanted >= 0)
+  {
+    if (wanted < (int)ictx->nb_streams && ictx->streams[wanted]->codecpar->codec_type == type && tms_stream_playable(ictx->streams[wanted]))
+      return wanted;
+    JANUS_LOG(LOG_VERB, "指定的媒体流 #%d 不存在或者不能播放，自动选择\n", wanted);
+  }
+
+  int index = av_find_best_stream(ictx, type, -1, related, NULL, 0);
+  if (index >= 0 && tms_stream_playable(ictx->streams[index]))
+    return index;
+  /* 最好的流不能播放，例如：不是h264的视频，选择第1个可以播放的流 */
+  unsigned int i = 0;
+  for (; i < ictx->nb_streams; i++)
+  {
+    if (ictx->streams[i]->codecpar->codec_type == type && tms_stream_playable(ictx->streams[i]))
+      return i;
+  }
+
+  return -1;
+}
 /* 输出媒体流格式信息 */
 void tms_dump_stream_format(TmsInputStream *ist)
 {
@@ -92,7 +160,7 @@ void tms_dump_stream_format(TmsInputStream *ist)
   JANUS_LOG(LOG_VERB, "-- codec.name %s\n", codec->name);
 
   /* 音频采样信息 */
-  if (codec->type == AVMEDIA_TYPE_AUDIO)
+  if (codec->type == AVMEDIA_TYPE_AUDIO && cctx)
   {
     JANUS_LOG(LOG_VERB, "-- ccxt.sample_fmt = %s\n", av_get_sample_fmt_name(cctx->sample_fmt));
     JANUS_LOG(LOG_VERB, "-- ccxt.sample_rate = %d\n", cctx->sample_rate);
@@ -0,0 +1,201 @@
+#ifndef TMS_PLAY_TRACE_H
+#define TMS_PLAY_TRACE_H
+
+#include "tms_play.h"
+
+#define TMS_TRACE_RING_SIZE 4096 // 环形缓冲区中的记录数，必须是2的幂
+
+/* 记录的事件类型 */
+enum
+{
+  TMS_TRACE_NONE = 0,
+  TMS_TRACE_VIDEO_PACKET, // 读取视频包，size为包大小，extra为nal_unit_type
+  TMS_TRACE_VIDEO_FRAME,  // 视频帧到达发送时间，lateness为晚于媒体时间的时长
+  TMS_TRACE_VIDEO_NAL,    // 发送nal，size为nal大小，extra为nal_unit_type
+  TMS_TRACE_VIDEO_RTP,    // 发送视频rtp包，seq为rtp序号，extra为rtp时间戳
+  TMS_TRACE_AUDIO_FRAME,  // 音频帧到达发送时间，size为帧时长（微秒）
+  TMS_TRACE_AUDIO_RTP,    // 发送音频rtp包，seq为rtp序号，extra为rtp时间戳
+  TMS_TRACE_SWITCH_INPUT, // 切换播放文件，size为媒体流数量
+  TMS_TRACE_RENDITION,    // 在关键帧切换码率，seq为切换后的码率序号，size为视频码率（kbps），extra为估计带宽（kbps）
+  TMS_TRACE_VIDEO_DROP,   // 拥塞时丢弃视频帧，seq为拥塞原因，size为帧大小，extra为发送速率（kbps）
+  TMS_TRACE_AUDIO_PACKET, // 解码音频包，seq为包序号，size为包大小，extra为解码出的帧数
+  TMS_TRACE_VIDEO_BURST,  // 完成1帧发送，seq为帧序号，size为平滑前的突发包数，extra为平滑后的
+  TMS_TRACE_NB_TYPES
+};
+
+static const char *tms_trace_type_names[TMS_TRACE_NB_TYPES] = {
+    "none",
+    "video.packet",
+    "video.frame",
+    "video.nal",
+    "video.rtp",
+    "audio.frame",
+    "audio.rtp",
+    "switch.input",
+    "video.rendition",
+    "video.drop",
+    "audio.packet",
+    "video.burst"};
+
+/**
+ * 固定大小的二进制记录
+ *
+ * index为写入时的序号加1，写完其它字段后最后写入，读取时用于判断记录是否完整或者已经被覆盖
+ */
+typedef struct TmsTraceRecord
+{
+  volatile gint index;
+  uint8_t type;
+  uint8_t reserved;
+  uint16_t seq;
+  uint32_t size;
+  uint32_t extra;
+  int32_t lateness_us; // 晚于媒体时间的时长，微秒
+  int64_t time_us;     // 发生时间，微秒
+} TmsTraceRecord;
+
+/**
+ * 会话的跟踪记录
+ *
+ * 播放线程无锁写入，覆盖最早的记录；管理接口读取时复制快照，不影响播放
+ */
+struct TmsTraceRing
+{
+  volatile gint head; // 已经写入的记录数
+  TmsTraceRecord records[TMS_TRACE_RING_SIZE];
+  janus_refcount ref;
+};
+
+static void tms_trace_ring_free(const janus_refcount *ring_ref)
+{
+  TmsTraceRing *ring = janus_refcount_containerof(ring_ref, TmsTraceRing, ref);
+  g_free(ring);
+}
+/* 新建跟踪记录，引用计数为1 */
+TmsTraceRing *tms_trace_ring_new(void)
+{
+  TmsTraceRing *ring = g_malloc0(sizeof(TmsTraceRing));
+  janus_refcount_init(&ring->ref, tms_trace_ring_free);
+
+  return ring;
+}
+void tms_trace_ring_ref(TmsTraceRing *ring)
+{
+  janus_refcount_increase(&ring->ref);
+}
+void tms_trace_ring_unref(TmsTraceRing *ring)
+{
+  janus_refcount_decrease(&ring->ref);
+}
+/* 写入1条记录，ring为NULL时不记录 */
+static inline void tms_trace(TmsTraceRing *ring, int type, uint16_t seq, uint32_t size, int64_t lateness_us, uint32_t extra)
+{
+  if (ring == NULL)
+    return;
+
+  guint index = (guint)g_atomic_int_add(&ring->head, 1);
+  TmsTraceRecord *record = &ring->records[index & (TMS_TRACE_RING_SIZE - 1)];
+  g_atomic_int_set(&record->index, 0);
+  record->type = type;
+  record->seq = seq;
+  record->size = size;
+  record->extra = extra;
+  record->lateness_us = (int32_t)FFMAX(FFMIN(lateness_us, INT32_MAX), INT32_MIN);
+  record->time_us = av_gettime_relative();
+  g_atomic_int_set(&record->index, index + 1);
+}
+/* 复制写入序号为index的记录，记录不完整或者已经被覆盖时返回FALSE */
+static gboolean tms_trace_ring_read(TmsTraceRing *ring, guint index, TmsTraceRecord *record)
+{
+  TmsTraceRecord *slot = &ring->records[index & (TMS_TRACE_RING_SIZE - 1)];
+  if ((guint)g_atomic_int_get(&slot->index) != index + 1)
+    return FALSE;
+  *record = *slot;
+  /* 复制的过程中被覆盖 */
+  return (guint)g_atomic_int_get(&slot->index) == index + 1;
+}
+/**
+ * 输出最近的max_records条记录，按发生顺序排列
+ *
+ * 每条记录为数组：[时间（微秒），类型，序号，大小，晚于媒体时间（微秒），附加值]
+ */
+json_t *tms_trace_ring_dump(TmsTraceRing *ring, int max_records)
+{
+  json_t *records = json_array();
+  /* 序号超过gint范围后回绕，按无符号数计算 */
+  guint head = (guint)g_atomic_int_get(&ring->head);
+  guint nb_records = FFMIN(head, TMS_TRACE_RING_SIZE);
+  if (max_records > 0 && (guint)max_records < nb_records)
+    nb_records = max_records;
+  guint index = head - nb_records;
+  for (; index != head; index++)
+  {
+    TmsTraceRecord record;
+    if (!tms_trace_ring_read(ring, index, &record))
+      continue;
+    json_t *item = json_array();
+    json_array_append_new(item, json_integer(record.time_us));
+    json_array_append_new(item, json_string(record.type < TMS_TRACE_NB_TYPES ? tms_trace_type_names[record.type] : "unknown"));
+    json_array_append_new(item, json_integer(record.seq));
+    json_array_append_new(item, json_integer(record.size));
+    json_array_append_new(item, json_integer(record.lateness_us));
+    json_array_append_new(item, json_integer(record.extra));
+    json_array_append_new(records, item);
+  }
+
+  return records;
+}
+static int tms_trace_compare_lateness(const void *a, const void *b)
+{
+  int32_t x = *(const int32_t *)a, y = *(const int32_t *)b;
+  return x < y ? -1 : x > y;
+}
+/* 排序后按最近排序法取百分位数 */
+static json_t *tms_trace_lateness_percentiles(int32_t *values, int nb_values)
+{
+  json_t *result = json_object();
+  json_object_set_new(result, "frames", json_integer(nb_values));
+  if (nb_values == 0)
+    return result;
+
+  qsort(values, nb_values, sizeof(int32_t), tms_trace_compare_lateness);
+  json_object_set_new(result, "p50_us", json_integer(values[(nb_values * 50 + 99) / 100 - 1]));
+  json_object_set_new(result, "p90_us", json_integer(values[(nb_values * 90 + 99) / 100 - 1]));
+  json_object_set_new(result, "p99_us", json_integer(values[(nb_values * 99 + 99) / 100 - 1]));
+  json_object_set_new(result, "max_us", json_integer(values[nb_values - 1]));
+
+  return result;
+}
+/**
+ * 统计缓冲区中视频帧和音频帧晚于媒体时间的分布
+ *
+ * 用于比较播放线程的调度策略（playback_policy）等对发送抖动的影响，只统计还在缓冲区中的最近记录
+ */
+json_t *tms_trace_ring_lateness(TmsTraceRing *ring)
+{
+  int32_t *video = g_malloc(sizeof(int32_t) * TMS_TRACE_RING_SIZE);
+  int32_t *audio = g_malloc(sizeof(int32_t) * TMS_TRACE_RING_SIZE);
+  int nb_video = 0, nb_audio = 0;
+  guint head = (guint)g_atomic_int_get(&ring->head);
+  guint index = head - FFMIN(head, TMS_TRACE_RING_SIZE);
+  for (; index != head; index++)
+  {
+    TmsTraceRecord record;
+    if (!tms_trace_ring_read(ring, index, &record))
+      continue;
+    if (record.type == TMS_TRACE_VIDEO_FRAME)
+      video[nb_video++] = record.lateness_us;
+    else if (record.type == TMS_TRACE_AUDIO_FRAME)
+      audio[nb_audio++] = record.lateness_us;
+  }
+
+  json_t *lateness = json_object();
+  json_object_set_new(lateness, "video", tms_trace_lateness_percentiles(video, nb_video));
+  json_object_set_new(lateness, "audio", tms_trace_lateness_percentiles(audio, nb_audio));
+  g_free(video);
+  g_free(audio);
+
+  return lateness;
+}
+
+#endif